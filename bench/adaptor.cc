@@ -0,0 +1,168 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Benchmark
+ *  \brief Compare the POSIX and io_uring socket adaptors.
+ *
+ *  Runs keep-alive GET requests against an in-process loopback
+ *  server, from one or more worker threads, each with a single
+ *  connection. Usage: bench_adaptor [requests] [threads] [body size].
+ */
+
+#include <lattice.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+LATTICE_USING_NAMESPACE
+
+// SERVER
+// ------
+
+
+/**
+ *  \brief Minimal keep-alive HTTP server, one thread per connection.
+ */
+struct server_t
+{
+    int sock = -1;
+    int port = 0;
+    std::string response;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    server_t(size_t length):
+        running(true)
+    {
+        response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n";
+        response.append(length, 'x');
+
+        sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(address);
+        ::bind(sock, reinterpret_cast<sockaddr*>(&address), size);
+        ::listen(sock, 128);
+        ::getsockname(sock, reinterpret_cast<sockaddr*>(&address), &size);
+        port = ntohs(address.sin_port);
+
+        thread = std::thread([this] {
+            while (running) {
+                int client = ::accept(sock, nullptr, nullptr);
+                if (client < 0) {
+                    break;
+                }
+                std::thread(&server_t::serve, this, client).detach();
+            }
+        });
+    }
+
+    ~server_t()
+    {
+        running = false;
+        ::shutdown(sock, SHUT_RDWR);
+        ::close(sock);
+        thread.join();
+    }
+
+    void serve(int client)
+    {
+        std::string buffer;
+        char data[4096];
+        while (true) {
+            size_t end = buffer.find("\r\n\r\n");
+            if (end != std::string::npos) {
+                buffer.erase(0, end + 4);
+                if (::send(client, response.data(), response.size(), MSG_NOSIGNAL) < 0) {
+                    break;
+                }
+                continue;
+            }
+            ssize_t read = ::recv(client, data, sizeof(data), 0);
+            if (read <= 0) {
+                break;
+            }
+            buffer.append(data, read);
+        }
+        ::close(client);
+    }
+};
+
+// BENCHMARK
+// ---------
+
+
+/**
+ *  \brief Run requests over keep-alive connections, and report timing.
+ */
+template <typename Adaptor>
+void run(const std::string& name, const url_t& url, size_t requests, size_t threads)
+{
+    std::string message = "GET / HTTP/1.1\r\nHost: " + url.host() + "\r\n\r\n";
+    std::atomic<size_t> errors(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            try {
+                connection_t<Adaptor> connection;
+                connection.open(url);
+                for (size_t j = 0; j < requests; ++j) {
+                    connection.write(message);
+                    response_t response(connection, GET);
+                    if (!response.ok()) {
+                        ++errors;
+                    }
+                }
+            } catch (std::exception& error) {
+                std::cerr << name << ": " << error.what() << std::endl;
+                ++errors;
+            }
+        });
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double total = static_cast<double>(requests * threads);
+    std::cout << name << ": "
+              << static_cast<size_t>(total / elapsed.count()) << " requests/s, "
+              << 1e6 * elapsed.count() / requests << " us/request/thread";
+    if (errors) {
+        std::cout << ", " << errors << " errors";
+    }
+    std::cout << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+    size_t length = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1024;
+
+    server_t server(length);
+    url_t url("http://127.0.0.1:" + std::to_string(server.port) + "/");
+
+    run<posix_socket_adaptor_t>("posix", url, requests, threads);
+#if defined(LATTICE_HAVE_IO_URING)
+    if (uring_socket_adaptor_t::supported()) {
+        run<uring_socket_adaptor_t>("io_uring", url, requests, threads);
+    } else {
+        std::cout << "io_uring: not supported by the kernel" << std::endl;
+    }
+#endif
+
+    return 0;
+}
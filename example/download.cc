@@ -0,0 +1,23 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Example
+ *  \brief Download a response body directly to a file.
+ */
+
+#include <lattice.h>
+#include <iostream>
+
+LATTICE_USING_NAMESPACE
+
+
+int main(int argc, char *argv[])
+{
+    url_t url = {"http://httpbin.org/bytes/100000"};
+    auto response = Get(url, download_t("download.bin", DOWNLOAD_SYNC));
+
+    std::cout << "Status: " << response.status() << "\n";
+    std::cout << "Saved body to download.bin" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Example
+ *  \brief Multiplex requests over a single HTTP/2 connection.
+ */
+
+#include <lattice.h>
+#include <iostream>
+
+LATTICE_USING_NAMESPACE
+
+
+int main(int argc, char *argv[])
+{
+    pool_t pool;
+    for (int i = 0; i < 10; ++i) {
+        pool.get(url_t("https://nghttp2.org/httpbin/get"), HTTP_2);
+    }
+
+    for (const auto &response: pool.perform()) {
+        std::cout << "Status: " << response.status() << "\n";
+    }
+
+    return 0;
+}
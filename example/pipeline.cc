@@ -0,0 +1,27 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Example
+ *  \brief Pipeline several requests on a single connection.
+ */
+
+#include <lattice.h>
+#include <iostream>
+
+LATTICE_USING_NAMESPACE
+
+
+int main(int argc, char *argv[])
+{
+    pipeline_t pipeline;
+    for (int i = 1; i <= 4; ++i) {
+        pipeline.get(url_t("http://httpbin.org/bytes/" + std::to_string(i * 16)));
+    }
+
+    for (auto &response: pipeline.perform()) {
+        std::cout << "Status: " << response.status()
+                  << ", received " << response.body().size() << " bytes\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Example
+ *  \brief Stream a response body to a file, without storing it.
+ */
+
+#include <lattice.h>
+#include <fstream>
+#include <iostream>
+
+LATTICE_USING_NAMESPACE
+
+
+int main(int argc, char *argv[])
+{
+    url_t url = {"http://httpbin.org/stream-bytes/100000"};
+    std::ofstream file("stream.bin", std::ios_base::binary);
+    size_t bytes = 0;
+
+    header_callback_t headers = [](const response_t& response) {
+        std::cout << "Status: " << response.status() << "\n";
+    };
+    body_callback_t body = [&](const char *data, size_t size) {
+        file.write(data, size);
+        bytes += size;
+        return bool(file);
+    };
+    auto response = Get(url, headers, body);
+
+    std::cout << "Wrote " << bytes << " bytes to stream.bin" << std::endl;
+
+    return 0;
+}
@@ -8,19 +8,32 @@
 #include <lattice/adaptor.h>
 #include <lattice/async.h>
 #include <lattice/auth.h>
+#include <lattice/buffer.h>
 #include <lattice/connection.h>
 #include <lattice/cookie.h>
 #include <lattice/crypto.h>
 #include <lattice/digest.h>
 #include <lattice/dns.h>
+#include <lattice/download.h>
+#include <lattice/eyeballs.h>
 #include <lattice/header.h>
+#include <lattice/hpack.h>
+#include <lattice/http2.h>
+#include <lattice/keepalive.h>
 #include <lattice/multipart.h>
 #include <lattice/parameter.h>
+#include <lattice/parser.h>
+#include <lattice/pipeline.h>
+#include <lattice/reactor.h>
 #include <lattice/redirect.h>
 #include <lattice/request.h>
+#include <lattice/resolver.h>
 #include <lattice/response.h>
+#include <lattice/socket.h>
 #include <lattice/ssl.h>
+#include <lattice/stream.h>
 #include <lattice/timeout.h>
+#include <lattice/tls.h>
 #include <lattice/transfer.h>
 #include <lattice/url.h>
 #include <lattice/util.h>
@@ -11,6 +11,7 @@
 #include <lattice/adaptor/openssl.h>
 #include <lattice/adaptor/nossl.h>
 #include <lattice/adaptor/posix.h>
+#include <lattice/adaptor/uring.h>
 #include <lattice/adaptor/windows.h>
 
 LATTICE_BEGIN_NAMESPACE
@@ -28,6 +29,8 @@ LATTICE_BEGIN_NAMESPACE
 // HTTP ADAPTERS
 #ifdef _WIN32
     typedef win32_socket_adaptor_t http_adaptor_t;
+#elif defined(LATTICE_USE_IO_URING) && defined(LATTICE_HAVE_IO_URING)
+    typedef uring_socket_adaptor_t http_adaptor_t;
 #else
     typedef posix_socket_adaptor_t http_adaptor_t;
 #endif
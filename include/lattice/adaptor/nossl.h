@@ -38,6 +38,7 @@ struct no_ssl_adaptor_t
     void close();
     size_t write(const char *buf, size_t len);
     size_t read(char *buf, size_t count);
+    bool alive() const;
 };
 
 
@@ -87,6 +88,13 @@ size_t no_ssl_adaptor_t<HttpAdaptor>::read(char *buf, size_t count)
     return 0;
 }
 
+
+template <typename HttpAdaptor>
+bool no_ssl_adaptor_t<HttpAdaptor>::alive() const
+{
+    return false;
+}
+
 LATTICE_END_NAMESPACE
 
 #ifdef _MSC_VER
@@ -6,9 +6,14 @@
  *  \brief OpenSSL socket adaptor.
  */
 
+#pragma once
+
 #ifdef LATTICE_HAVE_OPENSSL
 
+#include <lattice/buffer.h>
 #include <lattice/dns.h>
+#include <lattice/eyeballs.h>
+#include <lattice/socket.h>
 #include <lattice/method.h>
 #include <lattice/ssl.h>
 #include <lattice/timeout.h>
@@ -18,6 +23,28 @@
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#   include <unistd.h>
+#else
+#   include <process.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 // LEGACY
 #ifndef TLS_client_method
@@ -35,11 +62,166 @@ LATTICE_BEGIN_NAMESPACE
 const char * const PREFERRED_CIPHERS = "HIGH:!aNULL:!kRSA:!SRP:!PSK:!CAMELLIA:!RC4:!MD5:!DSS";
 static bool SSL_INITIALIZED = false;
 static X509_STORE *STORE = nullptr;
+static constexpr size_t SSL_RECORD_SIZE = 16384;
+static constexpr size_t SSL_SMALL_RECORD_SIZE = 1400;
+static constexpr size_t SSL_RAMP_SIZE = 1 << 20;
+static constexpr std::chrono::seconds SSL_RAMP_IDLE(1);
+static constexpr std::chrono::seconds SSL_STORE_CHECK(1);
+static constexpr std::chrono::seconds SSL_SESSION_SAVE_INTERVAL(5);
 
 // OBJECTS
 // -------
 
 
+/**
+ *  \brief Settings that determine a configured SSL context.
+ */
+struct ssl_context_key_t
+{
+    ssl_protocol_t protocol;
+    certificate_file_t certificate;
+    revocation_lists_t revoke;
+    bool verify;
+
+    bool operator<(const ssl_context_key_t& other) const
+    {
+        return std::tie(protocol, certificate, revoke, verify) < std::tie(other.protocol, other.certificate, other.revoke, other.verify);
+    }
+};
+
+
+/**
+ *  \brief Trust store parsed from a CA bundle and revocation lists.
+ */
+struct ssl_store_t
+{
+    X509_STORE *store = nullptr;
+    time_t certificate = 0;
+    time_t revoke = 0;
+    std::chrono::steady_clock::time_point checked;
+};
+
+
+/**
+ *  \brief Process-wide cache of parsed trust stores.
+ *
+ *  CA bundles and revocation lists are parsed once, and the store is
+ *  shared by every context which verifies against them. Stores are
+ *  replaced, never modified, when the files change on disk.
+ */
+struct ssl_store_cache_t
+{
+    std::mutex mutex;
+    std::map<std::pair<std::string, std::string>, ssl_store_t> stores;
+};
+
+
+/**
+ *  \brief Get the shared trust store cache.
+ */
+inline ssl_store_cache_t& ssl_stores()
+{
+    static ssl_store_cache_t cache;
+    return cache;
+}
+
+
+/**
+ *  \brief Configured SSL context, and the trust store it uses.
+ */
+struct ssl_context_t
+{
+    SSL_CTX *ctx = nullptr;
+    X509_STORE *store = nullptr;
+};
+
+
+/**
+ *  \brief Process-wide cache of configured SSL contexts.
+ *
+ *  Loading the CA bundle dominates the cost of a new connection, so
+ *  contexts are configured once per set of options and shared by all
+ *  connections, which only create an SSL object. Contexts are never
+ *  modified once cached, and are replaced when their trust store is
+ *  reloaded.
+ */
+struct ssl_context_cache_t
+{
+    std::mutex mutex;
+    std::map<ssl_context_key_t, ssl_context_t> contexts;
+};
+
+
+/**
+ *  \brief Get the shared SSL context cache.
+ */
+inline ssl_context_cache_t& ssl_contexts()
+{
+    static ssl_context_cache_t cache;
+    return cache;
+}
+
+
+/**
+ *  \brief Process-wide cache of TLS sessions for resumption.
+ *
+ *  Sessions are keyed by host, port, and context settings, and hold
+ *  the latest session or ticket from each server. If a file is set,
+ *  sessions are loaded from it, and new sessions are written back to
+ *  it, so other processes may resume them. Writes happen at most once
+ *  per SSL_SESSION_SAVE_INTERVAL, outside the cache lock, and pending
+ *  sessions are written on `flush()` and at exit.
+ */
+struct ssl_session_cache_t
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, SSL_SESSION*> sessions;
+    std::string path;
+    bool dirty = false;
+    std::chrono::steady_clock::time_point saved;
+    uint64_t generation = 0;
+
+    ssl_session_cache_t();
+    ~ssl_session_cache_t();
+
+    bool resume(const std::string& key, SSL* ssl);
+    void store(const std::string& key, SSL_SESSION* session);
+    void load(const std::string& path);
+    void flush();
+
+protected:
+    std::mutex file_mutex;
+    uint64_t written = 0;
+
+    std::string serialize() const;
+    void save(const std::string& path, const std::string& data, uint64_t version);
+};
+
+
+/**
+ *  \brief Get the shared SSL session cache.
+ */
+inline ssl_session_cache_t& ssl_sessions()
+{
+    static ssl_session_cache_t cache;
+    return cache;
+}
+
+
+/**
+ *  \brief Record sizing for a connection, growing as it warms up.
+ *
+ *  New and idle connections send records that fit in a single TCP
+ *  segment, so the peer can decrypt the first bytes as they arrive.
+ *  After SSL_RAMP_SIZE bytes, full records minimize framing overhead.
+ */
+struct ssl_ramp_t
+{
+    size_t sent = 0;
+    std::chrono::steady_clock::time_point last;
+};
+
+
 /**
  *  \brief Socket adaptor for OpenSSL.
  */
@@ -56,17 +238,31 @@ public:
 
     // REQUESTS
     bool open(const addrinfo& info, const std::string& host);
+    bool attach(socket_handle_t fd, const std::string& host);
     void close();
     size_t write(const char *buf, size_t len);
+    size_t writev(const buffer_list_t& buffers);
     size_t read(char *buf, size_t count);
+    bool alive() const;
+    bool pending() const;
 
     // OPTIONS
     void set_reuse_address();
     void set_timeout(const timeout_t& timeout);
+    void set_handshake_timeout(const timeout_t& timeout, std::chrono::steady_clock::time_point deadline);
     void set_certificate_file(const certificate_file_t& certificate);
     void set_revocation_lists(const revocation_lists_t& revoke);
     void set_ssl_protocol(ssl_protocol_t protocol);
     void set_verify_peer(const verify_peer_t& peer);
+    void set_early_data(const early_data_t& early);
+    void set_kernel_tls(const kernel_tls_t& kernel);
+    void set_alpn(const std::vector<std::string>& protocols);
+
+    // DATA
+    auto fd() const -> decltype(std::declval<const HttpAdaptor&>().fd());
+    std::string alpn_protocol() const;
+    bool resumed() const;
+    bool kernel_tls() const;
 
 protected:
     HttpAdaptor adaptor;
@@ -74,85 +270,200 @@ protected:
     revocation_lists_t revoke;
     ssl_protocol_t protocol = TLS;
     verify_peer_t verifypeer;
+    early_data_t earlydata;
+    kernel_tls_t kerneltls;
+    bool deferred = false;
+    ssl_ramp_t ramp;
+    std::string alpn;
+    std::string session;
+    std::chrono::milliseconds handshake = std::chrono::milliseconds(0);
+    std::chrono::steady_clock::time_point deadline;
 
-    SSL_CTX *ctx = nullptr;
     SSL *ssl = nullptr;
 
     static void initialize();
     static void cleanup();
-    void set_context();
-    void set_certificate();
-    void set_revoke();
-    void set_verify(const std::string& host);
     void ssl_connect();
+    void ssl_handshake(std::chrono::steady_clock::time_point limit);
+    void ssl_open(const std::string& host);
+    void ssl_finish();
+    size_t write_early(const char *buf, size_t len);
+    size_t write_buffers(const buffer_list_t& buffers);
+
+    template <typename T = HttpAdaptor>
+    typename std::enable_if<(has_set_cork<T>::value), void>::type
+    cork(bool cork);
+
+    template <typename T = HttpAdaptor>
+    typename std::enable_if<(!has_set_cork<T>::value), void>::type
+    cork(bool cork);
 };
 
 
-// IMPLEMENTATION
-// --------------
+// HELPERS
+// -------
 
 
 /**
- *  \brief Initialize OpenSSL.
+ *  \brief Check if the session has outlived its timeout.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::initialize()
+inline bool ssl_session_expired(const SSL_SESSION* session)
 {
-    SSL_load_error_strings();
-    SSL_library_init();
-    OpenSSL_add_ssl_algorithms();
+    long now = static_cast<long>(std::time(nullptr));
+    return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < now;
 }
 
 
 /**
- *  \brief Cleanup OpenSSL (noop).
+ *  \brief Encode bytes as lowercase hex.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::cleanup()
-{}
+inline std::string ssl_hex_encode(const unsigned char* data, size_t length)
+{
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; ++i) {
+        hex.push_back(DIGITS[data[i] >> 4]);
+        hex.push_back(DIGITS[data[i] & 0xf]);
+    }
+    return hex;
+}
 
 
 /**
- *  \brief Set the SSL connection context.
+ *  \brief Decode lowercase hex, returning false on invalid input.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::set_context()
+inline bool ssl_hex_decode(const std::string& hex, std::string& data)
 {
-    // initialize SSL methods
-    switch (protocol) {
-        case SSL_V23:
-            ctx = SSL_CTX_new(SSLv23_client_method());
-            break;
-        case TLS_V12:
-            ctx = SSL_CTX_new(TLSv1_2_client_method());
-            break;
-        case TLS_V11:
-            ctx = SSL_CTX_new(TLSv1_1_client_method());
-            break;
-        case TLS_V1:
-            ctx = SSL_CTX_new(TLSv1_client_method());
-            break;
-        case SSL_V3:
-            ctx = SSL_CTX_new(SSLv3_client_method());
-            break;
-        case TLS:
-            /* fallthrough */
-        default:
-            ctx = SSL_CTX_new(TLS_client_method());
+    auto digit = [](char c) -> int {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    };
+
+    if (hex.size() % 2) {
+        return false;
+    }
+    data.resize(hex.size() / 2);
+    for (size_t i = 0; i < data.size(); ++i) {
+        int high = digit(hex[2*i]);
+        int low = digit(hex[2*i+1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        data[i] = static_cast<char>((high << 4) | low);
+    }
+    return true;
+}
+
+
+/**
+ *  \brief Write `data` to a new file next to `path`, only readable by
+ *  the current user.
+ *
+ *  Returns the name of the file, or an empty string on failure. Each
+ *  file is uniquely named and created exclusively, so concurrent
+ *  writers, even in other processes, never share a temporary file.
+ */
+inline std::string ssl_write_temporary(const std::string& path, const std::string& data)
+{
+#ifdef _WIN32
+    static std::atomic<unsigned> counter(0);
+    std::string temporary = path + "." + std::to_string(_getpid()) + "." + std::to_string(counter++) + ".tmp";
+    bool ok;
+    {
+        std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+        ok = bool(stream.write(data.data(), data.size()));
+    }
+#else
+    std::string temporary = path + ".XXXXXX";
+    int fd = ::mkstemp(&temporary[0]);
+    if (fd < 0) {
+        return std::string();
+    }
+    bool ok = ::fchmod(fd, 0600) == 0;
+    for (size_t written = 0; ok && written < data.size(); ) {
+        ssize_t count = ::write(fd, data.data() + written, data.size() - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = count > 0;
+        written += ok ? count : 0;
+    }
+    ok &= ::close(fd) == 0;
+#endif
+    if (!ok) {
+        std::remove(temporary.data());
+        return std::string();
+    }
+
+    return temporary;
+}
+
+
+/**
+ *  \brief Encrypt data, sizing records for how warm the connection is.
+ *
+ *  Returns the number of bytes written, which is less than `len` only
+ *  if a write failed.
+ */
+inline size_t ssl_write(SSL* ssl, ssl_ramp_t& ramp, const char* buf, size_t len)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now - ramp.last > SSL_RAMP_IDLE) {
+        ramp.sent = 0;
+    }
+    ramp.last = now;
+
+    size_t written = 0;
+    while (written < len) {
+        // while warming up, each write is a single small record, since
+        // OpenSSL only splits writes by size when pipelining
+        size_t size = len - written;
+        if (ramp.sent < SSL_RAMP_SIZE) {
+            size = std::min(size, SSL_SMALL_RECORD_SIZE);
+        }
+        int count = SSL_write(ssl, buf + written, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+        if (count <= 0) {
             break;
+        }
+        written += count;
+        ramp.sent += count;
     }
-    if (!ctx) {
-        throw std::runtime_error("Unable to initialize SSL context.");
+
+    return written;
+}
+
+
+/**
+ *  \brief Store new sessions and tickets from the server.
+ *
+ *  The connection's session key is attached as the SSL app data.
+ *  A copy is stored, since OpenSSL marks a connection's session as
+ *  not resumable if the peer closes without a close_notify.
+ */
+inline int ssl_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto *key = static_cast<const std::string*>(SSL_get_app_data(ssl));
+    if (!key || key->empty()) {
+        return 0;
     }
-    SSL_CTX_set_options(ctx, SSL_OP_SINGLE_DH_USE);
+    SSL_SESSION *copy = SSL_SESSION_dup(session);
+    if (copy) {
+        ssl_sessions().store(*key, copy);
+    }
+
+    return 0;
 }
 
 
 /**
  *  \brief Set certificate file for the store.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::set_certificate()
+inline void ssl_set_certificate(SSL_CTX* ctx, const certificate_file_t& certificate)
 {
     int ok = 1;
     const char *data = certificate.data();
@@ -180,18 +491,29 @@ void open_ssl_adaptor_t<HttpAdaptor>::set_certificate()
 }
 
 
+/**
+ *  \brief Get the modification time of a file, or 0 if unavailable.
+ */
+inline time_t ssl_file_mtime(const std::string& path)
+{
+    struct stat info;
+    if (path.empty() || ::stat(path.data(), &info) != 0) {
+        return 0;
+    }
+    return info.st_mtime;
+}
+
+
 /**
  *  \brief Set revocation lists for the store.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::set_revoke()
+inline void ssl_set_revoke(X509_STORE* store, const std::string& revoke)
 {
     if (revoke.empty()) {
         return;
     }
 
-    // get our store and lookup, and load the store
-    X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+    // get our lookup, and load the store
     X509_LOOKUP *lookup = X509_STORE_add_lookup(store, X509_LOOKUP_file());
     int format = X509_FILETYPE_PEM;
     if (!lookup || !(X509_load_crl_file(lookup, revoke.data(), format))) {
@@ -204,123 +526,676 @@ void open_ssl_adaptor_t<HttpAdaptor>::set_revoke()
 
 
 /**
- *  \brief Verify untrusted certificate with certificate bundle.
+ *  \brief Parse a trust store from a CA bundle and revocation lists.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::set_verify(const std::string& host)
+inline X509_STORE* ssl_new_store(const std::string& certificate, const std::string& revoke)
 {
-    // set verification context
-    int mode = verifypeer ? SSL_VERIFY_PEER : SSL_VERIFY_NONE;
-    SSL_CTX_set_verify(ctx, mode, nullptr);
-    if (!verifypeer) {
-        return;
+    X509_STORE *store = X509_STORE_new();
+    if (!store) {
+        throw std::runtime_error("Unable to initialize SSL context.");
     }
 
-     // hostname verification
-    X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
-    X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
-    X509_VERIFY_PARAM_set1_host(param, host.data(), 0);
-
-    // set flags to avoid issues with legacy certificates
-    X509_STORE *store = SSL_CTX_get_cert_store(ctx);
-    X509_STORE_set_flags(store, X509_V_FLAG_TRUSTED_FIRST);
-
-    // set preferred ciphers
-    SSL_set_cipher_list(ssl, PREFERRED_CIPHERS);
-
-    // initalize content with bundle
-    if (certificate) {
-        if (!SSL_CTX_load_verify_locations(ctx, certificate.data(), nullptr)) {
-            throw std::runtime_error("Unable to load certificates from file.");
+    try {
+        // set flags to avoid issues with legacy certificates
+        X509_STORE_set_flags(store, X509_V_FLAG_TRUSTED_FIRST);
+
+        // initalize content with bundle
+        if (!certificate.empty()) {
+            if (!X509_STORE_load_locations(store, certificate.data(), nullptr)) {
+                throw std::runtime_error("Unable to load certificates from file.");
+            }
+        } else {
+            X509_STORE_set_default_paths(store);
         }
-    } else {
-        SSL_CTX_set_default_verify_paths(ctx);
+        ssl_set_revoke(store, revoke);
+    } catch (...) {
+        X509_STORE_free(store);
+        throw;
     }
+
+    return store;
 }
 
 
 /**
- *  \brief Connect to the remote host via SSL connect.
+ *  \brief Get the shared trust store for the files.
  *
- *  Process read and write descriptors.
+ *  The files are checked for changes at most once per SSL_STORE_CHECK,
+ *  and changed files are parsed into a new store, which replaces the
+ *  old one once fully loaded. If reloading fails, for example while
+ *  the file is being rewritten, the old store is kept until the next
+ *  check.
  *
- *  \warning Errors can be thrown for **no** reason, skip the null
- *  errors, including system errors without an error log, and throw
- *  handshake errors otherwise.
+ *  Returns a new reference, taken under the lock so a concurrent
+ *  reload cannot free the store first. Release it with X509_STORE_free.
  */
-template <typename HttpAdaptor>
-void open_ssl_adaptor_t<HttpAdaptor>::ssl_connect()
+inline X509_STORE* ssl_store(const std::string& certificate, const std::string& revoke)
 {
-    while (SSL_connect(ssl) == -1) {
-        fd_set desriptors;
-        FD_ZERO(&desriptors);
-        FD_SET(adaptor.fd(), &desriptors);
+    auto &cache = ssl_stores();
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto &item = cache.stores[std::make_pair(certificate, revoke)];
+    if (item.store && now < item.checked + SSL_STORE_CHECK) {
+        X509_STORE_up_ref(item.store);
+        return item.store;
+    }
 
-        switch (SSL_get_error(ssl, -1)) {
-            case SSL_ERROR_NONE:
-                /* fallthrough */
-            case SSL_ERROR_ZERO_RETURN:
-                /* no error */
-                return;
-            case SSL_ERROR_WANT_READ:
-                select(adaptor.fd() + 1, &desriptors, NULL, NULL, NULL);
-                break;
-            case SSL_ERROR_WANT_WRITE:
-                select(adaptor.fd() + 1, NULL, &desriptors, NULL, NULL);
-                break;
-            case SSL_ERROR_SYSCALL:
-                /* unknown error */
-                if (!ERR_get_error()) {
-                    // no error
-                    return;
-                }
-            default:
-                throw std::runtime_error("Unable to complete SSL handshake.");
-        }
+    item.checked = now;
+    time_t certificate_mtime = ssl_file_mtime(certificate);
+    time_t revoke_mtime = ssl_file_mtime(revoke);
+    if (item.store && certificate_mtime == item.certificate && revoke_mtime == item.revoke) {
+        X509_STORE_up_ref(item.store);
+        return item.store;
     }
-}
 
+    try {
+        X509_STORE *store = ssl_new_store(certificate, revoke);
+        X509_STORE_free(item.store);
+        item.store = store;
+        item.certificate = certificate_mtime;
+        item.revoke = revoke_mtime;
+    } catch (...) {
+        if (!item.store) {
+            throw;
+        }
+    }
+    X509_STORE_up_ref(item.store);
 
-template <typename HttpAdaptor>
-open_ssl_adaptor_t<HttpAdaptor>::~open_ssl_adaptor_t()
-{
-    close();
+    return item.store;
 }
 
 
 /**
- *  If not initialized, initialize SSL.
+ *  \brief Verify untrusted certificate with the shared trust store.
  */
-template <typename HttpAdaptor>
-open_ssl_adaptor_t<HttpAdaptor>::open_ssl_adaptor_t()
+inline void ssl_set_verify(SSL_CTX* ctx, const ssl_context_key_t& key, X509_STORE* store)
 {
-    std::lock_guard<std::mutex> lock(MUTEX);
-    if (!SSL_INITIALIZED) {
-        initialize();
-        std::atexit(cleanup);
-        SSL_INITIALIZED = true;
+    // set verification context
+    int mode = key.verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE;
+    SSL_CTX_set_verify(ctx, mode, nullptr);
+    if (!key.verify) {
+        return;
     }
+
+    // set preferred ciphers
+    SSL_CTX_set_cipher_list(ctx, PREFERRED_CIPHERS);
+
+    // the context holds a reference, so replaced stores outlive it
+    X509_STORE_up_ref(store);
+    SSL_CTX_set_cert_store(ctx, store);
 }
 
 
-template <typename HttpAdaptor>
-bool open_ssl_adaptor_t<HttpAdaptor>::open(const addrinfo& info, const std::string& host)
+/**
+ *  \brief Create and configure a new SSL context.
+ */
+inline SSL_CTX* ssl_new_context(const ssl_context_key_t& key, X509_STORE* store)
 {
-    set_context();
-    ssl = SSL_new(ctx);
-    set_verify(host);
-    if (certificate) {
-        set_certificate();
+    // initialize SSL methods
+    SSL_CTX *ctx;
+    switch (key.protocol) {
+        case SSL_V23:
+            ctx = SSL_CTX_new(SSLv23_client_method());
+            break;
+        case TLS_V12:
+            ctx = SSL_CTX_new(TLSv1_2_client_method());
+            break;
+        case TLS_V11:
+            ctx = SSL_CTX_new(TLSv1_1_client_method());
+            break;
+        case TLS_V1:
+            ctx = SSL_CTX_new(TLSv1_client_method());
+            break;
+        case SSL_V3:
+            ctx = SSL_CTX_new(SSLv3_client_method());
+            break;
+        case TLS:
+            /* fallthrough */
+        default:
+            ctx = SSL_CTX_new(TLS_client_method());
+            break;
     }
-    if (revoke) {
-        set_revoke();
+    if (!ctx) {
+        throw std::runtime_error("Unable to initialize SSL context.");
     }
+    SSL_CTX_set_options(ctx, SSL_OP_SINGLE_DH_USE);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, ssl_new_session);
 
-    // open socket and create SSL
+    try {
+        ssl_set_verify(ctx, key, store);
+        if (!key.certificate.empty()) {
+            ssl_set_certificate(ctx, key.certificate);
+        }
+    } catch (...) {
+        SSL_CTX_free(ctx);
+        throw;
+    }
+
+    return ctx;
+}
+
+
+/**
+ *  \brief Get the shared SSL context for the settings.
+ *
+ *  Contexts are configured on first use for each protocol, certificate
+ *  file, revocation list, and verification mode, and reconfigured if
+ *  their trust store was reloaded. Connections hold a reference to
+ *  their context, so replaced contexts live until they close.
+ *
+ *  Returns a new reference, taken under the lock so a concurrent
+ *  reload cannot free the context first. Release it with SSL_CTX_free.
+ */
+inline SSL_CTX* ssl_context(const ssl_context_key_t& key)
+{
+    X509_STORE *store = nullptr;
+    if (key.verify) {
+        store = ssl_store(key.certificate, key.revoke);
+    }
+
+    // the old context references the old store, so pointers are unique
+    auto &cache = ssl_contexts();
+    SSL_CTX *ctx;
+    try {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto &item = cache.contexts[key];
+        if (!item.ctx || item.store != store) {
+            ctx = ssl_new_context(key, store);
+            SSL_CTX_free(item.ctx);
+            item.ctx = ctx;
+            item.store = store;
+        }
+        ctx = item.ctx;
+        SSL_CTX_up_ref(ctx);
+    } catch (...) {
+        X509_STORE_free(store);
+        throw;
+    }
+    X509_STORE_free(store);
+
+    return ctx;
+}
+
+
+/**
+ *  \brief Verify the peer certificate matches the host.
+ */
+inline void ssl_set_host(SSL* ssl, const std::string& host)
+{
+    // match the name without the port
+    std::string name = host.substr(0, host.find(':'));
+    X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+    X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+    X509_VERIFY_PARAM_set1_host(param, name.data(), 0);
+}
+
+
+/**
+ *  \brief Create a client connection for the host, offering any
+ *  cached session.
+ *
+ *  `session` holds the key for new sessions, and must outlive the
+ *  connection.
+ */
+inline SSL* ssl_new_connection(const ssl_context_key_t& key, const std::string& host, std::string& session)
+{
+    SSL_CTX *ctx = ssl_context(key);
+    SSL *ssl = SSL_new(ctx);
+    SSL_CTX_free(ctx);
+    if (!ssl) {
+        throw std::runtime_error("Unable to create SSL connection.");
+    }
+    if (key.verify) {
+        ssl_set_host(ssl, host);
+    }
+
+    // offer a previous session, keyed by the host and context
+    session = host + "|" + std::to_string(int(key.protocol)) + "|" + key.certificate + "|" + key.revoke + "|" + std::to_string(key.verify);
+    SSL_set_app_data(ssl, &session);
+    ssl_sessions().resume(session, ssl);
     SSL_set_connect_state(ssl);
-    adaptor.open(info, host);
+
+    return ssl;
+}
+
+
+/**
+ *  \brief Encode protocols for ALPN, in order of preference.
+ */
+inline std::string ssl_alpn_protocols(const std::vector<std::string>& protocols)
+{
+    std::string alpn;
+    for (const auto &protocol: protocols) {
+        alpn.push_back(static_cast<char>(protocol.size()));
+        alpn += protocol;
+    }
+    return alpn;
+}
+
+// IMPLEMENTATION
+// --------------
+
+
+/**
+ *  \brief Initialize OpenSSL first, so pending sessions can still be
+ *  encoded when the cache is destroyed at exit.
+ */
+inline ssl_session_cache_t::ssl_session_cache_t()
+{
+    SSL_library_init();
+}
+
+
+/**
+ *  \brief Write pending sessions.
+ */
+inline ssl_session_cache_t::~ssl_session_cache_t()
+{
+    flush();
+}
+
+
+/**
+ *  \brief Offer the cached session for `key` to the connection.
+ */
+inline bool ssl_session_cache_t::resume(const std::string& key, SSL* ssl)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sessions.find(key);
+    if (it == sessions.end()) {
+        return false;
+    } else if (ssl_session_expired(it->second)) {
+        SSL_SESSION_free(it->second);
+        sessions.erase(it);
+        return false;
+    }
+
+    // offer a copy, so the cached session stays resumable
+    SSL_SESSION *copy = SSL_SESSION_dup(it->second);
+    if (!copy) {
+        return false;
+    }
+    bool resumed = SSL_set_session(ssl, copy) == 1;
+    SSL_SESSION_free(copy);
+
+    return resumed;
+}
+
+
+/**
+ *  \brief Take ownership of a session, replacing the previous one.
+ */
+inline void ssl_session_cache_t::store(const std::string& key, SSL_SESSION* session)
+{
+    std::string file, data;
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(key);
+        if (it != sessions.end()) {
+            SSL_SESSION_free(it->second);
+            it->second = session;
+        } else {
+            sessions.emplace(key, session);
+        }
+        if (path.empty()) {
+            return;
+        }
+
+        // batch sessions stored within the interval
+        dirty = true;
+        auto now = std::chrono::steady_clock::now();
+        if (now - saved < SSL_SESSION_SAVE_INTERVAL) {
+            return;
+        }
+        file = path;
+        data = serialize();
+        version = ++generation;
+        dirty = false;
+        saved = now;
+    }
+
+    save(file, data, version);
+}
+
+
+/**
+ *  \brief Write sessions stored since the last write to the file.
+ */
+inline void ssl_session_cache_t::flush()
+{
+    std::string file, data;
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!dirty || path.empty()) {
+            return;
+        }
+        file = path;
+        data = serialize();
+        version = ++generation;
+        dirty = false;
+        saved = std::chrono::steady_clock::now();
+    }
+
+    save(file, data, version);
+}
+
+
+/**
+ *  \brief Load unexpired sessions from the file, and save to it.
+ *
+ *  Missing files are created on the first save. Entries which fail
+ *  to decode are skipped.
+ */
+inline void ssl_session_cache_t::load(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->path = path;
+
+    std::ifstream stream(path);
+    std::string line, key, data;
+    while (std::getline(stream, line)) {
+        size_t index = line.find(' ');
+        if (index == std::string::npos) {
+            continue;
+        }
+        if (!ssl_hex_decode(line.substr(0, index), key) || !ssl_hex_decode(line.substr(index+1), data)) {
+            continue;
+        }
+
+        auto *bytes = reinterpret_cast<const unsigned char*>(data.data());
+        SSL_SESSION *session = d2i_SSL_SESSION(nullptr, &bytes, static_cast<long>(data.size()));
+        if (!session) {
+            continue;
+        } else if (ssl_session_expired(session) || sessions.count(key)) {
+            SSL_SESSION_free(session);
+            continue;
+        }
+        sessions.emplace(key, session);
+    }
+}
+
+
+/**
+ *  \brief Encode all unexpired sessions, one hex "key data" line each.
+ *
+ *  Must be called with the mutex held.
+ */
+inline std::string ssl_session_cache_t::serialize() const
+{
+    std::ostringstream stream;
+    for (const auto &item: sessions) {
+        if (ssl_session_expired(item.second)) {
+            continue;
+        }
+        int length = i2d_SSL_SESSION(item.second, nullptr);
+        if (length <= 0) {
+            continue;
+        }
+        std::string data(length, '\0');
+        auto *bytes = reinterpret_cast<unsigned char*>(&data[0]);
+        i2d_SSL_SESSION(item.second, &bytes);
+
+        auto *key = reinterpret_cast<const unsigned char*>(item.first.data());
+        stream << ssl_hex_encode(key, item.first.size()) << ' '
+               << ssl_hex_encode(reinterpret_cast<const unsigned char*>(data.data()), data.size()) << '\n';
+    }
+
+    return stream.str();
+}
+
+
+/**
+ *  \brief Write encoded sessions to the file.
+ *
+ *  The file is replaced atomically, so concurrent readers never see
+ *  partial writes, and is only readable by the current user, since
+ *  it holds session secrets. Each write goes through its own temporary
+ *  file, so processes sharing the file never interleave writes.
+ *  Snapshots older than the last written one are dropped, so racing
+ *  writers in a process cannot restore stale sessions.
+ */
+inline void ssl_session_cache_t::save(const std::string& path, const std::string& data, uint64_t version)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (version < written) {
+        return;
+    }
+    written = version;
+
+    std::string temporary = ssl_write_temporary(path, data);
+    if (temporary.empty()) {
+        return;
+    }
+    if (std::rename(temporary.data(), path.data())) {
+        // rename cannot replace existing files on Windows
+        std::remove(path.data());
+        if (std::rename(temporary.data(), path.data())) {
+            std::remove(temporary.data());
+        }
+    }
+}
+
+
+/**
+ *  \brief Initialize OpenSSL.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::initialize()
+{
+    SSL_load_error_strings();
+    SSL_library_init();
+    OpenSSL_add_ssl_algorithms();
+}
+
+
+/**
+ *  \brief Cleanup OpenSSL (noop).
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::cleanup()
+{}
+
+
+/**
+ *  \brief Connect to the remote host via SSL connect.
+ *
+ *  With a handshake timeout or deadline, the socket is non-blocking
+ *  during the handshake, and each wait is limited to the time left.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::ssl_connect()
+{
+    typedef std::chrono::steady_clock steady_clock;
+    auto limit = steady_clock::time_point();
+    if (handshake.count()) {
+        limit = steady_clock::now() + handshake;
+    }
+    if (deadline != steady_clock::time_point() && (limit == steady_clock::time_point() || deadline < limit)) {
+        limit = deadline;
+    }
+    if (limit == steady_clock::time_point()) {
+        ssl_handshake(limit);
+        return;
+    }
+
+    if (!set_blocking(adaptor.fd(), false)) {
+        throw std::runtime_error("Unable to set socket flags for SSL handshake.");
+    }
+    try {
+        ssl_handshake(limit);
+    } catch (...) {
+        set_blocking(adaptor.fd(), true);
+        throw;
+    }
+    set_blocking(adaptor.fd(), true);
+}
+
+
+/**
+ *  \brief Run the SSL handshake, waiting on the socket until `limit`.
+ *
+ *  \warning Errors can be thrown for **no** reason, skip the null
+ *  errors, including system errors without an error log, and throw
+ *  handshake errors otherwise.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::ssl_handshake(std::chrono::steady_clock::time_point limit)
+{
+    typedef std::chrono::steady_clock steady_clock;
+    while (SSL_connect(ssl) == -1) {
+        auto wait = std::chrono::milliseconds(0);
+        if (limit != steady_clock::time_point()) {
+            wait = std::chrono::duration_cast<std::chrono::milliseconds>(limit - steady_clock::now());
+            if (wait.count() <= 0) {
+                throw std::runtime_error("Request timed out during SSL handshake.");
+            }
+        }
+
+        switch (SSL_get_error(ssl, -1)) {
+            case SSL_ERROR_NONE:
+                /* fallthrough */
+            case SSL_ERROR_ZERO_RETURN:
+                /* no error */
+                return;
+            case SSL_ERROR_WANT_READ:
+                wait_socket(adaptor.fd(), false, wait);
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                wait_socket(adaptor.fd(), true, wait);
+                break;
+            case SSL_ERROR_SYSCALL:
+                /* unknown error */
+                if (!ERR_get_error()) {
+                    // no error
+                    return;
+                }
+            default:
+                throw std::runtime_error("Unable to complete SSL handshake.");
+        }
+    }
+}
+
+
+template <typename HttpAdaptor>
+open_ssl_adaptor_t<HttpAdaptor>::~open_ssl_adaptor_t()
+{
+    close();
+}
+
+
+/**
+ *  If not initialized, initialize SSL.
+ */
+template <typename HttpAdaptor>
+open_ssl_adaptor_t<HttpAdaptor>::open_ssl_adaptor_t()
+{
+    std::lock_guard<std::mutex> lock(MUTEX);
+    if (!SSL_INITIALIZED) {
+        initialize();
+        std::atexit(cleanup);
+        SSL_INITIALIZED = true;
+    }
+}
+
+
+/**
+ *  \brief Create the SSL connection over the open socket.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::ssl_open(const std::string& host)
+{
+    ssl_context_key_t key = {protocol, certificate, revoke, bool(verifypeer)};
+    ssl = ssl_new_connection(key, host, session);
+    if (!alpn.empty()) {
+        auto data = reinterpret_cast<const unsigned char*>(alpn.data());
+        SSL_set_alpn_protos(ssl, data, static_cast<unsigned>(alpn.size()));
+    }
+
+    // offload record encryption once the handshake completes
+#ifdef SSL_OP_ENABLE_KTLS
+    if (kerneltls) {
+        SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
+    // create SSL over the socket
     SSL_set_fd(ssl, adaptor.fd());
+
+    // defer the handshake, to send the first write as early data
+    SSL_SESSION *resumable = SSL_get_session(ssl);
+    if (earlydata && resumable && SSL_SESSION_get_max_early_data(resumable) > 0) {
+        deferred = true;
+        return;
+    }
+    ssl_connect();
+}
+
+
+/**
+ *  \brief Complete a handshake deferred for early data.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::ssl_finish()
+{
+    if (deferred) {
+        deferred = false;
+        ssl_connect();
+    }
+}
+
+
+/**
+ *  \brief Send data with the ClientHello, then complete the handshake.
+ *
+ *  Data which does not fit the server's early data limit, or which
+ *  the server rejects, is sent again after the handshake.
+ */
+template <typename HttpAdaptor>
+size_t open_ssl_adaptor_t<HttpAdaptor>::write_early(const char *buf, size_t len)
+{
+    deferred = false;
+    size_t written = 0;
+    if (len <= SSL_SESSION_get_max_early_data(SSL_get_session(ssl))) {
+        if (SSL_write_early_data(ssl, buf, len, &written) != 1) {
+            written = 0;
+        }
+    }
     ssl_connect();
+    if (written == len && SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED) {
+        return len;
+    }
+
+    // replay the rejected data
+    int replayed = SSL_write(ssl, buf, len);
+    return replayed > 0 ? replayed : 0;
+}
+
+
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::open(const addrinfo& info, const std::string& host)
+{
+    if (!adaptor.open(info, host)) {
+        return false;
+    }
+    ssl_open(host);
+
+    return true;
+}
+
+
+/**
+ *  \brief Take ownership of a connected socket, and secure it.
+ */
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::attach(socket_handle_t fd, const std::string& host)
+{
+    if (!adaptor.attach(fd, host)) {
+        return false;
+    }
+    ssl_open(host);
 
     return true;
 }
@@ -331,31 +1206,197 @@ void open_ssl_adaptor_t<HttpAdaptor>::close()
 {
     if (ssl) {
         SSL_shutdown(ssl);
-        adaptor.close();
         SSL_free(ssl);
         ssl = nullptr;
     }
-    if (ctx) {
-        SSL_CTX_free(ctx);
-        ctx = nullptr;
-    }
+    deferred = false;
+    adaptor.close();
 }
 
 
 template <typename HttpAdaptor>
 size_t open_ssl_adaptor_t<HttpAdaptor>::write(const char *buf, size_t len)
 {
-    return SSL_write(ssl, buf, len);
+    if (deferred && earlydata) {
+        return write_early(buf, len);
+    }
+    ssl_finish();
+    return ssl_write(ssl, ramp, buf, len);
+}
+
+
+/**
+ *  \brief Send a list of buffers in as few TLS records as possible.
+ *
+ *  Each SSL_write produces at least one record, so small buffers,
+ *  like the request line and headers, are coalesced up to the maximum
+ *  record size before encryption. Large buffers are written directly
+ *  from the caller's memory. Files are sent with `SSL_sendfile` under
+ *  kernel TLS, and are otherwise encrypted directly from memory-mapped
+ *  blocks.
+ *
+ *  The socket is corked while writing, so consecutive records share
+ *  TCP segments.
+ */
+template <typename HttpAdaptor>
+size_t open_ssl_adaptor_t<HttpAdaptor>::writev(const buffer_list_t& buffers)
+{
+    // coalesce the request into a single write for early data
+    if (deferred && earlydata) {
+        std::string staged;
+        bool files = false;
+        for (const auto& buffer: buffers) {
+            files |= buffer.file();
+            if (!buffer.file()) {
+                staged.append(buffer.data, buffer.size);
+            }
+        }
+        if (!files) {
+            return write_early(staged.data(), staged.size());
+        }
+    }
+    ssl_finish();
+
+    // uncork even if a write throws
+    struct corked_t
+    {
+        open_ssl_adaptor_t& adaptor;
+
+        ~corked_t()
+        {
+            adaptor.cork(false);
+        }
+    };
+
+    cork(true);
+    corked_t corked = {*this};
+    return write_buffers(buffers);
+}
+
+
+template <typename HttpAdaptor>
+size_t open_ssl_adaptor_t<HttpAdaptor>::write_buffers(const buffer_list_t& buffers)
+{
+    std::string staged;
+    size_t sent = 0;
+
+    auto flush = [&]() -> bool {
+        if (staged.empty()) {
+            return true;
+        }
+        size_t written = ssl_write(ssl, ramp, staged.data(), staged.size());
+        sent += written;
+        if (written != staged.size()) {
+            return false;
+        }
+        staged.clear();
+        return true;
+    };
+
+    auto writer = [this](const char *data, size_t size) -> size_t {
+        return ssl_write(ssl, ramp, data, size);
+    };
+
+    auto send_file = [&](const buffer_view_t& buffer) -> size_t {
+#ifdef SSL_OP_ENABLE_KTLS
+        if (kernel_tls()) {
+            size_t written = 0;
+            while (written < buffer.size) {
+                off_t offset = static_cast<off_t>(buffer.offset + written);
+                ossl_ssize_t count = SSL_sendfile(ssl, buffer.fd, offset, buffer.size - written, 0);
+                if (count <= 0) {
+                    break;
+                }
+                written += count;
+            }
+            return written;
+        }
+#endif
+        return write_file(buffer, writer);
+    };
+
+    for (const auto& buffer: buffers) {
+        if (buffer.file()) {
+            if (!flush()) {
+                return sent;
+            }
+            size_t written = send_file(buffer);
+            sent += written;
+            if (written != buffer.size) {
+                return sent;
+            }
+            continue;
+        }
+        if (staged.size() + buffer.size <= SSL_RECORD_SIZE) {
+            staged.append(buffer.data, buffer.size);
+            continue;
+        }
+        if (!flush()) {
+            return sent;
+        }
+        if (buffer.size < SSL_RECORD_SIZE) {
+            staged.append(buffer.data, buffer.size);
+            continue;
+        }
+        size_t written = writer(buffer.data, buffer.size);
+        sent += written;
+        if (written != buffer.size) {
+            return sent;
+        }
+    }
+    flush();
+
+    return sent;
 }
 
 
+template <typename HttpAdaptor>
+template <typename T>
+typename std::enable_if<(has_set_cork<T>::value), void>::type
+open_ssl_adaptor_t<HttpAdaptor>::cork(bool cork)
+{
+    adaptor.set_cork(cork);
+}
+
+
+template <typename HttpAdaptor>
+template <typename T>
+typename std::enable_if<(!has_set_cork<T>::value), void>::type
+open_ssl_adaptor_t<HttpAdaptor>::cork(bool cork)
+{}
+
+
 template <typename HttpAdaptor>
 size_t open_ssl_adaptor_t<HttpAdaptor>::read(char *buf, size_t count)
 {
+    ssl_finish();
     return SSL_read(ssl, buf, count);
 }
 
 
+/**
+ *  \brief Check if an idle connection may be reused.
+ *
+ *  Buffered, undecrypted records also mark the connection as unusable.
+ */
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::alive() const
+{
+    return ssl && !SSL_pending(ssl) && adaptor.alive();
+}
+
+
+/**
+ *  \brief Check if decrypted data is buffered, and can be read
+ *  without waiting on the socket.
+ */
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::pending() const
+{
+    return ssl && SSL_pending(ssl) > 0;
+}
+
+
 template <typename HttpAdaptor>
 void open_ssl_adaptor_t<HttpAdaptor>::set_reuse_address()
 {
@@ -370,6 +1411,19 @@ void open_ssl_adaptor_t<HttpAdaptor>::set_timeout(const timeout_t& timeout)
 }
 
 
+/**
+ *  \brief Limit the SSL handshake to `timeout`, and to `deadline`.
+ *
+ *  Zero timeouts, and default-constructed deadlines, are unlimited.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::set_handshake_timeout(const timeout_t& timeout, std::chrono::steady_clock::time_point deadline)
+{
+    this->handshake = std::chrono::milliseconds(timeout.milliseconds());
+    this->deadline = deadline;
+}
+
+
 template <typename HttpAdaptor>
 void open_ssl_adaptor_t<HttpAdaptor>::set_certificate_file(const certificate_file_t& certificate)
 {
@@ -394,7 +1448,127 @@ void open_ssl_adaptor_t<HttpAdaptor>::set_ssl_protocol(ssl_protocol_t protocol)
 template <typename HttpAdaptor>
 void open_ssl_adaptor_t<HttpAdaptor>::set_verify_peer(const verify_peer_t& peer)
 {
-    this->verifypeer = verifypeer;
+    this->verifypeer = peer;
+}
+
+
+/**
+ *  \brief Offload TLS records to the kernel after the handshake.
+ *
+ *  With kernel TLS, files are sent encrypted with `sendfile`, rather
+ *  than copied through user space. Silently ignored where kernel TLS
+ *  is unavailable.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::set_kernel_tls(const kernel_tls_t& kernel)
+{
+    this->kerneltls = kernel;
+}
+
+
+/**
+ *  \brief Send the first write as TLS 1.3 early data, when resuming
+ *  a session which allows it.
+ *
+ *  Early data may be replayed by an attacker, so it should only be
+ *  enabled for safe requests.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::set_early_data(const early_data_t& early)
+{
+    this->earlydata = early;
+}
+
+
+/**
+ *  \brief Set the protocols offered with ALPN, in order of preference.
+ */
+template <typename HttpAdaptor>
+void open_ssl_adaptor_t<HttpAdaptor>::set_alpn(const std::vector<std::string>& protocols)
+{
+    alpn = ssl_alpn_protocols(protocols);
+}
+
+
+template <typename HttpAdaptor>
+auto open_ssl_adaptor_t<HttpAdaptor>::fd() const -> decltype(std::declval<const HttpAdaptor&>().fd())
+{
+    return adaptor.fd();
+}
+
+
+/**
+ *  \brief Get the protocol selected by the server with ALPN.
+ *
+ *  Empty if the server did not select a protocol.
+ */
+template <typename HttpAdaptor>
+std::string open_ssl_adaptor_t<HttpAdaptor>::alpn_protocol() const
+{
+    const unsigned char *data = nullptr;
+    unsigned length = 0;
+    if (ssl) {
+        SSL_get0_alpn_selected(ssl, &data, &length);
+    }
+    if (!data) {
+        return std::string();
+    }
+    return std::string(reinterpret_cast<const char*>(data), length);
+}
+
+
+/**
+ *  \brief Check if the kernel encrypts writes to the connection.
+ *
+ *  False if kernel TLS was not requested, or the kernel, OpenSSL
+ *  build, or negotiated cipher does not support it.
+ */
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::kernel_tls() const
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    return ssl && !deferred && BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    return false;
+#endif
+}
+
+
+/**
+ *  \brief Check if the handshake resumed a cached session.
+ */
+template <typename HttpAdaptor>
+bool open_ssl_adaptor_t<HttpAdaptor>::resumed() const
+{
+    return ssl && SSL_session_reused(ssl);
+}
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Persist TLS sessions to `path`, loading any saved sessions.
+ *
+ *  Lets new processes resume sessions from earlier ones, skipping
+ *  a full handshake. Sessions are stored as unencrypted secrets, so
+ *  the file is only readable by the current user.
+ */
+inline void set_ssl_session_file(const std::string& path)
+{
+    ssl_sessions().load(path);
+}
+
+
+/**
+ *  \brief Write TLS sessions stored since the last write to the file.
+ *
+ *  Writes are batched, so call before handing the file to another
+ *  process. Pending sessions are also written at exit.
+ */
+inline void flush_ssl_sessions()
+{
+    ssl_sessions().flush();
 }
 
 LATTICE_END_NAMESPACE
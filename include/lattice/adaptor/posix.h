@@ -9,7 +9,9 @@
 
 #pragma once
 
+#include <lattice/buffer.h>
 #include <lattice/dns.h>
+#include <lattice/eyeballs.h>
 #include <lattice/ssl.h>
 #include <lattice/timeout.h>
 #include <lattice/url.h>
@@ -36,12 +38,20 @@ public:
 
     // REQUESTS
     bool open(const addrinfo& info, const std::string&);
+    bool attach(socket_handle_t fd, const std::string&);
     void close();
     size_t write(const char *buf, size_t len);
+    size_t writev(const buffer_list_t& buffers);
     size_t read(char *buf, size_t count);
+    size_t splice(int fd, size_t count, std::chrono::steady_clock::time_point deadline);
+    bool alive() const;
 
     // OPTIONS
     void set_reuse_address();
+    void set_no_sigpipe();
+    void set_no_delay();
+    void set_cork(bool cork);
+    void set_nonblocking(bool nonblocking = true);
     void set_timeout(const timeout_t& timeout);
     void set_certificate_file(const certificate_file_t& certificate);
     void set_revocation_lists(const revocation_lists_t& revoke);
@@ -52,6 +62,7 @@ public:
 
 protected:
     int sock = -1;
+    bool nonblocking = false;
 };
 
 LATTICE_END_NAMESPACE
@@ -0,0 +1,91 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Linux io_uring socket adaptor.
+ */
+
+#if defined(LATTICE_HAVE_IO_URING)
+
+#pragma once
+
+#include <lattice/dns.h>
+#include <lattice/eyeballs.h>
+#include <lattice/ssl.h>
+#include <lattice/timeout.h>
+#include <lattice/url.h>
+#include <chrono>
+#include <memory>
+#include <netdb.h>
+
+LATTICE_BEGIN_NAMESPACE
+
+// FORWARD
+// -------
+
+namespace detail
+{
+struct uring_ring_t;
+}   /* detail */
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Adapter for sockets driven by an io_uring instance.
+ *
+ *  Each adaptor owns a small submission ring. Writes are queued until
+ *  the following read, so a request and the wait for its response
+ *  are submitted with a single system call. Where the kernel supports
+ *  them, responses are received with a multishot receive into
+ *  buffers provided to the kernel, so data that has already arrived
+ *  is read without entering the kernel at all.
+ *
+ *  Connections are made with connect_any(), like other adaptors. The
+ *  adaptor replaces posix_socket_adaptor_t for plain HTTP. Under
+ *  open_ssl_adaptor_t, the ring is unused, since OpenSSL reads and
+ *  writes the descriptor directly.
+ */
+class uring_socket_adaptor_t
+{
+public:
+    typedef uring_socket_adaptor_t self;
+
+    uring_socket_adaptor_t();
+    uring_socket_adaptor_t(const self&) = delete;
+    self& operator=(const self&) = delete;
+    ~uring_socket_adaptor_t();
+
+    // REQUESTS
+    bool open(const addrinfo& info, const std::string&);
+    bool attach(socket_handle_t fd, const std::string&);
+    void close();
+    size_t write(const char *buf, size_t len);
+    size_t read(char *buf, size_t count);
+    bool alive() const;
+
+    // OPTIONS
+    void set_reuse_address();
+    void set_no_sigpipe();
+    void set_no_delay();
+    void set_cork(bool cork);
+    void set_timeout(const timeout_t& timeout);
+    void set_certificate_file(const certificate_file_t& certificate);
+    void set_revocation_lists(const revocation_lists_t& revoke);
+    void set_ssl_protocol(ssl_protocol_t ssl);
+
+    // DATA
+    const int fd() const;
+    bool multishot() const;
+    static bool supported();
+
+protected:
+    int sock = -1;
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0);
+    std::unique_ptr<detail::uring_ring_t> ring;
+};
+
+LATTICE_END_NAMESPACE
+
+#endif              // LATTICE_HAVE_IO_URING
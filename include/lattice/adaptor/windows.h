@@ -10,6 +10,7 @@
 #ifdef _WIN32
 
 #include <lattice/dns.h>
+#include <lattice/eyeballs.h>
 #include <lattice/method.h>
 #include <lattice/ssl.h>
 #include <lattice/timeout.h>
@@ -36,9 +37,11 @@ public:
 
     // REQUESTS
     bool open(const addrinfo& info, const std::string&);
+    bool attach(socket_handle_t fd, const std::string&);
     bool close();
     size_t write(const char *buf, size_t len);
     size_t read(char *buf, size_t count);
+    bool alive() const;
 
     // OPTIONS
     void set_reuse_address();
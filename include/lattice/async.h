@@ -8,6 +8,7 @@
 #pragma once
 
 #include <lattice/config.h>
+#include <lattice/reactor.h>
 #include <lattice/request.h>
 #include <lattice/response.h>
 #include <chrono>
@@ -25,11 +26,11 @@ typedef std::deque<response_t> response_list_t;
 
 
 /**
- *  \brief Thread pool for asynchronous requests.
+ *  \brief Pool for asynchronous requests.
  *
- *  \warning The asynchronous approach is rudimentary, with a
- *  single thread per socket. This is not intended to replace
- *  a true, asynchronous library like Boost::asio or Casablanca.
+ *  Requests are run by a reactor, which multiplexes many sockets
+ *  over a few event-loop threads. Requests the reactor cannot
+ *  multiplex fall back to a single thread per socket.
  */
 class pool_t
 {
@@ -40,6 +41,9 @@ public:
     pool_t(pool_t&&) = default;
     pool_t & operator=(pool_t&&) = default;
 
+    explicit pool_t(size_t threads);
+    pool_t(const std::shared_ptr<reactor_t>& reactor);
+
     template <typename... Ts> void get(Ts&&... ts);
     template <typename... Ts> void head(Ts&&... ts);
     template <typename... Ts> void options(Ts&&... ts);
@@ -61,6 +65,7 @@ public:
     explicit operator bool() const;
 
 protected:
+    std::shared_ptr<reactor_t> reactor = default_reactor();
     std::deque<std::future<response_t>> futures;
 };
 
@@ -78,10 +83,8 @@ void pool_t::get(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(GET);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(GET);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -94,10 +97,8 @@ void pool_t::head(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(HEAD);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(HEAD);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -110,10 +111,8 @@ void pool_t::options(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(OPTIONS);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(OPTIONS);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -126,10 +125,8 @@ void pool_t::patch(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(PATCH);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(PATCH);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -142,10 +139,8 @@ void pool_t::post(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(POST);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(POST);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -158,10 +153,8 @@ void pool_t::put(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(PUT);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(PUT);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
@@ -174,10 +167,8 @@ void pool_t::trace(Ts&&... ts)
     request_t request;
     set_option(request, std::forward<Ts>(ts)...);
 
-    futures.emplace_back(std::async(std::launch::async, [](request_t &&request) {
-        request.set_method(TRACE);
-        return request.exec();
-    }, std::move(request)));
+    request.set_method(TRACE);
+    futures.emplace_back(reactor->submit(std::move(request)));
 }
 
 
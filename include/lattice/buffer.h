@@ -0,0 +1,99 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Scatter-gather buffers for outgoing messages.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Non-owning view of a block of memory, or a region of a file.
+ *
+ *  File regions are described by an open descriptor and an offset,
+ *  so they can be sent without reading the file into memory.
+ */
+struct buffer_view_t
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    int fd = -1;
+    uint64_t offset = 0;
+
+    buffer_view_t() = default;
+    buffer_view_t(const buffer_view_t&) = default;
+    buffer_view_t & operator=(const buffer_view_t&) = default;
+
+    buffer_view_t(const char *data, size_t size);
+    buffer_view_t(int fd, uint64_t offset, size_t size);
+
+    bool file() const;
+};
+
+
+/**
+ *  \brief Ordered list of buffers sent as a single message.
+ *
+ *  Views added with `view()` reference memory owned by the caller,
+ *  which must outlive the list. Strings added with `store()` and
+ *  files added with `file()` are owned by the list, and stored
+ *  strings keep a stable address as the list grows, or is appended
+ *  to another list. Lists are
+ *  move-only, since copies would reference the storage of the
+ *  original.
+ */
+class buffer_list_t: public std::deque<buffer_view_t>
+{
+public:
+    typedef std::deque<buffer_view_t> base;
+
+    buffer_list_t() = default;
+    buffer_list_t(const buffer_list_t&) = delete;
+    buffer_list_t & operator=(const buffer_list_t&) = delete;
+    buffer_list_t(buffer_list_t&&);
+    buffer_list_t & operator=(buffer_list_t&&);
+    ~buffer_list_t();
+
+    void view(const char *data, size_t size);
+    void view(const std::string& data);
+    void store(std::string&& data);
+    void store_front(std::string&& data);
+    void file(const std::string& path);
+    void append(buffer_list_t&& other);
+
+    size_t length() const;
+    std::string string() const;
+    buffer_list_t slice(size_t offset, size_t size) const;
+
+private:
+    std::list<std::string> storage;
+    std::deque<int> files;
+};
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Callback to write a block, returning the bytes written.
+ */
+typedef std::function<size_t(const char*, size_t)> buffer_writer_t;
+
+/**
+ *  \brief Pass the contents of a file region to `writer`, in blocks.
+ */
+size_t write_file(const buffer_view_t& buffer, const buffer_writer_t& writer);
+
+LATTICE_END_NAMESPACE
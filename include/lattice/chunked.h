@@ -0,0 +1,75 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Chunked transfer encoding decoder.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <lattice/header.h>
+#include <cstdint>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Resumable decoder for chunked transfer encoding.
+ *
+ *  Input may be split at any byte, including inside the framing, so
+ *  the decoder works with buffered, non-blocking and streaming reads.
+ *  Chunk data is never copied by the decoder: `decode` returns spans
+ *  pointing into the input. Chunk extensions and trailers, defined in
+ *  RFC 7230 Section 4.1, are parsed and stored.
+ */
+class chunked_decoder_t
+{
+public:
+    chunked_decoder_t() = default;
+    chunked_decoder_t(const chunked_decoder_t&) = default;
+    chunked_decoder_t & operator=(const chunked_decoder_t&) = default;
+    chunked_decoder_t(chunked_decoder_t&&) = default;
+    chunked_decoder_t & operator=(chunked_decoder_t&&) = default;
+
+    // DECODING
+    size_t decode(const char *data, size_t length, const char *&chunk, size_t &size);
+    size_t decode(const char *data, size_t length, std::string& output);
+    void consume(size_t count);
+    void reset();
+
+    // DATA
+    bool done() const;
+    size_t remaining() const;
+    const std::string& extensions() const;
+    const header_t& trailers() const;
+
+protected:
+    enum state_t
+    {
+        SIZE,
+        SIZE_SPACE,
+        EXTENSION,
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER,
+        DONE,
+    };
+
+    state_t state = SIZE;
+    uint64_t remaining_ = 0;
+    size_t digits = 0;
+    std::string extension;
+    std::string line;
+    header_t trailers_;
+
+    void parse_trailer();
+};
+
+LATTICE_END_NAMESPACE
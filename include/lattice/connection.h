@@ -8,14 +8,23 @@
 #pragma once
 
 #include <lattice/adaptor.h>
+#include <lattice/buffer.h>
+#include <lattice/chunked.h>
 #include <lattice/config.h>
 #include <lattice/dns.h>
+#include <lattice/download.h>
+#include <lattice/eyeballs.h>
 #include <lattice/method.h>
 #include <lattice/ssl.h>
 #include <lattice/timeout.h>
 #include <lattice/util.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #ifdef _MSC_VER
 #   pragma warning(push)
@@ -29,25 +38,139 @@ LATTICE_BEGIN_NAMESPACE
 
 static constexpr size_t BUFFER_SIZE = 8092;
 
+/**
+ *  \brief Bytes sent between checks of the deadline.
+ */
+static constexpr size_t WRITE_BLOCK_SIZE = 65536;
+
 // FUNCTION
 // --------
 
 
+/**
+ *  \brief Raise the error for a failed connection.
+ *
+ *  Distinguishes attempts cut short by the timeout from unreachable hosts.
+ */
+inline void connection_failed(std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= deadline) {
+        throw std::runtime_error("Request timed out.");
+    }
+    throw std::runtime_error("Unable to establish a connection.");
+}
+
+
+/**
+ *  \brief Get the time left before `deadline`, or zero for no limit.
+ */
+inline std::chrono::milliseconds connection_budget(std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        return std::chrono::milliseconds(0);
+    }
+    // round up, so the attempts cannot stop short of the deadline
+    auto left = deadline - std::chrono::steady_clock::now();
+    auto budget = std::chrono::duration_cast<std::chrono::milliseconds>(left);
+    if (budget < left) {
+        ++budget;
+    }
+    if (budget.count() <= 0) {
+        throw std::runtime_error("Request timed out.");
+    }
+    return budget;
+}
+
+
+/**
+ *  \brief Open connection to the first address to respond.
+ */
+template <typename Adapter>
+typename std::enable_if<(has_attach<Adapter>::value), bool>::type
+open_addresses(Adapter& adaptor,
+    const address_list_t& addresses,
+    const std::string& host,
+    size_t& index,
+    std::chrono::milliseconds timeout)
+{
+    socket_handle_t sock;
+    if (!connect_any(addresses, sock, index, timeout)) {
+        return false;
+    }
+
+    return adaptor.attach(sock, host);
+}
+
+
+/**
+ *  \brief Open connection to each address in turn.
+ *
+ *  The adaptor's connect is blocking, so the timeout is not applied.
+ */
+template <typename Adapter>
+typename std::enable_if<(!has_attach<Adapter>::value), bool>::type
+open_addresses(Adapter& adaptor,
+    const address_list_t& addresses,
+    const std::string& host,
+    size_t& index,
+    std::chrono::milliseconds)
+{
+    for (index = 0; index < addresses.size(); ++index) {
+        if (adaptor.open(addrinfo(addresses[index]), host)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
 /**
  *  \brief Open connection without a cache.
  */
 template <typename Adapter>
-void open_connection(Adapter& adaptor, const std::string& host, const std::string& service)
+void open_connection(Adapter& adaptor,
+    const std::string& host,
+    const std::string& service,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
 {
+    std::chrono::steady_clock::time_point deadline;
+    if (timeout.count()) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
     // perform DNS lookup
-    for (auto &&info: dns_lookup_t(host, service)) {
-        if (adaptor.open(info, host)) {
-            return;
-        }
+    size_t index;
+    auto addresses = lookup_addresses(host, service);
+    if (open_addresses(adaptor, addresses, host, index, connection_budget(deadline))) {
+        return;
     }
 
     // no suitable addresses found
-    throw std::runtime_error("Unable to establish a connection.");
+    connection_failed(deadline);
+}
+
+
+/**
+ *  \brief Open connection to fixed addresses, without a lookup.
+ */
+template <typename Adapter>
+void open_connection(Adapter& adaptor,
+    const address_list_t& addresses,
+    const std::string& host,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+{
+    std::chrono::steady_clock::time_point deadline;
+    if (timeout.count()) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
+    size_t index;
+    if (open_addresses(adaptor, addresses, host, index, connection_budget(deadline))) {
+        return;
+    }
+
+    connection_failed(deadline);
 }
 
 
@@ -58,25 +181,32 @@ template <typename Adapter>
 void open_connection(Adapter& adaptor,
     const std::string& host,
     const std::string& service,
-    address_cache_t& cache)
+    address_cache_t& cache,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
 {
+    std::chrono::steady_clock::time_point deadline;
+    if (timeout.count()) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
     // try cached results
-    typename address_cache_t::iterator it;
-    if ((it = cache.find(host)) != cache.end()) {
-        if (adaptor.open(addrinfo(it->second), host)) {
-            return;
-        }
+    size_t index;
+    bool cached;
+    auto addresses = cache.resolve(host, service, &cached);
+    if (open_addresses(adaptor, addresses, host, index, connection_budget(deadline))) {
+        return;
     }
 
-    // perform DNS lookup
-    for (auto &&info: dns_lookup_t(host, service)) {
-        if (adaptor.open(info, host)) {
-            cache.emplace(host, info);
+    // cached addresses may be outdated, retry with a new lookup
+    if (cached) {
+        cache.erase(host, service);
+        addresses = cache.resolve(host, service);
+        if (open_addresses(adaptor, addresses, host, index, connection_budget(deadline))) {
             return;
         }
     }
 
-    throw std::runtime_error("Unable to establish a connection.");
+    connection_failed(deadline);
 }
 
 
@@ -95,8 +225,24 @@ class connection_t
 protected:
     Adapter adaptor;
     dns_cache_t cache = nullptr;
-
+    dns_overrides_t overrides;
+    std::string buffer;
+    size_t offset = 0;
+    std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(0);
+    std::chrono::milliseconds handshake_timeout = std::chrono::milliseconds(0);
+    std::chrono::milliseconds read_timeout = std::chrono::milliseconds(0);
+    std::chrono::milliseconds applied = std::chrono::milliseconds(0);
+    std::chrono::steady_clock::time_point deadline;
+
+    std::chrono::milliseconds remaining(std::chrono::milliseconds timeout) const;
+    std::chrono::milliseconds read_limit();
+    bool timed_out() const;
+    void write_failed(size_t sent) const;
+    long receive(char *dst, long bytes);
+    long fill();
     long readn(char *dst, long bytes);
+    long copy(file_writer_t& file, long bytes);
+    bool readline(std::string& line);
 
 public:
     connection_t();
@@ -110,23 +256,26 @@ public:
     void open(const url_t& url);
     void close();
     void write(const std::string& data);
+    void write(const buffer_list_t& buffers);
     void set_cache(const dns_cache_t& cache);
+    void set_overrides(const dns_overrides_t& overrides);
+    void set_timeout(const timeout_t& timeout);
+    void set_connect_timeout(const timeout_t& timeout);
+    void set_handshake_timeout(const timeout_t& timeout);
+    void set_deadline(std::chrono::steady_clock::time_point deadline);
+    bool alive() const;
 
     // RESPONSE
     std::string headers();
     std::string chunked();
+    std::string chunked(chunked_decoder_t& decoder);
     std::string body(const long length);
     std::string read();
+    long read_chunked(chunked_decoder_t& decoder, char *dst, long bytes);
+    long read_file(file_writer_t& file, long bytes);
+    long read_some(char *dst, long bytes);
 
     // OPTIONAL
-    template <typename T = Adapter>
-    typename std::enable_if<(has_set_timeout<T>::value), void>::type
-    set_timeout(const timeout_t& timeout);
-
-    template <typename T = Adapter>
-    typename std::enable_if<(!has_set_timeout<T>::value), void>::type
-    set_timeout(const timeout_t& timeout);
-
     template <typename T = Adapter>
     typename std::enable_if<(has_set_certificate_file<T>::value), void>::type
     set_certificate_file(const certificate_file_t& certificate);
@@ -158,6 +307,90 @@ public:
     template <typename T = Adapter>
     typename std::enable_if<(!has_set_verify_peer<T>::value), void>::type
     set_verify_peer(const verify_peer_t& peer);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_set_early_data<T>::value), void>::type
+    set_early_data(const early_data_t& early);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_set_early_data<T>::value), void>::type
+    set_early_data(const early_data_t& early);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_set_kernel_tls<T>::value), void>::type
+    set_kernel_tls(const kernel_tls_t& kernel);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_set_kernel_tls<T>::value), void>::type
+    set_kernel_tls(const kernel_tls_t& kernel);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_set_alpn<T>::value), void>::type
+    set_alpn(const std::vector<std::string>& protocols);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_set_alpn<T>::value), void>::type
+    set_alpn(const std::vector<std::string>& protocols);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_alpn_protocol<T>::value), std::string>::type
+    alpn_protocol() const;
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_alpn_protocol<T>::value), std::string>::type
+    alpn_protocol() const;
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_kernel_tls<T>::value), bool>::type
+    kernel_tls() const;
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_kernel_tls<T>::value), bool>::type
+    kernel_tls() const;
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_pending<T>::value), bool>::type
+    pending() const;
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_pending<T>::value), bool>::type
+    pending() const;
+
+    template <typename T = Adapter>
+    auto fd() const -> decltype(std::declval<const T&>().fd());
+
+protected:
+    template <typename T = Adapter>
+    typename std::enable_if<(has_set_timeout<T>::value), void>::type
+    apply_timeout(std::chrono::milliseconds timeout);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_set_timeout<T>::value), void>::type
+    apply_timeout(std::chrono::milliseconds timeout);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_set_handshake_timeout<T>::value), void>::type
+    apply_handshake_timeout();
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_set_handshake_timeout<T>::value), void>::type
+    apply_handshake_timeout();
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_writev<T>::value), size_t>::type
+    writev(const buffer_list_t& buffers);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_writev<T>::value), size_t>::type
+    writev(const buffer_list_t& buffers);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(has_splice<T>::value), long>::type
+    splice(file_writer_t& file, long bytes);
+
+    template <typename T = Adapter>
+    typename std::enable_if<(!has_splice<T>::value), long>::type
+    splice(file_writer_t& file, long bytes);
 };
 
 
@@ -165,18 +398,141 @@ public:
 // --------------
 
 
+/**
+ *  \brief Cap a timeout by the time left before the deadline.
+ *
+ *  Zero timeouts are unlimited. Throws once the deadline has passed.
+ */
+template <typename Adapter>
+std::chrono::milliseconds connection_t<Adapter>::remaining(std::chrono::milliseconds timeout) const
+{
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        return timeout;
+    }
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+        throw std::runtime_error("Request timed out.");
+    }
+
+    return timeout.count() && timeout < left ? timeout : left;
+}
+
+
+/**
+ *  \brief Apply the timeout for the next read, within the deadline.
+ */
+template <typename Adapter>
+std::chrono::milliseconds connection_t<Adapter>::read_limit()
+{
+    auto limit = remaining(read_timeout);
+    if (limit != applied) {
+        apply_timeout(limit);
+        applied = limit;
+    }
+
+    return limit;
+}
+
+
+/**
+ *  \brief Check if a short read or write was cut off by a timeout.
+ *
+ *  Socket timeouts fail with EAGAIN, and the adaptor stops between
+ *  system calls once the deadline has passed.
+ */
+template <typename Adapter>
+bool connection_t<Adapter>::timed_out() const
+{
+    if (deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= deadline) {
+        return true;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+
+/**
+ *  \brief Raise the error for a short write.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::write_failed(size_t sent) const
+{
+    if (timed_out()) {
+        throw std::runtime_error("Request timed out.");
+    }
+    throw std::runtime_error("Unable to make request, sent " + std::to_string(sent) + " bytes.");
+}
+
+
+/**
+ *  \brief Read from the socket, raising an error on timeouts.
+ *
+ *  Timed-out reads fail like closed connections at the adaptor, so
+ *  reads failing after the full timeout are reported as timeouts.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::receive(char *dst, long bytes)
+{
+    if (!read_timeout.count() && deadline == std::chrono::steady_clock::time_point()) {
+        return static_cast<long>(adaptor.read(dst, bytes));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto limit = read_limit();
+    long read = static_cast<long>(adaptor.read(dst, bytes));
+    if (read < 0 && std::chrono::steady_clock::now() - start >= limit) {
+        throw std::runtime_error("Request timed out.");
+    }
+
+    return read;
+}
+
+
+/**
+ *  \brief Read the next block from the socket into the read buffer.
+ *
+ *  Consumed bytes are discarded before reading, so the buffer only
+ *  grows while a single unit (like the headers) spans several blocks.
+ *  Returns the number of bytes read, or 0 on EOF or error.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::fill()
+{
+    if (offset) {
+        buffer.erase(0, offset);
+        offset = 0;
+    }
+
+    size_t size = buffer.size();
+    buffer.resize(size + BUFFER_SIZE);
+    long read = receive(&buffer[size], BUFFER_SIZE);
+    if (read < 0) {
+        read = 0;
+    }
+    buffer.resize(size + read);
+
+    return read;
+}
+
+
 /**
  *  Sockets guarantee at least 1 byte will be read, while valid, but do
- *  not guarantee N-bytes will be successfully read. Read until all
- *  data have been extracted.
+ *  not guarantee N-bytes will be successfully read. Drain any buffered
+ *  data, and read the remainder directly into the destination until
+ *  all data have been extracted.
  */
 template <typename Adapter>
 long connection_t<Adapter>::readn(char *dst, long bytes)
 {
-    long count = 0;
+    long count = std::min<long>(bytes, buffer.size() - offset);
+    std::memcpy(dst, buffer.data() + offset, count);
+    offset += count;
+    bytes -= count;
+    dst += count;
+
     while (bytes) {
-        long read = adaptor.read(dst, bytes);
-        if (!read) {
+        long read = receive(dst, bytes);
+        if (read <= 0) {
             return count;
         }
         bytes -= read;
@@ -188,6 +544,39 @@ long connection_t<Adapter>::readn(char *dst, long bytes)
 }
 
 
+/**
+ *  \brief Read a single CRLF-terminated line from the buffer.
+ *
+ *  The line is stored without the trailing line ending. Returns false
+ *  if the connection closed before a full line could be read.
+ */
+template <typename Adapter>
+bool connection_t<Adapter>::readline(std::string& line)
+{
+    size_t start = offset;
+    while (true) {
+        size_t end = buffer.find('\n', start);
+        if (end != std::string::npos) {
+            size_t last = end;
+            if (last > offset && buffer[last-1] == '\r') {
+                --last;
+            }
+            line.assign(buffer, offset, last - offset);
+            offset = end + 1;
+            return true;
+        }
+
+        start = buffer.size() - offset;
+        if (!fill()) {
+            line.assign(buffer, offset, std::string::npos);
+            offset = buffer.size();
+            return false;
+        }
+        start += offset;
+    }
+}
+
+
 template <typename Adapter>
 connection_t<Adapter>::connection_t()
 {}
@@ -200,13 +589,31 @@ connection_t<Adapter>::~connection_t()
 }
 
 
+/**
+ *  \brief Open a new socket to the host.
+ *
+ *  The read timeout is applied to the new socket, since the timeout
+ *  applied to any previous socket was lost when it closed.
+ */
 template <typename Adapter>
 void connection_t<Adapter>::open(const url_t& url)
 {
-    if (cache) {
-        open_connection(adaptor, url.host(), url.service(), *cache);
+    buffer.clear();
+    offset = 0;
+    applied = std::chrono::milliseconds(0);
+    apply_handshake_timeout();
+    auto timeout = remaining(connect_timeout);
+    address_list_t addresses;
+    if (overrides.find(url.host(), url.service(), addresses)) {
+        open_connection(adaptor, addresses, url.host(), timeout);
+    } else if (cache) {
+        open_connection(adaptor, url.host(), url.service(), *cache, timeout);
     } else {
-        open_connection(adaptor, url.host(), url.service());
+        open_connection(adaptor, url.host(), url.service(), timeout);
+    }
+    if (read_timeout.count()) {
+        apply_timeout(read_timeout);
+        applied = read_timeout;
     }
 }
 
@@ -215,22 +622,87 @@ template <typename Adapter>
 void connection_t<Adapter>::close()
 {
     adaptor.close();
+    buffer.clear();
+    offset = 0;
+    applied = std::chrono::milliseconds(0);
+}
+
+
+/**
+ *  \brief Set the timeout for each read and write, or zero for none.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::set_timeout(const timeout_t& timeout)
+{
+    read_timeout = std::chrono::milliseconds(timeout.milliseconds());
+    if (read_timeout != applied) {
+        apply_timeout(read_timeout);
+        applied = read_timeout;
+    }
+}
+
+
+/**
+ *  \brief Set the timeout to connect, over all addresses.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::set_connect_timeout(const timeout_t& timeout)
+{
+    connect_timeout = std::chrono::milliseconds(timeout.milliseconds());
+}
+
+
+/**
+ *  \brief Set the timeout for the TLS handshake.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::set_handshake_timeout(const timeout_t& timeout)
+{
+    handshake_timeout = std::chrono::milliseconds(timeout.milliseconds());
+}
+
+
+/**
+ *  \brief Set the deadline for the request, which caps every timeout.
+ *
+ *  A default-constructed time point clears the deadline.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::set_deadline(std::chrono::steady_clock::time_point deadline)
+{
+    this->deadline = deadline;
 }
 
 
 template <typename Adapter>
 template <typename T>
 typename std::enable_if<(has_set_timeout<T>::value), void>::type
-connection_t<Adapter>::set_timeout(const timeout_t& timeout)
+connection_t<Adapter>::apply_timeout(std::chrono::milliseconds timeout)
 {
-    adaptor.set_timeout(timeout);
+    adaptor.set_timeout(timeout_t(timeout));
 }
 
 
 template <typename Adapter>
 template <typename T>
 typename std::enable_if<(!has_set_timeout<T>::value), void>::type
-connection_t<Adapter>::set_timeout(const timeout_t& timeout)
+connection_t<Adapter>::apply_timeout(std::chrono::milliseconds timeout)
+{}
+
+
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_set_handshake_timeout<T>::value), void>::type
+connection_t<Adapter>::apply_handshake_timeout()
+{
+    adaptor.set_handshake_timeout(timeout_t(handshake_timeout), deadline);
+}
+
+
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_set_handshake_timeout<T>::value), void>::type
+connection_t<Adapter>::apply_handshake_timeout()
 {}
 
 
@@ -313,6 +785,168 @@ connection_t<Adapter>::set_verify_peer(const verify_peer_t& peer)
 {}
 
 
+/**
+ *  \brief Send the first request as TLS early data, if resuming.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_set_early_data<T>::value), void>::type
+connection_t<Adapter>::set_early_data(const early_data_t& early)
+{
+    adaptor.set_early_data(early);
+}
+
+
+/**
+ *  \brief Send the first request as TLS early data (noop).
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_set_early_data<T>::value), void>::type
+connection_t<Adapter>::set_early_data(const early_data_t& early)
+{}
+
+
+/**
+ *  \brief Offload TLS to the kernel after the handshake.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_set_kernel_tls<T>::value), void>::type
+connection_t<Adapter>::set_kernel_tls(const kernel_tls_t& kernel)
+{
+    adaptor.set_kernel_tls(kernel);
+}
+
+
+/**
+ *  \brief Offload TLS to the kernel after the handshake (noop).
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_set_kernel_tls<T>::value), void>::type
+connection_t<Adapter>::set_kernel_tls(const kernel_tls_t& kernel)
+{}
+
+
+/**
+ *  \brief Set the protocols offered with ALPN.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_set_alpn<T>::value), void>::type
+connection_t<Adapter>::set_alpn(const std::vector<std::string>& protocols)
+{
+    adaptor.set_alpn(protocols);
+}
+
+
+/**
+ *  \brief Set the protocols offered with ALPN (noop).
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_set_alpn<T>::value), void>::type
+connection_t<Adapter>::set_alpn(const std::vector<std::string>& protocols)
+{}
+
+
+/**
+ *  \brief Get the protocol negotiated with ALPN.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_alpn_protocol<T>::value), std::string>::type
+connection_t<Adapter>::alpn_protocol() const
+{
+    return adaptor.alpn_protocol();
+}
+
+
+/**
+ *  \brief Get the protocol negotiated with ALPN (none).
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_alpn_protocol<T>::value), std::string>::type
+connection_t<Adapter>::alpn_protocol() const
+{
+    return std::string();
+}
+
+
+/**
+ *  \brief Check if the kernel encrypts writes to the connection.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_kernel_tls<T>::value), bool>::type
+connection_t<Adapter>::kernel_tls() const
+{
+    return adaptor.kernel_tls();
+}
+
+
+/**
+ *  \brief Check if the kernel encrypts writes to the connection (never).
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_kernel_tls<T>::value), bool>::type
+connection_t<Adapter>::kernel_tls() const
+{
+    return false;
+}
+
+
+/**
+ *  \brief Check if data can be read without waiting on the socket.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_pending<T>::value), bool>::type
+connection_t<Adapter>::pending() const
+{
+    return offset < buffer.size() || adaptor.pending();
+}
+
+
+/**
+ *  \brief Check if data can be read without waiting on the socket.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_pending<T>::value), bool>::type
+connection_t<Adapter>::pending() const
+{
+    return offset < buffer.size();
+}
+
+
+/**
+ *  \brief Get the underlying socket, to wait for readability.
+ */
+template <typename Adapter>
+template <typename T>
+auto connection_t<Adapter>::fd() const -> decltype(std::declval<const T&>().fd())
+{
+    return adaptor.fd();
+}
+
+
+/**
+ *  \brief Check if the connection is open and may be reused.
+ *
+ *  Unread, buffered data means the previous response was not fully
+ *  consumed, and the connection cannot be reused.
+ */
+template <typename Adapter>
+bool connection_t<Adapter>::alive() const
+{
+    return offset == buffer.size() && adaptor.alive();
+}
+
+
 /**
  *  \brief Set DNS cache.
  */
@@ -323,85 +957,261 @@ void connection_t<Adapter>::set_cache(const dns_cache_t& cache)
 }
 
 
+/**
+ *  \brief Set fixed addresses for hosts, checked before the cache.
+ */
+template <typename Adapter>
+void connection_t<Adapter>::set_overrides(const dns_overrides_t& overrides)
+{
+    this->overrides = overrides;
+}
+
+
 /**
  *  \brief Send data through socket.
+ *
+ *  With a deadline, the data is sent in blocks, and the deadline is
+ *  checked before each block.
  */
 template <typename Adapter>
 void connection_t<Adapter>::write(const std::string& data)
 {
-    int sent = adaptor.write(data.data(), data.size());
-    if (sent != static_cast<int>(data.size())) {
-        throw std::runtime_error("Unable to make request, sent " + std::to_string(sent) + " bytes.");
+    long size = static_cast<long>(data.size());
+    long sent = 0;
+    errno = 0;
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        sent = std::max<int>(static_cast<int>(adaptor.write(data.data(), data.size())), 0);
+    } else {
+        while (sent < size) {
+            read_limit();
+            long block = std::min<long>(size - sent, WRITE_BLOCK_SIZE);
+            long written = std::max<int>(static_cast<int>(adaptor.write(data.data() + sent, block)), 0);
+            sent += written;
+            if (written != block) {
+                break;
+            }
+        }
+    }
+    if (sent != size) {
+        write_failed(sent);
     }
 }
 
 
 /**
- *  \brief Read headers data from server.
+ *  \brief Send a list of buffers through socket.
  *
- *  Slowly read from buffer until a double carriage return is found.
+ *  With a deadline, the buffers are sent in blocks, and the deadline
+ *  is checked before each block.
  */
 template <typename Adapter>
-std::string connection_t<Adapter>::headers()
+void connection_t<Adapter>::write(const buffer_list_t& buffers)
 {
-    std::string string;
-    int result;
-    char src;
-    while ((result = adaptor.read(&src, 1))) {
-        string += src;
-        size_t size = string.size() - 4;
-        if (size > 0 && src == '\n' && string.substr(size) == "\r\n\r\n") {
+    size_t length = buffers.length();
+    size_t sent = 0;
+    errno = 0;
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        sent = writev(buffers);
+    } else {
+        while (sent < length) {
+            read_limit();
+            size_t block = std::min(length - sent, WRITE_BLOCK_SIZE);
+            size_t written = writev(buffers.slice(sent, block));
+            sent += written;
+            if (written != block) {
+                break;
+            }
+        }
+    }
+    if (sent != length) {
+        write_failed(sent);
+    }
+}
+
+
+/**
+ *  \brief Send buffers with a single gather write.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(has_writev<T>::value), size_t>::type
+connection_t<Adapter>::writev(const buffer_list_t& buffers)
+{
+    return adaptor.writev(buffers);
+}
+
+
+/**
+ *  \brief Send buffers sequentially, for adaptors without gather writes.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_writev<T>::value), size_t>::type
+connection_t<Adapter>::writev(const buffer_list_t& buffers)
+{
+    auto writer = [this](const char *data, size_t size) -> size_t {
+        int written = static_cast<int>(adaptor.write(data, size));
+        return written > 0 ? written : 0;
+    };
+
+    size_t sent = 0;
+    for (const auto& buffer: buffers) {
+        size_t written;
+        if (buffer.file()) {
+            written = write_file(buffer, writer);
+        } else {
+            written = writer(buffer.data, buffer.size);
+        }
+        sent += written;
+        if (written != buffer.size) {
             break;
         }
     }
 
-    return string;
+    return sent;
 }
 
 
 /**
- *  \brief Read chunked transfer encoding.
+ *  \brief Read directly from the socket into a file.
  *
- *  Each message is prefixed with a single line denoting how
- *  long the message is, in hex.
+ *  The adaptor stops at the deadline, between reads, so slow senders
+ *  cannot hold the request past it.
  */
 template <typename Adapter>
-std::string connection_t<Adapter>::chunked()
+template <typename T>
+typename std::enable_if<(has_splice<T>::value), long>::type
+connection_t<Adapter>::splice(file_writer_t& file, long bytes)
+{
+    if (!file.spliceable()) {
+        return copy(file, bytes);
+    }
+
+    read_limit();
+    errno = 0;
+    long read = static_cast<long>(adaptor.splice(file.fd(), bytes, deadline));
+    file.advance(read);
+    if (read < bytes && timed_out()) {
+        throw std::runtime_error("Request timed out.");
+    }
+    return read;
+}
+
+
+/**
+ *  \brief Read from the socket into a file, in blocks.
+ */
+template <typename Adapter>
+template <typename T>
+typename std::enable_if<(!has_splice<T>::value), long>::type
+connection_t<Adapter>::splice(file_writer_t& file, long bytes)
+{
+    return copy(file, bytes);
+}
+
+
+/**
+ *  \brief Copy from the socket to a file through a user-space block.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::copy(file_writer_t& file, long bytes)
 {
-    // initialize alloc
-    std::string hex;
-    int result, offset = 0;
-    char *buffer = static_cast<char*>(malloc(offset));
-    char byte, *src = buffer + offset;
-
-    while ((result = adaptor.read(&byte, 1))) {
-        if (!(byte == '\r' || byte == '\n')) {
-            hex += byte;
-        } else if (hex == "0") {
-            // end of file
+    std::string block;
+    block.resize(std::min<long>(bytes, DOWNLOAD_BLOCK_SIZE));
+
+    long count = 0;
+    while (count < bytes) {
+        long size = std::min<long>(block.size(), bytes - count);
+        long read = receive(&block[0], size);
+        if (read <= 0) {
             break;
-        } else if (hex.size()) {
-            // get carriage return
-            result = adaptor.read(&byte, 1);
-
-            // read bytes
-            long bytes = std::strtoul(hex.data(), nullptr, 16);
-            buffer = static_cast<char*>(realloc(buffer, bytes + offset));
-            long read = readn(buffer + offset, bytes);
-            offset += read;
-            if (read != bytes) {
+        }
+        file.write(block.data(), read);
+        count += read;
+    }
+
+    return count;
+}
+
+
+/**
+ *  \brief Read headers data from server.
+ *
+ *  Scan the buffered data for a double carriage return, reading
+ *  whole blocks from the socket as required. Any data past the
+ *  headers is left in the buffer for the body.
+ */
+template <typename Adapter>
+std::string connection_t<Adapter>::headers()
+{
+    size_t start = offset;
+    while (true) {
+        size_t end = buffer.find("\r\n\r\n", start);
+        if (end != std::string::npos) {
+            end += 4;
+            std::string string(buffer, offset, end - offset);
+            offset = end;
+            return string;
+        }
+
+        // only the last 3 bytes can start a partial delimiter
+        start = buffer.size() - offset;
+        start = start > 3 ? start - 3 : 0;
+        if (!fill()) {
+            std::string string(buffer, offset, std::string::npos);
+            offset = buffer.size();
+            return string;
+        }
+        start += offset;
+    }
+}
+
+
+/**
+ *  \brief Read chunked transfer encoding.
+ */
+template <typename Adapter>
+std::string connection_t<Adapter>::chunked()
+{
+    chunked_decoder_t decoder;
+    return chunked(decoder);
+}
+
+
+/**
+ *  \brief Read chunked transfer encoding with a decoder.
+ *
+ *  The framing is decoded from the read buffer, so many small chunks
+ *  are read with few system calls. The remainder of large chunks is
+ *  read directly into the output, which grows geometrically. The
+ *  decoder holds any trailers once the body is complete.
+ */
+template <typename Adapter>
+std::string connection_t<Adapter>::chunked(chunked_decoder_t& decoder)
+{
+    std::string output;
+    while (!decoder.done()) {
+        size_t size = output.size();
+        size_t remaining = decoder.remaining();
+        if (remaining >= BUFFER_SIZE) {
+            output.resize(size + remaining);
+            long read = readn(&output[size], remaining);
+            decoder.consume(read);
+            output.resize(size + read);
+            if (read != static_cast<long>(remaining)) {
                 break;
             }
+            continue;
+        }
 
-            // clear our hex buffer for new messages
-            hex.clear();
+        output.resize(size + BUFFER_SIZE);
+        long read = read_chunked(decoder, &output[size], BUFFER_SIZE);
+        output.resize(size + read);
+        if (!read && !decoder.done()) {
+            break;
         }
     }
 
-    // create string output
-    std::string output(buffer, offset);
-    free(buffer);
-
     return output;
 }
 
@@ -415,7 +1225,7 @@ std::string connection_t<Adapter>::body(const long length)
     std::string string;
     if (length > 0) {
         string.resize(length);
-        adaptor.read(const_cast<char*>(&string[0]), length);
+        string.resize(readn(&string[0], length));
     } else if (length) {
         throw std::runtime_error("Asked to read negative bytes.");
     }
@@ -430,24 +1240,112 @@ std::string connection_t<Adapter>::body(const long length)
 template <typename Adapter>
 std::string connection_t<Adapter>::read()
 {
-    // read from connection
-    int result, offset = 0;
-    char *buffer = static_cast<char*>(malloc(BUFFER_SIZE));
-    char *src = buffer + offset;
-    while ((result = adaptor.read(src, BUFFER_SIZE))) {
-        offset += result;
-        buffer = static_cast<char*>(realloc(buffer, BUFFER_SIZE + offset));
-        src = buffer + offset;
+    std::string output(buffer, offset, std::string::npos);
+    buffer.clear();
+    offset = 0;
+
+    size_t size = output.size();
+    while (true) {
+        output.resize(size + BUFFER_SIZE);
+        long read = receive(&output[size], BUFFER_SIZE);
+        if (read <= 0) {
+            break;
+        }
+        size += read;
     }
-
-    // create string output
-    std::string output(buffer, offset);
-    free(buffer);
+    output.resize(size);
 
     return output;
 }
 
 
+/**
+ *  \brief Read up to `bytes` of a chunked body.
+ *
+ *  Decodes the framing from buffered data, and only reads from the
+ *  socket if no chunk data is buffered. Returns 0 once the body is
+ *  complete, or if the connection closed.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::read_chunked(chunked_decoder_t& decoder, char *dst, long bytes)
+{
+    long count = 0;
+    while (count < bytes && !decoder.done()) {
+        if (offset == buffer.size()) {
+            if (count) {
+                break;
+            }
+            size_t remaining = decoder.remaining();
+            if (remaining >= BUFFER_SIZE) {
+                // read large chunks directly into the destination
+                long read = receive(dst, std::min<long>(bytes, remaining));
+                if (read <= 0) {
+                    break;
+                }
+                decoder.consume(read);
+                return read;
+            } else if (!fill()) {
+                break;
+            }
+        }
+
+        const char *chunk;
+        size_t size = bytes - count;
+        offset += decoder.decode(buffer.data() + offset, buffer.size() - offset, chunk, size);
+        if (size) {
+            std::memcpy(dst + count, chunk, size);
+            count += size;
+        }
+    }
+
+    return count;
+}
+
+
+/**
+ *  \brief Write up to `bytes` of the response to a file.
+ *
+ *  Buffered data is written first, and the remainder is moved from
+ *  the socket to the file without passing through the read buffer.
+ *  Returns the number of bytes written, which is short on EOF.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::read_file(file_writer_t& file, long bytes)
+{
+    long count = std::min<long>(bytes, buffer.size() - offset);
+    if (count) {
+        file.write(buffer.data() + offset, count);
+        offset += count;
+    }
+    if (count < bytes) {
+        count += splice(file, bytes - count);
+    }
+
+    return count;
+}
+
+
+/**
+ *  \brief Read up to `bytes` of the response.
+ *
+ *  Buffered data is returned first, otherwise this performs at most
+ *  a single read from the socket. Returns 0 on EOF or error.
+ */
+template <typename Adapter>
+long connection_t<Adapter>::read_some(char *dst, long bytes)
+{
+    long count = std::min<long>(bytes, buffer.size() - offset);
+    if (count) {
+        std::memcpy(dst, buffer.data() + offset, count);
+        offset += count;
+        return count;
+    }
+
+    long read = receive(dst, bytes);
+    return read > 0 ? read : 0;
+}
+
+
 // TYPES
 // -----
 
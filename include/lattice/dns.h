@@ -15,17 +15,60 @@
 #   include <netdb.h>
 #endif
 #include <lattice/config.h>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 LATTICE_BEGIN_NAMESPACE
 
+// CONSTANTS
+// ---------
+
+static constexpr size_t DNS_CACHE_SIZE = 4096;
+static constexpr size_t DNS_CACHE_SHARDS = 16;
+static constexpr std::chrono::seconds DNS_TTL(60);
+static constexpr std::chrono::seconds DNS_NEGATIVE_TTL(5);
+static constexpr std::chrono::seconds DNS_STALE_TIME(300);
+static constexpr std::chrono::seconds DNS_MIN_TTL(5);
+static constexpr size_t DNS_PREFETCH_THREADS = 16;
+static constexpr size_t DNS_STALE_THREADS = 4;
+static constexpr std::chrono::seconds DNS_REFRESH_INTERVAL(1);
+static constexpr std::chrono::seconds DNS_REFRESH_AHEAD(10);
+#ifdef _WIN32
+static const char HOSTS_FILE[] = "C:\\Windows\\System32\\drivers\\etc\\hosts";
+#else
+static const char HOSTS_FILE[] = "/etc/hosts";
+#endif
+
 // TYPES
 // -----
 
 class address_cache_t;
+class dns_resolver_t;
 typedef std::shared_ptr<address_cache_t> dns_cache_t;
+typedef std::pair<std::string, std::string> dns_host_t;
+typedef std::vector<dns_host_t> dns_host_list_t;
+
+
+/**
+ *  \brief State of a cached lookup.
+ */
+enum dns_status_t
+{
+    DNS_MISSING,
+    DNS_FRESH,
+    DNS_STALE,
+    DNS_NEGATIVE,
+};
 
 // OBJECTS
 // -------
@@ -79,7 +122,7 @@ struct address_t
     int family;
     int socket_type;
     int protocol;
-    sockaddr address;
+    sockaddr_storage address;
     size_t length;
 
     address_t() = default;
@@ -93,17 +136,155 @@ struct address_t
     explicit operator addrinfo() const;
 };
 
+typedef std::vector<address_t> address_list_t;
+
+
+/**
+ *  \brief Cached addresses for a host, or a failed lookup.
+ */
+struct dns_entry_t
+{
+    address_list_t addresses;
+    std::chrono::steady_clock::time_point expires;
+    std::chrono::steady_clock::time_point renews;
+    bool refreshing = false;
+};
+
+
+/**
+ *  \brief Thread-safe cache for DNS lookups.
+ *
+ *  Entries are spread over shards by host, and each shard has a
+ *  reader-writer lock, so concurrent lookups rarely contend. Every
+ *  address is stored, with an expiry, and failed lookups are cached
+ *  briefly. Expired entries are served for up to DNS_STALE_TIME while
+ *  a single background lookup refreshes them, on at most
+ *  DNS_STALE_THREADS threads. Once a shard is full, the entry closest
+ *  to expiry is evicted.
+ *
+ *  Lookups use getaddrinfo, unless a resolver is set, in which case
+ *  entries expire with the record TTLs, of at least DNS_MIN_TTL.
+ *  Single-label names and names in the hosts file still use
+ *  getaddrinfo, so search domains and "localhost" keep working.
+ *
+ *  Known hosts, as {host, service} pairs, can be prefetched in
+ *  parallel, and refreshed in the background before they expire.
+ *  Snapshots save the live entries to a file, for later processes to
+ *  start warm.
+ *
+ *  Background refreshes keep the cache alive, so caches must be
+ *  created with `create_dns_cache()`.
+ */
+class address_cache_t: public std::enable_shared_from_this<address_cache_t>
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    address_cache_t(size_t capacity = DNS_CACHE_SIZE);
+    address_cache_t(const address_cache_t&) = delete;
+    address_cache_t & operator=(const address_cache_t&) = delete;
+    ~address_cache_t();
+
+    // LOOKUP
+    address_list_t resolve(const std::string& host, const std::string& service, bool* cached = nullptr);
+    dns_status_t find(const std::string& host, const std::string& service, address_list_t& addresses) const;
+    void prefetch(const dns_host_list_t& hosts);
+
+    // REFRESH
+    void start_refresh(const dns_host_list_t& hosts);
+    void stop_refresh();
+
+    // PERSISTENCE
+    void snapshot(const std::string& path) const;
+    size_t load(const std::string& path);
+
+    // MODIFIERS
+    void insert(const std::string& host, const std::string& service, const address_list_t& addresses, std::chrono::seconds ttl = DNS_TTL);
+    void insert_failure(const std::string& host, const std::string& service, std::chrono::seconds ttl = DNS_NEGATIVE_TTL);
+    void erase(const std::string& host, const std::string& service);
+    void clear();
+
+    // CAPACITY
+    size_t size() const;
+    size_t capacity() const;
+
+    // OPTIONS
+    void set_resolver(std::shared_ptr<dns_resolver_t> resolver);
+    std::shared_ptr<dns_resolver_t> get_resolver() const;
+
+protected:
+    struct shard_t
+    {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<std::string, dns_entry_t> entries;
+    };
+
+    struct refresher_t
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        dns_host_list_t hosts;
+        bool stopped = false;
+    };
+
+    std::array<shard_t, DNS_CACHE_SHARDS> shards;
+    size_t limit;
+    std::shared_ptr<dns_resolver_t> resolver;
+    std::shared_ptr<refresher_t> refresher;
+    std::mutex refresher_mutex;
+    dns_host_list_t stale;
+    size_t stale_workers = 0;
+    std::mutex stale_mutex;
+
+    shard_t& shard(const std::string& key);
+    const shard_t& shard(const std::string& key) const;
+    void store(const std::string& key, dns_entry_t&& entry);
+    bool claim(const std::string& key);
+    void queue_refresh(const std::string& host, const std::string& service);
+    bool expiring(const std::string& host, const std::string& service) const;
+    void refresh(const std::string& host, const std::string& service);
+    address_list_t lookup(const std::string& host, const std::string& service, std::chrono::seconds& ttl) const;
+    address_list_t lookup(const std::string& host, const std::string& service);
+};
+
 
 /**
- *  \brief Cache for DNS lookups.
+ *  \brief Fixed addresses for hosts, checked before any lookup.
+ *
+ *  Like curl's `--resolve`, entries map "host:port" to a comma-separated
+ *  list of numeric addresses. Hosts without a port match every port,
+ *  and a hosts file may be loaded as such entries. Copies share their
+ *  entries until modified.
  */
-struct address_cache_t: std::unordered_multimap<std::string, address_t>
+class dns_overrides_t
 {
-    typedef std::unordered_multimap<std::string, address_t> base;
-    using base::base;
+public:
+    dns_overrides_t() = default;
+    dns_overrides_t(const dns_overrides_t&) = default;
+    dns_overrides_t & operator=(const dns_overrides_t&) = default;
+    dns_overrides_t(dns_overrides_t&&) = default;
+    dns_overrides_t & operator=(dns_overrides_t&&) = default;
+
+    dns_overrides_t(std::initializer_list<std::pair<std::string, std::string>> list);
+
+    // MODIFIERS
+    void add(const std::string& host, const std::string& addresses);
+    void load_hosts(const std::string& path = HOSTS_FILE);
+    void clear();
 
-    template <typename ...Args>
-    friend dns_cache_t create_dns_cache(Args&& ...args);
+    // LOOKUP
+    bool find(const std::string& host, const std::string& service, address_list_t& addresses) const;
+
+    // CAPACITY
+    size_t size() const;
+    bool empty() const;
+    explicit operator bool() const;
+
+protected:
+    typedef std::unordered_map<std::string, address_list_t> map_t;
+    std::shared_ptr<map_t> entries;
+
+    map_t& modify();
 };
 
 
@@ -133,6 +314,48 @@ public:
     address_iterator_t end() const;
 };
 
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Order addresses by preference for connecting.
+ *
+ *  Destinations are sorted as in RFC 6724, then interleaved by
+ *  address family, starting with the preferred family (RFC 8305).
+ */
+void sort_addresses(address_list_t& addresses);
+
+/**
+ *  \brief Resolve the addresses for a host, by order of preference.
+ */
+address_list_t lookup_addresses(const std::string& host, const std::string& service);
+
+/**
+ *  \brief Check if a host must be resolved with getaddrinfo.
+ *
+ *  Single-label names need the search domains, and names in the hosts
+ *  file, loaded once, may not be known to any nameserver.
+ */
+bool system_host(const std::string& host);
+
+/**
+ *  \brief Split "host:port" or "[host]:port", with an optional port.
+ */
+void split_host(const std::string& value, std::string& host, std::string& port);
+
+/**
+ *  \brief Get the port for a service name or number.
+ */
+uint16_t service_port(const std::string& service);
+
+/**
+ *  \brief Create a cache warmed with the addresses for `hosts`.
+ *
+ *  If `refresh` is set, the hosts are refreshed in the background
+ *  before their entries expire.
+ */
+dns_cache_t create_dns_cache(const dns_host_list_t& hosts, bool refresh = false, size_t capacity = DNS_CACHE_SIZE);
+
 // IMPLEMENTATION
 // --------------
 
@@ -143,10 +366,14 @@ public:
  *  Expose only the `create_dns_cache` function call to set automatic
  *  lifetime management for the API.
  */
-template <typename... Ts>
+template <
+    typename... Ts,
+    typename = typename std::enable_if<std::is_constructible<address_cache_t, Ts...>::value>::type
+>
 dns_cache_t create_dns_cache(Ts&& ...ts)
 {
     return std::make_shared<address_cache_t>(std::forward<Ts>(ts)...);
 }
 
+
 LATTICE_END_NAMESPACE
\ No newline at end of file
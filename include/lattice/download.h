@@ -0,0 +1,113 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Download response bodies directly to files.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <pycpp/misc/enum.h>
+#include <cstdint>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr size_t DOWNLOAD_BLOCK_SIZE = 65536;
+
+// OBJECTS
+// -------
+
+
+/** \brief Enumerations for file download policies.
+ */
+enum download_flags_t: unsigned int
+{
+    DOWNLOAD_DIRECT     = 1,
+    DOWNLOAD_SYNC       = 2,
+};
+
+enum_flag(download_flags_t);
+
+
+/**
+ *  \brief Destination for a response body.
+ *
+ *  The body is written to a file, created or truncated at `path`,
+ *  or to an open file descriptor at its current position, which is
+ *  not closed. With `DOWNLOAD_DIRECT`, files opened from a path
+ *  bypass the page cache where supported, and with `DOWNLOAD_SYNC`,
+ *  the data is flushed to disk before the response is returned.
+ */
+class download_t
+{
+public:
+    download_t() = default;
+    download_t(const download_t&) = default;
+    download_t & operator=(const download_t&) = default;
+    download_t(download_t&&) = default;
+    download_t & operator=(download_t&&) = default;
+
+    download_t(const std::string& path, download_flags_t flags = download_flags_t(0));
+    download_t(int fd, download_flags_t flags = download_flags_t(0));
+
+    const std::string& path() const;
+    int fd() const;
+    download_flags_t flags() const;
+
+    explicit operator bool() const;
+
+protected:
+    std::string path_;
+    int fd_ = -1;
+    download_flags_t flags_ = download_flags_t(0);
+};
+
+
+/**
+ *  \brief Writes a response body to the destination of a download.
+ *
+ *  Files are preallocated once the length of the body is known, and
+ *  truncated to the data written when complete. Data may be written
+ *  through the writer, or directly to `fd()` and then recorded with
+ *  `advance()`, if `spliceable()`.
+ */
+class file_writer_t
+{
+public:
+    file_writer_t(const download_t& download);
+    file_writer_t(const file_writer_t&) = delete;
+    file_writer_t & operator=(const file_writer_t&) = delete;
+    ~file_writer_t();
+
+    // WRITING
+    void allocate(uint64_t length);
+    void write(const char *data, size_t size);
+    void advance(size_t size);
+    void finish();
+
+    // DATA
+    int fd() const;
+    uint64_t size() const;
+    bool direct() const;
+    bool spliceable() const;
+
+protected:
+    int fd_ = -1;
+    bool owned = false;
+    bool direct_ = false;
+    bool sync = false;
+    int64_t start = -1;
+    uint64_t written = 0;
+    uint64_t allocated = 0;
+    char *block = nullptr;
+    size_t used = 0;
+
+    void write_all(const char *data, size_t size);
+};
+
+LATTICE_END_NAMESPACE
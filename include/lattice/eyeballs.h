@@ -0,0 +1,48 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Parallel connection attempts over many addresses.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <lattice/dns.h>
+#include <lattice/socket.h>
+#include <chrono>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Delay before starting the next connection attempt (RFC 8305).
+ */
+static constexpr std::chrono::milliseconds CONNECTION_ATTEMPT_DELAY(250);
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Connect to the first address to respond ("Happy Eyeballs").
+ *
+ *  Addresses are tried in order with non-blocking connects, starting
+ *  the next attempt after `delay`, or as soon as an attempt fails.
+ *  The first socket to connect wins, and the others are closed.
+ *
+ *  \param addresses        Addresses, sorted with `sort_addresses`
+ *  \param sock             Connected socket, in blocking mode
+ *  \param index            Index of the connected address
+ *  \param timeout          Limit for all attempts, or zero for none
+ *  \param delay            Delay between attempts
+ *  \return                 If any address was connected in time
+ */
+bool connect_any(const address_list_t& addresses,
+    socket_handle_t& sock,
+    size_t& index,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+    std::chrono::milliseconds delay = CONNECTION_ATTEMPT_DELAY);
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,133 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HPACK header compression for HTTP/2.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr size_t HPACK_TABLE_SIZE = 4096;
+
+// OBJECTS
+// -------
+
+typedef std::pair<std::string, std::string> hpack_field_t;
+typedef std::vector<hpack_field_t> hpack_fields_t;
+
+
+/**
+ *  \brief Dynamic table shared by an HPACK encoder and decoder.
+ *
+ *  Entries are indexed after the 61 entries of the static table,
+ *  with the most recently added entry first, as in RFC 7541.
+ */
+class hpack_table_t
+{
+public:
+    hpack_table_t() = default;
+    hpack_table_t(const hpack_table_t&) = default;
+    hpack_table_t & operator=(const hpack_table_t&) = default;
+    hpack_table_t(hpack_table_t&&) = default;
+    hpack_table_t & operator=(hpack_table_t&&) = default;
+
+    void add(const std::string& name, const std::string& value);
+    void resize(size_t limit);
+    const hpack_field_t& at(size_t index) const;
+    size_t find(const std::string& name, const std::string& value, bool& exact) const;
+
+    size_t size() const;
+    size_t limit() const;
+    size_t entries() const;
+
+protected:
+    std::deque<hpack_field_t> fields;
+    size_t size_ = 0;
+    size_t limit_ = HPACK_TABLE_SIZE;
+
+    void evict(size_t limit);
+};
+
+
+/**
+ *  \brief Encodes header lists into HPACK header blocks.
+ *
+ *  Fields are indexed when possible, and otherwise added to the
+ *  dynamic table, except for credentials, which are never indexed.
+ *  Strings are Huffman-coded when shorter.
+ */
+class hpack_encoder_t
+{
+public:
+    hpack_encoder_t() = default;
+    hpack_encoder_t(const hpack_encoder_t&) = default;
+    hpack_encoder_t & operator=(const hpack_encoder_t&) = default;
+    hpack_encoder_t(hpack_encoder_t&&) = default;
+    hpack_encoder_t & operator=(hpack_encoder_t&&) = default;
+
+    void encode(const hpack_fields_t& fields, std::string& output);
+    void set_table_size(size_t size);
+    const hpack_table_t& table() const;
+
+protected:
+    hpack_table_t table_;
+    size_t update = 0;
+    bool pending = false;
+};
+
+
+/**
+ *  \brief Decodes HPACK header blocks into header lists.
+ *
+ *  Malformed blocks raise `std::runtime_error`, after which the
+ *  decoder state is undefined and the connection must be closed.
+ */
+class hpack_decoder_t
+{
+public:
+    hpack_decoder_t() = default;
+    hpack_decoder_t(const hpack_decoder_t&) = default;
+    hpack_decoder_t & operator=(const hpack_decoder_t&) = default;
+    hpack_decoder_t(hpack_decoder_t&&) = default;
+    hpack_decoder_t & operator=(hpack_decoder_t&&) = default;
+
+    void decode(const char *data, size_t length, hpack_fields_t& fields);
+    void set_table_size(size_t size);
+    const hpack_table_t& table() const;
+
+protected:
+    hpack_table_t table_;
+    size_t limit = HPACK_TABLE_SIZE;
+};
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Append the Huffman coding of `input` to `output`.
+ */
+void huffman_encode(const std::string& input, std::string& output);
+
+/**
+ *  \brief Get the length of the Huffman coding of `input`, in bytes.
+ */
+size_t huffman_length(const std::string& input);
+
+/**
+ *  \brief Decode a Huffman-coded string.
+ */
+std::string huffman_decode(const char *data, size_t length);
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,697 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HTTP/2 framing, streams and multiplexed sessions.
+ */
+
+#pragma once
+
+#include <lattice/adaptor.h>
+#include <lattice/config.h>
+#include <lattice/connection.h>
+#include <lattice/download.h>
+#include <lattice/hpack.h>
+#include <lattice/method.h>
+#include <lattice/response.h>
+#include <lattice/timeout.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static const std::string HTTP2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static constexpr size_t HTTP2_FRAME_HEADER = 9;
+static constexpr size_t HTTP2_FRAME_SIZE = 16384;
+static constexpr size_t HTTP2_MAX_STREAMS = 100;
+static constexpr int64_t HTTP2_DEFAULT_WINDOW = 65535;
+static constexpr int64_t HTTP2_STREAM_WINDOW = 1 << 22;
+static constexpr int64_t HTTP2_CONNECTION_WINDOW = 1 << 24;
+static constexpr int64_t HTTP2_MAX_WINDOW = 0x7fffffff;
+static constexpr std::chrono::seconds HTTP2_IDLE_TIMEOUT(30);
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief HTTP protocol version used for requests.
+ *
+ *  HTTP/2 is negotiated with ALPN for HTTPS, and falls back to
+ *  HTTP/1.1 if the server does not support it. Plain HTTP assumes
+ *  the server supports HTTP/2 ("prior knowledge").
+ */
+enum http_version_t
+{
+    HTTP_1_1    = 0,
+    HTTP_2      = 1,
+};
+
+
+/**
+ *  \brief HTTP/2 frame types.
+ */
+enum http2_frame_t: uint8_t
+{
+    HTTP2_DATA              = 0x0,
+    HTTP2_HEADERS           = 0x1,
+    HTTP2_PRIORITY          = 0x2,
+    HTTP2_RST_STREAM        = 0x3,
+    HTTP2_SETTINGS          = 0x4,
+    HTTP2_PUSH_PROMISE      = 0x5,
+    HTTP2_PING              = 0x6,
+    HTTP2_GOAWAY            = 0x7,
+    HTTP2_WINDOW_UPDATE     = 0x8,
+    HTTP2_CONTINUATION      = 0x9,
+};
+
+
+/**
+ *  \brief HTTP/2 frame flags.
+ */
+enum http2_flags_t: uint8_t
+{
+    HTTP2_END_STREAM        = 0x1,
+    HTTP2_ACK               = 0x1,
+    HTTP2_END_HEADERS       = 0x4,
+    HTTP2_PADDED            = 0x8,
+    HTTP2_PRIORITY_FLAG     = 0x20,
+};
+
+
+/**
+ *  \brief HTTP/2 settings identifiers.
+ */
+enum http2_setting_t: uint16_t
+{
+    HTTP2_HEADER_TABLE_SIZE         = 0x1,
+    HTTP2_ENABLE_PUSH               = 0x2,
+    HTTP2_MAX_CONCURRENT_STREAMS    = 0x3,
+    HTTP2_INITIAL_WINDOW_SIZE       = 0x4,
+    HTTP2_MAX_FRAME_SIZE            = 0x5,
+    HTTP2_MAX_HEADER_LIST_SIZE      = 0x6,
+};
+
+
+/**
+ *  \brief HTTP/2 error codes.
+ */
+enum http2_error_t: uint32_t
+{
+    HTTP2_NO_ERROR              = 0x0,
+    HTTP2_PROTOCOL_ERROR        = 0x1,
+    HTTP2_INTERNAL_ERROR        = 0x2,
+    HTTP2_FLOW_CONTROL_ERROR    = 0x3,
+    HTTP2_SETTINGS_TIMEOUT      = 0x4,
+    HTTP2_STREAM_CLOSED         = 0x5,
+    HTTP2_FRAME_SIZE_ERROR      = 0x6,
+    HTTP2_REFUSED_STREAM        = 0x7,
+    HTTP2_CANCEL                = 0x8,
+    HTTP2_COMPRESSION_ERROR     = 0x9,
+    HTTP2_CONNECT_ERROR         = 0xa,
+    HTTP2_ENHANCE_YOUR_CALM     = 0xb,
+    HTTP2_INADEQUATE_SECURITY   = 0xc,
+    HTTP2_HTTP_1_1_REQUIRED     = 0xd,
+};
+
+
+/**
+ *  \brief Receives stream events from an HTTP/2 engine.
+ */
+class http2_handler_t
+{
+public:
+    virtual ~http2_handler_t() = default;
+
+    virtual void on_headers(uint32_t stream, hpack_fields_t&& fields, bool end) = 0;
+    virtual void on_data(uint32_t stream, const char *data, size_t length, bool end) = 0;
+    virtual void on_reset(uint32_t stream, http2_error_t error) = 0;
+    virtual void on_goaway(uint32_t last, http2_error_t error) = 0;
+};
+
+
+/**
+ *  \brief Client side of the HTTP/2 framing layer, without I/O.
+ *
+ *  Received bytes are parsed into frames, which update the flow
+ *  control windows and settings and are passed to the handler as
+ *  stream events. Frames to send, including acknowledgements and
+ *  request bodies released by window updates, are queued in the
+ *  outbox. Connection errors queue a GOAWAY frame and raise
+ *  `std::runtime_error`.
+ */
+class http2_engine_t
+{
+public:
+    http2_engine_t(http2_handler_t& handler);
+    http2_engine_t(const http2_engine_t&) = delete;
+    http2_engine_t & operator=(const http2_engine_t&) = delete;
+
+    // FRAMES
+    void preface();
+    uint32_t submit(const hpack_fields_t& fields, std::string&& body);
+    void consume(uint32_t stream, size_t bytes);
+    void reset(uint32_t stream, http2_error_t error = HTTP2_CANCEL);
+    void goaway(http2_error_t error = HTTP2_NO_ERROR);
+    void receive(const char *data, size_t length);
+    std::string take();
+
+    // DATA
+    bool open() const;
+    bool available() const;
+    size_t streams() const;
+
+protected:
+    struct stream_t
+    {
+        int64_t send_window = HTTP2_DEFAULT_WINDOW;
+        int64_t recv_window = HTTP2_STREAM_WINDOW;
+        size_t unacked = 0;
+        std::string body;
+        size_t offset = 0;
+        bool local_closed = false;
+        bool remote_closed = false;
+    };
+
+    http2_handler_t& handler;
+    hpack_encoder_t encoder;
+    hpack_decoder_t decoder;
+    std::map<uint32_t, stream_t> active;
+    std::string input;
+    std::string output;
+    std::string block;
+    uint32_t next_stream = 1;
+    uint32_t block_stream = 0;
+    uint32_t continuation = 0;
+    bool block_end = false;
+    bool closing = false;
+    int64_t send_window = HTTP2_DEFAULT_WINDOW;
+    int64_t recv_window = HTTP2_DEFAULT_WINDOW;
+    int64_t initial_window = HTTP2_DEFAULT_WINDOW;
+    size_t unacked = 0;
+    size_t max_frame = HTTP2_FRAME_SIZE;
+    size_t max_streams = HTTP2_MAX_STREAMS;
+
+    size_t parse(const char *data, size_t length);
+    void frame(uint8_t type, uint8_t flags, uint32_t stream, const char *payload, size_t size);
+    void data_frame(uint8_t flags, uint32_t stream, const char *payload, size_t size);
+    void headers_frame(uint8_t flags, uint32_t stream, const char *payload, size_t size);
+    void settings_frame(uint8_t flags, const char *payload, size_t size);
+    void window_frame(uint32_t stream, const char *payload, size_t size);
+    void headers_complete();
+    void close_remote(uint32_t stream);
+    void send_data();
+    void write_frame(uint8_t type, uint8_t flags, uint32_t stream, const char *payload, size_t size);
+    void window_update(uint32_t stream, size_t increment);
+    void fail(http2_error_t error, const char *message);
+};
+
+
+namespace detail
+{
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Session interface used by streams to release their data.
+ */
+class http2_channel_t
+{
+public:
+    virtual ~http2_channel_t() = default;
+
+    virtual void consume(uint32_t stream, size_t bytes) = 0;
+    virtual void cancel(uint32_t stream) = 0;
+    virtual bool available() const = 0;
+};
+
+
+#ifdef _WIN32
+    typedef SOCKET http2_socket_t;
+#else
+    typedef int http2_socket_t;
+#endif
+
+
+/**
+ *  \brief Wait for a socket to become readable, or for a wake-up.
+ *
+ *  Uses a self-pipe on POSIX systems. On Windows, waits are capped
+ *  to a short interval instead.
+ */
+class http2_waker_t
+{
+public:
+    http2_waker_t();
+    http2_waker_t(const http2_waker_t&) = delete;
+    http2_waker_t & operator=(const http2_waker_t&) = delete;
+    ~http2_waker_t();
+
+    void wake();
+    bool wait(http2_socket_t fd, std::chrono::milliseconds timeout);
+
+protected:
+    int fds[2] = {-1, -1};
+};
+
+}   /* detail */
+
+
+/**
+ *  \brief Response to a request on a multiplexed HTTP/2 session.
+ *
+ *  Events are delivered by the session's I/O thread, and the status,
+ *  headers and body are read by the request's thread, with the same
+ *  interface as `body_reader_t`. Reading releases flow-control
+ *  credit, so the server never sends more than a window ahead of
+ *  the reader. The session must outlive the stream.
+ */
+class http2_stream_t
+{
+public:
+    http2_stream_t(detail::http2_channel_t* channel, uint32_t id, method_t method, const timeout_t& timeout);
+    http2_stream_t(const http2_stream_t&) = delete;
+    http2_stream_t & operator=(const http2_stream_t&) = delete;
+
+    // EVENTS
+    void headers(hpack_fields_t&& fields, bool end);
+    void data(const char *data, size_t length, bool end);
+    void reset(http2_error_t error);
+
+    // DATA
+    const response_t& response();
+    bool done() const;
+    bool timed_out() const;
+    http2_error_t error() const;
+    void set_deadline(std::chrono::steady_clock::time_point deadline);
+
+    // READ
+    size_t read(char *buf, size_t count);
+    bool read(std::string& block);
+    void buffer();
+    void download(file_writer_t& file);
+    void abort();
+
+protected:
+    detail::http2_channel_t* channel;
+    uint32_t id;
+    method_t method;
+    std::chrono::milliseconds timeout;
+    std::chrono::steady_clock::time_point deadline;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    response_t response_;
+    header_t trailers;
+    std::deque<std::string> blocks;
+    size_t offset = 0;
+    bool started = false;
+    bool ended = false;
+    bool expired = false;
+    http2_error_t error_ = HTTP2_NO_ERROR;
+
+    bool wait(std::unique_lock<std::mutex>& lock);
+    void finish();
+};
+
+
+/**
+ *  \brief HTTP/2 connection shared by concurrent requests.
+ *
+ *  The session owns the connection, and a single I/O thread writes
+ *  queued frames and reads from the socket, so TLS connections are
+ *  never used from two threads at once. Requests submit their
+ *  headers and body, and read the response from the returned stream.
+ *
+ *  The session stops accepting streams once the server sends GOAWAY
+ *  or the connection fails, and closes after it was idle for
+ *  `HTTP2_IDLE_TIMEOUT`.
+ */
+template <typename Connection>
+class http2_session_t: public detail::http2_channel_t, protected http2_handler_t
+{
+public:
+    http2_session_t(std::unique_ptr<Connection>&& connection);
+    http2_session_t(const http2_session_t&) = delete;
+    http2_session_t & operator=(const http2_session_t&) = delete;
+    ~http2_session_t();
+
+    std::shared_ptr<http2_stream_t> submit(const hpack_fields_t& fields,
+        std::string&& body,
+        method_t method,
+        const timeout_t& timeout = timeout_t());
+
+    void consume(uint32_t stream, size_t bytes) override;
+    void cancel(uint32_t stream) override;
+    bool available() const override;
+
+protected:
+    std::unique_ptr<Connection> connection;
+    http2_engine_t engine;
+    detail::http2_waker_t waker;
+    mutable std::mutex mutex;
+    std::condition_variable slots;
+    std::unordered_map<uint32_t, std::shared_ptr<http2_stream_t>> streams;
+    std::thread thread;
+    bool closed = false;
+    bool stopping = false;
+
+    void run();
+    void fail();
+
+    void on_headers(uint32_t stream, hpack_fields_t&& fields, bool end) override;
+    void on_data(uint32_t stream, const char *data, size_t length, bool end) override;
+    void on_reset(uint32_t stream, http2_error_t error) override;
+    void on_goaway(uint32_t last, http2_error_t error) override;
+};
+
+
+/**
+ *  \brief Process-wide cache of HTTP/2 sessions, keyed by origin.
+ *
+ *  Requests connecting to an origin hold its lock, so concurrent
+ *  requests share the first session rather than each opening a
+ *  connection. Origins which did not negotiate HTTP/2 are remembered,
+ *  and use HTTP/1.1 afterwards.
+ */
+class http2_session_cache_t
+{
+public:
+    http2_session_cache_t() = default;
+    http2_session_cache_t(const http2_session_cache_t&) = delete;
+    http2_session_cache_t & operator=(const http2_session_cache_t&) = delete;
+
+    std::mutex& lock(const std::string& origin);
+
+    template <typename Session>
+    std::shared_ptr<Session> find(const std::string& origin);
+    void add(const std::string& origin, const std::shared_ptr<detail::http2_channel_t>& session);
+
+    void downgrade(const std::string& origin);
+    bool downgraded(const std::string& origin) const;
+    void clear();
+
+protected:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<std::mutex>> locks;
+    std::unordered_map<std::string, std::shared_ptr<detail::http2_channel_t>> sessions;
+    std::unordered_set<std::string> http1;
+};
+
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Process-wide session cache used by HTTP/2 requests.
+ */
+http2_session_cache_t& default_http2_cache();
+
+// TYPES
+// -----
+
+// Sessions poll the socket from their own thread, so they use plain
+// socket adaptors, which never queue or pre-read data.
+#ifdef _WIN32
+    typedef win32_socket_adaptor_t http2_adaptor_t;
+#else
+    typedef posix_socket_adaptor_t http2_adaptor_t;
+#endif
+
+typedef connection_t<http2_adaptor_t> http2_connection_t;
+
+#if defined(HAVE_SSL) && defined(LATTICE_HAVE_OPENSSL)
+    typedef open_ssl_adaptor_t<http2_adaptor_t> https2_adaptor_t;
+    typedef connection_t<https2_adaptor_t> https2_connection_t;
+#endif
+
+
+// IMPLEMENTATION
+// --------------
+
+
+/**
+ *  Writes the connection preface, and starts the I/O thread.
+ */
+template <typename Connection>
+http2_session_t<Connection>::http2_session_t(std::unique_ptr<Connection>&& connection):
+    connection(std::move(connection)),
+    engine(*this)
+{
+    engine.preface();
+    thread = std::thread(&http2_session_t::run, this);
+}
+
+
+template <typename Connection>
+http2_session_t<Connection>::~http2_session_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    waker.wake();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+
+/**
+ *  \brief Start a request, or return null if the session is closing.
+ *
+ *  Blocks while the server's limit of concurrent streams is reached.
+ */
+template <typename Connection>
+std::shared_ptr<http2_stream_t> http2_session_t<Connection>::submit(const hpack_fields_t& fields,
+    std::string&& body,
+    method_t method,
+    const timeout_t& timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    slots.wait(lock, [this]() {
+        return closed || !engine.open() || engine.available();
+    });
+    if (closed || !engine.available()) {
+        return nullptr;
+    }
+
+    uint32_t id = engine.submit(fields, std::move(body));
+    auto stream = std::make_shared<http2_stream_t>(this, id, method, timeout);
+    streams.emplace(id, stream);
+    waker.wake();
+
+    return stream;
+}
+
+
+/**
+ *  \brief Release flow-control credit for data read from a stream.
+ */
+template <typename Connection>
+void http2_session_t<Connection>::consume(uint32_t stream, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    engine.consume(stream, bytes);
+    waker.wake();
+}
+
+
+/**
+ *  \brief Reset a stream the request no longer reads.
+ */
+template <typename Connection>
+void http2_session_t<Connection>::cancel(uint32_t stream)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (streams.erase(stream)) {
+        engine.reset(stream);
+        waker.wake();
+    }
+    slots.notify_all();
+}
+
+
+template <typename Connection>
+bool http2_session_t<Connection>::available() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && engine.open();
+}
+
+
+/**
+ *  \brief Write queued frames, and read and dispatch incoming frames.
+ *
+ *  The socket is only polled when no decrypted data is buffered,
+ *  and the poll is interrupted whenever frames are queued.
+ */
+template <typename Connection>
+void http2_session_t<Connection>::run()
+{
+    std::string output;
+    std::string input(BUFFER_SIZE * 8, '\0');
+    auto idle = std::chrono::steady_clock::now();
+    try {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto now = std::chrono::steady_clock::now();
+                if (!streams.empty()) {
+                    idle = now;
+                }
+                if (stopping || (streams.empty() && (!engine.open() || now - idle > HTTP2_IDLE_TIMEOUT))) {
+                    closed = true;
+                    engine.goaway();
+                    output = engine.take();
+                    break;
+                }
+                output = engine.take();
+            }
+
+            if (!output.empty()) {
+                connection->write(output);
+            }
+            if (!connection->pending() && !waker.wait(connection->fd(), std::chrono::seconds(1))) {
+                continue;
+            }
+
+            long read = connection->read_some(&input[0], input.size());
+            if (read <= 0) {
+                throw std::runtime_error("HTTP/2 connection closed by server.");
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            engine.receive(input.data(), read);
+            slots.notify_all();
+        }
+    } catch (std::exception&) {
+        std::lock_guard<std::mutex> lock(mutex);
+        output = engine.take();
+    }
+
+    // best-effort notice to the server, failures no longer matter
+    try {
+        if (!output.empty()) {
+            connection->write(output);
+        }
+    } catch (std::exception&) {
+    }
+    fail();
+}
+
+
+/**
+ *  \brief Close the session, and end every stream still active.
+ */
+template <typename Connection>
+void http2_session_t<Connection>::fail()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    connection->close();
+    for (auto &item: streams) {
+        item.second->reset(HTTP2_INTERNAL_ERROR);
+    }
+    streams.clear();
+    slots.notify_all();
+}
+
+
+template <typename Connection>
+void http2_session_t<Connection>::on_headers(uint32_t stream, hpack_fields_t&& fields, bool end)
+{
+    auto it = streams.find(stream);
+    if (it != streams.end()) {
+        it->second->headers(std::forward<hpack_fields_t>(fields), end);
+        if (end) {
+            streams.erase(it);
+        }
+    }
+}
+
+
+template <typename Connection>
+void http2_session_t<Connection>::on_data(uint32_t stream, const char *data, size_t length, bool end)
+{
+    auto it = streams.find(stream);
+    if (it != streams.end()) {
+        it->second->data(data, length, end);
+        if (end) {
+            streams.erase(it);
+        }
+    }
+}
+
+
+template <typename Connection>
+void http2_session_t<Connection>::on_reset(uint32_t stream, http2_error_t error)
+{
+    auto it = streams.find(stream);
+    if (it != streams.end()) {
+        it->second->reset(error);
+        streams.erase(it);
+    }
+}
+
+
+/**
+ *  \brief Refuse streams the server will not process.
+ *
+ *  Streams after the last stream processed by the server may be
+ *  safely retried on a new connection, whatever the error code.
+ */
+template <typename Connection>
+void http2_session_t<Connection>::on_goaway(uint32_t last, http2_error_t)
+{
+    for (auto it = streams.begin(); it != streams.end(); ) {
+        if (it->first > last) {
+            it->second->reset(HTTP2_REFUSED_STREAM);
+            it = streams.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+/**
+ *  \brief Get a usable session to the origin, or null.
+ *
+ *  Sessions which are closing are removed from the cache.
+ */
+template <typename Session>
+std::shared_ptr<Session> http2_session_cache_t::find(const std::string& origin)
+{
+    // close removed sessions after the lock is released
+    std::shared_ptr<detail::http2_channel_t> removed;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sessions.find(origin);
+    if (it == sessions.end()) {
+        return nullptr;
+    }
+
+    auto session = std::dynamic_pointer_cast<Session>(it->second);
+    if (session && session->available()) {
+        return session;
+    }
+    removed = std::move(it->second);
+    sessions.erase(it);
+
+    return nullptr;
+}
+
+LATTICE_END_NAMESPACE
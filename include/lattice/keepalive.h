@@ -0,0 +1,224 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Keep-alive connection pooling.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <lattice/timeout.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// TYPES
+// -----
+
+class connection_pool_t;
+typedef std::shared_ptr<connection_pool_t> connection_cache_t;
+
+namespace detail
+{
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Type-erased idle connection.
+ */
+struct idle_base_t
+{
+    std::chrono::steady_clock::time_point expires;
+
+    virtual ~idle_base_t() = default;
+};
+
+
+/**
+ *  \brief Idle connection of a specific adaptor type.
+ */
+template <typename Connection>
+struct idle_connection_t: idle_base_t
+{
+    std::unique_ptr<Connection> connection;
+};
+
+typedef std::unique_ptr<idle_base_t> idle_ptr_t;
+
+}   /* detail */
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Thread-safe pool of idle keep-alive connections.
+ *
+ *  Connections are keyed by their origin (scheme, host and port,
+ *  and any options that change how the connection was established),
+ *  and are checked out by requests to the same origin. Idle
+ *  connections expire after the idle timeout, or the timeout
+ *  advertised by the server, whichever comes first. Expired
+ *  connections to every origin are closed on each checkin, and the
+ *  pool holds at most `total` idle connections across origins.
+ */
+class connection_pool_t
+{
+public:
+    connection_pool_t() = default;
+    connection_pool_t(const connection_pool_t&) = delete;
+    connection_pool_t & operator=(const connection_pool_t&) = delete;
+    ~connection_pool_t() = default;
+
+    connection_pool_t(const timeout_t& idle, size_t limit = 8);
+
+    // CONNECTIONS
+    template <typename Connection>
+    std::unique_ptr<Connection> checkout(const std::string& origin);
+
+    template <typename Connection>
+    void checkin(const std::string& origin,
+        std::unique_ptr<Connection>&& connection,
+        const timeout_t& keep_alive = timeout_t());
+
+    // OPTIONS
+    void set_idle_timeout(const timeout_t& idle);
+    void set_max_idle(size_t limit);
+    void set_max_idle_total(size_t total);
+
+    // DATA
+    size_t size() const;
+    void clear();
+
+    template <typename ...Args>
+    friend connection_cache_t create_connection_cache(Args&& ...args);
+
+protected:
+    typedef std::deque<detail::idle_ptr_t> idle_list_t;
+    typedef std::vector<detail::idle_ptr_t> closed_list_t;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, idle_list_t> idle;
+    std::chrono::milliseconds timeout = std::chrono::seconds(30);
+    size_t limit = 8;
+    size_t total = 64;
+
+    std::chrono::steady_clock::time_point expires(const timeout_t& keep_alive) const;
+    void expire(idle_list_t& list, closed_list_t& closed) const;
+    void prune(closed_list_t& closed);
+};
+
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Process-wide connection pool used when no pool is specified.
+ */
+connection_cache_t default_connection_cache();
+
+
+// IMPLEMENTATION
+// --------------
+
+
+/**
+ *  \brief Take an idle connection to the origin from the pool.
+ *
+ *  The most recently used connection is tried first, and connections
+ *  which expired or were closed by the peer are discarded. Returns
+ *  a null pointer if no usable connection exists.
+ */
+template <typename Connection>
+std::unique_ptr<Connection> connection_pool_t::checkout(const std::string& origin)
+{
+    auto now = std::chrono::steady_clock::now();
+    while (true) {
+        detail::idle_ptr_t item;
+        closed_list_t closed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = idle.find(origin);
+            if (it == idle.end()) {
+                return nullptr;
+            }
+            expire(it->second, closed);
+            if (it->second.empty()) {
+                idle.erase(it);
+                return nullptr;
+            }
+            item = std::move(it->second.back());
+            it->second.pop_back();
+            if (it->second.empty()) {
+                idle.erase(it);
+            }
+        }
+
+        // check liveness outside the lock, it may require a syscall
+        auto *typed = dynamic_cast<detail::idle_connection_t<Connection>*>(item.get());
+        if (typed && item->expires > now && typed->connection->alive()) {
+            return std::move(typed->connection);
+        }
+    }
+}
+
+
+/**
+ *  \brief Return a connection to the pool after a complete response.
+ *
+ *  Expired connections to every origin are closed first. If the
+ *  origin already holds the maximum number of idle connections, the
+ *  oldest idle connection is closed, and if the pool is full, the
+ *  connection closest to expiry.
+ */
+template <typename Connection>
+void connection_pool_t::checkin(const std::string& origin,
+    std::unique_ptr<Connection>&& connection,
+    const timeout_t& keep_alive)
+{
+    if (!connection) {
+        return;
+    }
+
+    std::unique_ptr<detail::idle_connection_t<Connection>> item(new detail::idle_connection_t<Connection>);
+    item->connection = std::move(connection);
+
+    // close evicted connections after the lock is released
+    closed_list_t closed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        item->expires = expires(keep_alive);
+        prune(closed);
+        if (!limit || !total) {
+            closed.emplace_back(std::move(item));
+        } else {
+            auto &list = idle[origin];
+            if (list.size() >= limit) {
+                closed.emplace_back(std::move(list.front()));
+                list.pop_front();
+            }
+            list.emplace_back(std::move(item));
+        }
+    }
+}
+
+
+/**
+ *  \brief Only expose pool creator for lifetime management.
+ */
+template <typename... Ts>
+connection_cache_t create_connection_cache(Ts&& ...ts)
+{
+    return std::make_shared<connection_pool_t>(std::forward<Ts>(ts)...);
+}
+
+LATTICE_END_NAMESPACE
@@ -36,4 +36,17 @@ enum method_t: unsigned int
     CONNECT = 9,
 };
 
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Check if the method is idempotent (RFC 7231, Section 4.2.2).
+ */
+bool is_idempotent(method_t method);
+
+/**
+ *  \brief Check if the method is safe (RFC 7231, Section 4.2.1).
+ */
+bool is_safe(method_t method);
+
 LATTICE_END_NAMESPACE
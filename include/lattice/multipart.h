@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <lattice/buffer.h>
 #include <lattice/config.h>
 #include <deque>
 #include <memory>
@@ -61,6 +62,7 @@ struct part_value_t
     std::string name() const;
     const std::string & content_type() const;
     virtual std::string string() const;
+    virtual void buffers(buffer_list_t& list) const;
 };
 
 
@@ -73,6 +75,7 @@ struct file_value_t: part_value_t
 
     std::string buffer() const;
     std::string string() const override;
+    void buffers(buffer_list_t& list) const override;
 };
 
 
@@ -98,6 +101,7 @@ struct buffer_value_t: part_value_t
 
     const std::string & buffer() const;
     std::string string() const override;
+    void buffers(buffer_list_t& list) const override;
 };
 
 }   /* detail */
@@ -140,6 +144,8 @@ public:
     std::string header() const;
 
     std::string string() const;
+    void buffers(buffer_list_t& list) const;
+    bool has_files() const;
     explicit operator bool() const;
 
 private:
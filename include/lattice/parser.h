@@ -0,0 +1,71 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Incremental HTTP/1.1 response parser.
+ */
+
+#pragma once
+
+#include <lattice/chunked.h>
+#include <lattice/config.h>
+#include <lattice/method.h>
+#include <lattice/response.h>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Incremental parser for HTTP/1.1 responses.
+ *
+ *  Data may be fed in arbitrarily-sized pieces as they arrive from
+ *  a non-blocking socket, and the parser stops consuming data at the
+ *  end of the response, so any following response is left untouched.
+ */
+class response_parser_t
+{
+public:
+    response_parser_t() = default;
+    response_parser_t(const response_parser_t&) = default;
+    response_parser_t & operator=(const response_parser_t&) = default;
+    response_parser_t(response_parser_t&&) = default;
+    response_parser_t & operator=(response_parser_t&&) = default;
+
+    response_parser_t(method_t method);
+
+    // PARSING
+    size_t feed(const char* data, size_t length);
+    void finish();
+    void reset(method_t method = GET);
+
+    // DATA
+    bool headers_done() const;
+    bool done() const;
+    response_t& response();
+    const response_t& response() const;
+
+protected:
+    enum state_t
+    {
+        HEADERS,
+        LENGTH,
+        CHUNKED,
+        CLOSE,
+        DONE,
+    };
+
+    method_t method = GET;
+    state_t state = HEADERS;
+    response_t response_;
+    std::string buffer;
+    size_t remaining = 0;
+    chunked_decoder_t decoder;
+
+    size_t parse_headers(const char* data, size_t length);
+};
+
+LATTICE_END_NAMESPACE
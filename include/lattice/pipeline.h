@@ -0,0 +1,339 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HTTP/1.1 request pipelining.
+ */
+
+#pragma once
+
+#include <lattice/async.h>
+#include <lattice/buffer.h>
+#include <lattice/config.h>
+#include <lattice/keepalive.h>
+#include <lattice/method.h>
+#include <lattice/request.h>
+#include <lattice/response.h>
+#include <deque>
+#include <exception>
+#include <memory>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr size_t PIPELINE_DEPTH = 16;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Sends requests to a single origin back-to-back on one connection.
+ *
+ *  Runs of idempotent requests, up to the pipeline depth, are written
+ *  with a single gather write, and the responses are read in order.
+ *  Non-idempotent requests are sent alone, once all prior responses
+ *  were received, as in RFC 7230 Section 6.3.2.
+ *
+ *  If the server closes the connection mid-pipeline, the unanswered
+ *  requests are sent again on a new connection. Responses are not
+ *  followed for redirects or digest challenges.
+ */
+class pipeline_t
+{
+public:
+    pipeline_t() = default;
+    pipeline_t(const pipeline_t&) = default;
+    pipeline_t & operator=(const pipeline_t&) = default;
+    pipeline_t(pipeline_t&&) = default;
+    pipeline_t & operator=(pipeline_t&&) = default;
+
+    pipeline_t(size_t depth);
+
+    template <typename... Ts> void get(Ts&&... ts);
+    template <typename... Ts> void head(Ts&&... ts);
+    template <typename... Ts> void options(Ts&&... ts);
+    template <typename... Ts> void patch(Ts&&... ts);
+    template <typename... Ts> void post(Ts&&... ts);
+    template <typename... Ts> void put(Ts&&... ts);
+    template <typename... Ts> void trace(Ts&&... ts);
+    void add(const request_t& request);
+    void add(request_t&& request);
+
+    response_list_t perform();
+
+    template <typename Connection>
+    response_list_t perform(Connection& connection);
+
+    void set_depth(size_t depth);
+    size_t size() const;
+    explicit operator bool() const;
+
+protected:
+    std::deque<request_t> requests;
+    size_t depth = PIPELINE_DEPTH;
+
+    size_t batch(size_t first) const;
+    void check_origin() const;
+
+    template <typename Connection>
+    response_list_t pooled_perform(connection_pool_t& pool);
+
+    template <typename Connection>
+    response_list_t run(Connection& connection, bool fresh);
+};
+
+
+// IMPLEMENTATION
+// --------------
+
+
+/**
+ *  \brief Add GET request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::get(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(GET);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add HEAD request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::head(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(HEAD);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add OPTIONS request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::options(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(OPTIONS);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add PATCH request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::patch(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(PATCH);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add POST request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::post(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(POST);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add PUT request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::put(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(PUT);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Add TRACE request to the pipeline.
+ */
+template <typename... Ts>
+void pipeline_t::trace(Ts&&... ts)
+{
+    request_t request;
+    set_option(request, std::forward<Ts>(ts)...);
+
+    request.set_method(TRACE);
+    requests.emplace_back(std::move(request));
+}
+
+
+/**
+ *  \brief Send all requests, and return the responses in order.
+ *
+ *  The connection is checked out from the first request's connection
+ *  pool, or the process-wide pool, and returned to it afterwards if
+ *  the server allows it. The pipeline is empty once performed.
+ *
+ *  To avoid compiling external libraries into lattice, misuse inline
+ *  to keep this in the header.
+ */
+inline response_list_t pipeline_t::perform()
+{
+    if (requests.empty()) {
+        return response_list_t();
+    }
+    check_origin();
+
+    auto &front = requests.front();
+    auto service = front.get_url().service();
+    auto cache = front.get_connection_cache();
+    cache = cache ? cache : default_connection_cache();
+    if (service == "http") {
+        return pooled_perform<http_connection_t>(*cache);
+    } else if (service == "https") {
+        return pooled_perform<https_connection_t>(*cache);
+    } else {
+        throw std::runtime_error("Network scheme " + service + " is not supported.");
+    }
+
+    return response_list_t();
+}
+
+
+/**
+ *  \brief Send all requests on an open connection.
+ *
+ *  If the connection is closed by the server, it is reopened with
+ *  the options of the first unanswered request.
+ */
+template <typename Connection>
+response_list_t pipeline_t::perform(Connection& connection)
+{
+    check_origin();
+    auto responses = run(connection, false);
+    requests.clear();
+
+    return responses;
+}
+
+
+template <typename Connection>
+response_list_t pipeline_t::pooled_perform(connection_pool_t& pool)
+{
+    auto &front = requests.front();
+    auto origin = front.origin();
+    bool persistent = !requests.back().get_header().close_connection();
+
+    bool fresh = false;
+    auto connection = pool.checkout<Connection>(origin);
+    if (connection) {
+        connection->set_deadline(std::chrono::steady_clock::time_point());
+        connection->set_timeout(front.get_read_timeout() ? front.get_read_timeout() : front.get_timeout());
+    } else {
+        connection.reset(new Connection);
+        // batches may mix methods, so only send them after the handshake
+        front.open(*connection);
+        connection->set_early_data(early_data_t(false));
+        fresh = true;
+    }
+
+    auto responses = run(*connection, fresh);
+    auto timeout = responses.empty() ? timeout_t() : responses.back().keep_alive_timeout();
+    if (persistent && !responses.empty() && responses.back().keep_alive() && connection->alive()) {
+        pool.checkin(origin, std::move(connection), timeout);
+    }
+    requests.clear();
+
+    return responses;
+}
+
+
+/**
+ *  \brief Write each batch of requests and read the responses.
+ *
+ *  A batch ends early if the server closes the connection, which is
+ *  then reopened for the remaining requests. Unanswered idempotent
+ *  requests are sent again, unless nothing was received on a new
+ *  connection. Requests that cannot be retried get an empty response,
+ *  or raise the error that interrupted them.
+ */
+template <typename Connection>
+response_list_t pipeline_t::run(Connection& connection, bool fresh)
+{
+    response_list_t responses;
+    size_t index = 0;
+    while (index < requests.size()) {
+        size_t first = index;
+        size_t last = batch(first);
+        buffer_list_t list;
+        for (size_t i = first; i < last; ++i) {
+            list.append(requests[i].buffers());
+        }
+
+        bool reusable = false;
+        std::exception_ptr error;
+        try {
+            connection.write(list);
+            while (index < last) {
+                auto response = requests[index].receive(connection, false);
+                if (!response) {
+                    break;
+                }
+                reusable = response.keep_alive() && !requests[index].get_header().close_connection();
+                responses.emplace_back(std::move(response));
+                ++index;
+                if (!reusable) {
+                    break;
+                }
+            }
+        } catch (...) {
+            error = std::current_exception();
+            reusable = false;
+        }
+
+        fresh &= index == first;
+        if (index == requests.size() || (index == last && reusable)) {
+            continue;
+        }
+
+        // the connection closed before all responses were received
+        if (index == first && (fresh || !is_idempotent(requests[index].get_method()))) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            responses.emplace_back();
+            if (++index == requests.size()) {
+                break;
+            }
+        }
+        connection.close();
+        requests[index].open(connection);
+        connection.set_early_data(early_data_t(false));
+        fresh = true;
+    }
+
+    return responses;
+}
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,69 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Event-driven engine for concurrent requests.
+ */
+
+#pragma once
+
+#include <lattice/config.h>
+#include <lattice/request.h>
+#include <lattice/response.h>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// FORWARD
+// -------
+
+namespace detail
+{
+class event_loop_t;
+}   /* detail */
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Run many requests concurrently on a few threads.
+ *
+ *  Each thread runs an event loop over non-blocking sockets (epoll on
+ *  Linux), and requests are distributed over the loops round-robin.
+ *  Each loop also keeps idle keep-alive connections for reuse.
+ *
+ *  Requests the event loops cannot run (or every request, on
+ *  platforms without epoll) run in a separate thread instead.
+ */
+class reactor_t
+{
+public:
+    explicit reactor_t(size_t threads = 1);
+    reactor_t(const reactor_t&) = delete;
+    reactor_t & operator=(const reactor_t&) = delete;
+    ~reactor_t();
+
+    std::future<response_t> submit(request_t&& request);
+    bool supports(const request_t& request) const;
+    size_t threads() const;
+
+protected:
+    std::vector<std::unique_ptr<detail::event_loop_t>> loops;
+    std::atomic<size_t> counter;
+};
+
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Process-wide reactor shared by request pools.
+ */
+std::shared_ptr<reactor_t> default_reactor();
+
+LATTICE_END_NAMESPACE
@@ -10,11 +10,16 @@
 
 #include <lattice/adaptor.h>
 #include <lattice/auth.h>
+#include <lattice/buffer.h>
 #include <lattice/connection.h>
 #include <lattice/cookie.h>
 #include <lattice/digest.h>
 #include <lattice/dns.h>
+#include <lattice/download.h>
 #include <lattice/header.h>
+#include <lattice/hpack.h>
+#include <lattice/http2.h>
+#include <lattice/keepalive.h>
 #include <lattice/method.h>
 #include <lattice/multipart.h>
 #include <lattice/parameter.h>
@@ -22,12 +27,19 @@
 #include <lattice/redirect.h>
 #include <lattice/response.h>
 #include <lattice/ssl.h>
+#include <lattice/stream.h>
 #include <lattice/timeout.h>
 #include <lattice/url.h>
 #include <sstream>
+#include <type_traits>
 
 LATTICE_BEGIN_NAMESPACE
 
+// FORWARD
+// -------
+
+class pipeline_t;
+
 // OBJECTS
 // -------
 
@@ -52,6 +64,10 @@ public:
     void set_parameters(parameters_t&&);
     void set_header(const header_t&);
     void set_timeout(const timeout_t&);
+    void set_connect_timeout(const connect_timeout_t&);
+    void set_handshake_timeout(const handshake_timeout_t&);
+    void set_read_timeout(const read_timeout_t&);
+    void set_total_timeout(const total_timeout_t&);
     void set_auth(const authentication_t&);
     void set_digest(const digest_t&);
     void set_multipart(const multipart_t&);
@@ -71,7 +87,17 @@ public:
     void set_ssl_protocol(ssl_protocol_t);
     void set_verify_peer(const verify_peer_t&);
     void set_verify_peer(verify_peer_t&&);
+    void set_early_data(const early_data_t&);
+    void set_kernel_tls(const kernel_tls_t&);
     void set_cache(const dns_cache_t&);
+    void set_overrides(const dns_overrides_t&);
+    void set_overrides(dns_overrides_t&&);
+    void set_connection_cache(const connection_cache_t&);
+    void set_header_callback(const header_callback_t&);
+    void set_body_callback(const body_callback_t&);
+    void set_download(const download_t&);
+    void set_download(download_t&&);
+    void set_http_version(http_version_t);
 
     // LATTICE_FWDING OPTIONS
     void set_option(method_t);
@@ -81,6 +107,10 @@ public:
     void set_option(parameters_t&&);
     void set_option(const header_t&);
     void set_option(const timeout_t&);
+    void set_option(const connect_timeout_t&);
+    void set_option(const handshake_timeout_t&);
+    void set_option(const read_timeout_t&);
+    void set_option(const total_timeout_t&);
     void set_option(const authentication_t&);
     void set_option(const digest_t&);
     void set_option(const multipart_t&);
@@ -100,7 +130,17 @@ public:
     void set_option(ssl_protocol_t);
     void set_option(const verify_peer_t&);
     void set_option(verify_peer_t&&);
+    void set_option(const early_data_t&);
+    void set_option(const kernel_tls_t&);
     void set_option(const dns_cache_t&);
+    void set_option(const dns_overrides_t&);
+    void set_option(dns_overrides_t&&);
+    void set_option(const connection_cache_t&);
+    void set_option(const header_callback_t&);
+    void set_option(const body_callback_t&);
+    void set_option(const download_t&);
+    void set_option(download_t&&);
+    void set_option(http_version_t);
 
     // ACCESS
     method_t get_method() const;
@@ -108,18 +148,38 @@ public:
     const parameters_t& get_parameters() const;
     const header_t& get_header() const;
     const timeout_t& get_timeout() const;
+    const connect_timeout_t& get_connect_timeout() const;
+    const handshake_timeout_t& get_handshake_timeout() const;
+    const read_timeout_t& get_read_timeout() const;
+    const total_timeout_t& get_total_timeout() const;
+    const proxy_t& get_proxy() const;
     const digest_t& get_digest() const;
     const redirects_t& get_redirects() const;
     const certificate_file_t& get_certificate_file() const;
     const revocation_lists_t& get_revocation_lists() const;
     ssl_protocol_t get_ssl_protocol() const;
     const verify_peer_t& get_verify_peer() const;
+    const early_data_t& get_early_data() const;
+    const kernel_tls_t& get_kernel_tls() const;
     const dns_cache_t get_dns_cache() const;
+    const dns_overrides_t& get_overrides() const;
+    const connection_cache_t get_connection_cache() const;
+    const header_callback_t& get_header_callback() const;
+    const body_callback_t& get_body_callback() const;
+    const download_t& get_download() const;
+    const multipart_t& get_multipart() const;
+    http_version_t get_http_version() const;
 
     // CONNECTIONS
     template <typename... Ts>
+    buffer_list_t buffers(Ts&&... ts) const;
+    template <typename... Ts>
+    hpack_fields_t fields(Ts&&... ts) const;
+    template <typename... Ts>
     std::string message(Ts&&... ts) const;
     std::string method_name() const;
+    std::string origin() const;
+    bool follow(const response_t&);
 
     response_t exec();
 
@@ -140,16 +200,49 @@ protected:
     multipart_t multipart;
     proxy_t proxy;
     timeout_t timeout;
+    connect_timeout_t connect_timeout;
+    handshake_timeout_t handshake_timeout;
+    read_timeout_t read_timeout;
+    total_timeout_t total_timeout;
+    std::chrono::steady_clock::time_point deadline;
     redirects_t redirects;
     certificate_file_t certificate;
     revocation_lists_t revoke;
     method_t method = static_cast<method_t>(0);
     ssl_protocol_t ssl = static_cast<ssl_protocol_t>(0);
     verify_peer_t verifypeer;
+    early_data_t earlydata;
+    kernel_tls_t kerneltls;
     dns_cache_t cache = nullptr;
+    dns_overrides_t overrides;
+    connection_cache_t pool = nullptr;
+    header_callback_t header_callback;
+    body_callback_t body_callback;
+    download_t download;
+    http_version_t version = HTTP_1_1;
+
+    friend class pipeline_t;
 
     std::stringstream method_header() const;
     std::stringstream method_header(const response_t&) const;
+    response_t dispatch();
+    buffer_list_t body_buffers() const;
+    hpack_fields_t header_fields(const std::string& headers, size_t length) const;
+
+    template <typename Connection>
+    response_t send(Connection&);
+
+    template <typename Connection>
+    response_t receive(Connection&, bool follow);
+
+    template <typename Reader>
+    response_t stream_response(Reader&, bool follow);
+
+    template <typename Connection>
+    response_t pooled_exec(connection_pool_t&);
+
+    template <typename Connection>
+    response_t multiplexed_exec(connection_pool_t&, bool retry = true);
 };
 
 
@@ -256,63 +349,123 @@ response_t Trace(Ts&&... ts)
 // --------------
 
 
+/**
+ *  \brief Build the request as a list of buffers.
+ *
+ *  The request line and headers are formatted into a single buffer,
+ *  while the body references the request's parameters and multipart
+ *  buffers, so large bodies are sent without intermediate copies.
+ *  The list must not outlive the request.
+ */
 template <typename... Ts>
-std::string request_t::message(Ts&&... ts) const
+buffer_list_t request_t::buffers(Ts&&... ts) const
 {
-    std::stringstream stream;
-
-    // get our formatted body
-    std::string body;
-    if (method == POST && parameters) {
-        body += parameters.post();
-    } else if (multipart) {
-        body += multipart.string();
-    }
+    // get our body
+    buffer_list_t list = body_buffers();
 
     // get formatted headers
     auto headers = method_header(std::forward<Ts>(ts)...);
-    if (!body.empty()) {
-        headers << "Content-Length: " << body.size() << "\r\n";
+    size_t length = list.length();
+    if (length) {
+        headers << "Content-Length: " << length << "\r\n";
     }
 
     // get first line
+    std::stringstream stream;
     if (method == POST) {
         stream << method_name() << " " << url.path()
                << " HTTP/1.1\r\n"
                << headers.str()
-               << "\r\n" << body;
+               << "\r\n";
     } else {
         stream << method_name() << " " << url.path() << parameters.get()
                << " HTTP/1.1\r\n"
                << headers.str()
-               << "\r\n" << body;
+               << "\r\n";
     }
+    list.store_front(stream.str());
+
+    return list;
+}
+
+
+template <typename... Ts>
+std::string request_t::message(Ts&&... ts) const
+{
+    return buffers(std::forward<Ts>(ts)...).string();
+}
 
-    // end message with double CRLF
-    stream << "\r\n";
-    if (!body.empty()) {
-        stream << "\r\n";
-    }
 
-    return stream.str();
+/**
+ *  \brief Build the request headers as HTTP/2 header fields.
+ *
+ *  The request line becomes pseudo-header fields, and headers
+ *  specific to HTTP/1.1 connections are removed.
+ */
+template <typename... Ts>
+hpack_fields_t request_t::fields(Ts&&... ts) const
+{
+    auto headers = method_header(std::forward<Ts>(ts)...);
+    return header_fields(headers.str(), body_buffers().length());
 }
 
 
 /**
  *  \brief Make request to server.
  *
+ *  Connections are checked out from the request's connection pool,
+ *  or the process-wide pool if none was set, and returned to it
+ *  after the response if the server allows it. With a total timeout,
+ *  every phase of the request, including redirects, shares a single
+ *  deadline.
+ *
  *  To avoid compiling external libraries into lattice, misuse inline
  *  to keep this in the header.
  */
 inline response_t request_t::exec()
+{
+    if (!total_timeout || deadline != std::chrono::steady_clock::time_point()) {
+        return dispatch();
+    }
+
+    // set the deadline for the request and any redirects
+    auto duration = std::chrono::milliseconds(total_timeout.milliseconds());
+    deadline = std::chrono::steady_clock::now() + duration;
+    try {
+        auto response = dispatch();
+        deadline = std::chrono::steady_clock::time_point();
+        return response;
+    } catch (...) {
+        deadline = std::chrono::steady_clock::time_point();
+        throw;
+    }
+}
+
+
+/**
+ *  \brief Send the request with the connection type for its scheme.
+ *
+ *  Uploads with file parts use HTTP/1.1, which streams the files
+ *  from disk, rather than buffering them for HTTP/2 frames.
+ */
+inline response_t request_t::dispatch()
 {
     auto service = url.service();
+    auto cache = pool ? pool : default_connection_cache();
+    if (version == HTTP_2 && !proxy && !multipart.has_files()) {
+        if (service == "http") {
+            return multiplexed_exec<http2_connection_t>(*cache);
+#if defined(HAVE_SSL) && defined(LATTICE_HAVE_OPENSSL)
+        } else if (service == "https" && !default_http2_cache().downgraded(origin())) {
+            return multiplexed_exec<https2_connection_t>(*cache);
+#endif
+        }
+    }
+
     if (service == "http") {
-        http_connection_t connection;
-        return exec(connection);
+        return pooled_exec<http_connection_t>(*cache);
     } else if (service == "https") {
-        https_connection_t connection;
-        return exec(connection);
+        return pooled_exec<https_connection_t>(*cache);
     } else {
         throw std::runtime_error("Network scheme " + service + " is not supported.");
     }
@@ -321,18 +474,196 @@ inline response_t request_t::exec()
 }
 
 
+/**
+ *  \brief Make request on a pooled keep-alive connection.
+ *
+ *  The server may close an idle connection at any time, so requests
+ *  with idempotent methods that fail on a reused connection before
+ *  any response was received are retried once on a new connection.
+ */
+template <typename Connection>
+response_t request_t::pooled_exec(connection_pool_t& pool)
+{
+    std::unique_ptr<Connection> connection;
+    bool persistent = !header.close_connection();
+    if (persistent) {
+        connection = pool.checkout<Connection>(origin());
+    }
+
+    if (connection) {
+        auto method = this->method;
+        auto url = this->url;
+        auto redirects = this->redirects;
+        try {
+            connection->set_deadline(deadline);
+            connection->set_timeout(read_timeout ? read_timeout : timeout);
+            auto response = send(*connection);
+            if (response || !is_idempotent(method)) {
+                if (persistent && response.keep_alive() && connection->alive()) {
+                    pool.checkin(origin(), std::move(connection), response.keep_alive_timeout());
+                }
+                return response;
+            }
+        } catch (std::exception&) {
+            if (!is_idempotent(method)) {
+                throw;
+            }
+        }
+
+        // restore state modified by the failed request
+        this->method = method;
+        this->url = std::move(url);
+        this->redirects = redirects;
+    }
+
+    connection.reset(new Connection);
+    auto response = exec(*connection);
+    if (persistent && response.keep_alive() && connection->alive()) {
+        pool.checkin(origin(), std::move(connection), response.keep_alive_timeout());
+    }
+
+    return response;
+}
+
+
+namespace detail
+{
+/**
+ *  \brief Pool a connection, if `Pooled` requests can check it out.
+ */
+template <typename Pooled, typename Connection>
+typename std::enable_if<std::is_same<Pooled, Connection>::value>::type
+checkin_as(connection_pool_t& pool, const std::string& origin, std::unique_ptr<Connection>&& connection, const timeout_t& keep_alive)
+{
+    pool.checkin(origin, std::move(connection), keep_alive);
+}
+
+
+/**
+ *  \brief Close a connection no pooled request could check out.
+ */
+template <typename Pooled, typename Connection>
+typename std::enable_if<!std::is_same<Pooled, Connection>::value>::type
+checkin_as(connection_pool_t&, const std::string&, std::unique_ptr<Connection>&&, const timeout_t&)
+{}
+
+}   /* detail */
+
+
+/**
+ *  \brief Make request on a shared HTTP/2 session.
+ *
+ *  Concurrent requests to the origin share a single connection, which
+ *  is opened by the first request. If the server does not select
+ *  HTTP/2 with ALPN, the request is sent with HTTP/1.1 on the new
+ *  connection, and later requests to the origin use HTTP/1.1. The
+ *  connection is then pooled for them if it has the same type as
+ *  HTTPS connections, and closed otherwise.
+ *
+ *  Requests refused by the server, and idempotent requests that
+ *  failed with the connection, are retried once on a new session.
+ */
+template <typename Connection>
+response_t request_t::multiplexed_exec(connection_pool_t& pool, bool retry)
+{
+    typedef http2_session_t<Connection> session_t;
+    auto &cache = default_http2_cache();
+    auto key = origin();
+
+    std::shared_ptr<session_t> session;
+    std::unique_ptr<Connection> connection;
+    {
+        std::lock_guard<std::mutex> lock(cache.lock(key));
+        session = cache.find<session_t>(key);
+        if (!session) {
+            connection.reset(new Connection);
+            connection->set_alpn({"h2", "http/1.1"});
+            open(*connection);
+            if (url.service() == "http" || connection->alpn_protocol() == "h2") {
+                // the session outlives the request's deadline
+                connection->set_deadline(std::chrono::steady_clock::time_point());
+                session = std::make_shared<session_t>(std::move(connection));
+                cache.add(key, session);
+            } else {
+                cache.downgrade(key);
+            }
+        }
+    }
+
+    if (!session) {
+        bool persistent = !header.close_connection();
+        auto response = send(*connection);
+        if (persistent && response.keep_alive() && connection->alive()) {
+            detail::checkin_as<https_connection_t>(pool, origin(), std::move(connection), response.keep_alive_timeout());
+        }
+        return response;
+    }
+
+    response_t response;
+    do {
+        auto method = this->method;
+        auto stream = session->submit(fields(), body_buffers().string(), method, read_timeout ? read_timeout : timeout);
+        if (stream) {
+            stream->set_deadline(deadline);
+            response = stream_response(*stream, true);
+            if (stream->timed_out()) {
+                throw std::runtime_error("Request timed out.");
+            }
+        }
+        if (!response) {
+            auto error = stream ? stream->error() : HTTP2_REFUSED_STREAM;
+            bool refused = error == HTTP2_REFUSED_STREAM;
+            refused |= error == HTTP2_INTERNAL_ERROR && is_idempotent(method);
+            return retry && refused ? multiplexed_exec<Connection>(pool, false) : response;
+        } else if (response.unauthorized() && digest) {
+            // using digest authentication
+            stream = session->submit(fields(response), body_buffers().string(), method, read_timeout ? read_timeout : timeout);
+            if (!stream) {
+                return response_t();
+            }
+            stream->set_deadline(deadline);
+            response = stream_response(*stream, false);
+            if (stream->timed_out()) {
+                throw std::runtime_error("Request timed out.");
+            }
+            return response;
+        } else if ((this->method = response.redirect(method)) != STOP) {
+            if (follow(response) && origin() != key) {
+                return redirects-- ? exec() : response;
+            }
+        } else {
+            break;
+        }
+    } while (redirects--);
+
+    return response;
+}
+
+
 template <typename Connection>
 response_t request_t::exec(Connection& connection)
 {
     open(connection);
+    return send(connection);
+}
+
+
+/**
+ *  \brief Send request over an open connection and read the response.
+ *
+ *  Follows redirects and digest authentication challenges.
+ */
+template <typename Connection>
+response_t request_t::send(Connection& connection)
+{
     response_t response;
     do {
-        connection.write(message());
-        response = response_t(connection);
+        connection.write(buffers());
+        response = receive(connection, true);
         if (response.unauthorized() && digest) {
             // using digest authentication
-            connection.write(message(response));
-            response = response_t(connection);
+            connection.write(buffers(response));
+            response = receive(connection, false);
             return response;
         } else if ((method = response.redirect(method)) != STOP) {
             reset(connection, response);
@@ -345,11 +676,78 @@ response_t request_t::exec(Connection& connection)
 }
 
 
+/**
+ *  \brief Read a response, passing it to the streaming callbacks.
+ *
+ *  Responses that will be followed, like redirects and digest
+ *  challenges, are read in full and are not passed to the callbacks.
+ *  If a download or body callback is set, the body is not stored in
+ *  the response, and a download takes precedence over the callback.
+ */
+template <typename Connection>
+response_t request_t::receive(Connection& connection, bool follow)
+{
+    if (!header_callback && !body_callback && !download) {
+        return response_t(connection, method);
+    }
+
+    body_reader_t<Connection> reader(connection, method);
+    return stream_response(reader, follow);
+}
+
+
+/**
+ *  \brief Read a response from a body reader or HTTP/2 stream.
+ */
+template <typename Reader>
+response_t request_t::stream_response(Reader& reader, bool follow)
+{
+    auto &response = reader.response();
+    follow &= (response.unauthorized() && digest) || (response.redirect(method) != STOP && redirects);
+    if (follow || !response.status()) {
+        reader.buffer();
+        return reader.response();
+    }
+
+    if (header_callback) {
+        header_callback(response);
+    }
+    if (download) {
+        // keep the bytes received, even if the body ended early
+        file_writer_t file(download);
+        try {
+            reader.download(file);
+        } catch (...) {
+            file.finish();
+            throw;
+        }
+        file.finish();
+    } else if (body_callback) {
+        std::string block;
+        while (reader.read(block)) {
+            if (!body_callback(block.data(), block.size())) {
+                reader.abort();
+                break;
+            }
+        }
+    } else {
+        reader.buffer();
+    }
+
+    return reader.response();
+}
+
+
 template <typename Connection>
 void request_t::open(Connection& connection) const
 {
     // set options
     connection.set_verify_peer(verifypeer);
+    connection.set_early_data(early_data_t(earlydata && is_safe(method) && version != HTTP_2));
+    connection.set_kernel_tls(kerneltls);
+    connection.set_connect_timeout(connect_timeout ? connect_timeout : timeout);
+    connection.set_handshake_timeout(handshake_timeout ? handshake_timeout : timeout);
+    connection.set_deadline(deadline);
     if (certificate) {
         connection.set_certificate_file(certificate);
     }
@@ -362,6 +760,9 @@ void request_t::open(Connection& connection) const
     if (cache) {
         connection.set_cache(cache);
     }
+    if (overrides) {
+        connection.set_overrides(overrides);
+    }
 
     // open and set timeout
     if (!proxy) {
@@ -369,8 +770,8 @@ void request_t::open(Connection& connection) const
     } else {
         connection.open(url_t(proxy));
     }
-    if (timeout) {
-        connection.set_timeout(timeout);
+    if (read_timeout || timeout) {
+        connection.set_timeout(read_timeout ? read_timeout : timeout);
     }
 }
 
@@ -378,22 +779,7 @@ void request_t::open(Connection& connection) const
 template <typename Connection>
 void request_t::reset(Connection& connection, const response_t& response)
 {
-    // check if we need to reset connection
-    bool reconnect = header.close_connection();
-    reconnect |= response.headers().close_connection();
-
-    url_t newurl(response.headers().at("location"));
-    if (newurl.absolute()) {
-        // reconnect if the service or host changes
-        reconnect |= url.service() != newurl.service();
-        reconnect |= url.host() != newurl.host();
-        url = newurl;
-    } else {
-        url.set_path(newurl.path());
-    }
-
-    // reset connection
-    if (reconnect) {
+    if (follow(response)) {
         connection.close();
         open(connection);
     }
@@ -0,0 +1,140 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Asynchronous DNS resolver over UDP.
+ */
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <lattice/config.h>
+#include <lattice/dns.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr std::chrono::seconds DNS_QUERY_TIMEOUT(5);
+static constexpr int DNS_QUERY_ATTEMPTS = 2;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Non-blocking lookup of the A and AAAA records for a host.
+ *
+ *  Both questions are sent at once over a single UDP socket. Event
+ *  loops watch `fd()` for input and call `on_readable()`, and call
+ *  `on_timeout()` once `expires()` passes, which retries unanswered
+ *  questions on the next nameserver. The descriptor may change after
+ *  a timeout, if the next nameserver uses another address family.
+ *
+ *  Numeric hosts complete immediately, without a socket. Queries
+ *  advertise a DNS_PACKET_SIZE UDP payload with EDNS0, and answers
+ *  still truncated finish the query as `truncated()`, without
+ *  addresses, since TCP is not used.
+ */
+class dns_query_t
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    dns_query_t(const std::string& host, const std::string& service, const address_list_t& servers, std::chrono::milliseconds timeout, int attempts);
+    dns_query_t(const dns_query_t&) = delete;
+    dns_query_t & operator=(const dns_query_t&) = delete;
+    ~dns_query_t();
+
+    // EVENTS
+    void on_readable();
+    void on_timeout();
+
+    // DATA
+    int fd() const;
+    clock::time_point expires() const;
+    bool done() const;
+    bool truncated() const;
+    address_list_t addresses() const;
+    std::chrono::seconds ttl() const;
+    const std::string& host() const;
+    const std::string& service() const;
+
+protected:
+    struct question_t
+    {
+        uint16_t type;
+        uint16_t id = 0;
+        bool answered = false;
+    };
+
+    std::string hostname;
+    std::string servicename;
+    std::string name;
+    uint16_t port = 0;
+    address_list_t servers;
+    std::chrono::milliseconds timeout;
+    int attempts;
+    int tries = 0;
+    int sock = -1;
+    int family = -1;
+    question_t questions[2];
+    address_list_t results;
+    uint32_t minimum = UINT32_MAX;
+    clock::time_point deadline;
+    bool finished = false;
+    bool nxdomain = false;
+    bool overflowed = false;
+
+    void send();
+    bool receive(const std::string& packet);
+    void check();
+};
+
+
+/**
+ *  \brief Resolver for the nameservers in resolv.conf.
+ *
+ *  Lookups run queries without getaddrinfo, so they honor their own
+ *  timeouts and report the record TTLs. Search domains and the hosts
+ *  file are not applied, so DNS caches and reactors resolve hosts
+ *  matching `system_host()` with getaddrinfo instead. Hosts with
+ *  truncated answers are also resolved with getaddrinfo.
+ */
+class dns_resolver_t
+{
+public:
+    dns_resolver_t();
+    dns_resolver_t(const std::vector<std::string>& nameservers);
+    dns_resolver_t(const dns_resolver_t&) = delete;
+    dns_resolver_t & operator=(const dns_resolver_t&) = delete;
+
+    // REQUESTS
+    std::unique_ptr<dns_query_t> query(const std::string& host, const std::string& service) const;
+    address_list_t resolve(const std::string& host, const std::string& service, std::chrono::seconds* ttl = nullptr) const;
+
+    // OPTIONS
+    void set_timeout(std::chrono::milliseconds timeout);
+    void set_attempts(int attempts);
+
+    // DATA
+    const address_list_t& nameservers() const;
+
+protected:
+    address_list_t servers;
+    std::chrono::milliseconds timeout = DNS_QUERY_TIMEOUT;
+    int attempts = DNS_QUERY_ATTEMPTS;
+
+    void add_nameserver(const std::string& nameserver);
+};
+
+LATTICE_END_NAMESPACE
+
+#endif
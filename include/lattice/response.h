@@ -8,11 +8,13 @@
 
 #pragma once
 
+#include <lattice/chunked.h>
 #include <lattice/config.h>
 #include <lattice/cookie.h>
 #include <lattice/header.h>
 #include <lattice/method.h>
 #include <lattice/redirect.h>
+#include <lattice/timeout.h>
 #include <lattice/transfer.h>
 #include <lattice/url.h>
 #include <tuple>
@@ -23,6 +25,11 @@ LATTICE_BEGIN_NAMESPACE
 // -------
 
 struct response_t;
+class response_parser_t;
+class http2_stream_t;
+
+template <typename Connection>
+class body_reader_t;
 
 // OBJECTS
 // -------
@@ -143,7 +150,7 @@ struct response_t
     response_t & operator=(response_t&&) = default;
 
     template <typename Connection, typename = disable_if_response<Connection>>
-    response_t(Connection &connection);
+    response_t(Connection &connection, method_t method = GET);
 
     // DATA
     const int status() const;
@@ -195,9 +202,17 @@ struct response_t
     method_t redirect(method_t method) const;
     bool permanent_redirect() const;
 
+    // CONNECTION
+    bool keep_alive() const;
+    timeout_t keep_alive_timeout() const;
+
     explicit operator bool() const;
 
 protected:
+    friend class response_parser_t;
+    template <typename> friend class body_reader_t;
+    friend class http2_stream_t;
+
     status_code_t status_ = static_cast<status_code_t>(0);
     header_t headers_;
     cookies_t cookies_;
@@ -205,7 +220,9 @@ protected:
     mime_t mime;
     std::string charset;
     std::string body_;
+    bool persistent = false;
 
+    bool has_body(method_t method) const;
     void parse_code(const std::string &line);
     void parse_cookie(const std::string &string);
     void parse_transfer_encoding(std::string &string);
@@ -213,6 +230,7 @@ protected:
     void parse_type(const std::string &string);
     void parse_header_line(const std::string &line);
     void parse_header(const std::string &lines);
+    void parse_trailers(const header_t &trailers);
 };
 
 
@@ -225,22 +243,28 @@ protected:
  *  them based on RFC 2616 [Section 4.4][reference].
  *
  *  If the transfer encoding is set, and not identity, assume the data
- *  is chunked, unless the connection was closed.
+ *  is chunked, unless the connection was closed. Responses to HEAD
+ *  requests, and 1xx, 204 and 304 responses never have a body.
  *
  *  [reference] https://www.w3.org/Protocols/rfc2616/rfc2616-sec4.html#sec4
  */
 template <typename Connection, typename>
-response_t::response_t(Connection& connection)
+response_t::response_t(Connection& connection, method_t method)
 {
     parse_header(connection.headers());
-    if (!!transfer && !(transfer & IDENTITY)) {
+    if (!has_body(method)) {
+        // message is complete after the headers
+    } else if (!!transfer && !(transfer & IDENTITY)) {
         // connection has the transfer set and is not identity
-        body_ = connection.chunked();
+        chunked_decoder_t decoder;
+        body_ = connection.chunked(decoder);
+        parse_trailers(decoder.trailers());
     } else if (headers().find("content-length") != headers().end()) {
         body_ = connection.body(std::stol(headers().at("content-length")));
     } else {
-        // no content-length or chunked storage, just read
+        // no content-length or chunked storage, read until closed
         body_ = connection.read();
+        persistent = false;
     }
 }
 
@@ -0,0 +1,43 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Portable helpers for raw socket handles.
+ */
+
+#pragma once
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#endif
+#include <lattice/config.h>
+#include <chrono>
+
+LATTICE_BEGIN_NAMESPACE
+
+// TYPES
+// -----
+
+#ifdef _WIN32
+    typedef SOCKET socket_handle_t;
+#else
+    typedef int socket_handle_t;
+#endif
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Toggle blocking mode on a socket.
+ */
+bool set_blocking(socket_handle_t sock, bool blocking);
+
+/**
+ *  \brief Wait for a socket to become readable or writable.
+ *
+ *  A zero timeout waits indefinitely. Returns false if the timeout
+ *  expired or the wait failed.
+ */
+bool wait_socket(socket_handle_t sock, bool write, std::chrono::milliseconds timeout);
+
+LATTICE_END_NAMESPACE
@@ -88,4 +88,42 @@ struct verify_peer_t
     explicit operator bool() const;
 };
 
+
+/**
+ *  \brief Send safe requests as TLS 1.3 early data when resuming.
+ */
+struct early_data_t
+{
+    bool enabled = false;
+
+    early_data_t() = default;
+    early_data_t(const early_data_t&) = default;
+    early_data_t & operator=(const early_data_t&) = default;
+    early_data_t(early_data_t&&) = default;
+    early_data_t & operator=(early_data_t&&) = default;
+
+    early_data_t(const bool enabled);
+
+    explicit operator bool() const;
+};
+
+
+/**
+ *  \brief Offload TLS encryption to the kernel, where supported.
+ */
+struct kernel_tls_t
+{
+    bool enabled = false;
+
+    kernel_tls_t() = default;
+    kernel_tls_t(const kernel_tls_t&) = default;
+    kernel_tls_t & operator=(const kernel_tls_t&) = default;
+    kernel_tls_t(kernel_tls_t&&) = default;
+    kernel_tls_t & operator=(kernel_tls_t&&) = default;
+
+    kernel_tls_t(const bool enabled);
+
+    explicit operator bool() const;
+};
+
 LATTICE_END_NAMESPACE
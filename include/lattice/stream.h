@@ -0,0 +1,285 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Streaming response bodies.
+ */
+
+#pragma once
+
+#include <lattice/chunked.h>
+#include <lattice/config.h>
+#include <lattice/download.h>
+#include <lattice/method.h>
+#include <lattice/response.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr size_t STREAM_BLOCK_SIZE = 65536;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Callback invoked with the status and headers of a response.
+ *
+ *  Called once the headers are parsed, before any of the body is read.
+ */
+struct header_callback_t: std::function<void(const response_t&)>
+{
+    typedef std::function<void(const response_t&)> base;
+    using base::base;
+};
+
+
+/**
+ *  \brief Callback invoked with each block of a response body.
+ *
+ *  The body is not stored in the response. Return false to stop
+ *  reading, which closes the connection.
+ */
+struct body_callback_t: std::function<bool(const char*, size_t)>
+{
+    typedef std::function<bool(const char*, size_t)> base;
+    using base::base;
+};
+
+
+/**
+ *  \brief Pull-based reader for a response body.
+ *
+ *  The headers are parsed on construction, and the body is read
+ *  incrementally from the connection, for content-length, chunked
+ *  and close-delimited bodies. The connection may only be reused
+ *  once the body has been read to the end.
+ */
+template <typename Connection>
+class body_reader_t
+{
+public:
+    body_reader_t(Connection& connection, method_t method = GET);
+    body_reader_t(const body_reader_t&) = delete;
+    body_reader_t & operator=(const body_reader_t&) = delete;
+
+    // DATA
+    const response_t& response() const;
+    bool done() const;
+
+    // READ
+    size_t read(char *buf, size_t count);
+    bool read(std::string& block);
+    void buffer();
+    void download(file_writer_t& file);
+    void abort();
+
+protected:
+    enum mode_t
+    {
+        NONE,
+        LENGTH,
+        CHUNKED,
+        CLOSE,
+    };
+
+    Connection& connection;
+    response_t response_;
+    mode_t mode = NONE;
+    long remaining = 0;
+    chunked_decoder_t decoder;
+};
+
+
+// IMPLEMENTATION
+// --------------
+
+
+/**
+ *  The body is delimited as in `response_t`: responses without a
+ *  body end after the headers, then the transfer encoding, then the
+ *  content length, and otherwise the body is read until the
+ *  connection closes.
+ */
+template <typename Connection>
+body_reader_t<Connection>::body_reader_t(Connection& connection, method_t method):
+    connection(connection)
+{
+    response_.parse_header(connection.headers());
+    auto &headers = response_.headers();
+    if (!response_.has_body(method)) {
+        mode = NONE;
+    } else if (!!response_.transfer && !(response_.transfer & IDENTITY)) {
+        mode = CHUNKED;
+    } else if (headers.find("content-length") != headers.end()) {
+        remaining = std::stol(headers.at("content-length"));
+        mode = remaining > 0 ? LENGTH : NONE;
+    } else {
+        mode = CLOSE;
+        response_.persistent = false;
+    }
+}
+
+
+/**
+ *  \brief Get the response, with the body only if it was buffered.
+ */
+template <typename Connection>
+const response_t& body_reader_t<Connection>::response() const
+{
+    return response_;
+}
+
+
+template <typename Connection>
+bool body_reader_t<Connection>::done() const
+{
+    return mode == NONE;
+}
+
+
+/**
+ *  \brief Read up to `count` bytes of the body.
+ *
+ *  Returns 0 once the body is complete. A body truncated by the
+ *  server also ends the body, and the connection is not reusable.
+ */
+template <typename Connection>
+size_t body_reader_t<Connection>::read(char *buf, size_t count)
+{
+    long read = 0;
+    switch (mode) {
+        case NONE:
+            return 0;
+        case LENGTH:
+            read = connection.read_some(buf, std::min<long>(count, remaining));
+            remaining -= read;
+            if (!read) {
+                abort();
+            } else if (!remaining) {
+                mode = NONE;
+            }
+            break;
+        case CHUNKED:
+            read = connection.read_chunked(decoder, buf, count);
+            if (decoder.done()) {
+                response_.parse_trailers(decoder.trailers());
+                mode = NONE;
+            } else if (!read) {
+                abort();
+            }
+            break;
+        case CLOSE:
+            read = connection.read_some(buf, count);
+            if (!read) {
+                mode = NONE;
+            }
+            break;
+    }
+
+    return static_cast<size_t>(read);
+}
+
+
+/**
+ *  \brief Read the next block of the body into `block`.
+ *
+ *  Returns false once the body is complete.
+ */
+template <typename Connection>
+bool body_reader_t<Connection>::read(std::string& block)
+{
+    block.resize(STREAM_BLOCK_SIZE);
+    block.resize(read(&block[0], block.size()));
+
+    return !block.empty();
+}
+
+
+/**
+ *  \brief Read the remainder of the body into the response.
+ */
+template <typename Connection>
+void body_reader_t<Connection>::buffer()
+{
+    auto &body = response_.body_;
+    size_t size = body.size();
+    while (!done()) {
+        body.resize(size + STREAM_BLOCK_SIZE);
+        size += read(&body[size], STREAM_BLOCK_SIZE);
+    }
+    body.resize(size);
+}
+
+
+/**
+ *  \brief Write the remainder of the body to a file.
+ *
+ *  The file is preallocated for content-length bodies. Large chunks
+ *  and unframed data are moved from the socket to the file without
+ *  the read buffer, while small chunks are decoded in blocks. Unlike
+ *  reads, a content-length or chunked body that ends early throws,
+ *  since a partial file cannot be told apart from a complete one.
+ */
+template <typename Connection>
+void body_reader_t<Connection>::download(file_writer_t& file)
+{
+    std::string block;
+    switch (mode) {
+        case NONE:
+            break;
+        case LENGTH:
+            file.allocate(remaining);
+            remaining -= connection.read_file(file, remaining);
+            if (remaining) {
+                abort();
+                throw std::runtime_error("Download ended before the full body was received.");
+            } else {
+                mode = NONE;
+            }
+            break;
+        case CHUNKED:
+            block.resize(STREAM_BLOCK_SIZE);
+            while (!done()) {
+                long size = static_cast<long>(decoder.remaining());
+                if (size >= static_cast<long>(STREAM_BLOCK_SIZE)) {
+                    long moved = connection.read_file(file, size);
+                    decoder.consume(moved);
+                    if (moved != size) {
+                        abort();
+                    }
+                } else {
+                    file.write(block.data(), read(&block[0], block.size()));
+                }
+            }
+            if (!decoder.done()) {
+                throw std::runtime_error("Download ended before the full body was received.");
+            }
+            break;
+        case CLOSE:
+            connection.read_file(file, std::numeric_limits<long>::max());
+            mode = NONE;
+            break;
+    }
+}
+
+
+/**
+ *  \brief Stop reading the body, and mark the connection as unusable.
+ */
+template <typename Connection>
+void body_reader_t<Connection>::abort()
+{
+    mode = NONE;
+    remaining = 0;
+    response_.persistent = false;
+}
+
+LATTICE_END_NAMESPACE
@@ -29,6 +29,9 @@ LATTICE_BEGIN_NAMESPACE
 
 /**
  *  \brief Timeout for a request object.
+ *
+ *  Used for every phase of the request without a specific timeout:
+ *  connecting, the TLS handshake, and each read or write.
  */
 class timeout_t
 {
@@ -56,6 +59,42 @@ protected:
 };
 
 
+
+/**
+ *  \brief Timeout to establish a connection, over all addresses.
+ */
+struct connect_timeout_t: timeout_t
+{
+    using timeout_t::timeout_t;
+};
+
+
+/**
+ *  \brief Timeout for the TLS handshake.
+ */
+struct handshake_timeout_t: timeout_t
+{
+    using timeout_t::timeout_t;
+};
+
+
+/**
+ *  \brief Timeout for each read from, or write to, the connection.
+ */
+struct read_timeout_t: timeout_t
+{
+    using timeout_t::timeout_t;
+};
+
+
+/**
+ *  \brief Deadline for the entire request, including redirects.
+ */
+struct total_timeout_t: timeout_t
+{
+    using timeout_t::timeout_t;
+};
+
 // IMPLEMENTATION
 // --------------
 
@@ -0,0 +1,90 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief TLS over memory buffers, for non-blocking transports.
+ */
+
+#pragma once
+
+#ifdef LATTICE_HAVE_OPENSSL
+
+#include <lattice/buffer.h>
+#include <lattice/config.h>
+#include <lattice/ssl.h>
+#include <lattice/adaptor/openssl.h>
+#include <string>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief TLS client over memory buffers, independent of any socket.
+ *
+ *  Ciphertext from the peer is passed to `receive()`, and ciphertext
+ *  for the peer is taken from `output()`, then acknowledged with
+ *  `consume()` once sent. The engine never blocks: operations which
+ *  need more data from the peer return early, so event loops,
+ *  io_uring, or in-memory transports can drive many handshakes and
+ *  connections from a single thread.
+ *
+ *  Contexts and sessions are shared with the OpenSSL socket adaptor.
+ */
+class tls_engine_t
+{
+public:
+    tls_engine_t();
+    tls_engine_t(const tls_engine_t&) = delete;
+    tls_engine_t & operator=(const tls_engine_t&) = delete;
+    ~tls_engine_t();
+
+    // REQUESTS
+    void open(const std::string& host);
+    void close();
+    bool handshake();
+    size_t write(const char *buf, size_t len);
+    long read(char *buf, size_t count);
+
+    // TRANSPORT
+    void receive(const char *data, size_t size);
+    buffer_view_t output() const;
+    void consume(size_t bytes);
+
+    // OPTIONS
+    void set_certificate_file(const certificate_file_t& certificate);
+    void set_revocation_lists(const revocation_lists_t& revoke);
+    void set_ssl_protocol(ssl_protocol_t protocol);
+    void set_verify_peer(const verify_peer_t& peer);
+    void set_alpn(const std::vector<std::string>& protocols);
+
+    // DATA
+    bool established() const;
+    bool pending() const;
+    bool resumed() const;
+    std::string alpn_protocol() const;
+
+protected:
+    certificate_file_t certificate;
+    revocation_lists_t revoke;
+    ssl_protocol_t protocol = TLS;
+    verify_peer_t verifypeer;
+    std::string alpn;
+    std::string session;
+    std::string outgoing;
+    size_t sent = 0;
+    ssl_ramp_t ramp;
+
+    SSL *ssl = nullptr;
+    BIO *input = nullptr;
+    BIO *network = nullptr;
+
+    void flush();
+};
+
+LATTICE_END_NAMESPACE
+
+#endif
@@ -81,6 +81,17 @@ HAS_MEMBER_FUNCTION(set_certificate_file, has_set_certificate_file);
 HAS_MEMBER_FUNCTION(set_revocation_lists, has_set_revocation_lists);
 HAS_MEMBER_FUNCTION(set_ssl_protocol, has_set_ssl_protocol);
 HAS_MEMBER_FUNCTION(set_verify_peer, has_set_verify_peer);
+HAS_MEMBER_FUNCTION(set_early_data, has_set_early_data);
+HAS_MEMBER_FUNCTION(set_kernel_tls, has_set_kernel_tls);
+HAS_MEMBER_FUNCTION(kernel_tls, has_kernel_tls);
+HAS_MEMBER_FUNCTION(writev, has_writev);
+HAS_MEMBER_FUNCTION(splice, has_splice);
+HAS_MEMBER_FUNCTION(set_alpn, has_set_alpn);
+HAS_MEMBER_FUNCTION(alpn_protocol, has_alpn_protocol);
+HAS_MEMBER_FUNCTION(pending, has_pending);
+HAS_MEMBER_FUNCTION(attach, has_attach);
+HAS_MEMBER_FUNCTION(set_handshake_timeout, has_set_handshake_timeout);
+HAS_MEMBER_FUNCTION(set_cork, has_set_cork);
 
 // CLEANUP
 // -------
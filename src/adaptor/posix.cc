@@ -9,14 +9,240 @@
 
 #include <lattice/adaptor/posix.h>
 #include <lattice/util.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__linux__)
+#   include <sys/sendfile.h>
+#endif
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 
 LATTICE_BEGIN_NAMESPACE
 
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Maximum buffers gathered per system call (below IOV_MAX).
+ */
+static constexpr size_t VECTOR_LIMIT = 64;
+
+#ifdef MSG_NOSIGNAL
+    static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    static constexpr int SEND_FLAGS = 0;
+#endif
+
+#ifdef MSG_MORE
+    static constexpr int MORE_FLAGS = MSG_MORE;
+#else
+    static constexpr int MORE_FLAGS = 0;
+#endif
+
+/**
+ *  \brief Requested capacity of the pipe used to splice into files.
+ */
+static constexpr size_t PIPE_SIZE = 1 << 20;
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Send a run of in-memory buffers.
+ *
+ *  Buffers are gathered into `sendmsg`, up to VECTOR_LIMIT at a
+ *  time, and partial writes resume from the first unsent byte. If
+ *  `more` is set, the kernel is told more data follows, so the last
+ *  block is coalesced with the following file data.
+ */
+template <typename Iter>
+static size_t send_vectors(int sock, Iter first, Iter last, bool more)
+{
+    size_t sent = 0;
+    size_t offset = 0;
+    iovec vectors[VECTOR_LIMIT];
+    while (first != last) {
+        // gather the unsent buffers
+        size_t count = 0;
+        auto it = first;
+        for (; it != last && count < VECTOR_LIMIT; ++it, ++count) {
+            size_t skip = it == first ? offset : 0;
+            vectors[count].iov_base = const_cast<char*>(it->data + skip);
+            vectors[count].iov_len = it->size - skip;
+        }
+
+        msghdr message = {};
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+        int flags = SEND_FLAGS | (more || it != last ? MORE_FLAGS : 0);
+        ssize_t written = ::sendmsg(sock, &message, flags);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            break;
+        }
+        sent += written;
+
+        // advance past fully-sent buffers
+        size_t remaining = static_cast<size_t>(written);
+        while (remaining && remaining >= first->size - offset) {
+            remaining -= first->size - offset;
+            offset = 0;
+            ++first;
+        }
+        offset += remaining;
+    }
+
+    return sent;
+}
+
+
+/**
+ *  \brief Send a file region, without copying it through user space.
+ */
+static size_t send_file(int sock, const buffer_view_t& buffer)
+{
+#if defined(__linux__)
+    size_t sent = 0;
+    off_t offset = static_cast<off_t>(buffer.offset);
+    while (sent < buffer.size) {
+        ssize_t written = ::sendfile(sock, buffer.fd, &offset, buffer.size - sent);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            break;
+        }
+        sent += written;
+    }
+
+    return sent;
+#else
+    return write_file(buffer, [sock](const char *data, size_t size) -> size_t {
+        ssize_t written = ::send(sock, data, size, SEND_FLAGS);
+        return written > 0 ? written : 0;
+    });
+#endif
+}
+
+
+/**
+ *  \brief Check if `deadline` has passed, where the default is unlimited.
+ */
+static bool expired(std::chrono::steady_clock::time_point deadline)
+{
+    return deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= deadline;
+}
+
+
+/**
+ *  \brief Copy up to `count` bytes between descriptors, through user space.
+ *
+ *  Stops early, between reads, once `deadline` has passed.
+ */
+static size_t copy_stream(int in, int out, size_t count, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point())
+{
+    char block[65536];
+    size_t copied = 0;
+    while (copied < count && !expired(deadline)) {
+        ssize_t read = ::read(in, block, std::min(count - copied, sizeof(block)));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        } else if (read <= 0) {
+            break;
+        }
+        for (ssize_t written = 0; written < read; ) {
+            ssize_t size = ::write(out, block + written, read - written);
+            if (size < 0 && errno == EINTR) {
+                continue;
+            } else if (size <= 0) {
+                return copied + written;
+            }
+            written += size;
+        }
+        copied += read;
+    }
+
+    return copied;
+}
+
+
+#if defined(__linux__)
+
+
+/**
+ *  \brief Move data from a socket to a file through a pipe.
+ *
+ *  If the socket cannot be spliced, the data is copied instead. If
+ *  the file cannot be spliced, like files opened for appending, the
+ *  pipe is drained by copying, and the rest of the data is copied.
+ *  Stops early, between reads from the socket, once `deadline` has
+ *  passed.
+ */
+static size_t splice_stream(int sock, int fd, size_t count, std::chrono::steady_clock::time_point deadline)
+{
+    int pipes[2];
+    if (::pipe2(pipes, O_CLOEXEC) < 0) {
+        return copy_stream(sock, fd, count, deadline);
+    }
+    long capacity = ::fcntl(pipes[1], F_SETPIPE_SZ, PIPE_SIZE);
+    if (capacity <= 0) {
+        capacity = ::fcntl(pipes[1], F_GETPIPE_SZ);
+    }
+    if (capacity <= 0) {
+        capacity = 65536;
+    }
+
+    size_t moved = 0;
+    bool copy = false;
+    bool failed = false;
+    while (moved < count && !copy && !failed && !expired(deadline)) {
+        size_t size = std::min<size_t>(count - moved, capacity);
+        ssize_t read = ::splice(sock, nullptr, pipes[1], nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        } else if (read < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            copy = true;
+            break;
+        } else if (read <= 0) {
+            break;
+        }
+
+        while (read) {
+            ssize_t written = ::splice(pipes[0], nullptr, fd, nullptr, read, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            } else if (written <= 0) {
+                size_t drained = copy_stream(pipes[0], fd, read);
+                moved += drained;
+                copy = drained == static_cast<size_t>(read);
+                failed = !copy;
+                break;
+            }
+            read -= written;
+            moved += written;
+        }
+    }
+    ::close(pipes[0]);
+    ::close(pipes[1]);
+
+    if (copy) {
+        moved += copy_stream(sock, fd, count - moved, deadline);
+    }
+
+    return moved;
+}
+
+#endif
+
 // OBJECTS
 // -------
 
@@ -29,6 +255,10 @@ posix_socket_adaptor_t::~posix_socket_adaptor_t()
 {}
 
 
+/**
+ *  In non-blocking mode, returns true once the connection is in
+ *  progress, and the socket becomes writable when it completes.
+ */
 bool posix_socket_adaptor_t::open(const addrinfo& info, const std::string&)
 {
     sock = ::socket(info.ai_family, info.ai_socktype, info.ai_protocol);
@@ -36,15 +266,41 @@ bool posix_socket_adaptor_t::open(const addrinfo& info, const std::string&)
         return false;
     }
     set_reuse_address();
+    set_no_sigpipe();
+    if (info.ai_socktype == SOCK_STREAM && info.ai_family != AF_UNIX) {
+        set_no_delay();
+    }
+    if (nonblocking) {
+        set_nonblocking();
+    }
     if (::connect(sock, info.ai_addr, info.ai_addrlen) >= 0) {
         return true;
+    } else if (nonblocking && errno == EINPROGRESS) {
+        return true;
     }
 
     ::close(sock);
+    sock = -1;
     return false;
 }
 
 
+/**
+ *  \brief Take ownership of a connected socket.
+ */
+bool posix_socket_adaptor_t::attach(socket_handle_t fd, const std::string&)
+{
+    sock = fd;
+    set_no_sigpipe();
+    set_no_delay();
+    if (nonblocking) {
+        set_nonblocking();
+    }
+
+    return true;
+}
+
+
 void posix_socket_adaptor_t::close()
 {
     if (sock >= 0) {
@@ -54,9 +310,53 @@ void posix_socket_adaptor_t::close()
 }
 
 
+/**
+ *  Writing to a socket closed by the peer raises SIGPIPE, which
+ *  is suppressed so stale keep-alive connections fail gracefully.
+ */
 size_t posix_socket_adaptor_t::write(const char *buf, size_t len)
 {
-    return ::send(sock, buf, len, 0);
+    #ifdef MSG_NOSIGNAL
+        return ::send(sock, buf, len, MSG_NOSIGNAL);
+    #else
+        return ::send(sock, buf, len, 0);
+    #endif
+}
+
+
+/**
+ *  \brief Send a list of buffers with as few system calls as possible.
+ *
+ *  Runs of in-memory buffers are gathered into single writes, and
+ *  files are sent with `sendfile` where available. Returns the number
+ *  of bytes sent, which is short only on error.
+ */
+size_t posix_socket_adaptor_t::writev(const buffer_list_t& buffers)
+{
+    size_t sent = 0;
+    auto it = buffers.begin();
+    while (it != buffers.end()) {
+        size_t expected;
+        size_t written;
+        if (it->file()) {
+            expected = it->size;
+            written = send_file(sock, *it);
+            ++it;
+        } else {
+            auto last = it;
+            for (expected = 0; last != buffers.end() && !last->file(); ++last) {
+                expected += last->size;
+            }
+            written = send_vectors(sock, it, last, last != buffers.end());
+            it = last;
+        }
+        sent += written;
+        if (written != expected) {
+            break;
+        }
+    }
+
+    return sent;
 }
 
 
@@ -66,6 +366,46 @@ size_t posix_socket_adaptor_t::read(char *buf, size_t count)
 }
 
 
+/**
+ *  \brief Read up to `count` bytes from the socket into a file.
+ *
+ *  The data is written at the file's current position, with `splice`
+ *  where available, so it is never copied into user space. Returns
+ *  the number of bytes written, which is short on EOF, error, or
+ *  once `deadline` has passed.
+ */
+size_t posix_socket_adaptor_t::splice(int fd, size_t count, std::chrono::steady_clock::time_point deadline)
+{
+#if defined(__linux__)
+    return splice_stream(sock, fd, count, deadline);
+#else
+    return copy_stream(sock, fd, count, deadline);
+#endif
+}
+
+
+/**
+ *  \brief Check if an idle socket may be reused, without blocking.
+ *
+ *  An idle keep-alive connection should have no pending data: if the
+ *  socket is readable, the peer either closed the connection or sent
+ *  unsolicited data, and the socket cannot be reused.
+ */
+bool posix_socket_adaptor_t::alive() const
+{
+    if (sock < 0) {
+        return false;
+    }
+
+    pollfd descriptor;
+    descriptor.fd = sock;
+    descriptor.events = POLLIN;
+    descriptor.revents = 0;
+
+    return ::poll(&descriptor, 1, 0) == 0;
+}
+
+
 void posix_socket_adaptor_t::set_reuse_address()
 {
     int reuse = 1;
@@ -85,15 +425,81 @@ void posix_socket_adaptor_t::set_reuse_address()
 
 
 /**
- *  \warning Microseconds are not set since it causes stoichastic
- *  errors.
+ *  \brief Suppress SIGPIPE on platforms without MSG_NOSIGNAL.
+ */
+void posix_socket_adaptor_t::set_no_sigpipe()
+{
+    #ifdef SO_NOSIGPIPE
+        int value = 1;
+        char *option = reinterpret_cast<char*>(&value);
+        if (::setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, option, sizeof(value))) {
+            throw std::runtime_error("Unable to set socket option via setsockopt().");
+        }
+    #endif
+}
+
+
+/**
+ *  \brief Send small segments immediately, rather than waiting for
+ *  earlier segments to be acknowledged.
+ *
+ *  Requests are written with as few calls as possible, so Nagle's
+ *  algorithm only delays the final segment of each request.
+ */
+void posix_socket_adaptor_t::set_no_delay()
+{
+    int value = 1;
+    char *option = reinterpret_cast<char*>(&value);
+    if (::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, option, sizeof(value))) {
+        throw std::runtime_error("Unable to set socket option via setsockopt().");
+    }
+}
+
+
+/**
+ *  \brief Hold partial segments while corked, and flush on uncorking.
+ *
+ *  Corking is only an optimization, so it is ignored on platforms or
+ *  sockets without TCP_CORK.
+ */
+void posix_socket_adaptor_t::set_cork(bool cork)
+{
+    #ifdef TCP_CORK
+        int value = cork;
+        char *option = reinterpret_cast<char*>(&value);
+        ::setsockopt(sock, IPPROTO_TCP, TCP_CORK, option, sizeof(value));
+    #endif
+}
+
+
+/**
+ *  \brief Toggle non-blocking mode, for use with an event loop.
+ *
+ *  If the socket is not yet open, the mode is applied when it opens.
+ */
+void posix_socket_adaptor_t::set_nonblocking(bool nonblocking)
+{
+    this->nonblocking = nonblocking;
+    if (sock < 0) {
+        return;
+    }
+
+    int flags = ::fcntl(sock, F_GETFL, 0);
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (flags < 0 || ::fcntl(sock, F_SETFL, flags) < 0) {
+        throw std::runtime_error("Unable to set socket flags via fcntl().");
+    }
+}
+
+
+/**
+ *  \brief Set the timeout for each read and write, in milliseconds.
  */
 void posix_socket_adaptor_t::set_timeout(const timeout_t& timeout)
 {
-    // create timeout, do not set microseconds as it causes errors
     struct timeval value;
-    value.tv_sec = timeout.seconds();
-    value.tv_usec = 0;
+    value.tv_sec = timeout.milliseconds() / 1000;
+    value.tv_usec = (timeout.milliseconds() % 1000) * 1000;
 
     // set options
     char *option = reinterpret_cast<char*>(&value);
@@ -0,0 +1,946 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Linux io_uring socket adaptor.
+ */
+
+#if defined(LATTICE_HAVE_IO_URING)
+
+#include <lattice/adaptor/uring.h>
+#include <lattice/util.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <string>
+
+LATTICE_BEGIN_NAMESPACE
+
+namespace detail
+{
+// CONSTANTS
+// ---------
+
+static constexpr unsigned RING_ENTRIES = 16;
+static constexpr unsigned BUFFER_COUNT = 8;
+static constexpr unsigned BUFFER_LENGTH = 16384;
+static constexpr uint16_t BUFFER_GROUP = 0;
+static constexpr size_t STAGE_LIMIT = 65536;
+static constexpr std::chrono::milliseconds SEND_WAIT_LIMIT(1000);
+
+/**
+ *  \brief Tags identifying the operation for each completion.
+ */
+enum uring_tag_t: uint64_t
+{
+    URING_SEND = 1,
+    URING_WRITE,
+    URING_RECV,
+    URING_MULTISHOT,
+    URING_TIMEOUT,
+    URING_CANCEL,
+    URING_PROVIDE,
+    URING_RECYCLE,
+};
+
+// FUNCTIONS
+// ---------
+
+
+static int uring_setup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+
+static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, const void* arg, size_t size)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size));
+}
+
+
+static int uring_register(int fd, unsigned opcode, const void* arg, unsigned count)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+
+static __kernel_timespec to_timespec(std::chrono::milliseconds timeout)
+{
+    __kernel_timespec ts;
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+    return ts;
+}
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Received data in a provided buffer.
+ */
+struct received_t
+{
+    uint16_t bid;
+    size_t length;
+    size_t offset;
+};
+
+
+/**
+ *  \brief Submission and completion rings, and the receive buffers.
+ */
+struct uring_ring_t
+{
+    int fd = -1;
+    unsigned features = 0;
+
+    // rings
+    void* sq_map = MAP_FAILED;
+    size_t sq_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sq_local = 0;
+    unsigned queued = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    // provided buffers
+    std::unique_ptr<char[]> storage;
+    bool multishot = false;
+
+    // receive state
+    bool armed = false;
+    bool eof = false;
+    int error = 0;
+    std::deque<received_t> received;
+
+    // synchronous operation state
+    bool done = false;
+    int result = 0;
+
+    // send state
+    std::string staged;
+    std::string inflight;
+    unsigned sends = 0;
+
+    uring_ring_t();
+    ~uring_ring_t();
+
+    io_uring_sqe* sqe(uint64_t tag);
+    int enter(unsigned wait, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    int wait(std::chrono::milliseconds timeout = std::chrono::milliseconds(0), unsigned count = 1);
+    void reap();
+    void handle(const io_uring_cqe& cqe);
+    io_uring_sqe* flush(int sock);
+    void arm(int sock);
+    void recycle(uint16_t bid);
+    void reset();
+
+protected:
+    void map_rings(const io_uring_params& params);
+    void provide_buffers();
+    void cleanup();
+};
+
+
+uring_ring_t::uring_ring_t()
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    #if defined(IORING_SETUP_COOP_TASKRUN)
+        // completions are reaped in the submitting thread, avoid IPIs
+        params.flags = IORING_SETUP_COOP_TASKRUN;
+    #endif
+    fd = uring_setup(RING_ENTRIES, &params);
+    if (fd < 0 && errno == EINVAL) {
+        std::memset(&params, 0, sizeof(params));
+        fd = uring_setup(RING_ENTRIES, &params);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create io_uring instance.");
+    }
+
+    try {
+        map_rings(params);
+    } catch (...) {
+        cleanup();
+        throw;
+    }
+
+    // the ring descriptor is not registered with IORING_REGISTER_RING_FDS:
+    // the registered index is only valid in the registering thread, and
+    // pooled connections are checked out by other threads
+    provide_buffers();
+}
+
+
+uring_ring_t::~uring_ring_t()
+{
+    cleanup();
+}
+
+
+void uring_ring_t::map_rings(const io_uring_params& params)
+{
+    features = params.features;
+    sq_entries = params.sq_entries;
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+
+    int protection = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+    sq_map = ::mmap(nullptr, sq_size, protection, flags, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        throw std::runtime_error("Unable to map io_uring submission queue.");
+    }
+    cq_map = single ? sq_map : ::mmap(nullptr, cq_size, protection, flags, fd, IORING_OFF_CQ_RING);
+    if (cq_map == MAP_FAILED) {
+        throw std::runtime_error("Unable to map io_uring completion queue.");
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* map = ::mmap(nullptr, sqes_size, protection, flags, fd, IORING_OFF_SQES);
+    sqes = static_cast<io_uring_sqe*>(map);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Unable to map io_uring submission entries.");
+    }
+
+    char* sq = static_cast<char*>(sq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_local = *sq_tail;
+
+    char* cq = static_cast<char*>(cq_map);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+
+/**
+ *  \brief Provide the receive buffers to the kernel for multishot receives.
+ *
+ *  Kernels without multishot receives (before 6.0) fall back to
+ *  a single receive directly into the caller's buffer.
+ */
+void uring_ring_t::provide_buffers()
+{
+#if defined(IORING_RECV_MULTISHOT)
+    storage.reset(new char[BUFFER_COUNT * BUFFER_LENGTH]);
+    io_uring_sqe* entry = sqe(URING_PROVIDE);
+    entry->opcode = IORING_OP_PROVIDE_BUFFERS;
+    entry->fd = BUFFER_COUNT;
+    entry->addr = reinterpret_cast<__u64>(storage.get());
+    entry->len = BUFFER_LENGTH;
+    entry->off = 0;
+    entry->buf_group = BUFFER_GROUP;
+
+    done = false;
+    while (!done) {
+        if (wait() < 0) {
+            return;
+        }
+    }
+    multishot = result >= 0;
+#endif
+}
+
+
+void uring_ring_t::cleanup()
+{
+    if (sqes != MAP_FAILED) {
+        ::munmap(sqes, sqes_size);
+    }
+    if (cq_map != MAP_FAILED && cq_map != sq_map) {
+        ::munmap(cq_map, cq_size);
+    }
+    if (sq_map != MAP_FAILED) {
+        ::munmap(sq_map, sq_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+
+/**
+ *  \brief Get a cleared submission entry, submitting if the queue is full.
+ */
+io_uring_sqe* uring_ring_t::sqe(uint64_t tag)
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sq_local - head >= sq_entries) {
+        enter(0);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sq_local - head >= sq_entries) {
+            throw std::runtime_error("io_uring submission queue is full.");
+        }
+    }
+
+    unsigned index = sq_local & sq_mask;
+    io_uring_sqe* entry = &sqes[index];
+    std::memset(entry, 0, sizeof(*entry));
+    entry->user_data = tag;
+    sq_array[index] = index;
+    ++sq_local;
+    ++queued;
+    __atomic_store_n(sq_tail, sq_local, __ATOMIC_RELEASE);
+
+    return entry;
+}
+
+
+/**
+ *  \brief Submit queued entries and wait for completions.
+ *
+ *  Returns a negative error code on failure, or -ETIME if the timeout
+ *  expired before `wait` completions were posted.
+ */
+int uring_ring_t::enter(unsigned wait, std::chrono::milliseconds timeout)
+{
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    const void* arg = nullptr;
+    size_t size = 0;
+
+    #if defined(IORING_FEAT_EXT_ARG)
+        io_uring_getevents_arg ext;
+        __kernel_timespec ts;
+        if (wait && timeout.count() > 0 && (features & IORING_FEAT_EXT_ARG)) {
+            ts = to_timespec(timeout);
+            std::memset(&ext, 0, sizeof(ext));
+            ext.ts = reinterpret_cast<__u64>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &ext;
+            size = sizeof(ext);
+        }
+    #endif
+
+    int result;
+    while (true) {
+        result = uring_enter(fd, queued, wait, flags, arg, size);
+        if (result >= 0 || errno != EINTR) {
+            break;
+        }
+        // entries are consumed before the wait is interrupted
+        queued = 0;
+    }
+    if (result < 0) {
+        return -errno;
+    }
+
+    queued = 0;
+    return result;
+}
+
+
+/**
+ *  \brief Wait for at least `count` completions, and process completions.
+ */
+int uring_ring_t::wait(std::chrono::milliseconds timeout, unsigned count)
+{
+    int result = enter(count, timeout);
+    reap();
+    return result;
+}
+
+
+/**
+ *  \brief Process all posted completions, without entering the kernel.
+ */
+void uring_ring_t::reap()
+{
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        handle(cqes[head & cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+void uring_ring_t::handle(const io_uring_cqe& cqe)
+{
+    switch (cqe.user_data) {
+        case URING_WRITE:
+        case URING_RECV:
+        case URING_PROVIDE:
+            done = true;
+            result = cqe.res;
+            break;
+        case URING_SEND:
+            --sends;
+            if (cqe.res < 0) {
+                error = error ? error : -cqe.res;
+            } else if (static_cast<size_t>(cqe.res) < inflight.size()) {
+                error = error ? error : EPIPE;
+            }
+            break;
+        case URING_MULTISHOT:
+            if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                received.push_back({bid, static_cast<size_t>(cqe.res), 0});
+            } else if (cqe.res == 0) {
+                eof = true;
+            } else if (cqe.res == -EINVAL && received.empty()) {
+                // kernel without multishot receives
+                multishot = false;
+            } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                error = error ? error : -cqe.res;
+            }
+            #if defined(IORING_CQE_F_MORE)
+                armed &= bool(cqe.flags & IORING_CQE_F_MORE);
+            #else
+                armed = false;
+            #endif
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ *  \brief Queue the staged data for sending.
+ *
+ *  Only a single send is in flight at a time, so sends are never
+ *  reordered. Returns the queued entry, or null if nothing is staged.
+ */
+io_uring_sqe* uring_ring_t::flush(int sock)
+{
+    if (staged.empty()) {
+        return nullptr;
+    }
+    while (sends) {
+        if (wait() < 0) {
+            break;
+        }
+    }
+
+    inflight.swap(staged);
+    staged.clear();
+    io_uring_sqe* entry = sqe(URING_SEND);
+    entry->opcode = IORING_OP_SEND;
+    entry->fd = sock;
+    entry->addr = reinterpret_cast<__u64>(inflight.data());
+    entry->len = static_cast<__u32>(inflight.size());
+    entry->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    ++sends;
+
+    return entry;
+}
+
+
+/**
+ *  \brief Queue a multishot receive into the provided buffers.
+ */
+void uring_ring_t::arm(int sock)
+{
+#if defined(IORING_RECV_MULTISHOT)
+    io_uring_sqe* entry = sqe(URING_MULTISHOT);
+    entry->opcode = IORING_OP_RECV;
+    entry->fd = sock;
+    entry->ioprio = IORING_RECV_MULTISHOT;
+    entry->flags = IOSQE_BUFFER_SELECT;
+    entry->buf_group = BUFFER_GROUP;
+    armed = true;
+#endif
+}
+
+
+/**
+ *  \brief Return a consumed buffer to the kernel.
+ *
+ *  The buffer is queued and provided with the next submission.
+ */
+void uring_ring_t::recycle(uint16_t bid)
+{
+    io_uring_sqe* entry = sqe(URING_RECYCLE);
+    entry->opcode = IORING_OP_PROVIDE_BUFFERS;
+    entry->fd = 1;
+    entry->addr = reinterpret_cast<__u64>(storage.get() + bid * BUFFER_LENGTH);
+    entry->len = BUFFER_LENGTH;
+    entry->off = bid;
+    entry->buf_group = BUFFER_GROUP;
+    #if defined(IORING_FEAT_CQE_SKIP)
+        if (features & IORING_FEAT_CQE_SKIP) {
+            entry->flags |= IOSQE_CQE_SKIP_SUCCESS;
+        }
+    #endif
+}
+
+
+/**
+ *  \brief Clear the per-connection state, once nothing is in flight.
+ */
+void uring_ring_t::reset()
+{
+    for (const auto& item: received) {
+        recycle(item.bid);
+    }
+    received.clear();
+    armed = false;
+    eof = false;
+    error = 0;
+    done = false;
+    staged.clear();
+    inflight.clear();
+    sends = 0;
+}
+
+}   /* detail */
+
+// OBJECTS
+// -------
+
+
+uring_socket_adaptor_t::uring_socket_adaptor_t()
+{}
+
+
+uring_socket_adaptor_t::~uring_socket_adaptor_t()
+{
+    close();
+}
+
+
+/**
+ *  Connect through connect_any(), so every connection shares the
+ *  non-blocking connect path used for multiple addresses.
+ */
+bool uring_socket_adaptor_t::open(const addrinfo& info, const std::string& host)
+{
+    socket_handle_t fd;
+    size_t index;
+    if (!connect_any(address_list_t(1, address_t(info)), fd, index)) {
+        return false;
+    }
+
+    return attach(fd, host);
+}
+
+
+/**
+ *  \brief Take ownership of a connected socket.
+ *
+ *  The ring is created on first use, and kept when the adaptor
+ *  is re-opened for a new connection.
+ */
+bool uring_socket_adaptor_t::attach(socket_handle_t fd, const std::string&)
+{
+    if (!ring) {
+        if (!supported()) {
+            ::close(fd);
+            throw std::runtime_error("io_uring is not supported by the kernel.");
+        }
+        ring.reset(new detail::uring_ring_t);
+    }
+
+    sock = fd;
+    set_no_sigpipe();
+    set_no_delay();
+
+    return true;
+}
+
+
+/**
+ *  Send any staged data, so writes without a following read are not
+ *  lost. Cancel the multishot receive and wait for any pending send,
+ *  since the kernel holds a reference to the socket until both
+ *  complete.
+ */
+void uring_socket_adaptor_t::close()
+{
+    if (sock < 0) {
+        return;
+    }
+
+    if (ring) {
+        if (!ring->error) {
+            ring->flush(sock);
+        }
+        if (ring->armed) {
+            io_uring_sqe* entry = ring->sqe(detail::URING_CANCEL);
+            entry->opcode = IORING_OP_ASYNC_CANCEL;
+            entry->addr = detail::URING_MULTISHOT;
+        }
+        while (ring->armed || ring->sends) {
+            if (ring->wait() < 0) {
+                break;
+            }
+        }
+        ring->reset();
+    }
+    ::close(sock);
+    sock = -1;
+}
+
+
+/**
+ *  \brief Stage data to send with the next read.
+ *
+ *  Writes are deferred until the response is read, so the request
+ *  and the wait for its response need a single system call. Large
+ *  writes are sent immediately, directly from the caller's buffer.
+ */
+size_t uring_socket_adaptor_t::write(const char *buf, size_t len)
+{
+    if (sock < 0 || ring->error) {
+        errno = sock < 0 ? EBADF : ring->error;
+        return static_cast<size_t>(-1);
+    }
+
+    if (ring->staged.size() + len <= detail::STAGE_LIMIT) {
+        ring->staged.append(buf, len);
+        return len;
+    }
+
+    io_uring_sqe* previous = ring->flush(sock);
+    if (len <= detail::STAGE_LIMIT) {
+        ring->staged.append(buf, len);
+        return len;
+    } else if (previous) {
+        previous->flags |= IOSQE_IO_LINK;
+    }
+
+    io_uring_sqe* entry = ring->sqe(detail::URING_WRITE);
+    entry->opcode = IORING_OP_SEND;
+    entry->fd = sock;
+    entry->addr = reinterpret_cast<__u64>(buf);
+    entry->len = static_cast<__u32>(len);
+    entry->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    ring->done = false;
+    while (!ring->done || ring->sends) {
+        int result = ring->wait();
+        if (result < 0) {
+            errno = -result;
+            return static_cast<size_t>(-1);
+        }
+    }
+    if (ring->result < 0) {
+        errno = -ring->result;
+        return static_cast<size_t>(-1);
+    }
+
+    return static_cast<size_t>(ring->result);
+}
+
+
+/**
+ *  \brief Submit staged writes, and read available data.
+ *
+ *  With multishot receives, data is copied out of the provided
+ *  buffers, and the kernel is only entered when no data is ready.
+ *  Otherwise, the staged send and a receive into `buf` are linked
+ *  and submitted together.
+ */
+size_t uring_socket_adaptor_t::read(char *buf, size_t count)
+{
+    if (sock < 0) {
+        errno = EBADF;
+        return static_cast<size_t>(-1);
+    }
+
+    auto& r = *ring;
+    auto start = std::chrono::steady_clock::now();
+    r.reap();
+    while (r.multishot && r.received.empty() && !r.eof && !r.error) {
+        if (!r.armed) {
+            r.arm(sock);
+        }
+        r.flush(sock);
+
+        auto remaining = std::chrono::milliseconds(0);
+        if (timeout.count() > 0) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            remaining = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+            if (remaining.count() <= 0) {
+                errno = EAGAIN;
+                return static_cast<size_t>(-1);
+            }
+        }
+
+        // wait for the send and the data together, but never wait on
+        // the data indefinitely if the send failed
+        bool timed = false;
+        #if defined(IORING_FEAT_EXT_ARG)
+            timed = r.features & IORING_FEAT_EXT_ARG;
+        #endif
+        int result;
+        if (r.sends && timed) {
+            auto limit = detail::SEND_WAIT_LIMIT;
+            if (remaining.count() > 0) {
+                limit = std::min(remaining, limit);
+            }
+            result = r.wait(limit, 1 + r.sends);
+            if (result == -ETIME) {
+                continue;
+            }
+        } else {
+            result = r.wait(remaining);
+        }
+        if (result == -ETIME) {
+            errno = EAGAIN;
+            return static_cast<size_t>(-1);
+        } else if (result < 0) {
+            errno = -result;
+            return static_cast<size_t>(-1);
+        }
+    }
+
+    if (!r.received.empty()) {
+        // submit any staged send without waiting
+        r.flush(sock);
+        if (r.queued) {
+            r.enter(0);
+        }
+
+        auto& item = r.received.front();
+        size_t length = std::min(count, item.length - item.offset);
+        const char* data = r.storage.get() + item.bid * detail::BUFFER_LENGTH;
+        std::memcpy(buf, data + item.offset, length);
+        item.offset += length;
+        if (item.offset == item.length) {
+            r.recycle(item.bid);
+            r.received.pop_front();
+        }
+        return length;
+    } else if (r.error) {
+        errno = r.error;
+        return static_cast<size_t>(-1);
+    } else if (r.eof) {
+        return 0;
+    }
+
+    // single-shot receive, linked after the staged send
+    io_uring_sqe* previous = r.flush(sock);
+    if (previous) {
+        previous->flags |= IOSQE_IO_LINK;
+    }
+    io_uring_sqe* entry = r.sqe(detail::URING_RECV);
+    entry->opcode = IORING_OP_RECV;
+    entry->fd = sock;
+    entry->addr = reinterpret_cast<__u64>(buf);
+    entry->len = static_cast<__u32>(count);
+    __kernel_timespec ts = detail::to_timespec(timeout);
+    if (timeout.count() > 0) {
+        entry->flags |= IOSQE_IO_LINK;
+        io_uring_sqe* limit = r.sqe(detail::URING_TIMEOUT);
+        limit->opcode = IORING_OP_LINK_TIMEOUT;
+        limit->addr = reinterpret_cast<__u64>(&ts);
+        limit->len = 1;
+    }
+
+    r.done = false;
+    while (!r.done) {
+        int result = r.wait();
+        if (result < 0) {
+            errno = -result;
+            return static_cast<size_t>(-1);
+        }
+    }
+    if (r.error) {
+        errno = r.error;
+        return static_cast<size_t>(-1);
+    } else if (r.result == -ECANCELED) {
+        errno = EAGAIN;
+        return static_cast<size_t>(-1);
+    } else if (r.result < 0) {
+        errno = -r.result;
+        return static_cast<size_t>(-1);
+    }
+
+    return static_cast<size_t>(r.result);
+}
+
+
+/**
+ *  \brief Check if an idle socket may be reused, without blocking.
+ *
+ *  With a multishot receive armed, any data or end-of-file has been
+ *  posted to the completion queue, which is checked after running
+ *  pending completions. Otherwise, poll the socket.
+ */
+bool uring_socket_adaptor_t::alive() const
+{
+    if (sock < 0) {
+        return false;
+    } else if (ring && ring->armed) {
+        ring->enter(0);
+        ring->reap();
+        return ring->armed && ring->received.empty() && !ring->eof && !ring->error;
+    }
+
+    pollfd descriptor;
+    descriptor.fd = sock;
+    descriptor.events = POLLIN;
+    descriptor.revents = 0;
+
+    return ::poll(&descriptor, 1, 0) == 0;
+}
+
+
+void uring_socket_adaptor_t::set_reuse_address()
+{
+    int reuse = 1;
+    char *option = reinterpret_cast<char*>(&reuse);
+    int size = sizeof(reuse);
+    if (::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, option, size)) {
+        throw std::runtime_error("Unable to set socket option via setsockopt().");
+    }
+}
+
+
+/**
+ *  Sends use MSG_NOSIGNAL, which suffices on Linux.
+ */
+void uring_socket_adaptor_t::set_no_sigpipe()
+{}
+
+
+/**
+ *  Queued writes are submitted together, so disabling Nagle's
+ *  algorithm does not produce extra segments.
+ */
+void uring_socket_adaptor_t::set_no_delay()
+{
+    int value = 1;
+    char *option = reinterpret_cast<char*>(&value);
+    if (::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, option, sizeof(value))) {
+        throw std::runtime_error("Unable to set socket option via setsockopt().");
+    }
+}
+
+
+/**
+ *  Only applies to writes that bypass the ring, like those from an
+ *  OpenSSL adaptor over the socket.
+ */
+void uring_socket_adaptor_t::set_cork(bool cork)
+{
+    #ifdef TCP_CORK
+        int value = cork;
+        char *option = reinterpret_cast<char*>(&value);
+        ::setsockopt(sock, IPPROTO_TCP, TCP_CORK, option, sizeof(value));
+    #endif
+}
+
+
+/**
+ *  Socket timeouts do not apply to io_uring operations, so the timeout
+ *  is also applied to each wait for completions. The socket options
+ *  are still set for TLS, which reads the descriptor directly.
+ */
+void uring_socket_adaptor_t::set_timeout(const timeout_t& timeout)
+{
+    this->timeout = std::chrono::milliseconds(timeout.milliseconds());
+
+    struct timeval value;
+    value.tv_sec = timeout.milliseconds() / 1000;
+    value.tv_usec = (timeout.milliseconds() % 1000) * 1000;
+
+    char *option = reinterpret_cast<char*>(&value);
+    socklen_t size = sizeof(timeval);
+    if (::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, option, size)) {
+        throw std::runtime_error("Unable to set socket option via setsockopt().");
+    }
+    if (::setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, option, size)) {
+        throw std::runtime_error("Unable to set socket option via setsockopt().");
+    }
+}
+
+
+void uring_socket_adaptor_t::set_certificate_file(const certificate_file_t& certificate)
+{
+    encryption_warning();
+}
+
+
+void uring_socket_adaptor_t::set_revocation_lists(const revocation_lists_t& revoke)
+{
+    encryption_warning();
+}
+
+
+void uring_socket_adaptor_t::set_ssl_protocol(ssl_protocol_t ssl)
+{
+    encryption_warning();
+}
+
+
+const int uring_socket_adaptor_t::fd() const
+{
+    return sock;
+}
+
+
+/**
+ *  \brief Check if responses are read via multishot receives.
+ */
+bool uring_socket_adaptor_t::multishot() const
+{
+    return ring && ring->multishot;
+}
+
+
+/**
+ *  \brief Probe once if the kernel supports the required operations.
+ */
+bool uring_socket_adaptor_t::supported()
+{
+    static bool value = [] {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int fd = detail::uring_setup(2, &params);
+        if (fd < 0) {
+            return false;
+        }
+
+        const unsigned count = 256;
+        size_t size = sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op);
+        std::unique_ptr<char[]> memory(new char[size]());
+        auto* probe = reinterpret_cast<io_uring_probe*>(memory.get());
+        bool ok = detail::uring_register(fd, IORING_REGISTER_PROBE, probe, count) >= 0;
+        for (int op: {IORING_OP_SEND, IORING_OP_RECV, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL}) {
+            ok = ok && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        }
+        ::close(fd);
+
+        return ok;
+    }();
+
+    return value;
+}
+
+LATTICE_END_NAMESPACE
+
+#endif              // LATTICE_HAVE_IO_URING
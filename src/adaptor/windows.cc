@@ -68,6 +68,16 @@ bool win32_socket_adaptor_t::open(const addrinfo& info, const std::string&)
 }
 
 
+/**
+ *  \brief Take ownership of a connected socket.
+ */
+bool win32_socket_adaptor_t::attach(socket_handle_t fd, const std::string&)
+{
+    sock = fd;
+    return true;
+}
+
+
 bool win32_socket_adaptor_t::close()
 {
     if (sock != INVALID_SOCKET) {
@@ -91,6 +101,28 @@ size_t win32_socket_adaptor_t::read(char *buf, size_t count)
 }
 
 
+/**
+ *  \brief Check if an idle socket may be reused, without blocking.
+ *
+ *  An idle keep-alive connection should have no pending data: if the
+ *  socket is readable, the peer either closed the connection or sent
+ *  unsolicited data, and the socket cannot be reused.
+ */
+bool win32_socket_adaptor_t::alive() const
+{
+    if (sock == INVALID_SOCKET) {
+        return false;
+    }
+
+    fd_set descriptors;
+    FD_ZERO(&descriptors);
+    FD_SET(sock, &descriptors);
+    timeval zero = {0, 0};
+
+    return ::select(0, &descriptors, nullptr, nullptr, &zero) == 0;
+}
+
+
 void win32_socket_adaptor_t::set_reuse_address()
 {
     int reuse = 1;
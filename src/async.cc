@@ -13,6 +13,16 @@ LATTICE_BEGIN_NAMESPACE
 // -------
 
 
+pool_t::pool_t(size_t threads):
+    reactor(std::make_shared<reactor_t>(threads))
+{}
+
+
+pool_t::pool_t(const std::shared_ptr<reactor_t>& reactor):
+    reactor(reactor)
+{}
+
+
 response_list_t pool_t::perform()
 {
     response_list_t list;
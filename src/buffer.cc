@@ -0,0 +1,337 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Scatter-gather buffers for outgoing messages.
+ */
+
+#include <lattice/buffer.h>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#   include <pycpp/string/unicode.h>
+#   include <fcntl.h>
+#   include <io.h>
+#   include <sys/stat.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Size of each block of a file passed to a writer.
+ */
+static constexpr size_t FILE_BLOCK_SIZE = 4 << 20;
+
+// FUNCTIONS
+// ---------
+
+#if defined(_WIN32)
+
+
+static int open_file(const std::string& path, uint64_t& size)
+{
+    auto utf16 = PYCPP_NAMESPACE::utf8_to_utf16(path);
+    auto *name = reinterpret_cast<const wchar_t*>(utf16.data());
+    int fd = ::_wopen(name, _O_RDONLY | _O_BINARY);
+    struct _stat64 status;
+    if (fd >= 0 && ::_fstat64(fd, &status) == 0) {
+        size = static_cast<uint64_t>(status.st_size);
+    }
+
+    return fd;
+}
+
+
+static void close_file(int fd)
+{
+    ::_close(fd);
+}
+
+
+/**
+ *  Files are read in blocks into a reusable buffer.
+ */
+size_t write_file(const buffer_view_t& buffer, const buffer_writer_t& writer)
+{
+    std::string block;
+    block.resize(std::min(FILE_BLOCK_SIZE, buffer.size));
+
+    size_t sent = 0;
+    if (::_lseeki64(buffer.fd, buffer.offset, SEEK_SET) < 0) {
+        return sent;
+    }
+    while (sent < buffer.size) {
+        unsigned count = static_cast<unsigned>(std::min(block.size(), buffer.size - sent));
+        int read = ::_read(buffer.fd, &block[0], count);
+        if (read <= 0) {
+            break;
+        }
+        size_t written = writer(block.data(), read);
+        sent += written;
+        if (written != static_cast<size_t>(read)) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+#else                           // POSIX
+
+
+static int open_file(const std::string& path, uint64_t& size)
+{
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd >= 0 && ::fstat(fd, &status) == 0) {
+        size = static_cast<uint64_t>(status.st_size);
+    }
+
+    return fd;
+}
+
+
+static void close_file(int fd)
+{
+    ::close(fd);
+}
+
+
+/**
+ *  Files are mapped in blocks, so only a single block is resident at
+ *  a time, and the data is passed to the writer without copying it
+ *  into user space first.
+ */
+size_t write_file(const buffer_view_t& buffer, const buffer_writer_t& writer)
+{
+    static const uint64_t page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+
+    size_t sent = 0;
+    while (sent < buffer.size) {
+        // mappings must start on a page boundary
+        uint64_t position = buffer.offset + sent;
+        uint64_t start = position - position % page;
+        size_t skip = static_cast<size_t>(position - start);
+        size_t count = std::min(FILE_BLOCK_SIZE, buffer.size - sent);
+
+        void *map = ::mmap(nullptr, skip + count, PROT_READ, MAP_SHARED, buffer.fd, start);
+        if (map == MAP_FAILED) {
+            break;
+        }
+        ::madvise(map, skip + count, MADV_SEQUENTIAL);
+        size_t written = writer(static_cast<const char*>(map) + skip, count);
+        ::munmap(map, skip + count);
+
+        sent += written;
+        if (written != count) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+#endif
+
+// OBJECTS
+// -------
+
+
+buffer_view_t::buffer_view_t(const char *data, size_t size):
+    data(data),
+    size(size)
+{}
+
+
+buffer_view_t::buffer_view_t(int fd, uint64_t offset, size_t size):
+    size(size),
+    fd(fd),
+    offset(offset)
+{}
+
+
+bool buffer_view_t::file() const
+{
+    return fd >= 0;
+}
+
+
+buffer_list_t::buffer_list_t(buffer_list_t&& other)
+{
+    operator=(std::move(other));
+}
+
+
+/**
+ *  Ownership of open files is transferred, so the moved-from list
+ *  does not close them.
+ */
+buffer_list_t & buffer_list_t::operator=(buffer_list_t&& other)
+{
+    base::swap(other);
+    storage.swap(other.storage);
+    files.swap(other.files);
+
+    return *this;
+}
+
+
+buffer_list_t::~buffer_list_t()
+{
+    for (int fd: files) {
+        close_file(fd);
+    }
+}
+
+
+/**
+ *  Empty views are skipped, so every buffer in the list contains
+ *  at least 1 byte.
+ */
+void buffer_list_t::view(const char *data, size_t size)
+{
+    if (size) {
+        emplace_back(data, size);
+    }
+}
+
+
+void buffer_list_t::view(const std::string& data)
+{
+    view(data.data(), data.size());
+}
+
+
+void buffer_list_t::store(std::string&& data)
+{
+    if (!data.empty()) {
+        storage.emplace_back(std::forward<std::string>(data));
+        emplace_back(storage.back().data(), storage.back().size());
+    }
+}
+
+
+/**
+ *  \brief Prepend an owned buffer, for headers computed from the body.
+ */
+void buffer_list_t::store_front(std::string&& data)
+{
+    if (!data.empty()) {
+        storage.emplace_back(std::forward<std::string>(data));
+        emplace_front(storage.back().data(), storage.back().size());
+    }
+}
+
+
+/**
+ *  \brief Add the contents of a file, which is opened but not read.
+ *
+ *  The size is fixed when the file is added, so the length of the
+ *  message is known before any data is sent.
+ */
+void buffer_list_t::file(const std::string& path)
+{
+    uint64_t size = 0;
+    int fd = open_file(path, size);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file " + path + ".");
+    }
+    files.emplace_back(fd);
+    if (size) {
+        emplace_back(fd, 0, static_cast<size_t>(size));
+    }
+}
+
+
+/**
+ *  \brief Move all buffers from `other` to the end of the list.
+ *
+ *  Stored strings and open files are transferred without copying,
+ *  so views of them remain valid.
+ */
+void buffer_list_t::append(buffer_list_t&& other)
+{
+    storage.splice(storage.end(), other.storage);
+    files.insert(files.end(), other.files.begin(), other.files.end());
+    other.files.clear();
+    insert(end(), other.begin(), other.end());
+    other.clear();
+}
+
+
+/**
+ *  \brief Get the total number of bytes in all buffers.
+ */
+size_t buffer_list_t::length() const
+{
+    size_t length = 0;
+    for (const auto& buffer: *this) {
+        length += buffer.size;
+    }
+
+    return length;
+}
+
+
+/**
+ *  \brief Copy all buffers into a single, contiguous string.
+ */
+std::string buffer_list_t::string() const
+{
+    std::string output;
+    output.reserve(length());
+    for (const auto& buffer: *this) {
+        if (buffer.file()) {
+            write_file(buffer, [&output](const char *data, size_t size) {
+                output.append(data, size);
+                return size;
+            });
+        } else {
+            output.append(buffer.data, buffer.size);
+        }
+    }
+
+    return output;
+}
+
+
+/**
+ *  \brief View up to `size` bytes of the buffers, from `offset`.
+ *
+ *  The slice references the storage and files of this list, which
+ *  must outlive it.
+ */
+buffer_list_t buffer_list_t::slice(size_t offset, size_t size) const
+{
+    buffer_list_t slice;
+    for (const auto& buffer: *this) {
+        if (!size) {
+            break;
+        } else if (offset >= buffer.size) {
+            offset -= buffer.size;
+            continue;
+        }
+
+        size_t count = std::min(size, buffer.size - offset);
+        if (buffer.file()) {
+            slice.emplace_back(buffer.fd, buffer.offset + offset, count);
+        } else {
+            slice.emplace_back(buffer.data + offset, count);
+        }
+        offset = 0;
+        size -= count;
+    }
+
+    return slice;
+}
+
+LATTICE_END_NAMESPACE
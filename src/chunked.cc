@@ -0,0 +1,278 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Chunked transfer encoding decoder.
+ */
+
+#include <lattice/chunked.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Maximum number of hex digits in a chunk size.
+ */
+static constexpr size_t MAX_DIGITS = 15;
+
+/**
+ *  \brief Maximum length of chunk extensions, or of a trailer line.
+ */
+static constexpr size_t MAX_LINE = 8192;
+
+// FUNCTIONS
+// ---------
+
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+static std::string trim_space(const std::string& string, size_t first, size_t last)
+{
+    while (first < last && std::isspace(static_cast<unsigned char>(string[first]))) {
+        ++first;
+    }
+    while (last > first && std::isspace(static_cast<unsigned char>(string[last-1]))) {
+        --last;
+    }
+    return string.substr(first, last - first);
+}
+
+
+static void invalid_chunk()
+{
+    throw std::runtime_error("Invalid chunk size in chunked transfer encoding.");
+}
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Store a complete trailer line, without the line ending.
+ */
+void chunked_decoder_t::parse_trailer()
+{
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+        std::string key = trim_space(line, 0, colon);
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        trailers_.emplace(key, trim_space(line, colon + 1, line.size()));
+    }
+    line.clear();
+}
+
+
+/**
+ *  \brief Decode data up to the end of the next span of chunk data.
+ *
+ *  On input, `size` is the maximum amount of chunk data to return,
+ *  and must be non-zero. On output, `chunk` and `size` describe the
+ *  chunk data found, which points into `data`, or `size` is 0 if the
+ *  input only contained framing. Returns the number of bytes
+ *  consumed, which is less than `length` if chunk data was found or
+ *  the body is complete.
+ */
+size_t chunked_decoder_t::decode(const char *data, size_t length, const char *&chunk, size_t &size)
+{
+    const char *first = data;
+    const char *last = data + length;
+    size_t limit = size;
+    chunk = nullptr;
+    size = 0;
+
+    while (data != last && state != DONE) {
+        switch (state) {
+            case SIZE: {
+                if (!digits) {
+                    extension.clear();
+                }
+                int value = hex_value(*data);
+                if (value >= 0) {
+                    if (++digits > MAX_DIGITS) {
+                        invalid_chunk();
+                    }
+                    remaining_ = remaining_ * 16 + value;
+                    ++data;
+                    break;
+                } else if (!digits) {
+                    invalid_chunk();
+                }
+                state = SIZE_SPACE;
+            }
+            /* fallthrough */
+            case SIZE_SPACE:
+                if (*data == ' ' || *data == '\t') {
+                    ++data;
+                } else if (*data == ';') {
+                    state = EXTENSION;
+                    ++data;
+                } else if (*data == '\r' || *data == '\n') {
+                    state = SIZE_LF;
+                } else {
+                    invalid_chunk();
+                }
+                break;
+            case EXTENSION: {
+                auto *end = static_cast<const char*>(std::memchr(data, '\n', last - data));
+                auto *stop = end ? end : last;
+                extension.append(data, stop);
+                if (extension.size() > MAX_LINE) {
+                    throw std::runtime_error("Chunk extension is too long.");
+                }
+                data = stop;
+                if (end) {
+                    if (!extension.empty() && extension.back() == '\r') {
+                        extension.pop_back();
+                    }
+                    state = SIZE_LF;
+                }
+                break;
+            }
+            case SIZE_LF:
+                if (*data == '\n') {
+                    state = remaining_ ? DATA : TRAILER;
+                    digits = 0;
+                } else if (*data != '\r') {
+                    invalid_chunk();
+                }
+                ++data;
+                break;
+            case DATA: {
+                size_t count = static_cast<size_t>(std::min<uint64_t>(remaining_, last - data));
+                count = std::min(count, limit);
+                chunk = data;
+                size = count;
+                consume(count);
+                return data + count - first;
+            }
+            case DATA_CR:
+                if (*data == '\r') {
+                    state = DATA_LF;
+                    ++data;
+                    break;
+                }
+                /* fallthrough */
+            case DATA_LF:
+                if (*data != '\n') {
+                    throw std::runtime_error("Chunk data is not followed by a line ending.");
+                }
+                state = SIZE;
+                ++data;
+                break;
+            case TRAILER: {
+                auto *end = static_cast<const char*>(std::memchr(data, '\n', last - data));
+                auto *stop = end ? end : last;
+                line.append(data, stop);
+                if (line.size() > MAX_LINE) {
+                    throw std::runtime_error("Chunk trailer is too long.");
+                }
+                data = end ? end + 1 : last;
+                if (end) {
+                    if (!line.empty() && line.back() == '\r') {
+                        line.pop_back();
+                    }
+                    if (line.empty()) {
+                        // trailers end with an empty line
+                        state = DONE;
+                    } else {
+                        parse_trailer();
+                    }
+                }
+                break;
+            }
+            case DONE:
+                break;
+        }
+    }
+
+    return data - first;
+}
+
+
+/**
+ *  \brief Decode data, appending the chunk data to `output`.
+ */
+size_t chunked_decoder_t::decode(const char *data, size_t length, std::string& output)
+{
+    size_t offset = 0;
+    while (offset < length && !done()) {
+        const char *chunk;
+        size_t size = length - offset;
+        offset += decode(data + offset, length - offset, chunk, size);
+        output.append(chunk, size);
+    }
+
+    return offset;
+}
+
+
+/**
+ *  \brief Mark chunk data as read by the caller, bypassing `decode`.
+ *
+ *  Allows large chunks to be read directly into their destination.
+ *  `count` must not exceed `remaining()`.
+ */
+void chunked_decoder_t::consume(size_t count)
+{
+    remaining_ -= count;
+    if (!remaining_ && state == DATA) {
+        state = DATA_CR;
+    }
+}
+
+
+void chunked_decoder_t::reset()
+{
+    *this = chunked_decoder_t();
+}
+
+
+bool chunked_decoder_t::done() const
+{
+    return state == DONE;
+}
+
+
+/**
+ *  \brief Get the number of bytes left in the current chunk's data.
+ */
+size_t chunked_decoder_t::remaining() const
+{
+    return state == DATA ? static_cast<size_t>(remaining_) : 0;
+}
+
+
+/**
+ *  \brief Get the extensions of the most recent chunk, without the ';'.
+ */
+const std::string& chunked_decoder_t::extensions() const
+{
+    return extension;
+}
+
+
+const header_t& chunked_decoder_t::trailers() const
+{
+    return trailers_;
+}
+
+LATTICE_END_NAMESPACE
@@ -6,8 +6,31 @@
  */
 
 #include <lattice/dns.h>
+#include <lattice/resolver.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#   include <netinet/in.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#else
+#   include <process.h>
+#endif
 
 #ifdef _MSC_VER
 #   pragma warning(push)
@@ -16,6 +39,474 @@
 
 LATTICE_BEGIN_NAMESPACE
 
+// CONSTANTS
+// ---------
+
+static const char SNAPSHOT_MAGIC[4] = {'L', 'D', 'N', 'S'};
+static constexpr uint8_t SNAPSHOT_VERSION = 1;
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Entry in the default policy table of RFC 6724.
+ */
+struct policy_t
+{
+    uint8_t prefix[16];
+    int length;
+    int precedence;
+    int label;
+};
+
+
+/**
+ *  \brief Destination address with the attributes used to sort it.
+ */
+struct destination_t
+{
+    address_t address;
+    bool usable = false;
+    int scope = 0;
+    int label = 0;
+    int precedence = 0;
+    int source_scope = 0;
+    int source_label = 0;
+    int prefix = 0;
+};
+
+
+/**
+ *  \brief Default policy table, by decreasing prefix length.
+ */
+static const policy_t POLICY_TABLE[] = {
+    {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1}, 128, 50, 0},
+    {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff}, 96, 35, 4},
+    {{0}, 96, 1, 3},
+    {{0x20, 0x01, 0, 0}, 32, 5, 5},
+    {{0x20, 0x02}, 16, 30, 2},
+    {{0x3f, 0xfe}, 16, 1, 12},
+    {{0xfe, 0xc0}, 10, 1, 11},
+    {{0xfc}, 7, 3, 13},
+    {{0}, 0, 40, 1},
+};
+
+
+/**
+ *  \brief Get the IPv6 form of an address, mapping IPv4 addresses.
+ */
+static bool ipv6_bytes(const sockaddr_storage& address, uint8_t *bytes)
+{
+    memset(bytes, 0, 16);
+    if (address.ss_family == AF_INET6) {
+        auto *ipv6 = reinterpret_cast<const sockaddr_in6*>(&address);
+        memcpy(bytes, &ipv6->sin6_addr, 16);
+        return true;
+    } else if (address.ss_family == AF_INET) {
+        auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&address);
+        bytes[10] = bytes[11] = 0xff;
+        memcpy(bytes + 12, &ipv4->sin_addr, 4);
+        return true;
+    }
+
+    return false;
+}
+
+
+static int common_prefix(const uint8_t *left, const uint8_t *right, int limit)
+{
+    int length = 0;
+    while (length < limit) {
+        uint8_t bit = 0x80 >> (length % 8);
+        if ((left[length / 8] & bit) != (right[length / 8] & bit)) {
+            break;
+        }
+        ++length;
+    }
+
+    return length;
+}
+
+
+static const policy_t& address_policy(const uint8_t *bytes)
+{
+    for (const auto &policy: POLICY_TABLE) {
+        if (common_prefix(bytes, policy.prefix, policy.length) == policy.length) {
+            return policy;
+        }
+    }
+
+    return POLICY_TABLE[sizeof(POLICY_TABLE) / sizeof(policy_t) - 1];
+}
+
+
+/**
+ *  \brief Get the scope of an address, with IPv4 addresses mapped.
+ */
+static int address_scope(const uint8_t *bytes)
+{
+    static const uint8_t loopback[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    static const uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+    if (bytes[0] == 0xff) {
+        return bytes[1] & 0x0f;
+    } else if (bytes[0] == 0xfe && (bytes[1] & 0xc0) == 0x80) {
+        return 2;
+    } else if (bytes[0] == 0xfe && (bytes[1] & 0xc0) == 0xc0) {
+        return 5;
+    } else if (memcmp(bytes, loopback, 16) == 0) {
+        return 2;
+    } else if (memcmp(bytes, mapped, 12) == 0) {
+        bool local = bytes[12] == 127 || (bytes[12] == 169 && bytes[13] == 254);
+        return local ? 2 : 14;
+    }
+
+    return 14;
+}
+
+
+/**
+ *  \brief Find the source address the kernel would use for `address`.
+ *
+ *  Connecting a UDP socket selects a route without sending packets.
+ */
+static bool find_source(const address_t& address, sockaddr_storage& source)
+{
+    auto destination = reinterpret_cast<const sockaddr*>(&address.address);
+    auto length = static_cast<socklen_t>(address.length);
+    socklen_t size = sizeof(source);
+    bool found = false;
+
+#ifdef _WIN32
+    SOCKET sock = ::socket(address.family, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock != INVALID_SOCKET) {
+        found = !::connect(sock, destination, length) &&
+            !::getsockname(sock, reinterpret_cast<sockaddr*>(&source), &size);
+        ::closesocket(sock);
+    }
+#else
+    int sock = ::socket(address.family, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock >= 0) {
+        found = !::connect(sock, destination, length) &&
+            !::getsockname(sock, reinterpret_cast<sockaddr*>(&source), &size);
+        ::close(sock);
+    }
+#endif
+
+    return found;
+}
+
+
+static destination_t make_destination(const address_t& address)
+{
+    destination_t destination;
+    destination.address = address;
+
+    uint8_t bytes[16];
+    if (!ipv6_bytes(address.address, bytes)) {
+        return destination;
+    }
+    const policy_t& policy = address_policy(bytes);
+    destination.scope = address_scope(bytes);
+    destination.label = policy.label;
+    destination.precedence = policy.precedence;
+
+    sockaddr_storage source;
+    uint8_t source_bytes[16];
+    memset(&source, 0, sizeof(source));
+    if (find_source(address, source) && ipv6_bytes(source, source_bytes)) {
+        destination.usable = true;
+        destination.source_scope = address_scope(source_bytes);
+        destination.source_label = address_policy(source_bytes).label;
+        destination.prefix = common_prefix(bytes, source_bytes, 64);
+    }
+
+    return destination;
+}
+
+
+/**
+ *  \brief Compare destinations by the rules of RFC 6724, section 6.
+ *
+ *  Rules for deprecated, home and native addresses are skipped, since
+ *  the attributes are not available. Rule 9 is applied only to IPv6,
+ *  since it defeats DNS round-robin for IPv4 addresses.
+ */
+static bool prefer(const destination_t& left, const destination_t& right)
+{
+    // rule 1: avoid unusable destinations
+    if (left.usable != right.usable) {
+        return left.usable;
+    }
+
+    // rule 2: prefer matching scope
+    bool left_scope = left.scope == left.source_scope;
+    bool right_scope = right.scope == right.source_scope;
+    if (left_scope != right_scope) {
+        return left_scope;
+    }
+
+    // rule 5: prefer matching label
+    bool left_label = left.label == left.source_label;
+    bool right_label = right.label == right.source_label;
+    if (left_label != right_label) {
+        return left_label;
+    }
+
+    // rule 6: prefer higher precedence
+    if (left.precedence != right.precedence) {
+        return left.precedence > right.precedence;
+    }
+
+    // rule 8: prefer smaller scope
+    if (left.scope != right.scope) {
+        return left.scope < right.scope;
+    }
+
+    // rule 9: use longest matching prefix
+    bool ipv6 = left.address.family == AF_INET6 && right.address.family == AF_INET6;
+    if (ipv6 && left.prefix != right.prefix) {
+        return left.prefix > right.prefix;
+    }
+
+    // rule 10: otherwise, leave the order unchanged
+    return false;
+}
+
+
+/**
+ *  \brief Key cache entries by host and service, since addresses
+ *  include the port.
+ */
+static std::string cache_key(const std::string& host, const std::string& service)
+{
+    return host + " " + service;
+}
+
+
+/**
+ *  \brief Normalize a host name for matching.
+ */
+static std::string host_key(const std::string& name)
+{
+    std::string key(name);
+    if (!key.empty() && key.back() == '.') {
+        key.pop_back();
+    }
+    std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+        return static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+    });
+
+    return key;
+}
+
+
+/**
+ *  \brief Parse a numeric address, which may be in brackets.
+ */
+static bool numeric_address(const std::string& value, address_t& address)
+{
+    std::string host(value);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.data(), "0", &hints, &result)) {
+        return false;
+    }
+    address = address_t(*result);
+    freeaddrinfo(result);
+
+    return true;
+}
+
+
+static void set_port(address_t& address, uint16_t port)
+{
+    if (address.family == AF_INET6) {
+        reinterpret_cast<sockaddr_in6*>(&address.address)->sin6_port = htons(port);
+    } else if (address.family == AF_INET) {
+        reinterpret_cast<sockaddr_in*>(&address.address)->sin_port = htons(port);
+    }
+}
+
+
+/**
+ *  \brief Append an integer to a snapshot, in network byte order.
+ */
+template <typename Int>
+static void pack(std::string& data, Int value)
+{
+    auto bits = static_cast<uint64_t>(value);
+    for (size_t i = sizeof(Int); i-- > 0; ) {
+        data.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+    }
+}
+
+
+/**
+ *  \brief Read an integer from a snapshot, returning false if truncated.
+ */
+template <typename Int>
+static bool unpack(const std::string& data, size_t& offset, Int& value)
+{
+    if (offset + sizeof(Int) > data.size()) {
+        return false;
+    }
+
+    uint64_t bits = 0;
+    for (size_t i = 0; i < sizeof(Int); ++i) {
+        bits = (bits << 8) | static_cast<unsigned char>(data[offset++]);
+    }
+    value = static_cast<Int>(bits);
+
+    return true;
+}
+
+
+/**
+ *  \brief Append an address as its family, port and raw bytes.
+ *
+ *  The socket address structures differ between systems, so they are
+ *  not written directly.
+ */
+static void pack_address(std::string& data, const address_t& address)
+{
+    if (address.family == AF_INET6) {
+        auto *ipv6 = reinterpret_cast<const sockaddr_in6*>(&address.address);
+        pack<uint8_t>(data, 6);
+        pack<uint16_t>(data, ntohs(ipv6->sin6_port));
+        data.append(reinterpret_cast<const char*>(&ipv6->sin6_addr), 16);
+        pack<uint32_t>(data, ipv6->sin6_scope_id);
+    } else {
+        auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&address.address);
+        pack<uint8_t>(data, 4);
+        pack<uint16_t>(data, ntohs(ipv4->sin_port));
+        data.append(reinterpret_cast<const char*>(&ipv4->sin_addr), 4);
+    }
+}
+
+
+static bool unpack_address(const std::string& data, size_t& offset, address_t& address)
+{
+    uint8_t version;
+    uint16_t port;
+    if (!unpack(data, offset, version) || !unpack(data, offset, port)) {
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.socket_type = SOCK_STREAM;
+    address.protocol = IPPROTO_TCP;
+    if (version == 6 && offset + 16 <= data.size()) {
+        auto *ipv6 = reinterpret_cast<sockaddr_in6*>(&address.address);
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        memcpy(&ipv6->sin6_addr, data.data() + offset, 16);
+        offset += 16;
+        uint32_t scope;
+        if (!unpack(data, offset, scope)) {
+            return false;
+        }
+        ipv6->sin6_scope_id = scope;
+        address.family = AF_INET6;
+        address.length = sizeof(sockaddr_in6);
+        return true;
+    } else if (version == 4 && offset + 4 <= data.size()) {
+        auto *ipv4 = reinterpret_cast<sockaddr_in*>(&address.address);
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        memcpy(&ipv4->sin_addr, data.data() + offset, 4);
+        offset += 4;
+        address.family = AF_INET;
+        address.length = sizeof(sockaddr_in);
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ *  \brief Get the time to refresh an entry, DNS_REFRESH_AHEAD before
+ *  it expires, or halfway through shorter lifetimes.
+ */
+static auto renewal(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point expires)
+    -> std::chrono::steady_clock::time_point
+{
+    auto ahead = std::min<std::chrono::steady_clock::duration>(DNS_REFRESH_AHEAD, (expires - now) / 2);
+    return expires - ahead;
+}
+
+
+/**
+ *  \brief Call `function` for every host, over a pool of threads.
+ */
+template <typename Function>
+static void for_each_host(const dns_host_list_t& hosts, Function function)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&hosts, &next, &function]() {
+        for (size_t i = next++; i < hosts.size(); i = next++) {
+            function(hosts[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t count = std::min(hosts.size(), DNS_PREFETCH_THREADS);
+    for (size_t i = 1; i < count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+
+/**
+ *  \brief Write `data` to a new, uniquely-named file next to `path`.
+ *
+ *  Returns the name of the file, so concurrent writers to the same
+ *  path never share a temporary file.
+ */
+static std::string write_temporary(const std::string& path, const std::string& data)
+{
+#ifndef _WIN32
+    std::string temporary = path + ".XXXXXX";
+    int fd = ::mkstemp(&temporary[0]);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to write DNS cache snapshot: " + path);
+    }
+    bool written = ::fchmod(fd, 0644) == 0;
+    for (size_t offset = 0; written && offset < data.size(); ) {
+        ssize_t size = ::write(fd, data.data() + offset, data.size() - offset);
+        written = size > 0 || (size < 0 && errno == EINTR);
+        offset += size > 0 ? size : 0;
+    }
+    written &= ::close(fd) == 0;
+#else
+    static std::atomic<unsigned> counter(0);
+    std::string temporary = path + "." + std::to_string(_getpid()) + "." + std::to_string(counter++) + ".tmp";
+    bool written;
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        written = bool(file.write(data.data(), data.size()));
+    }
+#endif
+    if (!written) {
+        std::remove(temporary.data());
+        throw std::runtime_error("Unable to write DNS cache snapshot: " + path);
+    }
+
+    return temporary;
+}
+
 // OBJECTS
 // -------
 
@@ -101,24 +592,693 @@ address_t::address_t(const addrinfo &info):
     family(info.ai_family),
     socket_type(info.ai_socktype),
     protocol(info.ai_protocol),
-    address(*info.ai_addr),
-    length(info.ai_addrlen)
-{}
+    length(std::min<size_t>(info.ai_addrlen, sizeof(address)))
+{
+    memset(&address, 0, sizeof(address));
+    memcpy(&address, info.ai_addr, length);
+}
 
 
 address_t::operator addrinfo() const
 {
     addrinfo info;
+    memset(&info, 0, sizeof(info));
     info.ai_family = family;
     info.ai_socktype = socket_type;
     info.ai_protocol = protocol;
-    info.ai_addr = const_cast<sockaddr*>(&address);
+    info.ai_addr = reinterpret_cast<sockaddr*>(const_cast<sockaddr_storage*>(&address));
     info.ai_addrlen = length;
 
     return info;
 }
 
 
+address_cache_t::address_cache_t(size_t capacity):
+    limit(std::max<size_t>(1, capacity / DNS_CACHE_SHARDS))
+{}
+
+
+address_cache_t::~address_cache_t()
+{
+    stop_refresh();
+}
+
+
+/**
+ *  \brief Get the addresses for a host, from the cache if possible.
+ *
+ *  Fresh and stale entries are returned as is, and stale entries are
+ *  refreshed in the background. Cached failures throw without a
+ *  lookup. Otherwise, the host is resolved and cached. If `cached`
+ *  is set, it records whether the addresses came from the cache.
+ */
+address_list_t address_cache_t::resolve(const std::string& host, const std::string& service, bool* cached)
+{
+    address_list_t addresses;
+    auto status = find(host, service, addresses);
+    if (cached) {
+        *cached = status == DNS_FRESH || status == DNS_STALE;
+    }
+
+    switch (status) {
+        case DNS_FRESH:
+            return addresses;
+        case DNS_STALE:
+            if (claim(cache_key(host, service))) {
+                queue_refresh(host, service);
+            }
+            return addresses;
+        case DNS_NEGATIVE:
+            throw std::runtime_error("Unable to get address from getaddrinfo(): " + host + service);
+        case DNS_MISSING:
+            /* fallthrough */
+        default:
+            return lookup(host, service);
+    }
+}
+
+
+/**
+ *  \brief Find the cached addresses for a host, without a lookup.
+ */
+dns_status_t address_cache_t::find(const std::string& host, const std::string& service, address_list_t& addresses) const
+{
+    auto key = cache_key(host, service);
+    auto &item = shard(key);
+    std::shared_lock<std::shared_timed_mutex> lock(item.mutex);
+    auto it = item.entries.find(key);
+    if (it == item.entries.end()) {
+        return DNS_MISSING;
+    }
+
+    auto &entry = it->second;
+    auto now = clock::now();
+    if (entry.addresses.empty()) {
+        return now < entry.expires ? DNS_NEGATIVE : DNS_MISSING;
+    } else if (now >= entry.expires + DNS_STALE_TIME) {
+        return DNS_MISSING;
+    }
+    addresses = entry.addresses;
+
+    return now < entry.expires ? DNS_FRESH : DNS_STALE;
+}
+
+
+/**
+ *  \brief Resolve and cache the addresses for many hosts in parallel.
+ *
+ *  Blocks until every lookup completes. Failures are cached, as for
+ *  `resolve()`, and otherwise ignored.
+ */
+void address_cache_t::prefetch(const dns_host_list_t& hosts)
+{
+    for_each_host(hosts, [this](const dns_host_t& host) {
+        try {
+            lookup(host.first, host.second);
+        } catch (...) {
+            // cached as a failure
+        }
+    });
+}
+
+
+/**
+ *  \brief Refresh `hosts` in the background, before they expire.
+ *
+ *  Every DNS_REFRESH_INTERVAL, hosts which are missing, or expire
+ *  within DNS_REFRESH_AHEAD, are resolved again, keeping the old
+ *  addresses if the lookup fails. Hosts with short TTLs are resolved
+ *  halfway through them instead, so each host is resolved at most
+ *  once per half DNS_MIN_TTL. Replaces the hosts of any running
+ *  refresh.
+ */
+void address_cache_t::start_refresh(const dns_host_list_t& hosts)
+{
+    std::lock_guard<std::mutex> lock(refresher_mutex);
+    if (refresher) {
+        std::lock_guard<std::mutex> guard(refresher->mutex);
+        refresher->hosts = hosts;
+        return;
+    }
+
+    auto state = std::make_shared<refresher_t>();
+    state->hosts = hosts;
+    refresher = state;
+    std::weak_ptr<address_cache_t> weak = shared_from_this();
+    std::thread([weak, state]() {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (!state->condition.wait_for(lock, DNS_REFRESH_INTERVAL, [&state]() { return state->stopped; })) {
+            auto hosts = state->hosts;
+            lock.unlock();
+            auto cache = weak.lock();
+            if (!cache) {
+                return;
+            }
+
+            dns_host_list_t expiring;
+            for (const auto &host: hosts) {
+                if (cache->expiring(host.first, host.second)) {
+                    expiring.emplace_back(host);
+                }
+            }
+            for_each_host(expiring, [&cache](const dns_host_t& host) {
+                cache->refresh(host.first, host.second);
+            });
+            cache.reset();
+            lock.lock();
+        }
+    }).detach();
+}
+
+
+void address_cache_t::stop_refresh()
+{
+    std::lock_guard<std::mutex> lock(refresher_mutex);
+    if (refresher) {
+        {
+            std::lock_guard<std::mutex> guard(refresher->mutex);
+            refresher->stopped = true;
+        }
+        refresher->condition.notify_all();
+        refresher.reset();
+    }
+}
+
+
+/**
+ *  \brief Save the unexpired entries to a file.
+ *
+ *  Expiry times are stored as Unix time, since the steady clock does
+ *  not carry over between processes. The file is replaced atomically
+ *  where the system allows, from a temporary file unique to the call,
+ *  so concurrent snapshots to the same path leave one of them intact.
+ */
+void address_cache_t::snapshot(const std::string& path) const
+{
+    auto now = clock::now();
+    auto wall = std::chrono::system_clock::now();
+    std::string data(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    pack(data, SNAPSHOT_VERSION);
+
+    std::string body;
+    uint32_t count = 0;
+    for (auto &item: shards) {
+        std::shared_lock<std::shared_timed_mutex> lock(item.mutex);
+        for (const auto &pair: item.entries) {
+            auto &entry = pair.second;
+            if (entry.expires <= now || pair.first.size() > UINT16_MAX) {
+                continue;
+            }
+            auto expires = wall + std::chrono::duration_cast<std::chrono::system_clock::duration>(entry.expires - now);
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(expires.time_since_epoch()).count();
+            pack<uint16_t>(body, static_cast<uint16_t>(pair.first.size()));
+            body += pair.first;
+            pack<int64_t>(body, seconds);
+            pack<uint16_t>(body, static_cast<uint16_t>(std::min<size_t>(entry.addresses.size(), UINT16_MAX)));
+            for (size_t i = 0; i < entry.addresses.size() && i < UINT16_MAX; ++i) {
+                pack_address(body, entry.addresses[i]);
+            }
+            ++count;
+        }
+    }
+    pack(data, count);
+    data += body;
+
+    std::string temporary = write_temporary(path, data);
+    if (std::rename(temporary.data(), path.data())) {
+        // Windows does not replace existing files
+        std::remove(path.data());
+        if (std::rename(temporary.data(), path.data())) {
+            std::remove(temporary.data());
+            throw std::runtime_error("Unable to write DNS cache snapshot: " + path);
+        }
+    }
+}
+
+
+/**
+ *  \brief Add the entries from a snapshot, returning the number added.
+ *
+ *  Entries which expired since the snapshot are dropped, and others
+ *  replace any cached entry for the same host. A missing file adds
+ *  nothing, and an invalid file throws without adding entries.
+ */
+size_t address_cache_t::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t offset = sizeof(SNAPSHOT_MAGIC);
+    uint8_t version;
+    uint32_t count;
+    bool valid = data.compare(0, sizeof(SNAPSHOT_MAGIC), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+    valid = valid && unpack(data, offset, version) && version == SNAPSHOT_VERSION;
+    valid = valid && unpack(data, offset, count);
+
+    auto now = clock::now();
+    auto wall = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::vector<std::pair<std::string, dns_entry_t>> entries;
+    for (uint32_t i = 0; valid && i < count; ++i) {
+        uint16_t length, addresses;
+        int64_t expires;
+        valid = unpack(data, offset, length) && offset + length <= data.size();
+        if (!valid) {
+            break;
+        }
+        std::string key = data.substr(offset, length);
+        offset += length;
+        valid = unpack(data, offset, expires) && unpack(data, offset, addresses);
+
+        dns_entry_t entry;
+        for (uint16_t j = 0; valid && j < addresses; ++j) {
+            address_t address;
+            valid = unpack_address(data, offset, address);
+            entry.addresses.emplace_back(address);
+        }
+        if (valid && expires > wall) {
+            entry.expires = now + std::chrono::seconds(expires - wall);
+            entry.renews = renewal(now, entry.expires);
+            entries.emplace_back(std::move(key), std::move(entry));
+        }
+    }
+    if (!valid) {
+        throw std::runtime_error("Invalid DNS cache snapshot: " + path);
+    }
+
+    for (auto &item: entries) {
+        store(item.first, std::move(item.second));
+    }
+
+    return entries.size();
+}
+
+
+/**
+ *  \brief Cache the addresses for a host, replacing any entry.
+ */
+void address_cache_t::insert(const std::string& host, const std::string& service, const address_list_t& addresses, std::chrono::seconds ttl)
+{
+    if (addresses.empty()) {
+        insert_failure(host, service);
+        return;
+    }
+
+    auto now = clock::now();
+    dns_entry_t entry;
+    entry.addresses = addresses;
+    entry.expires = now + ttl;
+    entry.renews = renewal(now, entry.expires);
+    store(cache_key(host, service), std::move(entry));
+}
+
+
+/**
+ *  \brief Cache a failed lookup for a host.
+ */
+void address_cache_t::insert_failure(const std::string& host, const std::string& service, std::chrono::seconds ttl)
+{
+    dns_entry_t entry;
+    entry.expires = clock::now() + ttl;
+    store(cache_key(host, service), std::move(entry));
+}
+
+
+void address_cache_t::erase(const std::string& host, const std::string& service)
+{
+    auto key = cache_key(host, service);
+    auto &item = shard(key);
+    std::lock_guard<std::shared_timed_mutex> lock(item.mutex);
+    item.entries.erase(key);
+}
+
+
+void address_cache_t::clear()
+{
+    for (auto &item: shards) {
+        std::lock_guard<std::shared_timed_mutex> lock(item.mutex);
+        item.entries.clear();
+    }
+}
+
+
+size_t address_cache_t::size() const
+{
+    size_t count = 0;
+    for (auto &item: shards) {
+        std::shared_lock<std::shared_timed_mutex> lock(item.mutex);
+        count += item.entries.size();
+    }
+
+    return count;
+}
+
+
+size_t address_cache_t::capacity() const
+{
+    return limit * DNS_CACHE_SHARDS;
+}
+
+
+/**
+ *  \brief Resolve hosts with `resolver`, or getaddrinfo if null.
+ */
+void address_cache_t::set_resolver(std::shared_ptr<dns_resolver_t> resolver)
+{
+    std::atomic_store(&this->resolver, resolver);
+}
+
+
+std::shared_ptr<dns_resolver_t> address_cache_t::get_resolver() const
+{
+    return std::atomic_load(&resolver);
+}
+
+
+auto address_cache_t::shard(const std::string& key) -> shard_t&
+{
+    return shards[std::hash<std::string>()(key) % DNS_CACHE_SHARDS];
+}
+
+
+auto address_cache_t::shard(const std::string& key) const -> const shard_t&
+{
+    return shards[std::hash<std::string>()(key) % DNS_CACHE_SHARDS];
+}
+
+
+/**
+ *  \brief Store an entry, evicting another if the shard is full.
+ *
+ *  Entries past their stale time are dropped first, and otherwise
+ *  the entry closest to expiry is evicted.
+ */
+void address_cache_t::store(const std::string& key, dns_entry_t&& entry)
+{
+    auto &item = shard(key);
+    std::lock_guard<std::shared_timed_mutex> lock(item.mutex);
+    auto &entries = item.entries;
+    if (entries.size() >= limit && entries.find(key) == entries.end()) {
+        auto now = clock::now();
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            if (now >= it->second.expires + DNS_STALE_TIME) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (entries.size() >= limit && entries.find(key) == entries.end()) {
+        auto oldest = std::min_element(entries.begin(), entries.end(), [](const std::pair<const std::string, dns_entry_t>& left, const std::pair<const std::string, dns_entry_t>& right) {
+            return left.second.expires < right.second.expires;
+        });
+        entries.erase(oldest);
+    }
+    entries[key] = std::move(entry);
+}
+
+
+/**
+ *  \brief Mark a stale entry as refreshing, returning false if a
+ *  refresh is already running.
+ */
+bool address_cache_t::claim(const std::string& key)
+{
+    auto &item = shard(key);
+    std::lock_guard<std::shared_timed_mutex> lock(item.mutex);
+    auto it = item.entries.find(key);
+    if (it == item.entries.end() || it->second.refreshing) {
+        return false;
+    }
+    it->second.refreshing = true;
+
+    return true;
+}
+
+
+/**
+ *  \brief Refresh a claimed entry in the background.
+ *
+ *  Refreshes are queued for up to DNS_STALE_THREADS workers, which
+ *  exit once the queue is drained. Each entry is claimed once, so the
+ *  queue never exceeds the capacity.
+ */
+void address_cache_t::queue_refresh(const std::string& host, const std::string& service)
+{
+    {
+        std::lock_guard<std::mutex> lock(stale_mutex);
+        stale.emplace_back(host, service);
+        if (stale_workers >= DNS_STALE_THREADS) {
+            return;
+        }
+        ++stale_workers;
+    }
+
+    auto self = shared_from_this();
+    std::thread([self]() {
+        while (true) {
+            dns_host_t item;
+            {
+                std::lock_guard<std::mutex> lock(self->stale_mutex);
+                if (self->stale.empty()) {
+                    --self->stale_workers;
+                    return;
+                }
+                item = std::move(self->stale.back());
+                self->stale.pop_back();
+            }
+            self->refresh(item.first, item.second);
+        }
+    }).detach();
+}
+
+
+/**
+ *  \brief Check if a host is missing, or due to be refreshed.
+ *
+ *  Cached failures are left to expire first.
+ */
+bool address_cache_t::expiring(const std::string& host, const std::string& service) const
+{
+    auto key = cache_key(host, service);
+    auto &item = shard(key);
+    std::shared_lock<std::shared_timed_mutex> lock(item.mutex);
+    auto it = item.entries.find(key);
+    if (it == item.entries.end()) {
+        return true;
+    } else if (it->second.addresses.empty()) {
+        return clock::now() >= it->second.expires;
+    }
+
+    return clock::now() >= it->second.renews;
+}
+
+
+/**
+ *  \brief Replace an entry, keeping it if the lookup fails.
+ *
+ *  Kept entries are not refreshed again for DNS_NEGATIVE_TTL.
+ */
+void address_cache_t::refresh(const std::string& host, const std::string& service)
+{
+    try {
+        std::chrono::seconds ttl;
+        auto addresses = lookup(host, service, ttl);
+        insert(host, service, addresses, ttl);
+    } catch (...) {
+        auto key = cache_key(host, service);
+        auto &item = shard(key);
+        {
+            std::lock_guard<std::shared_timed_mutex> lock(item.mutex);
+            auto it = item.entries.find(key);
+            if (it != item.entries.end()) {
+                it->second.refreshing = false;
+                it->second.renews = clock::now() + DNS_NEGATIVE_TTL;
+                return;
+            }
+        }
+        insert_failure(host, service);
+    }
+}
+
+
+/**
+ *  \brief Resolve a host without caching, with the TTL to cache it for.
+ */
+address_list_t address_cache_t::lookup(const std::string& host, const std::string& service, std::chrono::seconds& ttl) const
+{
+    ttl = DNS_TTL;
+#ifndef _WIN32
+    auto resolver = get_resolver();
+    if (resolver && !system_host(host)) {
+        auto addresses = resolver->resolve(host, service, &ttl);
+        ttl = std::max(ttl, DNS_MIN_TTL);
+        return addresses;
+    }
+#endif
+
+    return lookup_addresses(host, service);
+}
+
+
+/**
+ *  \brief Resolve a host and cache the result, including failures.
+ */
+address_list_t address_cache_t::lookup(const std::string& host, const std::string& service)
+{
+    address_list_t addresses;
+    std::chrono::seconds ttl;
+    try {
+        addresses = lookup(host, service, ttl);
+    } catch (...) {
+        insert_failure(host, service);
+        throw;
+    }
+    insert(host, service, addresses, ttl);
+
+    return addresses;
+}
+
+
+dns_overrides_t::dns_overrides_t(std::initializer_list<std::pair<std::string, std::string>> list)
+{
+    for (const auto &item: list) {
+        add(item.first, item.second);
+    }
+}
+
+
+/**
+ *  \brief Use `addresses` for a host, replacing any entry.
+ *
+ *  \param host             Host and port, "example.com:443", or "example.com" for every port
+ *  \param addresses        Numeric addresses, "192.0.2.1,[2001:db8::1]"
+ */
+void dns_overrides_t::add(const std::string& host, const std::string& addresses)
+{
+    std::string name, port;
+    split_host(host, name, port);
+    if (name.empty() || (!port.empty() && !std::all_of(port.begin(), port.end(), ::isdigit))) {
+        throw std::runtime_error("Invalid host for address override: " + host);
+    }
+
+    address_list_t list;
+    std::istringstream stream(addresses);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        address_t address;
+        if (!numeric_address(item, address)) {
+            throw std::runtime_error("Invalid address for host override: " + item);
+        }
+        list.emplace_back(address);
+    }
+    if (list.empty()) {
+        throw std::runtime_error("No addresses to override host: " + host);
+    }
+
+    auto key = host_key(name);
+    if (!port.empty()) {
+        key += ":" + std::to_string(std::stoul(port));
+    }
+    modify()[key] = std::move(list);
+}
+
+
+/**
+ *  \brief Add the entries of a hosts file, for every port.
+ *
+ *  Invalid lines are skipped, and names listed more than once keep
+ *  every address, in order. A missing file adds no entries.
+ */
+void dns_overrides_t::load_hosts(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line, value, name;
+    while (std::getline(file, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        address_t address;
+        if (!(words >> value) || !numeric_address(value, address)) {
+            continue;
+        }
+        auto &map = modify();
+        while (words >> name) {
+            map[host_key(name)].emplace_back(address);
+        }
+    }
+}
+
+
+void dns_overrides_t::clear()
+{
+    entries.reset();
+}
+
+
+/**
+ *  \brief Find the addresses for a host, preferring entries for its port.
+ */
+bool dns_overrides_t::find(const std::string& host, const std::string& service, address_list_t& addresses) const
+{
+    if (empty()) {
+        return false;
+    }
+
+    std::string name, port;
+    split_host(host, name, port);
+    uint16_t number = service_port(port.empty() ? service : port);
+    auto key = host_key(name);
+    auto it = entries->find(key + ":" + std::to_string(number));
+    if (it == entries->end()) {
+        it = entries->find(key);
+    }
+    if (it == entries->end()) {
+        return false;
+    }
+
+    addresses = it->second;
+    for (auto &address: addresses) {
+        set_port(address, number);
+    }
+
+    return true;
+}
+
+
+size_t dns_overrides_t::size() const
+{
+    return entries ? entries->size() : 0;
+}
+
+
+bool dns_overrides_t::empty() const
+{
+    return size() == 0;
+}
+
+
+dns_overrides_t::operator bool() const
+{
+    return !empty();
+}
+
+
+/**
+ *  \brief Get the entries for modification, copying shared entries.
+ */
+auto dns_overrides_t::modify() -> map_t&
+{
+    if (!entries) {
+        entries = std::make_shared<map_t>();
+    } else if (entries.use_count() > 1) {
+        entries = std::make_shared<map_t>(*entries);
+    }
+
+    return *entries;
+}
+
+
 dns_lookup_t::dns_lookup_t(const std::string &host, const std::string &service)
 {
     // initialize our hints
@@ -167,6 +1327,118 @@ address_iterator_t dns_lookup_t::end() const
     return address_iterator_t(nullptr);
 }
 
+// FUNCTIONS
+// ---------
+
+
+void sort_addresses(address_list_t& addresses)
+{
+    if (addresses.size() < 2) {
+        return;
+    }
+
+    std::vector<destination_t> destinations;
+    destinations.reserve(addresses.size());
+    for (const auto &address: addresses) {
+        destinations.emplace_back(make_destination(address));
+    }
+    std::stable_sort(destinations.begin(), destinations.end(), prefer);
+
+    // interleave families, starting with the most preferred
+    int family = destinations.front().address.family;
+    address_list_t first, second;
+    for (const auto &destination: destinations) {
+        auto &list = destination.address.family == family ? first : second;
+        list.emplace_back(destination.address);
+    }
+
+    addresses.clear();
+    for (size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+        if (i < first.size()) {
+            addresses.emplace_back(first[i]);
+        }
+        if (i < second.size()) {
+            addresses.emplace_back(second[i]);
+        }
+    }
+}
+
+
+address_list_t lookup_addresses(const std::string& host, const std::string& service)
+{
+    address_list_t addresses;
+    for (auto &&info: dns_lookup_t(host, service)) {
+        addresses.emplace_back(info);
+    }
+    sort_addresses(addresses);
+
+    return addresses;
+}
+
+
+bool system_host(const std::string& host)
+{
+    static const dns_overrides_t hosts = [] {
+        dns_overrides_t overrides;
+        overrides.load_hosts();
+        return overrides;
+    }();
+
+    std::string name, port;
+    split_host(host, name, port);
+    address_list_t addresses;
+    return name.find('.') == std::string::npos || hosts.find(name, "http", addresses);
+}
+
+
+void split_host(const std::string& value, std::string& host, std::string& port)
+{
+    port.clear();
+    if (!value.empty() && value.front() == '[') {
+        size_t end = value.find(']');
+        host = value.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+        if (end != std::string::npos && end + 1 < value.size() && value[end+1] == ':') {
+            port = value.substr(end + 2);
+        }
+    } else if (std::count(value.begin(), value.end(), ':') == 1) {
+        size_t index = value.find(':');
+        host = value.substr(0, index);
+        port = value.substr(index + 1);
+    } else {
+        host = value;
+    }
+}
+
+
+uint16_t service_port(const std::string& service)
+{
+    if (service == "http") {
+        return 80;
+    } else if (service == "https") {
+        return 443;
+    } else if (!service.empty() && std::all_of(service.begin(), service.end(), ::isdigit)) {
+        return static_cast<uint16_t>(std::stoul(service));
+    }
+
+    servent *entry = ::getservbyname(service.data(), "tcp");
+    if (!entry) {
+        throw std::runtime_error("Unknown service: " + service);
+    }
+    return ntohs(static_cast<uint16_t>(entry->s_port));
+}
+
+
+dns_cache_t create_dns_cache(const dns_host_list_t& hosts, bool refresh, size_t capacity)
+{
+    auto cache = create_dns_cache(capacity);
+    cache->prefetch(hosts);
+    if (refresh) {
+        cache->start_refresh(hosts);
+    }
+
+    return cache;
+}
+
 LATTICE_END_NAMESPACE
 
 #ifdef _MSC_VER
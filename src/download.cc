@@ -0,0 +1,425 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Download response bodies directly to files.
+ */
+
+#include <lattice/download.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#   include <pycpp/string/unicode.h>
+#   include <fcntl.h>
+#   include <io.h>
+#   include <malloc.h>
+#   include <sys/stat.h>
+#else
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Alignment of buffers and offsets for direct I/O.
+ */
+static constexpr size_t DIRECT_ALIGNMENT = 4096;
+
+/**
+ *  \brief Size of each aligned block written with direct I/O.
+ */
+static constexpr size_t DIRECT_BLOCK_SIZE = 1 << 20;
+
+// FUNCTIONS
+// ---------
+
+#if defined(_WIN32)
+
+
+/**
+ *  Direct I/O is not supported, and files are always buffered.
+ */
+static int open_output(const std::string& path, bool, bool& direct)
+{
+    auto utf16 = PYCPP_NAMESPACE::utf8_to_utf16(path);
+    auto *name = reinterpret_cast<const wchar_t*>(utf16.data());
+    direct = false;
+
+    return ::_wopen(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+
+
+static void close_output(int fd)
+{
+    ::_close(fd);
+}
+
+
+static int64_t tell_output(int fd)
+{
+    return ::_lseeki64(fd, 0, SEEK_CUR);
+}
+
+
+static long write_output(int fd, const char *data, size_t size)
+{
+    unsigned count = static_cast<unsigned>(std::min<size_t>(size, 1 << 30));
+    return ::_write(fd, data, count);
+}
+
+
+static bool allocate_output(int fd, int64_t start, uint64_t length)
+{
+    return ::_chsize_s(fd, start + length) == 0;
+}
+
+
+static bool truncate_output(int fd, int64_t length)
+{
+    return ::_chsize_s(fd, length) == 0;
+}
+
+
+static void end_direct_output(int)
+{}
+
+
+static bool sync_output(int fd)
+{
+    return ::_commit(fd) == 0;
+}
+
+
+static char * allocate_block()
+{
+    return static_cast<char*>(::_aligned_malloc(DIRECT_BLOCK_SIZE, DIRECT_ALIGNMENT));
+}
+
+
+static void free_block(char *block)
+{
+    ::_aligned_free(block);
+}
+
+#else                           // POSIX
+
+
+/**
+ *  Filesystems that reject `O_DIRECT` fall back to buffered writes.
+ *  On macOS, which has no `O_DIRECT`, caching is disabled instead,
+ *  which does not require aligned writes.
+ */
+static int open_output(const std::string& path, bool request_direct, bool& direct)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = -1;
+    direct = false;
+#if defined(O_DIRECT)
+    if (request_direct) {
+        fd = ::open(path.data(), flags | O_DIRECT, 0644);
+        direct = fd >= 0;
+    }
+#endif
+    if (fd < 0) {
+        fd = ::open(path.data(), flags, 0644);
+    }
+#if defined(F_NOCACHE)
+    if (fd >= 0 && request_direct) {
+        ::fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
+
+    return fd;
+}
+
+
+static void close_output(int fd)
+{
+    ::close(fd);
+}
+
+
+/**
+ *  \brief Get the position data will be written at.
+ *
+ *  Returns -1 for pipes and sockets, and for files opened for
+ *  appending, since preallocating them would move the end of file.
+ */
+static int64_t tell_output(int fd)
+{
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || (flags & O_APPEND)) {
+        return -1;
+    }
+    return static_cast<int64_t>(::lseek(fd, 0, SEEK_CUR));
+}
+
+
+static long write_output(int fd, const char *data, size_t size)
+{
+    return static_cast<long>(::write(fd, data, size));
+}
+
+
+/**
+ *  Preallocation is a hint to reduce fragmentation, and failures,
+ *  like on filesystems without support, are ignored.
+ */
+static bool allocate_output(int fd, int64_t start, uint64_t length)
+{
+#if defined(__linux__)
+    return ::fallocate(fd, 0, static_cast<off_t>(start), static_cast<off_t>(length)) == 0;
+#else
+    return false;
+#endif
+}
+
+
+static bool truncate_output(int fd, int64_t length)
+{
+    return ::ftruncate(fd, static_cast<off_t>(length)) == 0;
+}
+
+
+/**
+ *  \brief Clear `O_DIRECT`, so an unaligned tail may be written.
+ */
+static void end_direct_output(int fd)
+{
+#if defined(O_DIRECT)
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) {
+        ::fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+#endif
+}
+
+
+static bool sync_output(int fd)
+{
+#if defined(__APPLE__)
+    return ::fsync(fd) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+
+static char * allocate_block()
+{
+    void *memory = nullptr;
+    if (::posix_memalign(&memory, DIRECT_ALIGNMENT, DIRECT_BLOCK_SIZE)) {
+        return nullptr;
+    }
+    return static_cast<char*>(memory);
+}
+
+
+static void free_block(char *block)
+{
+    std::free(block);
+}
+
+#endif
+
+// OBJECTS
+// -------
+
+
+download_t::download_t(const std::string& path, download_flags_t flags):
+    path_(path),
+    flags_(flags)
+{}
+
+
+download_t::download_t(int fd, download_flags_t flags):
+    fd_(fd),
+    flags_(flags)
+{}
+
+
+const std::string& download_t::path() const
+{
+    return path_;
+}
+
+
+int download_t::fd() const
+{
+    return fd_;
+}
+
+
+download_flags_t download_t::flags() const
+{
+    return flags_;
+}
+
+
+download_t::operator bool() const
+{
+    return !path_.empty() || fd_ >= 0;
+}
+
+
+/**
+ *  Direct I/O is only used for files opened from a path, since it
+ *  changes the file status flags, which are shared with the caller's
+ *  descriptor.
+ */
+file_writer_t::file_writer_t(const download_t& download):
+    sync(!!(download.flags() & DOWNLOAD_SYNC))
+{
+    if (!download.path().empty()) {
+        bool direct = !!(download.flags() & DOWNLOAD_DIRECT);
+        fd_ = open_output(download.path(), direct, direct_);
+        if (fd_ < 0) {
+            throw std::runtime_error("Unable to open file " + download.path() + ".");
+        }
+        owned = true;
+        start = 0;
+    } else if ((fd_ = download.fd()) >= 0) {
+        start = tell_output(fd_);
+    } else {
+        throw std::runtime_error("Download has no destination.");
+    }
+
+    if (direct_ && !(block = allocate_block())) {
+        close_output(fd_);
+        throw std::bad_alloc();
+    }
+}
+
+
+file_writer_t::~file_writer_t()
+{
+    if (owned) {
+        close_output(fd_);
+    }
+    if (block) {
+        free_block(block);
+    }
+}
+
+
+/**
+ *  \brief Reserve space for a body of known length.
+ */
+void file_writer_t::allocate(uint64_t length)
+{
+    if (start >= 0 && length && allocate_output(fd_, start, length)) {
+        allocated = length;
+    }
+}
+
+
+/**
+ *  With direct I/O, data is staged in an aligned block, and only
+ *  full blocks are written until the download finishes.
+ */
+void file_writer_t::write(const char *data, size_t size)
+{
+    written += size;
+    if (!direct_) {
+        write_all(data, size);
+        return;
+    }
+
+    while (size) {
+        size_t count = std::min(size, DIRECT_BLOCK_SIZE - used);
+        std::memcpy(block + used, data, count);
+        used += count;
+        data += count;
+        size -= count;
+        if (used == DIRECT_BLOCK_SIZE) {
+            write_all(block, used);
+            used = 0;
+        }
+    }
+}
+
+
+/**
+ *  \brief Record data written directly to the file descriptor.
+ */
+void file_writer_t::advance(size_t size)
+{
+    written += size;
+}
+
+
+/**
+ *  \brief Flush staged data, and trim any unused preallocated space.
+ */
+void file_writer_t::finish()
+{
+    if (used) {
+        end_direct_output(fd_);
+        write_all(block, used);
+        used = 0;
+    }
+    if (allocated > written && !truncate_output(fd_, start + written)) {
+        throw std::runtime_error("Unable to truncate file.");
+    }
+    allocated = 0;
+    if (sync && !sync_output(fd_)) {
+        throw std::runtime_error("Unable to sync file.");
+    }
+}
+
+
+int file_writer_t::fd() const
+{
+    return fd_;
+}
+
+
+/**
+ *  \brief Get the number of bytes of the body written.
+ */
+uint64_t file_writer_t::size() const
+{
+    return written;
+}
+
+
+bool file_writer_t::direct() const
+{
+    return direct_;
+}
+
+
+/**
+ *  \brief Check if data may be written directly to the descriptor.
+ */
+bool file_writer_t::spliceable() const
+{
+    return !direct_;
+}
+
+
+void file_writer_t::write_all(const char *data, size_t size)
+{
+    while (size) {
+        long count = write_output(fd_, data, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            throw std::runtime_error("Unable to write to file.");
+        }
+        data += count;
+        size -= count;
+    }
+}
+
+LATTICE_END_NAMESPACE
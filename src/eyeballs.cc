@@ -0,0 +1,268 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Parallel connection attempts over many addresses.
+ */
+
+#include <lattice/eyeballs.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <poll.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#   include <cerrno>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+// TYPES
+// -----
+
+#ifdef _WIN32
+    typedef WSAPOLLFD poll_descriptor_t;
+#else
+    typedef pollfd poll_descriptor_t;
+#endif
+
+typedef std::chrono::steady_clock steady_clock;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Connection attempt in progress.
+ */
+struct attempt_t
+{
+    socket_handle_t sock;
+    size_t index;
+};
+
+
+enum attempt_status_t
+{
+    ATTEMPT_FAILED,
+    ATTEMPT_PENDING,
+    ATTEMPT_CONNECTED,
+};
+
+// HELPERS
+// -------
+
+#ifdef _WIN32
+
+
+static bool valid_socket(socket_handle_t sock)
+{
+    return sock != INVALID_SOCKET;
+}
+
+
+static void close_socket(socket_handle_t sock)
+{
+    ::closesocket(sock);
+}
+
+
+static bool connect_in_progress()
+{
+    return ::WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+
+static int socket_error(socket_handle_t sock)
+{
+    int error = 0;
+    int length = sizeof(error);
+    if (::getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length)) {
+        return -1;
+    }
+    return error;
+}
+
+
+static int poll_sockets(std::vector<poll_descriptor_t>& descriptors, int timeout)
+{
+    return ::WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), timeout);
+}
+
+#else
+
+
+static bool valid_socket(socket_handle_t sock)
+{
+    return sock >= 0;
+}
+
+
+static void close_socket(socket_handle_t sock)
+{
+    ::close(sock);
+}
+
+
+static bool connect_in_progress()
+{
+    return errno == EINPROGRESS;
+}
+
+
+static int socket_error(socket_handle_t sock)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length)) {
+        return -1;
+    }
+    return error;
+}
+
+
+static int poll_sockets(std::vector<poll_descriptor_t>& descriptors, int timeout)
+{
+    int count;
+    do {
+        count = ::poll(descriptors.data(), descriptors.size(), timeout);
+    } while (count < 0 && errno == EINTR);
+    return count;
+}
+
+#endif
+
+
+/**
+ *  \brief Start a non-blocking connection to `address`.
+ */
+static attempt_status_t start_attempt(const address_t& address, socket_handle_t& sock)
+{
+    sock = ::socket(address.family, address.socket_type, address.protocol);
+    if (!valid_socket(sock)) {
+        return ATTEMPT_FAILED;
+    }
+
+    auto *destination = reinterpret_cast<const sockaddr*>(&address.address);
+    auto length = static_cast<socklen_t>(address.length);
+    if (set_blocking(sock, false)) {
+        if (::connect(sock, destination, length) == 0) {
+            return ATTEMPT_CONNECTED;
+        } else if (connect_in_progress()) {
+            return ATTEMPT_PENDING;
+        }
+    }
+
+    close_socket(sock);
+    return ATTEMPT_FAILED;
+}
+
+
+/**
+ *  \brief Get the milliseconds until `time`, rounded up.
+ */
+static int milliseconds_until(steady_clock::time_point time)
+{
+    auto remaining = time - steady_clock::now();
+    if (remaining <= steady_clock::duration::zero()) {
+        return 0;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count();
+    return static_cast<int>(ms) + 1;
+}
+
+// FUNCTIONS
+// ---------
+
+
+bool connect_any(const address_list_t& addresses,
+    socket_handle_t& sock,
+    size_t& index,
+    std::chrono::milliseconds timeout,
+    std::chrono::milliseconds delay)
+{
+    std::vector<attempt_t> attempts;
+    std::vector<poll_descriptor_t> descriptors;
+    auto due = steady_clock::now();
+    auto deadline = due + timeout;
+    size_t next = 0;
+    bool connected = false;
+
+    while (!connected) {
+        if (timeout.count() > 0 && steady_clock::now() >= deadline) {
+            break;
+        }
+
+        // start the next attempt, once due or if none are in progress
+        if (next < addresses.size() && (attempts.empty() || steady_clock::now() >= due)) {
+            socket_handle_t attempt;
+            size_t current = next++;
+            switch (start_attempt(addresses[current], attempt)) {
+                case ATTEMPT_CONNECTED:
+                    sock = attempt;
+                    index = current;
+                    connected = true;
+                    break;
+                case ATTEMPT_PENDING:
+                    attempts.push_back({attempt, current});
+                    due = steady_clock::now() + delay;
+                    break;
+                case ATTEMPT_FAILED:
+                    due = steady_clock::now();
+                    break;
+            }
+            continue;
+        } else if (attempts.empty()) {
+            break;
+        }
+
+        // wait for an attempt to complete, the next to be due, or the deadline
+        int wait = next < addresses.size() ? milliseconds_until(due) : -1;
+        if (timeout.count() > 0) {
+            int remaining = milliseconds_until(deadline);
+            wait = wait < 0 ? remaining : std::min(wait, remaining);
+        }
+        descriptors.resize(attempts.size());
+        for (size_t i = 0; i < attempts.size(); ++i) {
+            descriptors[i].fd = attempts[i].sock;
+            descriptors[i].events = POLLOUT;
+            descriptors[i].revents = 0;
+        }
+        if (poll_sockets(descriptors, wait) < 0) {
+            break;
+        }
+
+        for (size_t i = descriptors.size(); i-- > 0; ) {
+            if (!descriptors[i].revents) {
+                continue;
+            }
+            bool failed = descriptors[i].revents & (POLLERR | POLLHUP);
+            if (!failed && socket_error(attempts[i].sock) == 0) {
+                sock = attempts[i].sock;
+                index = attempts[i].index;
+                attempts.erase(attempts.begin() + i);
+                connected = true;
+                break;
+            }
+            close_socket(attempts[i].sock);
+            attempts.erase(attempts.begin() + i);
+            due = steady_clock::now();
+        }
+    }
+
+    // cancel the remaining attempts
+    for (const auto &attempt: attempts) {
+        close_socket(attempt.sock);
+    }
+    if (connected && !set_blocking(sock, true)) {
+        close_socket(sock);
+        connected = false;
+    }
+
+    return connected;
+}
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,596 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HPACK header compression for HTTP/2.
+ */
+
+#include <lattice/hpack.h>
+#include <algorithm>
+#include <stdexcept>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Size overhead of each dynamic table entry.
+ */
+static constexpr size_t ENTRY_OVERHEAD = 32;
+
+/**
+ *  \brief Largest integer accepted in a header block.
+ */
+static constexpr uint64_t MAX_INTEGER = 1 << 28;
+
+/**
+ *  \brief Huffman code and code length for each octet, and for EOS.
+ */
+static const struct {
+    uint32_t code;
+    uint8_t bits;
+} HUFFMAN[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+static const hpack_field_t STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static constexpr size_t STATIC_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Canonical Huffman decoding tables, indexed by code length.
+ *
+ *  The HPACK code is canonical, so codes of the same length are
+ *  consecutive, and sort as their symbols do.
+ */
+struct huffman_tables_t
+{
+    uint32_t first[31] = {};
+    uint32_t count[31] = {};
+    uint16_t offset[31] = {};
+    uint16_t symbols[257];
+
+    huffman_tables_t()
+    {
+        uint16_t index = 0;
+        for (uint8_t bits = 5; bits <= 30; ++bits) {
+            offset[bits] = index;
+            for (uint16_t symbol = 0; symbol < 257; ++symbol) {
+                if (HUFFMAN[symbol].bits == bits) {
+                    if (!count[bits]) {
+                        first[bits] = HUFFMAN[symbol].code;
+                    }
+                    ++count[bits];
+                    symbols[index++] = symbol;
+                }
+            }
+        }
+    }
+};
+
+
+static const huffman_tables_t& huffman_tables()
+{
+    static const huffman_tables_t tables;
+    return tables;
+}
+
+
+static void invalid_block(const char *message)
+{
+    throw std::runtime_error(std::string("Invalid HPACK header block: ") + message);
+}
+
+
+static void encode_integer(uint64_t value, uint8_t prefix, uint8_t flags, std::string& output)
+{
+    uint64_t limit = (1 << prefix) - 1;
+    if (value < limit) {
+        output.push_back(static_cast<char>(flags | value));
+        return;
+    }
+
+    output.push_back(static_cast<char>(flags | limit));
+    value -= limit;
+    while (value >= 128) {
+        output.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+
+static uint64_t decode_integer(const uint8_t*& first, const uint8_t* last, uint8_t prefix)
+{
+    uint64_t limit = (1 << prefix) - 1;
+    uint64_t value = *first++ & limit;
+    if (value < limit) {
+        return value;
+    }
+
+    for (unsigned shift = 0; ; shift += 7) {
+        if (first == last) {
+            invalid_block("truncated integer");
+        }
+        // zero continuation bytes never grow the value past MAX_INTEGER
+        if (shift > 28) {
+            invalid_block("integer overflow");
+        }
+        uint8_t byte = *first++;
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (value > MAX_INTEGER) {
+            invalid_block("integer overflow");
+        }
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+
+static void encode_string(const std::string& string, std::string& output)
+{
+    size_t length = huffman_length(string);
+    if (length < string.size()) {
+        encode_integer(length, 7, 0x80, output);
+        huffman_encode(string, output);
+    } else {
+        encode_integer(string.size(), 7, 0, output);
+        output += string;
+    }
+}
+
+
+static std::string decode_string(const uint8_t*& first, const uint8_t* last)
+{
+    if (first == last) {
+        invalid_block("truncated string");
+    }
+    bool huffman = *first & 0x80;
+    uint64_t length = decode_integer(first, last, 7);
+    if (length > static_cast<uint64_t>(last - first)) {
+        invalid_block("truncated string");
+    }
+
+    auto data = reinterpret_cast<const char*>(first);
+    first += length;
+    if (huffman) {
+        return huffman_decode(data, length);
+    }
+    return std::string(data, length);
+}
+
+
+static bool is_sensitive(const std::string& name)
+{
+    return name == "authorization" || name == "proxy-authorization" || name == "cookie";
+}
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Add entry to the dynamic table, evicting older entries.
+ */
+void hpack_table_t::add(const std::string& name, const std::string& value)
+{
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    if (size > limit_) {
+        evict(0);
+        return;
+    }
+
+    evict(limit_ - size);
+    fields.emplace_front(name, value);
+    size_ += size;
+}
+
+
+/**
+ *  \brief Set the maximum size of the dynamic table.
+ */
+void hpack_table_t::resize(size_t limit)
+{
+    limit_ = limit;
+    evict(limit);
+}
+
+
+/**
+ *  \brief Get field at a one-based index into the static and dynamic tables.
+ */
+const hpack_field_t& hpack_table_t::at(size_t index) const
+{
+    if (index == 0 || index > STATIC_SIZE + fields.size()) {
+        invalid_block("index out of range");
+    } else if (index <= STATIC_SIZE) {
+        return STATIC_TABLE[index - 1];
+    }
+    return fields[index - STATIC_SIZE - 1];
+}
+
+
+/**
+ *  \brief Find index of a field, or of its name, or 0 if not present.
+ */
+size_t hpack_table_t::find(const std::string& name, const std::string& value, bool& exact) const
+{
+    size_t match = 0;
+    exact = false;
+    for (size_t i = 0; i < STATIC_SIZE; ++i) {
+        if (STATIC_TABLE[i].first == name) {
+            if (STATIC_TABLE[i].second == value) {
+                exact = true;
+                return i + 1;
+            }
+            match = match ? match : i + 1;
+        }
+    }
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i].first == name) {
+            if (fields[i].second == value) {
+                exact = true;
+                return STATIC_SIZE + i + 1;
+            }
+            match = match ? match : STATIC_SIZE + i + 1;
+        }
+    }
+
+    return match;
+}
+
+
+size_t hpack_table_t::size() const
+{
+    return size_;
+}
+
+
+size_t hpack_table_t::limit() const
+{
+    return limit_;
+}
+
+
+size_t hpack_table_t::entries() const
+{
+    return fields.size();
+}
+
+
+void hpack_table_t::evict(size_t limit)
+{
+    while (size_ > limit) {
+        auto &field = fields.back();
+        size_ -= field.first.size() + field.second.size() + ENTRY_OVERHEAD;
+        fields.pop_back();
+    }
+}
+
+
+/**
+ *  \brief Append header block for the fields to `output`.
+ *
+ *  Field names must be lowercase, as required by HTTP/2.
+ */
+void hpack_encoder_t::encode(const hpack_fields_t& fields, std::string& output)
+{
+    if (pending) {
+        encode_integer(update, 5, 0x20, output);
+        pending = false;
+    }
+
+    for (const auto &field: fields) {
+        bool exact;
+        size_t index = table_.find(field.first, field.second, exact);
+        if (exact) {
+            encode_integer(index, 7, 0x80, output);
+            continue;
+        }
+
+        bool sensitive = is_sensitive(field.first);
+        if (sensitive) {
+            encode_integer(index, 4, 0x10, output);
+        } else {
+            encode_integer(index, 6, 0x40, output);
+        }
+        if (!index) {
+            encode_string(field.first, output);
+        }
+        encode_string(field.second, output);
+        if (!sensitive) {
+            table_.add(field.first, field.second);
+        }
+    }
+}
+
+
+/**
+ *  \brief Set the dynamic table size allowed by the peer.
+ *
+ *  The encoder never uses more than the default table size, and
+ *  signals the change at the start of the next header block.
+ */
+void hpack_encoder_t::set_table_size(size_t size)
+{
+    size = std::min(size, HPACK_TABLE_SIZE);
+    if (size != table_.limit()) {
+        table_.resize(size);
+        update = size;
+        pending = true;
+    }
+}
+
+
+const hpack_table_t& hpack_encoder_t::table() const
+{
+    return table_;
+}
+
+
+/**
+ *  \brief Decode a complete header block, appending to `fields`.
+ */
+void hpack_decoder_t::decode(const char *data, size_t length, hpack_fields_t& fields)
+{
+    auto first = reinterpret_cast<const uint8_t*>(data);
+    auto last = first + length;
+    bool start = true;
+    while (first < last) {
+        uint8_t byte = *first;
+        if (byte & 0x80) {
+            // indexed header field
+            fields.emplace_back(table_.at(decode_integer(first, last, 7)));
+        } else if ((byte & 0xe0) == 0x20) {
+            // dynamic table size update
+            uint64_t size = decode_integer(first, last, 5);
+            if (!start || size > limit) {
+                invalid_block("unexpected table size update");
+            }
+            table_.resize(size);
+            continue;
+        } else {
+            // literal header field
+            bool indexing = (byte & 0xc0) == 0x40;
+            uint64_t index = decode_integer(first, last, indexing ? 6 : 4);
+            std::string name = index ? table_.at(index).first : decode_string(first, last);
+            std::string value = decode_string(first, last);
+            if (indexing) {
+                table_.add(name, value);
+            }
+            fields.emplace_back(std::move(name), std::move(value));
+        }
+        start = false;
+    }
+}
+
+
+/**
+ *  \brief Set the dynamic table size advertised to the peer.
+ */
+void hpack_decoder_t::set_table_size(size_t size)
+{
+    limit = size;
+}
+
+
+const hpack_table_t& hpack_decoder_t::table() const
+{
+    return table_;
+}
+
+// FUNCTIONS
+// ---------
+
+
+void huffman_encode(const std::string& input, std::string& output)
+{
+    uint64_t buffer = 0;
+    unsigned bits = 0;
+    for (unsigned char c: input) {
+        buffer = (buffer << HUFFMAN[c].bits) | HUFFMAN[c].code;
+        bits += HUFFMAN[c].bits;
+        while (bits >= 8) {
+            bits -= 8;
+            output.push_back(static_cast<char>(buffer >> bits));
+        }
+    }
+
+    // pad with the most-significant bits of EOS
+    if (bits) {
+        buffer = (buffer << (8 - bits)) | (0xff >> bits);
+        output.push_back(static_cast<char>(buffer));
+    }
+}
+
+
+size_t huffman_length(const std::string& input)
+{
+    size_t bits = 0;
+    for (unsigned char c: input) {
+        bits += HUFFMAN[c].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+
+std::string huffman_decode(const char *data, size_t length)
+{
+    const auto &tables = huffman_tables();
+    std::string output;
+    output.reserve(length * 8 / 5);
+
+    uint64_t buffer = 0;
+    unsigned bits = 0;
+    auto first = reinterpret_cast<const uint8_t*>(data);
+    auto last = first + length;
+    while (true) {
+        while (bits <= 56 && first < last) {
+            buffer = (buffer << 8) | *first++;
+            bits += 8;
+        }
+        if (bits < 5) {
+            break;
+        }
+
+        // find the shortest length whose codes include the prefix
+        uint16_t symbol = 256;
+        uint8_t size = 5;
+        for (; size <= 30 && size <= bits; ++size) {
+            uint32_t code = static_cast<uint32_t>(buffer >> (bits - size)) & ((1u << size) - 1);
+            if (code >= tables.first[size] && code - tables.first[size] < tables.count[size]) {
+                symbol = tables.symbols[tables.offset[size] + code - tables.first[size]];
+                break;
+            }
+        }
+        if (size > 30 || size > bits) {
+            break;
+        } else if (symbol == 256) {
+            invalid_block("EOS in Huffman string");
+        }
+        output.push_back(static_cast<char>(symbol));
+        bits -= size;
+        buffer &= (uint64_t(1) << bits) - 1;
+    }
+
+    // padding must be fewer than 8 bits, all ones
+    if (bits >= 8 || buffer != (uint64_t(1) << bits) - 1) {
+        invalid_block("invalid Huffman padding");
+    }
+
+    return output;
+}
+
+LATTICE_END_NAMESPACE
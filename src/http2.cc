@@ -0,0 +1,1067 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HTTP/2 framing, streams and multiplexed sessions.
+ */
+
+#include <lattice/http2.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#   include <winsock2.h>
+#else
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Largest header block accepted, across CONTINUATION frames.
+ */
+static constexpr size_t MAX_HEADER_BLOCK = 1 << 20;
+
+/**
+ *  \brief Longest wait on Windows, which cannot be woken.
+ */
+static constexpr std::chrono::milliseconds WINDOWS_POLL(10);
+
+// HELPERS
+// -------
+
+
+static uint32_t read_uint32(const char *data)
+{
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+
+static void write_uint32(std::string& output, uint32_t value)
+{
+    output.push_back(static_cast<char>(value >> 24));
+    output.push_back(static_cast<char>(value >> 16));
+    output.push_back(static_cast<char>(value >> 8));
+    output.push_back(static_cast<char>(value));
+}
+
+
+static void write_setting(std::string& output, http2_setting_t id, uint32_t value)
+{
+    output.push_back(static_cast<char>(id >> 8));
+    output.push_back(static_cast<char>(id));
+    write_uint32(output, value);
+}
+
+
+/**
+ *  \brief Remove the padding from a frame payload.
+ */
+static bool unpad(uint8_t flags, const char *&payload, size_t &size)
+{
+    if (!(flags & HTTP2_PADDED)) {
+        return true;
+    } else if (!size) {
+        return false;
+    }
+
+    size_t padding = static_cast<uint8_t>(payload[0]);
+    ++payload;
+    --size;
+    if (padding > size) {
+        return false;
+    }
+    size -= padding;
+
+    return true;
+}
+
+// OBJECTS
+// -------
+
+
+http2_engine_t::http2_engine_t(http2_handler_t& handler):
+    handler(handler)
+{}
+
+
+/**
+ *  \brief Queue the connection preface and initial settings.
+ *
+ *  Server push is disabled, and the receive windows are enlarged so
+ *  the server is rarely blocked on flow control.
+ */
+void http2_engine_t::preface()
+{
+    std::string settings;
+    write_setting(settings, HTTP2_ENABLE_PUSH, 0);
+    write_setting(settings, HTTP2_INITIAL_WINDOW_SIZE, HTTP2_STREAM_WINDOW);
+
+    output += HTTP2_PREFACE;
+    write_frame(HTTP2_SETTINGS, 0, 0, settings.data(), settings.size());
+    window_update(0, HTTP2_CONNECTION_WINDOW - recv_window);
+    recv_window = HTTP2_CONNECTION_WINDOW;
+}
+
+
+/**
+ *  \brief Open a stream with the request headers and body.
+ *
+ *  The body is sent as the flow-control windows allow. Returns the
+ *  stream identifier.
+ */
+uint32_t http2_engine_t::submit(const hpack_fields_t& fields, std::string&& body)
+{
+    uint32_t id = next_stream;
+    next_stream += 2;
+
+    std::string headers;
+    encoder.encode(fields, headers);
+    bool end = body.empty();
+    size_t offset = 0;
+    do {
+        size_t size = std::min(headers.size() - offset, max_frame);
+        uint8_t flags = offset + size == headers.size() ? HTTP2_END_HEADERS : 0;
+        if (offset) {
+            write_frame(HTTP2_CONTINUATION, flags, id, headers.data() + offset, size);
+        } else {
+            flags |= end ? HTTP2_END_STREAM : 0;
+            write_frame(HTTP2_HEADERS, flags, id, headers.data(), size);
+        }
+        offset += size;
+    } while (offset < headers.size());
+
+    auto &stream = active[id];
+    stream.send_window = initial_window;
+    stream.body = std::move(body);
+    stream.local_closed = end;
+    send_data();
+
+    return id;
+}
+
+
+/**
+ *  \brief Release flow-control credit for data read by the client.
+ *
+ *  Window updates are sent once half of a window was consumed.
+ */
+void http2_engine_t::consume(uint32_t stream, size_t bytes)
+{
+    if (!bytes) {
+        return;
+    }
+
+    unacked += bytes;
+    if (unacked >= HTTP2_CONNECTION_WINDOW / 2) {
+        window_update(0, unacked);
+        recv_window += unacked;
+        unacked = 0;
+    }
+
+    auto it = active.find(stream);
+    if (it != active.end() && !it->second.remote_closed) {
+        auto &state = it->second;
+        state.unacked += bytes;
+        if (state.unacked >= HTTP2_STREAM_WINDOW / 2) {
+            window_update(stream, state.unacked);
+            state.recv_window += state.unacked;
+            state.unacked = 0;
+        }
+    }
+}
+
+
+/**
+ *  \brief Close a stream with RST_STREAM.
+ */
+void http2_engine_t::reset(uint32_t stream, http2_error_t error)
+{
+    if (active.erase(stream)) {
+        std::string payload;
+        write_uint32(payload, error);
+        write_frame(HTTP2_RST_STREAM, 0, stream, payload.data(), payload.size());
+    }
+}
+
+
+/**
+ *  \brief Close the connection with GOAWAY.
+ *
+ *  The server never opens streams, so the last stream is always 0.
+ */
+void http2_engine_t::goaway(http2_error_t error)
+{
+    if (closing) {
+        return;
+    }
+
+    closing = true;
+    std::string payload;
+    write_uint32(payload, 0);
+    write_uint32(payload, error);
+    write_frame(HTTP2_GOAWAY, 0, 0, payload.data(), payload.size());
+}
+
+
+/**
+ *  \brief Process bytes read from the connection.
+ *
+ *  Complete frames are parsed in place, and only a trailing partial
+ *  frame is copied until the remainder is received.
+ */
+void http2_engine_t::receive(const char *data, size_t length)
+{
+    if (input.empty()) {
+        size_t used = parse(data, length);
+        input.assign(data + used, length - used);
+    } else {
+        input.append(data, length);
+        input.erase(0, parse(input.data(), input.size()));
+    }
+}
+
+
+/**
+ *  \brief Take the frames queued for sending.
+ */
+std::string http2_engine_t::take()
+{
+    std::string data;
+    data.swap(output);
+    return data;
+}
+
+
+/**
+ *  \brief Check if new streams may be opened on the connection.
+ */
+bool http2_engine_t::open() const
+{
+    return !closing && next_stream < static_cast<uint32_t>(HTTP2_MAX_WINDOW);
+}
+
+
+/**
+ *  \brief Check if a new stream may be opened without exceeding the
+ *  server's limit of concurrent streams.
+ */
+bool http2_engine_t::available() const
+{
+    return open() && active.size() < max_streams;
+}
+
+
+size_t http2_engine_t::streams() const
+{
+    return active.size();
+}
+
+
+size_t http2_engine_t::parse(const char *data, size_t length)
+{
+    size_t offset = 0;
+    while (length - offset >= HTTP2_FRAME_HEADER) {
+        auto header = reinterpret_cast<const uint8_t*>(data + offset);
+        size_t size = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+        if (size > HTTP2_FRAME_SIZE) {
+            fail(HTTP2_FRAME_SIZE_ERROR, "frame exceeds the maximum size");
+        } else if (length - offset < HTTP2_FRAME_HEADER + size) {
+            break;
+        }
+
+        uint32_t stream = read_uint32(data + offset + 5) & 0x7fffffff;
+        frame(header[3], header[4], stream, data + offset + HTTP2_FRAME_HEADER, size);
+        offset += HTTP2_FRAME_HEADER + size;
+    }
+
+    return offset;
+}
+
+
+void http2_engine_t::frame(uint8_t type, uint8_t flags, uint32_t stream, const char *payload, size_t size)
+{
+    if (continuation && (type != HTTP2_CONTINUATION || stream != continuation)) {
+        fail(HTTP2_PROTOCOL_ERROR, "expected CONTINUATION frame");
+    }
+
+    switch (type) {
+        case HTTP2_DATA:
+            data_frame(flags, stream, payload, size);
+            break;
+        case HTTP2_HEADERS:
+            headers_frame(flags, stream, payload, size);
+            break;
+        case HTTP2_CONTINUATION:
+            if (!continuation) {
+                fail(HTTP2_PROTOCOL_ERROR, "unexpected CONTINUATION frame");
+            } else if (block.size() + size > MAX_HEADER_BLOCK) {
+                fail(HTTP2_ENHANCE_YOUR_CALM, "header block too large");
+            }
+            block.append(payload, size);
+            if (flags & HTTP2_END_HEADERS) {
+                continuation = 0;
+                headers_complete();
+            }
+            break;
+        case HTTP2_RST_STREAM:
+            if (!stream) {
+                fail(HTTP2_PROTOCOL_ERROR, "RST_STREAM on stream 0");
+            } else if (size != 4) {
+                fail(HTTP2_FRAME_SIZE_ERROR, "invalid RST_STREAM frame");
+            } else if (stream >= next_stream) {
+                fail(HTTP2_PROTOCOL_ERROR, "RST_STREAM on idle stream");
+            } else if (active.erase(stream)) {
+                handler.on_reset(stream, static_cast<http2_error_t>(read_uint32(payload)));
+            }
+            break;
+        case HTTP2_SETTINGS:
+            if (stream) {
+                fail(HTTP2_PROTOCOL_ERROR, "SETTINGS on a stream");
+            }
+            settings_frame(flags, payload, size);
+            break;
+        case HTTP2_PUSH_PROMISE:
+            fail(HTTP2_PROTOCOL_ERROR, "server push is disabled");
+            break;
+        case HTTP2_PING:
+            if (stream) {
+                fail(HTTP2_PROTOCOL_ERROR, "PING on a stream");
+            } else if (size != 8) {
+                fail(HTTP2_FRAME_SIZE_ERROR, "invalid PING frame");
+            } else if (!(flags & HTTP2_ACK)) {
+                write_frame(HTTP2_PING, HTTP2_ACK, 0, payload, size);
+            }
+            break;
+        case HTTP2_GOAWAY: {
+            if (stream) {
+                fail(HTTP2_PROTOCOL_ERROR, "GOAWAY on a stream");
+            } else if (size < 8) {
+                fail(HTTP2_FRAME_SIZE_ERROR, "invalid GOAWAY frame");
+            }
+            uint32_t last = read_uint32(payload) & 0x7fffffff;
+            closing = true;
+            active.erase(active.upper_bound(last), active.end());
+            handler.on_goaway(last, static_cast<http2_error_t>(read_uint32(payload + 4)));
+            break;
+        }
+        case HTTP2_WINDOW_UPDATE:
+            window_frame(stream, payload, size);
+            break;
+        case HTTP2_PRIORITY:
+            /* fallthrough */
+        default:
+            // priorities and unknown frames are ignored
+            break;
+    }
+}
+
+
+/**
+ *  \brief Handle a DATA frame.
+ *
+ *  The whole payload counts against the windows, so padding, and
+ *  data for streams which were already reset, is released at once.
+ */
+void http2_engine_t::data_frame(uint8_t flags, uint32_t stream, const char *payload, size_t size)
+{
+    size_t length = size;
+    if (!stream) {
+        fail(HTTP2_PROTOCOL_ERROR, "DATA on stream 0");
+    } else if (stream >= next_stream) {
+        fail(HTTP2_PROTOCOL_ERROR, "DATA on idle stream");
+    } else if (!unpad(flags, payload, size)) {
+        fail(HTTP2_PROTOCOL_ERROR, "invalid padding");
+    } else if (static_cast<int64_t>(length) > recv_window) {
+        fail(HTTP2_FLOW_CONTROL_ERROR, "connection window exceeded");
+    }
+    recv_window -= length;
+
+    auto it = active.find(stream);
+    if (it == active.end() || it->second.remote_closed) {
+        consume(stream, length);
+        if (it != active.end()) {
+            reset(stream, HTTP2_STREAM_CLOSED);
+        }
+        return;
+    }
+
+    auto &state = it->second;
+    if (static_cast<int64_t>(length) > state.recv_window) {
+        consume(stream, length);
+        reset(stream, HTTP2_FLOW_CONTROL_ERROR);
+        handler.on_reset(stream, HTTP2_FLOW_CONTROL_ERROR);
+        return;
+    }
+    state.recv_window -= length;
+    consume(stream, length - size);
+
+    bool end = flags & HTTP2_END_STREAM;
+    handler.on_data(stream, payload, size, end);
+    if (end) {
+        close_remote(stream);
+    }
+}
+
+
+void http2_engine_t::headers_frame(uint8_t flags, uint32_t stream, const char *payload, size_t size)
+{
+    if (!stream) {
+        fail(HTTP2_PROTOCOL_ERROR, "HEADERS on stream 0");
+    } else if (!unpad(flags, payload, size)) {
+        fail(HTTP2_PROTOCOL_ERROR, "invalid padding");
+    }
+    if (flags & HTTP2_PRIORITY_FLAG) {
+        if (size < 5) {
+            fail(HTTP2_FRAME_SIZE_ERROR, "invalid HEADERS frame");
+        }
+        payload += 5;
+        size -= 5;
+    }
+
+    block.assign(payload, size);
+    block_stream = stream;
+    block_end = flags & HTTP2_END_STREAM;
+    if (flags & HTTP2_END_HEADERS) {
+        headers_complete();
+    } else {
+        continuation = stream;
+    }
+}
+
+
+void http2_engine_t::settings_frame(uint8_t flags, const char *payload, size_t size)
+{
+    if (flags & HTTP2_ACK) {
+        if (size) {
+            fail(HTTP2_FRAME_SIZE_ERROR, "invalid SETTINGS acknowledgement");
+        }
+        return;
+    } else if (size % 6) {
+        fail(HTTP2_FRAME_SIZE_ERROR, "invalid SETTINGS frame");
+    }
+
+    for (size_t offset = 0; offset < size; offset += 6) {
+        auto id = (uint16_t(uint8_t(payload[offset])) << 8) | uint8_t(payload[offset+1]);
+        uint32_t value = read_uint32(payload + offset + 2);
+        switch (id) {
+            case HTTP2_HEADER_TABLE_SIZE:
+                encoder.set_table_size(value);
+                break;
+            case HTTP2_MAX_CONCURRENT_STREAMS:
+                max_streams = value;
+                break;
+            case HTTP2_INITIAL_WINDOW_SIZE:
+                if (value > HTTP2_MAX_WINDOW) {
+                    fail(HTTP2_FLOW_CONTROL_ERROR, "initial window too large");
+                }
+                for (auto &item: active) {
+                    item.second.send_window += int64_t(value) - initial_window;
+                }
+                initial_window = value;
+                break;
+            case HTTP2_MAX_FRAME_SIZE:
+                if (value < HTTP2_FRAME_SIZE || value > 0xffffff) {
+                    fail(HTTP2_PROTOCOL_ERROR, "invalid maximum frame size");
+                }
+                max_frame = value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    write_frame(HTTP2_SETTINGS, HTTP2_ACK, 0, nullptr, 0);
+    send_data();
+}
+
+
+void http2_engine_t::window_frame(uint32_t stream, const char *payload, size_t size)
+{
+    if (size != 4) {
+        fail(HTTP2_FRAME_SIZE_ERROR, "invalid WINDOW_UPDATE frame");
+    }
+
+    int64_t increment = read_uint32(payload) & 0x7fffffff;
+    if (!stream) {
+        if (!increment) {
+            fail(HTTP2_PROTOCOL_ERROR, "empty connection window update");
+        } else if ((send_window += increment) > HTTP2_MAX_WINDOW) {
+            fail(HTTP2_FLOW_CONTROL_ERROR, "connection window overflow");
+        }
+    } else {
+        auto it = active.find(stream);
+        if (it == active.end()) {
+            return;
+        }
+        auto &state = it->second;
+        http2_error_t error = HTTP2_NO_ERROR;
+        if (!increment) {
+            error = HTTP2_PROTOCOL_ERROR;
+        } else if ((state.send_window += increment) > HTTP2_MAX_WINDOW) {
+            error = HTTP2_FLOW_CONTROL_ERROR;
+        }
+        if (error) {
+            reset(stream, error);
+            handler.on_reset(stream, error);
+            return;
+        }
+    }
+
+    send_data();
+}
+
+
+/**
+ *  \brief Decode a complete header block, and pass it to the handler.
+ *
+ *  Blocks for closed streams are still decoded, to keep the dynamic
+ *  table synchronized with the server.
+ */
+void http2_engine_t::headers_complete()
+{
+    hpack_fields_t fields;
+    try {
+        decoder.decode(block.data(), block.size(), fields);
+    } catch (std::exception&) {
+        fail(HTTP2_COMPRESSION_ERROR, "invalid header block");
+    }
+    block.clear();
+
+    auto it = active.find(block_stream);
+    if (it == active.end() || it->second.remote_closed) {
+        if (block_stream >= next_stream) {
+            fail(HTTP2_PROTOCOL_ERROR, "HEADERS on idle stream");
+        }
+        return;
+    }
+
+    handler.on_headers(block_stream, std::move(fields), block_end);
+    if (block_end) {
+        close_remote(block_stream);
+    }
+}
+
+
+void http2_engine_t::close_remote(uint32_t stream)
+{
+    auto it = active.find(stream);
+    if (it != active.end()) {
+        it->second.remote_closed = true;
+        if (it->second.local_closed) {
+            active.erase(it);
+        }
+    }
+}
+
+
+/**
+ *  \brief Send request bodies, up to the flow-control windows.
+ */
+void http2_engine_t::send_data()
+{
+    for (auto it = active.begin(); it != active.end() && send_window > 0; ) {
+        auto &state = it->second;
+        while (!state.local_closed && send_window > 0 && state.send_window > 0) {
+            size_t remaining = state.body.size() - state.offset;
+            size_t size = std::min<int64_t>({int64_t(remaining), int64_t(max_frame), send_window, state.send_window});
+            bool end = size == remaining;
+            write_frame(HTTP2_DATA, end ? HTTP2_END_STREAM : 0, it->first, state.body.data() + state.offset, size);
+            state.offset += size;
+            state.send_window -= size;
+            send_window -= size;
+            if (end) {
+                state.local_closed = true;
+                std::string().swap(state.body);
+            }
+        }
+
+        if (state.local_closed && state.remote_closed) {
+            it = active.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+void http2_engine_t::write_frame(uint8_t type, uint8_t flags, uint32_t stream, const char *payload, size_t size)
+{
+    output.push_back(static_cast<char>(size >> 16));
+    output.push_back(static_cast<char>(size >> 8));
+    output.push_back(static_cast<char>(size));
+    output.push_back(static_cast<char>(type));
+    output.push_back(static_cast<char>(flags));
+    write_uint32(output, stream);
+    output.append(payload, size);
+}
+
+
+void http2_engine_t::window_update(uint32_t stream, size_t increment)
+{
+    std::string payload;
+    write_uint32(payload, static_cast<uint32_t>(increment));
+    write_frame(HTTP2_WINDOW_UPDATE, 0, stream, payload.data(), payload.size());
+}
+
+
+void http2_engine_t::fail(http2_error_t error, const char *message)
+{
+    goaway(error);
+    throw std::runtime_error(std::string("HTTP/2 protocol error: ") + message + ".");
+}
+
+
+namespace detail
+{
+
+#if defined(_WIN32)
+
+http2_waker_t::http2_waker_t()
+{}
+
+
+http2_waker_t::~http2_waker_t()
+{}
+
+
+void http2_waker_t::wake()
+{}
+
+
+bool http2_waker_t::wait(http2_socket_t fd, std::chrono::milliseconds timeout)
+{
+    WSAPOLLFD descriptor = {fd, POLLRDNORM, 0};
+    int ms = static_cast<int>(std::min(timeout, WINDOWS_POLL).count());
+    return WSAPoll(&descriptor, 1, ms) > 0;
+}
+
+#else
+
+http2_waker_t::http2_waker_t()
+{
+    if (::pipe(fds)) {
+        throw std::runtime_error("Unable to create pipe.");
+    }
+    for (int fd: fds) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+
+http2_waker_t::~http2_waker_t()
+{
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+
+void http2_waker_t::wake()
+{
+    char byte = 0;
+    ssize_t written = ::write(fds[1], &byte, 1);
+    (void) written;
+}
+
+
+/**
+ *  \brief Wait for the socket to be readable, or the waker woken.
+ *
+ *  Returns if the socket is readable, or was closed.
+ */
+bool http2_waker_t::wait(http2_socket_t fd, std::chrono::milliseconds timeout)
+{
+    pollfd descriptors[2] = {{fd, POLLIN, 0}, {fds[0], POLLIN, 0}};
+    if (::poll(descriptors, 2, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+    }
+    if (descriptors[1].revents) {
+        char buffer[64];
+        while (::read(fds[0], buffer, sizeof(buffer)) > 0);
+    }
+
+    return descriptors[0].revents != 0;
+}
+
+#endif
+
+}   /* detail */
+
+
+http2_stream_t::http2_stream_t(detail::http2_channel_t* channel, uint32_t id, method_t method, const timeout_t& timeout):
+    channel(channel),
+    id(id),
+    method(method),
+    timeout(timeout.milliseconds())
+{}
+
+
+/**
+ *  \brief Set the status and headers, or the trailers.
+ *
+ *  Informational responses are skipped.
+ */
+void http2_stream_t::headers(hpack_fields_t&& fields, bool end)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (started) {
+        for (auto &field: fields) {
+            trailers.emplace(std::move(field.first), std::move(field.second));
+        }
+    } else {
+        int status = 0;
+        for (const auto &field: fields) {
+            if (field.first == ":status") {
+                status = std::atoi(field.second.data());
+            }
+        }
+        if (status < 200 && !end) {
+            return;
+        }
+
+        response_.status_ = static_cast<status_code_t>(status);
+        response_.persistent = true;
+        for (const auto &field: fields) {
+            if (!field.first.empty() && field.first[0] != ':') {
+                response_.parse_header_line(field.first + ": " + field.second);
+            }
+        }
+        started = true;
+    }
+
+    ended |= end;
+    cv.notify_all();
+}
+
+
+void http2_stream_t::data(const char *data, size_t length, bool end)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (length) {
+        blocks.emplace_back(data, length);
+    }
+    ended |= end;
+    cv.notify_all();
+}
+
+
+/**
+ *  \brief End the stream early, keeping any data not yet read.
+ */
+void http2_stream_t::reset(http2_error_t error)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ended) {
+        error_ = error;
+        ended = true;
+    }
+    cv.notify_all();
+}
+
+
+/**
+ *  \brief Wait for the status and headers.
+ *
+ *  The status is 0 if the stream ended before a response, see
+ *  `error()` for the reason.
+ */
+const response_t& http2_stream_t::response()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!started && !ended) {
+        if (!wait(lock)) {
+            lock.unlock();
+            abort();
+            break;
+        }
+    }
+
+    return response_;
+}
+
+
+bool http2_stream_t::done() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ended && blocks.empty();
+}
+
+
+/**
+ *  \brief Check if a wait for the response exceeded the timeout.
+ */
+bool http2_stream_t::timed_out() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return expired;
+}
+
+
+/**
+ *  \brief Set the deadline for the response, capping each wait.
+ */
+void http2_stream_t::set_deadline(std::chrono::steady_clock::time_point deadline)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->deadline = deadline;
+}
+
+
+/**
+ *  \brief Get the reason the stream ended, if it was reset.
+ *
+ *  Streams refused by the server, or after the last stream it
+ *  processed, end with `HTTP2_REFUSED_STREAM`, and may be retried.
+ *  Streams on failed connections end with `HTTP2_INTERNAL_ERROR`.
+ */
+http2_error_t http2_stream_t::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error_;
+}
+
+
+/**
+ *  \brief Read up to `count` bytes of the body.
+ *
+ *  Returns 0 once the body is complete.
+ */
+size_t http2_stream_t::read(char *buf, size_t count)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (blocks.empty() && !ended) {
+        if (!wait(lock)) {
+            lock.unlock();
+            abort();
+            return 0;
+        }
+    }
+    if (blocks.empty()) {
+        finish();
+        return 0;
+    }
+
+    auto &front = blocks.front();
+    size_t size = std::min(count, front.size() - offset);
+    std::memcpy(buf, front.data() + offset, size);
+    offset += size;
+    if (offset == front.size()) {
+        blocks.pop_front();
+        offset = 0;
+    }
+    lock.unlock();
+    channel->consume(id, size);
+
+    return size;
+}
+
+
+/**
+ *  \brief Read the next block of the body into `block`.
+ *
+ *  Blocks are the received DATA frames, which are moved rather than
+ *  copied. Returns false once the body is complete.
+ */
+bool http2_stream_t::read(std::string& block)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (blocks.empty() && !ended) {
+        if (!wait(lock)) {
+            lock.unlock();
+            abort();
+            block.clear();
+            return false;
+        }
+    }
+    if (blocks.empty()) {
+        finish();
+        block.clear();
+        return false;
+    }
+
+    if (offset) {
+        block.assign(blocks.front(), offset, std::string::npos);
+        offset = 0;
+    } else {
+        block.swap(blocks.front());
+    }
+    blocks.pop_front();
+    lock.unlock();
+    channel->consume(id, block.size());
+
+    return true;
+}
+
+
+/**
+ *  \brief Read the remainder of the body into the response.
+ */
+void http2_stream_t::buffer()
+{
+    auto &body = response_.body_;
+    std::string block;
+    while (read(block)) {
+        if (body.empty()) {
+            body.swap(block);
+        } else {
+            body += block;
+        }
+    }
+}
+
+
+/**
+ *  \brief Write the remainder of the body to a file.
+ */
+void http2_stream_t::download(file_writer_t& file)
+{
+    auto &headers = response_.headers();
+    auto it = headers.find("content-length");
+    if (it != headers.end()) {
+        file.allocate(std::stol(it->second));
+    }
+
+    std::string block;
+    while (read(block)) {
+        file.write(block.data(), block.size());
+    }
+}
+
+
+/**
+ *  \brief Stop reading the body, and reset the stream.
+ *
+ *  Data received but not read is released to the connection window.
+ */
+void http2_stream_t::abort()
+{
+    size_t unread = 0;
+    bool cancel;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &block: blocks) {
+            unread += block.size();
+        }
+        unread -= offset;
+        blocks.clear();
+        offset = 0;
+        cancel = !ended;
+        if (cancel) {
+            error_ = HTTP2_CANCEL;
+            ended = true;
+        }
+    }
+
+    if (cancel) {
+        channel->cancel(id);
+    }
+    if (unread) {
+        channel->consume(id, unread);
+    }
+}
+
+
+/**
+ *  \brief Wait for a stream event, up to the timeout and deadline.
+ *
+ *  Returns false if the request timed out.
+ */
+bool http2_stream_t::wait(std::unique_lock<std::mutex>& lock)
+{
+    typedef std::chrono::steady_clock steady_clock;
+    auto limit = steady_clock::time_point();
+    if (timeout.count()) {
+        limit = steady_clock::now() + timeout;
+    }
+    if (deadline != steady_clock::time_point() && (limit == steady_clock::time_point() || deadline < limit)) {
+        limit = deadline;
+    }
+
+    if (limit == steady_clock::time_point()) {
+        cv.wait(lock);
+    } else if (cv.wait_until(lock, limit) == std::cv_status::timeout) {
+        expired = true;
+    }
+    return !expired;
+}
+
+
+/**
+ *  \brief Add the trailers once the body was read.
+ */
+void http2_stream_t::finish()
+{
+    response_.parse_trailers(trailers);
+    trailers.clear();
+}
+
+
+std::mutex& http2_session_cache_t::lock(const std::string& origin)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &item = locks[origin];
+    if (!item) {
+        item.reset(new std::mutex);
+    }
+    return *item;
+}
+
+
+void http2_session_cache_t::add(const std::string& origin, const std::shared_ptr<detail::http2_channel_t>& session)
+{
+    std::shared_ptr<detail::http2_channel_t> replaced;
+    std::lock_guard<std::mutex> lock(mutex);
+    replaced = std::move(sessions[origin]);
+    sessions[origin] = session;
+}
+
+
+/**
+ *  \brief Remember the origin does not support HTTP/2.
+ */
+void http2_session_cache_t::downgrade(const std::string& origin)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    http1.insert(origin);
+}
+
+
+bool http2_session_cache_t::downgraded(const std::string& origin) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return http1.count(origin) != 0;
+}
+
+
+/**
+ *  \brief Remove all sessions, and forget downgraded origins.
+ *
+ *  Sessions still used by requests close once the requests complete.
+ */
+void http2_session_cache_t::clear()
+{
+    decltype(sessions) removed;
+    std::lock_guard<std::mutex> lock(mutex);
+    removed.swap(sessions);
+    http1.clear();
+}
+
+// FUNCTIONS
+// ---------
+
+
+http2_session_cache_t& default_http2_cache()
+{
+    static http2_session_cache_t cache;
+    return cache;
+}
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,158 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Keep-alive connection pooling.
+ */
+
+#include <lattice/keepalive.h>
+#include <algorithm>
+#include <iterator>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Margin before the server's keep-alive timeout.
+ *
+ *  Avoid reusing a connection the server is about to close.
+ */
+static constexpr std::chrono::milliseconds KEEP_ALIVE_MARGIN = std::chrono::seconds(1);
+
+// FUNCTIONS
+// ---------
+
+
+connection_cache_t default_connection_cache()
+{
+    static connection_cache_t cache = create_connection_cache();
+    return cache;
+}
+
+// OBJECTS
+// -------
+
+
+connection_pool_t::connection_pool_t(const timeout_t& idle, size_t limit):
+    timeout(idle.milliseconds()),
+    limit(limit)
+{}
+
+
+std::chrono::steady_clock::time_point connection_pool_t::expires(const timeout_t& keep_alive) const
+{
+    auto duration = timeout;
+    if (keep_alive) {
+        auto server = std::chrono::milliseconds(keep_alive.milliseconds());
+        if (server > KEEP_ALIVE_MARGIN) {
+            server -= KEEP_ALIVE_MARGIN;
+        }
+        duration = std::min(duration, server);
+    }
+
+    return std::chrono::steady_clock::now() + duration;
+}
+
+
+void connection_pool_t::set_idle_timeout(const timeout_t& idle)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    timeout = std::chrono::milliseconds(idle.milliseconds());
+}
+
+
+void connection_pool_t::set_max_idle(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->limit = limit;
+}
+
+
+void connection_pool_t::set_max_idle_total(size_t total)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->total = total;
+}
+
+
+/**
+ *  \brief Move expired connections from the list to `closed`.
+ */
+void connection_pool_t::expire(idle_list_t& list, closed_list_t& closed) const
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = list.begin(); it != list.end(); ) {
+        if ((*it)->expires <= now) {
+            closed.emplace_back(std::move(*it));
+            it = list.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+/**
+ *  \brief Remove expired connections to every origin, and make room
+ *  for one more connection, evicting the one closest to expiry.
+ *
+ *  Must be called with the mutex held. Removed connections are moved
+ *  to `closed`, to be closed after the lock is released.
+ */
+void connection_pool_t::prune(closed_list_t& closed)
+{
+    size_t count = 0;
+    for (auto it = idle.begin(); it != idle.end(); ) {
+        expire(it->second, closed);
+        count += it->second.size();
+        it = it->second.empty() ? idle.erase(it) : std::next(it);
+    }
+
+    for (; count && count >= total; --count) {
+        auto oldest = idle.end();
+        idle_list_t::iterator item;
+        for (auto it = idle.begin(); it != idle.end(); ++it) {
+            auto first = std::min_element(it->second.begin(), it->second.end(), [](const detail::idle_ptr_t& left, const detail::idle_ptr_t& right) {
+                return left->expires < right->expires;
+            });
+            if (oldest == idle.end() || (*first)->expires < (*item)->expires) {
+                oldest = it;
+                item = first;
+            }
+        }
+        closed.emplace_back(std::move(*item));
+        oldest->second.erase(item);
+        if (oldest->second.empty()) {
+            idle.erase(oldest);
+        }
+    }
+}
+
+
+size_t connection_pool_t::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const auto &pair: idle) {
+        count += pair.second.size();
+    }
+
+    return count;
+}
+
+
+/**
+ *  Idle connections are closed after the lock is released.
+ */
+void connection_pool_t::clear()
+{
+    decltype(idle) closed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed.swap(idle);
+    }
+}
+
+LATTICE_END_NAMESPACE
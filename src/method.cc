@@ -0,0 +1,45 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HTTP methods.
+ */
+
+#include <lattice/method.h>
+
+LATTICE_BEGIN_NAMESPACE
+
+// FUNCTIONS
+// ---------
+
+
+bool is_idempotent(method_t method)
+{
+    switch (method) {
+        case PUT:
+            /* fallthrough */
+        case DELETE:
+            return true;
+        default:
+            return is_safe(method);
+    }
+}
+
+
+bool is_safe(method_t method)
+{
+    switch (method) {
+        case GET:
+            /* fallthrough */
+        case HEAD:
+            /* fallthrough */
+        case OPTIONS:
+            /* fallthrough */
+        case TRACE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+LATTICE_END_NAMESPACE
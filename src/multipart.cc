@@ -11,6 +11,7 @@
 #include <pycpp/hashlib.h>
 #include <pycpp/random.h>
 #include <pycpp/string/unicode.h>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <unordered_map>
@@ -24,6 +25,8 @@ namespace detail
 // CONSTANTS
 // ---------
 
+static const char CRLF[] = "\r\n";
+
 /**
  *  \brief Lookup table for common application types.
  */
@@ -174,7 +177,7 @@ part_value_t::part_value_t(const std::string& filename, const std::string& conte
 
 
 part_value_t::part_value_t(std::string&& path, std::string&& content_type):
-    filename(std::forward<std::string>(filename))
+    filename(std::forward<std::string>(path))
 {
     if (content_type.empty()) {
         this->content_type_ = detect_content_type(this->filename);
@@ -222,6 +225,15 @@ std::string part_value_t::string() const
 }
 
 
+/**
+ *  \brief Append the part headers to a scatter-gather list.
+ */
+void part_value_t::buffers(buffer_list_t& list) const
+{
+    list.store(part_value_t::string());
+}
+
+
 std::string file_value_t::buffer() const
 {
     #ifdef _WIN32
@@ -242,6 +254,18 @@ std::string file_value_t::string() const
 }
 
 
+/**
+ *  The file is opened, but not read, so it can be streamed from disk
+ *  when the request is sent.
+ */
+void file_value_t::buffers(buffer_list_t& list) const
+{
+    part_value_t::buffers(list);
+    list.file(filename);
+    list.view(CRLF, 2);
+}
+
+
 buffer_value_t::buffer_value_t(const std::string &filename,
         const std::string &buffer,
         const std::string &content_type):
@@ -272,6 +296,18 @@ std::string buffer_value_t::string() const
     return stream.str();
 }
 
+
+/**
+ *  The buffer is referenced, not copied, so the part must outlive
+ *  the list.
+ */
+void buffer_value_t::buffers(buffer_list_t& list) const
+{
+    part_value_t::buffers(list);
+    list.view(buffer_);
+    list.view(CRLF, 2);
+}
+
 }   /* detail */
 
 
@@ -309,6 +345,37 @@ std::string multipart_t::string() const
 }
 
 
+/**
+ *  \brief Append the encoded message to a scatter-gather list.
+ *
+ *  Produces the same data as `string()`, without copying the contents
+ *  of buffer parts.
+ */
+void multipart_t::buffers(buffer_list_t& list) const
+{
+    for (const auto &item: *this) {
+        list.store("--" + boundary() + "\r\n");
+        item->buffers(list);
+    }
+
+    // if any elements were written, write a trailing separator.
+    if (*this) {
+        list.store("--" + boundary() + "--\r\n");
+    }
+}
+
+
+/**
+ *  \brief Check if any part is streamed from a file.
+ */
+bool multipart_t::has_files() const
+{
+    return std::any_of(begin(), end(), [](const detail::part_ptr_t& part) {
+        return bool(std::dynamic_pointer_cast<detail::file_value_t>(part));
+    });
+}
+
+
 std::string multipart_t::header() const
 {
     return "multipart/form-data; boundary=" + boundary();
@@ -0,0 +1,156 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Incremental HTTP/1.1 response parser.
+ */
+
+#include <lattice/parser.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+response_parser_t::response_parser_t(method_t method):
+    method(method)
+{}
+
+
+/**
+ *  \brief Buffer data until the double carriage return.
+ *
+ *  Once all headers are available, parse them and determine how the
+ *  message body is delimited, according to RFC 7230 Section 3.3.3.
+ */
+size_t response_parser_t::parse_headers(const char* data, size_t length)
+{
+    // only the last 3 bytes can start a partial delimiter
+    size_t start = buffer.size() > 3 ? buffer.size() - 3 : 0;
+    buffer.append(data, length);
+    size_t end = buffer.find("\r\n\r\n", start);
+    if (end == std::string::npos) {
+        return length;
+    }
+
+    end += 4;
+    size_t consumed = length - (buffer.size() - end);
+    buffer.resize(end);
+    response_.parse_header(buffer);
+    buffer.clear();
+
+    auto &headers = response_.headers();
+    auto it = headers.find("content-length");
+    if (!response_.has_body(method)) {
+        state = DONE;
+    } else if (!!response_.transfer && !(response_.transfer & IDENTITY)) {
+        state = CHUNKED;
+    } else if (it != headers.end()) {
+        remaining = std::strtoul(it->second.data(), nullptr, 10);
+        state = remaining ? LENGTH : DONE;
+    } else {
+        state = CLOSE;
+        response_.persistent = false;
+    }
+
+    return consumed;
+}
+
+
+/**
+ *  \brief Parse the next block of data from the server.
+ *
+ *  Returns the number of bytes consumed, which is less than the
+ *  number of bytes provided only if the response is complete.
+ */
+size_t response_parser_t::feed(const char* data, size_t length)
+{
+    size_t offset = 0;
+    while (offset < length && state != DONE) {
+        const char *first = data + offset;
+        size_t size = length - offset;
+        switch (state) {
+            case HEADERS:
+                offset += parse_headers(first, size);
+                break;
+            case LENGTH: {
+                size_t count = std::min(remaining, size);
+                response_.body_.append(first, count);
+                remaining -= count;
+                offset += count;
+                if (!remaining) {
+                    state = DONE;
+                }
+                break;
+            }
+            case CHUNKED:
+                offset += decoder.decode(first, size, response_.body_);
+                if (decoder.done()) {
+                    response_.parse_trailers(decoder.trailers());
+                    state = DONE;
+                }
+                break;
+            case CLOSE:
+                response_.body_.append(first, size);
+                offset = length;
+                break;
+            case DONE:
+                break;
+        }
+    }
+
+    return offset;
+}
+
+
+/**
+ *  \brief Signal the server closed the connection.
+ *
+ *  Completes responses delimited by the connection closing, and
+ *  throws if the response is otherwise incomplete.
+ */
+void response_parser_t::finish()
+{
+    if (state == CLOSE) {
+        state = DONE;
+    } else if (state != DONE) {
+        throw std::runtime_error("Connection closed before the response was complete.");
+    }
+}
+
+
+void response_parser_t::reset(method_t method)
+{
+    *this = response_parser_t(method);
+}
+
+
+bool response_parser_t::headers_done() const
+{
+    return state != HEADERS;
+}
+
+
+bool response_parser_t::done() const
+{
+    return state == DONE;
+}
+
+
+response_t& response_parser_t::response()
+{
+    return response_;
+}
+
+
+const response_t& response_parser_t::response() const
+{
+    return response_;
+}
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,101 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief HTTP/1.1 request pipelining.
+ */
+
+#include <lattice/pipeline.h>
+#include <algorithm>
+#include <stdexcept>
+
+LATTICE_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+pipeline_t::pipeline_t(size_t depth)
+{
+    set_depth(depth);
+}
+
+
+void pipeline_t::add(const request_t& request)
+{
+    requests.emplace_back(request);
+}
+
+
+void pipeline_t::add(request_t&& request)
+{
+    requests.emplace_back(std::forward<request_t>(request));
+}
+
+
+/**
+ *  \brief Set the maximum number of requests written before reading.
+ */
+void pipeline_t::set_depth(size_t depth)
+{
+    this->depth = std::max<size_t>(depth, 1);
+}
+
+
+size_t pipeline_t::size() const
+{
+    return requests.size();
+}
+
+
+pipeline_t::operator bool() const
+{
+    return !requests.empty();
+}
+
+
+/**
+ *  \brief Find the end of the batch starting at `first`.
+ *
+ *  Batches are runs of idempotent requests, ending at the pipeline
+ *  depth or at a request which closes the connection. Non-idempotent
+ *  requests form their own batch, so they are never retried.
+ */
+size_t pipeline_t::batch(size_t first) const
+{
+    size_t last = first + 1;
+    if (!is_idempotent(requests[first].get_method())) {
+        return last;
+    }
+
+    while (last < requests.size() && last - first < depth) {
+        if (requests[last - 1].get_header().close_connection()) {
+            break;
+        } else if (!is_idempotent(requests[last].get_method())) {
+            break;
+        }
+        ++last;
+    }
+
+    return last;
+}
+
+
+/**
+ *  \brief Check all requests can share a single connection.
+ */
+void pipeline_t::check_origin() const
+{
+    if (requests.empty()) {
+        return;
+    }
+
+    auto origin = requests.front().origin();
+    for (const auto &request: requests) {
+        if (request.origin() != origin) {
+            throw std::runtime_error("Pipelined requests must share an origin.");
+        }
+    }
+}
+
+LATTICE_END_NAMESPACE
@@ -0,0 +1,1225 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Event-driven engine for concurrent requests.
+ */
+
+#include <lattice/reactor.h>
+#include <lattice/dns.h>
+#include <lattice/parser.h>
+#include <lattice/tls.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#if defined(LATTICE_HAVE_EPOLL)
+#   include <lattice/adaptor/posix.h>
+#   include <lattice/resolver.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#   include <cerrno>
+#   include <cstring>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+namespace detail
+{
+#if defined(LATTICE_HAVE_EPOLL)
+
+// CONSTANTS
+// ---------
+
+static constexpr int MAX_EVENTS = 256;
+static constexpr size_t MAX_IDLE = 8;
+static constexpr size_t MAX_IDLE_TOTAL = 64;
+static constexpr size_t LOOKUP_THREADS = 2;
+static constexpr size_t READ_SIZE = 65536;
+static constexpr std::chrono::seconds IDLE_TIMEOUT(30);
+
+// TYPES
+// -----
+
+typedef std::chrono::steady_clock steady_clock;
+typedef steady_clock::time_point time_point;
+struct reactor_task_t;
+typedef std::multimap<time_point, reactor_task_t*> timer_list_t;
+
+
+/**
+ *  \brief Close sockets owned by the event loop once discarded.
+ */
+struct socket_closer_t
+{
+    void operator()(posix_socket_adaptor_t* socket) const
+    {
+        socket->close();
+        delete socket;
+    }
+};
+
+typedef std::unique_ptr<posix_socket_adaptor_t, socket_closer_t> socket_ptr_t;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  \brief Resolved address for a non-blocking connection.
+ */
+struct endpoint_t
+{
+    int family;
+    int socket_type;
+    int protocol;
+    sockaddr_storage address;
+    socklen_t length;
+
+    endpoint_t(const addrinfo& info);
+    addrinfo info() const;
+};
+
+
+/**
+ *  \brief State for a single request in the event loop.
+ */
+struct reactor_task_t
+{
+    enum state_t
+    {
+        RESOLVING,
+        CONNECTING,
+        HANDSHAKING,
+        WRITING,
+        READING,
+    };
+
+    request_t request;
+    std::promise<response_t> promise;
+    std::unique_ptr<dns_query_t> query;
+    std::vector<endpoint_t> endpoints;
+    size_t endpoint = 0;
+    socket_ptr_t socket;
+#if defined(LATTICE_HAVE_OPENSSL)
+    std::unique_ptr<tls_engine_t> tls;
+#endif
+    bool registered = false;
+    bool reused = false;
+    std::string output;
+    size_t written = 0;
+    response_parser_t parser;
+    state_t state = CONNECTING;
+    long redirects = 0;
+    bool digested = false;
+    timer_list_t::iterator timer;
+    time_point deadline;
+    bool timed = false;
+};
+
+
+/**
+ *  \brief Idle keep-alive socket owned by an event loop.
+ */
+struct idle_socket_t
+{
+    socket_ptr_t socket;
+#if defined(LATTICE_HAVE_OPENSSL)
+    std::unique_ptr<tls_engine_t> tls;
+#endif
+    time_point expires;
+};
+
+
+/**
+ *  \brief Single-threaded epoll loop driving many requests.
+ */
+class event_loop_t
+{
+public:
+    event_loop_t();
+    event_loop_t(const event_loop_t&) = delete;
+    event_loop_t & operator=(const event_loop_t&) = delete;
+    ~event_loop_t();
+
+    void submit(std::unique_ptr<reactor_task_t>&& task);
+
+protected:
+    int epoll = -1;
+    int wakeup = -1;
+    std::atomic<bool> running;
+    std::mutex mutex;
+    std::deque<std::unique_ptr<reactor_task_t>> pending;
+    std::condition_variable finished;
+    std::deque<std::unique_ptr<reactor_task_t>> unresolved;
+    size_t lookups = 0;
+    std::unordered_map<reactor_task_t*, std::unique_ptr<reactor_task_t>> tasks;
+    std::unordered_multimap<std::string, idle_socket_t> idle;
+    timer_list_t timers;
+    std::vector<char> buffer;
+    std::thread thread;
+
+    void run();
+    void accept_pending();
+    void start(reactor_task_t* task);
+    void connect(reactor_task_t* task);
+    bool resolved(reactor_task_t* task);
+    void lookup(reactor_task_t* task);
+    void send(reactor_task_t* task, std::string&& message, bool reconnect);
+    void process(reactor_task_t* task);
+    void on_connect(reactor_task_t* task);
+    void on_write(reactor_task_t* task);
+    void on_read(reactor_task_t* task);
+    bool on_data(reactor_task_t* task, const char* data, size_t size);
+    void on_eof(reactor_task_t* task);
+#if defined(LATTICE_HAVE_OPENSSL)
+    void on_handshake(reactor_task_t* task);
+    bool on_decrypt(reactor_task_t* task, size_t size);
+    bool flush(reactor_task_t* task);
+#endif
+    void on_response(reactor_task_t* task, bool reusable);
+    void complete(reactor_task_t* task, bool reusable);
+    void retry(reactor_task_t* task, std::exception_ptr error);
+    void fail(reactor_task_t* task, std::exception_ptr error);
+    void release(reactor_task_t* task);
+    void watch(reactor_task_t* task, uint32_t events);
+    void touch(reactor_task_t* task);
+    bool reuse(reactor_task_t* task);
+    int wait_timeout() const;
+    void expire();
+    void prune();
+};
+
+
+// FUNCTIONS
+// ---------
+
+
+/**
+ *  \brief Resolve the addresses for the request's host or proxy.
+ *
+ *  Address overrides are used as is. If the DNS cache has a resolver, hosts missing from the cache
+ *  start a query, which the event loop completes, unless they match
+ *  `system_host()` or `query` is false. Otherwise, if `wait` is false,
+ *  returns false rather than blocking on a lookup.
+ */
+static bool resolve(reactor_task_t* task, bool wait = true, bool query = true)
+{
+    auto &request = task->request;
+    url_t target = request.get_proxy() ? url_t(request.get_proxy()) : request.get_url();
+    auto cache = request.get_dns_cache();
+    address_list_t addresses;
+    task->query.reset();
+    task->endpoints.clear();
+    bool fixed = request.get_overrides().find(target.host(), target.service(), addresses);
+    if (!fixed && cache) {
+        auto resolver = cache->get_resolver();
+        bool missing = cache->find(target.host(), target.service(), addresses) == DNS_MISSING;
+        if (query && resolver && missing && !system_host(target.host())) {
+            task->query = resolver->query(target.host(), target.service());
+            return true;
+        } else if (missing && !wait) {
+            return false;
+        }
+        addresses = cache->resolve(target.host(), target.service());
+    } else if (!fixed) {
+        if (!wait) {
+            return false;
+        }
+        addresses = lookup_addresses(target.host(), target.service());
+    }
+    for (const auto &address: addresses) {
+        task->endpoints.emplace_back(addrinfo(address));
+    }
+
+    return true;
+}
+
+
+/**
+ *  \brief Get the descriptor the task is waiting on.
+ */
+static int descriptor(const reactor_task_t* task)
+{
+    if (task->state == reactor_task_t::RESOLVING) {
+        return task->query->fd();
+    }
+
+    return task->socket ? task->socket->fd() : -1;
+}
+
+
+template <typename... Ts>
+static std::exception_ptr make_error(Ts&&... ts)
+{
+    return std::make_exception_ptr(std::runtime_error(std::forward<Ts>(ts)...));
+}
+
+
+/**
+ *  \brief Check if the last socket operation would block.
+ */
+static bool would_block(long result)
+{
+    return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+
+// OBJECTS
+// -------
+
+
+endpoint_t::endpoint_t(const addrinfo& info):
+    family(info.ai_family),
+    socket_type(info.ai_socktype),
+    protocol(info.ai_protocol),
+    length(static_cast<socklen_t>(info.ai_addrlen))
+{
+    std::memset(&address, 0, sizeof(address));
+    std::memcpy(&address, info.ai_addr, std::min<size_t>(info.ai_addrlen, sizeof(address)));
+}
+
+
+addrinfo endpoint_t::info() const
+{
+    addrinfo info;
+    std::memset(&info, 0, sizeof(info));
+    info.ai_family = family;
+    info.ai_socktype = socket_type;
+    info.ai_protocol = protocol;
+    info.ai_addr = reinterpret_cast<sockaddr*>(const_cast<sockaddr_storage*>(&address));
+    info.ai_addrlen = length;
+
+    return info;
+}
+
+
+event_loop_t::event_loop_t():
+    running(true),
+    buffer(READ_SIZE)
+{
+    epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll < 0 || wakeup < 0) {
+        throw std::runtime_error("Unable to create event loop.");
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (::epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event) < 0) {
+        throw std::runtime_error("Unable to create event loop.");
+    }
+
+    thread = std::thread(&event_loop_t::run, this);
+}
+
+
+/**
+ *  Outstanding requests fail when the loop is destroyed, once the
+ *  lookups in progress in helper threads finish.
+ */
+event_loop_t::~event_loop_t()
+{
+    running = false;
+    uint64_t value = 1;
+    if (::write(wakeup, &value, sizeof(value)) < 0) {
+        // the loop is still woken by the pending event
+    }
+    thread.join();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return lookups == 0; });
+    }
+
+    auto error = make_error("Event loop stopped before the request completed.");
+    for (auto &pair: tasks) {
+        pair.second->promise.set_exception(error);
+    }
+    for (auto &task: pending) {
+        task->promise.set_exception(error);
+    }
+    for (auto &task: unresolved) {
+        task->promise.set_exception(error);
+    }
+    ::close(epoll);
+    ::close(wakeup);
+}
+
+
+/**
+ *  \brief Queue task from any thread and wake the loop.
+ */
+void event_loop_t::submit(std::unique_ptr<reactor_task_t>&& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace_back(std::move(task));
+    }
+
+    uint64_t value = 1;
+    if (::write(wakeup, &value, sizeof(value)) < 0) {
+        // counter overflow, the loop is already signaled
+    }
+}
+
+
+void event_loop_t::run()
+{
+    epoll_event events[MAX_EVENTS];
+    while (running) {
+        int count = ::epoll_wait(epoll, events, MAX_EVENTS, wait_timeout());
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            auto *task = static_cast<reactor_task_t*>(events[i].data.ptr);
+            if (!task) {
+                uint64_t value;
+                while (::read(wakeup, &value, sizeof(value)) > 0);
+                accept_pending();
+            } else if (tasks.count(task)) {
+                process(task);
+            }
+        }
+        expire();
+    }
+}
+
+
+void event_loop_t::accept_pending()
+{
+    std::deque<std::unique_ptr<reactor_task_t>> list;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        list.swap(pending);
+    }
+
+    for (auto &item: list) {
+        auto *task = item.get();
+        tasks.emplace(task, std::move(item));
+        try {
+            start(task);
+        } catch (...) {
+            fail(task, std::current_exception());
+        }
+    }
+}
+
+
+/**
+ *  \brief Begin request on an idle connection, or a new connection.
+ */
+void event_loop_t::start(reactor_task_t* task)
+{
+    touch(task);
+    task->parser.reset(task->request.get_method());
+    if (reuse(task)) {
+        task->state = reactor_task_t::WRITING;
+        on_write(task);
+    } else {
+        connect(task);
+    }
+}
+
+
+/**
+ *  \brief Take a live idle socket to the request's origin.
+ */
+bool event_loop_t::reuse(reactor_task_t* task)
+{
+    auto now = steady_clock::now();
+    auto range = idle.equal_range(task->request.origin());
+    for (auto it = range.first; it != range.second; ) {
+        auto socket = std::move(it->second.socket);
+        bool usable = it->second.expires > now && socket->alive();
+#if defined(LATTICE_HAVE_OPENSSL)
+        auto tls = std::move(it->second.tls);
+        usable &= !tls || !tls->pending();
+#endif
+        it = idle.erase(it);
+        if (usable) {
+            task->socket = std::move(socket);
+#if defined(LATTICE_HAVE_OPENSSL)
+            task->tls = std::move(tls);
+#endif
+            task->query.reset();
+            task->registered = false;
+            task->reused = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ *  \brief Start a non-blocking connection to the next address.
+ */
+void event_loop_t::connect(reactor_task_t* task)
+{
+    release(task);
+    task->socket.reset();
+#if defined(LATTICE_HAVE_OPENSSL)
+    task->tls.reset();
+#endif
+    task->reused = false;
+    if (!resolved(task)) {
+        return;
+    }
+
+    std::string host = task->request.get_url().host();
+    while (task->endpoint < task->endpoints.size()) {
+        auto info = task->endpoints[task->endpoint++].info();
+        socket_ptr_t socket(new posix_socket_adaptor_t);
+        socket->set_nonblocking();
+        if (socket->open(info, host)) {
+            task->socket = std::move(socket);
+            task->state = reactor_task_t::CONNECTING;
+            watch(task, EPOLLOUT);
+            touch(task);
+            return;
+        }
+    }
+
+    fail(task, make_error("Unable to establish a connection."));
+}
+
+
+/**
+ *  \brief Wait for the task's DNS query, returning true once the
+ *  endpoints are known.
+ *
+ *  Answers and failures are cached with the record TTL. Truncated
+ *  answers are resolved again in a helper thread, with getaddrinfo.
+ */
+bool event_loop_t::resolved(reactor_task_t* task)
+{
+    if (!task->query) {
+        return true;
+    } else if (!task->query->done()) {
+        task->state = reactor_task_t::RESOLVING;
+        watch(task, EPOLLIN);
+        touch(task);
+        return false;
+    }
+
+    auto query = std::move(task->query);
+    if (query->truncated()) {
+        lookup(task);
+        return false;
+    }
+    auto cache = task->request.get_dns_cache();
+    task->state = reactor_task_t::CONNECTING;
+    address_list_t addresses;
+    try {
+        addresses = query->addresses();
+    } catch (...) {
+        cache->insert_failure(query->host(), query->service());
+        throw;
+    }
+    cache->insert(query->host(), query->service(), addresses, query->ttl());
+    for (const auto &address: addresses) {
+        task->endpoints.emplace_back(addrinfo(address));
+    }
+    task->endpoint = 0;
+    touch(task);
+
+    return true;
+}
+
+
+/**
+ *  \brief Resolve the task's host in a helper thread.
+ *
+ *  Lookups without a resolver block, and would stall every request
+ *  on the loop. The task leaves the loop, and is submitted again once
+ *  its addresses are known. Lookups are queued for up to
+ *  LOOKUP_THREADS workers, which exit once the queue is drained.
+ */
+void event_loop_t::lookup(reactor_task_t* task)
+{
+    release(task);
+    task->socket.reset();
+#if defined(LATTICE_HAVE_OPENSSL)
+    task->tls.reset();
+#endif
+    task->endpoint = 0;
+    auto it = tasks.find(task);
+    auto item = std::move(it->second);
+    tasks.erase(it);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unresolved.emplace_back(std::move(item));
+        if (lookups >= LOOKUP_THREADS) {
+            return;
+        }
+        ++lookups;
+    }
+
+    std::thread([this]() {
+        while (true) {
+            std::unique_ptr<reactor_task_t> task;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!running || unresolved.empty()) {
+                    --lookups;
+                    finished.notify_all();
+                    return;
+                }
+                task = std::move(unresolved.front());
+                unresolved.pop_front();
+            }
+            try {
+                resolve(task.get(), true, false);
+            } catch (...) {
+                task->promise.set_exception(std::current_exception());
+                continue;
+            }
+            submit(std::move(task));
+        }
+    }).detach();
+}
+
+
+/**
+ *  \brief Send a follow-up request for a redirect or authentication.
+ */
+void event_loop_t::send(reactor_task_t* task, std::string&& message, bool reconnect)
+{
+    task->output = std::move(message);
+    task->written = 0;
+    task->parser.reset(task->request.get_method());
+    if (reconnect) {
+        task->endpoint = 0;
+        connect(task);
+    } else {
+        task->reused = false;
+        task->state = reactor_task_t::WRITING;
+        on_write(task);
+    }
+}
+
+
+void event_loop_t::process(reactor_task_t* task)
+{
+    try {
+        switch (task->state) {
+            case reactor_task_t::RESOLVING:
+                task->query->on_readable();
+                connect(task);
+                break;
+            case reactor_task_t::CONNECTING:
+                on_connect(task);
+                break;
+            case reactor_task_t::HANDSHAKING:
+#if defined(LATTICE_HAVE_OPENSSL)
+                on_handshake(task);
+#endif
+                break;
+            case reactor_task_t::WRITING:
+                on_write(task);
+                break;
+            case reactor_task_t::READING:
+                on_read(task);
+                break;
+        }
+    } catch (...) {
+        fail(task, std::current_exception());
+    }
+}
+
+
+void event_loop_t::on_connect(reactor_task_t* task)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(task->socket->fd(), SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error) {
+        // try the next address
+        connect(task);
+        return;
+    }
+
+#if defined(LATTICE_HAVE_OPENSSL)
+    auto &request = task->request;
+    if (request.get_url().service() == "https") {
+        task->tls.reset(new tls_engine_t);
+        task->tls->set_certificate_file(request.get_certificate_file());
+        task->tls->set_revocation_lists(request.get_revocation_lists());
+        task->tls->set_ssl_protocol(request.get_ssl_protocol());
+        task->tls->set_verify_peer(request.get_verify_peer());
+        task->tls->open(request.get_url().host());
+        task->state = reactor_task_t::HANDSHAKING;
+        touch(task);
+        on_handshake(task);
+        return;
+    }
+#endif
+
+    task->state = reactor_task_t::WRITING;
+    on_write(task);
+}
+
+
+void event_loop_t::on_write(reactor_task_t* task)
+{
+#if defined(LATTICE_HAVE_OPENSSL)
+    if (task->tls) {
+        if (task->written < task->output.size()) {
+            const char *data = task->output.data() + task->written;
+            task->written += task->tls->write(data, task->output.size() - task->written);
+        }
+        try {
+            if (!flush(task)) {
+                return;
+            }
+        } catch (...) {
+            retry(task, std::current_exception());
+            return;
+        }
+        task->state = reactor_task_t::READING;
+        watch(task, EPOLLIN);
+        return;
+    }
+#endif
+
+    while (task->written < task->output.size()) {
+        const char *data = task->output.data() + task->written;
+        size_t size = task->output.size() - task->written;
+        long sent = static_cast<long>(task->socket->write(data, size));
+        if (would_block(sent)) {
+            watch(task, EPOLLOUT);
+            return;
+        } else if (sent <= 0) {
+            retry(task, make_error("Unable to make request, connection was closed."));
+            return;
+        }
+        task->written += sent;
+        touch(task);
+    }
+
+    task->state = reactor_task_t::READING;
+    watch(task, EPOLLIN);
+}
+
+
+void event_loop_t::on_read(reactor_task_t* task)
+{
+    while (true) {
+        long read = static_cast<long>(task->socket->read(buffer.data(), buffer.size()));
+        if (would_block(read)) {
+            return;
+        } else if (read < 0) {
+            retry(task, make_error("Unable to read response, connection was reset."));
+            return;
+        } else if (read == 0) {
+            on_eof(task);
+            return;
+        }
+
+        touch(task);
+#if defined(LATTICE_HAVE_OPENSSL)
+        if (task->tls) {
+            if (on_decrypt(task, read)) {
+                return;
+            }
+            continue;
+        }
+#endif
+        if (on_data(task, buffer.data(), read)) {
+            return;
+        } else if (static_cast<size_t>(read) < buffer.size()) {
+            return;
+        }
+    }
+}
+
+
+/**
+ *  \brief Parse response data, returning true once the response completes.
+ */
+bool event_loop_t::on_data(reactor_task_t* task, const char* data, size_t size)
+{
+    size_t consumed = task->parser.feed(data, size);
+    if (!task->parser.done()) {
+        return false;
+    }
+
+    // unexpected trailing data means the socket cannot be reused
+    bool reusable = consumed == size;
+#if defined(LATTICE_HAVE_OPENSSL)
+    reusable &= !task->tls || !task->tls->pending();
+#endif
+    on_response(task, reusable);
+    return true;
+}
+
+
+/**
+ *  \brief Finish a response delimited by the connection closing.
+ */
+void event_loop_t::on_eof(reactor_task_t* task)
+{
+    try {
+        task->parser.finish();
+    } catch (...) {
+        retry(task, std::current_exception());
+        return;
+    }
+    on_response(task, false);
+}
+
+#if defined(LATTICE_HAVE_OPENSSL)
+
+
+/**
+ *  \brief Advance the TLS handshake, then send the request.
+ */
+void event_loop_t::on_handshake(reactor_task_t* task)
+{
+    auto &tls = *task->tls;
+    while (true) {
+        bool done = tls.handshake();
+        if (!flush(task)) {
+            return;
+        } else if (done) {
+            task->state = reactor_task_t::WRITING;
+            touch(task);
+            on_write(task);
+            return;
+        }
+
+        long read = static_cast<long>(task->socket->read(buffer.data(), buffer.size()));
+        if (would_block(read)) {
+            watch(task, EPOLLIN);
+            return;
+        } else if (read <= 0) {
+            throw std::runtime_error("Unable to complete SSL handshake.");
+        }
+        touch(task);
+        tls.receive(buffer.data(), read);
+    }
+}
+
+
+/**
+ *  \brief Decrypt `size` bytes of the read buffer, and parse the
+ *  plaintext. Returns true once the response completes.
+ */
+bool event_loop_t::on_decrypt(reactor_task_t* task, size_t size)
+{
+    auto &tls = *task->tls;
+    tls.receive(buffer.data(), size);
+    while (true) {
+        long read = tls.read(buffer.data(), buffer.size());
+        if (read < 0) {
+            return false;
+        } else if (read == 0) {
+            on_eof(task);
+            return true;
+        } else if (on_data(task, buffer.data(), read)) {
+            return true;
+        }
+    }
+}
+
+
+/**
+ *  \brief Send the ciphertext waiting in the task's TLS engine.
+ *
+ *  Returns false if the socket would block, after watching for space.
+ */
+bool event_loop_t::flush(reactor_task_t* task)
+{
+    auto &tls = *task->tls;
+    for (auto output = tls.output(); output.size; output = tls.output()) {
+        long sent = static_cast<long>(task->socket->write(output.data, output.size));
+        if (would_block(sent)) {
+            watch(task, EPOLLOUT);
+            return false;
+        } else if (sent <= 0) {
+            throw std::runtime_error("Unable to make request, connection was closed.");
+        }
+        tls.consume(sent);
+        touch(task);
+    }
+
+    return true;
+}
+
+#endif
+
+
+/**
+ *  \brief Handle complete response, following redirects or digest
+ *  authentication challenges like request_t::exec().
+ */
+void event_loop_t::on_response(reactor_task_t* task, bool reusable)
+{
+    auto &request = task->request;
+    auto &response = task->parser.response();
+    bool keep = reusable && response.keep_alive() && !request.get_header().close_connection();
+
+    if (response.unauthorized() && request.get_digest() && !task->digested) {
+        task->digested = true;
+        send(task, request.message(response), !keep);
+        return;
+    } else if (!task->digested) {
+        method_t method = response.redirect(request.get_method());
+        if (method != STOP && task->redirects > 0) {
+            --task->redirects;
+            request.set_method(method);
+            bool reconnect = request.follow(response) || !keep;
+            if (reconnect && !resolve(task, false)) {
+                task->output = request.message();
+                task->written = 0;
+                lookup(task);
+                return;
+            }
+            send(task, request.message(), reconnect);
+            return;
+        }
+    }
+
+    complete(task, keep);
+}
+
+
+/**
+ *  \brief Resolve the request, and keep the socket if allowed.
+ *
+ *  Each origin keeps up to MAX_IDLE sockets, and the loop up to
+ *  MAX_IDLE_TOTAL, evicting the socket closest to expiry.
+ */
+void event_loop_t::complete(reactor_task_t* task, bool reusable)
+{
+    release(task);
+    if (reusable && idle.count(task->request.origin()) < MAX_IDLE) {
+        if (idle.size() >= MAX_IDLE_TOTAL) {
+            typedef decltype(idle)::value_type entry_t;
+            auto oldest = std::min_element(idle.begin(), idle.end(), [](const entry_t& left, const entry_t& right) {
+                return left.second.expires < right.second.expires;
+            });
+            idle.erase(oldest);
+        }
+        idle_socket_t item;
+        item.socket = std::move(task->socket);
+#if defined(LATTICE_HAVE_OPENSSL)
+        item.tls = std::move(task->tls);
+#endif
+        item.expires = steady_clock::now() + IDLE_TIMEOUT;
+        auto timeout = task->parser.response().keep_alive_timeout();
+        if (timeout) {
+            item.expires = std::min(item.expires, steady_clock::now() + std::chrono::milliseconds(timeout.milliseconds()));
+        }
+        idle.emplace(task->request.origin(), std::move(item));
+    }
+
+    task->promise.set_value(std::move(task->parser.response()));
+    tasks.erase(task);
+}
+
+
+/**
+ *  \brief Retry requests that failed on a reused connection.
+ *
+ *  The server may close idle connections at any time, so requests
+ *  which fail before any response was received are retried on a new
+ *  connection if nothing was sent, or the method is idempotent.
+ */
+void event_loop_t::retry(reactor_task_t* task, std::exception_ptr error)
+{
+    bool retry = task->reused && !task->parser.headers_done();
+    retry &= task->written == 0 || is_idempotent(task->request.get_method());
+    if (!retry) {
+        fail(task, error);
+        return;
+    }
+
+    task->written = 0;
+    task->endpoint = 0;
+    task->parser.reset(task->request.get_method());
+    connect(task);
+}
+
+
+void event_loop_t::fail(reactor_task_t* task, std::exception_ptr error)
+{
+    release(task);
+    task->promise.set_exception(error);
+    tasks.erase(task);
+}
+
+
+/**
+ *  \brief Stop watching the task's descriptor and timer.
+ */
+void event_loop_t::release(reactor_task_t* task)
+{
+    if (task->timed) {
+        timers.erase(task->timer);
+        task->timed = false;
+    }
+    if (task->registered) {
+        int fd = descriptor(task);
+        if (fd >= 0) {
+            ::epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        task->registered = false;
+    }
+}
+
+
+void event_loop_t::watch(reactor_task_t* task, uint32_t events)
+{
+    epoll_event event;
+    event.events = events;
+    event.data.ptr = task;
+    int operation = task->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (::epoll_ctl(epoll, operation, descriptor(task), &event) < 0) {
+        throw std::runtime_error("Unable to watch socket via epoll_ctl().");
+    }
+    task->registered = true;
+}
+
+
+/**
+ *  \brief Reset the inactivity timer after progress on the request.
+ *
+ *  Connecting and the TLS handshake use their own timeouts, and later
+ *  phases the read timeout, if set. The timer never runs past the total deadline.
+ *  DNS queries are bounded by the resolver, so while resolving, the
+ *  timer fires when the query should be retried.
+ */
+void event_loop_t::touch(reactor_task_t* task)
+{
+    auto &request = task->request;
+    bool limited = task->deadline != time_point();
+    if (task->state == reactor_task_t::RESOLVING) {
+        if (task->timed) {
+            timers.erase(task->timer);
+        }
+        auto expires = task->query->expires();
+        task->timer = timers.emplace(limited ? std::min(expires, task->deadline) : expires, task);
+        task->timed = true;
+        return;
+    }
+
+    const timeout_t* phase = &request.get_read_timeout();
+    if (task->state == reactor_task_t::CONNECTING) {
+        phase = &request.get_connect_timeout();
+    } else if (task->state == reactor_task_t::HANDSHAKING) {
+        phase = &request.get_handshake_timeout();
+    }
+    const timeout_t& timeout = *phase ? *phase : request.get_timeout();
+    if (!timeout && !limited) {
+        return;
+    }
+
+    if (task->timed) {
+        timers.erase(task->timer);
+    }
+    auto deadline = task->deadline;
+    if (timeout) {
+        auto expires = steady_clock::now() + std::chrono::milliseconds(timeout.milliseconds());
+        deadline = limited ? std::min(deadline, expires) : expires;
+    }
+    task->timer = timers.emplace(deadline, task);
+    task->timed = true;
+}
+
+
+/**
+ *  \brief Wait until the next timer, or until an idle socket expires.
+ */
+int event_loop_t::wait_timeout() const
+{
+    time_point next;
+    if (!timers.empty()) {
+        next = timers.begin()->first;
+    }
+    for (const auto &item: idle) {
+        if (next == time_point() || item.second.expires < next) {
+            next = item.second.expires;
+        }
+    }
+    if (next == time_point()) {
+        return -1;
+    }
+
+    auto remaining = next - steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+    return static_cast<int>(std::max<long long>(ms, 0));
+}
+
+
+void event_loop_t::expire()
+{
+    auto now = steady_clock::now();
+    while (!timers.empty() && timers.begin()->first <= now) {
+        auto *task = timers.begin()->second;
+        bool limited = task->deadline != time_point();
+        if (task->state != reactor_task_t::RESOLVING || (limited && now >= task->deadline)) {
+            fail(task, make_error("Request timed out."));
+            continue;
+        }
+
+        // retry the lookup on the next nameserver
+        try {
+            task->query->on_timeout();
+            connect(task);
+        } catch (...) {
+            fail(task, std::current_exception());
+        }
+    }
+    prune();
+}
+
+
+/**
+ *  \brief Close idle sockets past their keep-alive timeout.
+ */
+void event_loop_t::prune()
+{
+    auto now = steady_clock::now();
+    for (auto it = idle.begin(); it != idle.end(); ) {
+        if (it->second.expires <= now) {
+            it = idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+#else
+
+/**
+ *  \brief Placeholder on systems without an event loop.
+ */
+class event_loop_t
+{};
+
+#endif
+}   /* detail */
+
+// FUNCTIONS
+// ---------
+
+
+std::shared_ptr<reactor_t> default_reactor()
+{
+    static std::shared_ptr<reactor_t> reactor = [] {
+        size_t threads = std::thread::hardware_concurrency();
+        return std::make_shared<reactor_t>(std::max<size_t>(1, std::min<size_t>(threads, 4)));
+    }();
+    return reactor;
+}
+
+// OBJECTS
+// -------
+
+
+reactor_t::reactor_t(size_t threads):
+    counter(0)
+{
+#if defined(LATTICE_HAVE_EPOLL)
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        loops.emplace_back(new detail::event_loop_t);
+    }
+#endif
+}
+
+
+reactor_t::~reactor_t()
+{}
+
+
+/**
+ *  \brief Check if the request can run in an event loop.
+ *
+ *  Only HTTP/1.1 requests without streaming callbacks, downloads, or
+ *  file uploads are run in event loops, since their bodies would be
+ *  buffered in memory. HTTPS runs over a memory-buffered TLS
+ *  engine, without a proxy.
+ */
+bool reactor_t::supports(const request_t& request) const
+{
+    auto &proxy = request.get_proxy();
+    auto service = request.get_url().service();
+#if defined(LATTICE_HAVE_OPENSSL)
+    bool secure = service == "https" && !proxy;
+#else
+    bool secure = false;
+#endif
+    return (
+        !loops.empty() &&
+        !request.get_header_callback() &&
+        !request.get_body_callback() &&
+        !request.get_download() &&
+        !request.get_multipart().has_files() &&
+        request.get_http_version() == HTTP_1_1 &&
+        (service == "http" || secure) &&
+        (!proxy || url_t(proxy).service() == "http")
+    );
+}
+
+
+size_t reactor_t::threads() const
+{
+    return loops.size();
+}
+
+
+/**
+ *  \brief Start request, and return a future for the response.
+ *
+ *  Name resolution runs in the calling thread, unless the DNS cache
+ *  has a resolver, in which case uncached hosts are resolved in the
+ *  event loop. Hosts for redirects are resolved the same way, but
+ *  by a few helper threads rather than the calling thread. Errors are
+ *  reported through the future.
+ */
+std::future<response_t> reactor_t::submit(request_t&& request)
+{
+    if (!supports(request)) {
+        return std::async(std::launch::async, [](request_t &&request) {
+            return request.exec();
+        }, std::move(request));
+    }
+
+#if defined(LATTICE_HAVE_EPOLL)
+    std::unique_ptr<detail::reactor_task_t> task(new detail::reactor_task_t);
+    auto future = task->promise.get_future();
+    try {
+        if (request.get_total_timeout()) {
+            auto total = std::chrono::milliseconds(request.get_total_timeout().milliseconds());
+            task->deadline = detail::steady_clock::now() + total;
+        }
+        task->redirects = request.get_redirects().count;
+        task->output = request.message();
+        task->request = std::move(request);
+        detail::resolve(task.get());
+    } catch (...) {
+        task->promise.set_exception(std::current_exception());
+        return future;
+    }
+
+    loops[counter++ % loops.size()]->submit(std::move(task));
+    return future;
+#else
+    throw std::runtime_error("Event loops are not supported.");
+#endif
+}
+
+LATTICE_END_NAMESPACE
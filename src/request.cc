@@ -9,7 +9,9 @@
 #include <lattice/request.h>
 #include <lattice/version.h>
 #include <pycpp/string/base64.h>
+#include <pycpp/string/casemap.h>
 #include <pycpp/string/codec.h>
+#include <pycpp/string/string.h>
 #include <pycpp/string/unicode.h>
 #include <cstdio>
 #include <fstream>
@@ -21,6 +23,24 @@
 
 LATTICE_BEGIN_NAMESPACE
 
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Check if the header only applies to HTTP/1.1 connections.
+ */
+static bool is_connection_header(const std::string& name)
+{
+    return (
+        name == "connection" ||
+        name == "keep-alive" ||
+        name == "proxy-connection" ||
+        name == "transfer-encoding" ||
+        name == "upgrade"
+    );
+}
+
 // OBJECTS
 // -------
 
@@ -52,6 +72,51 @@ std::string request_t::method_name() const
 }
 
 
+/**
+ *  \brief Key for connections which may serve the request.
+ *
+ *  Encrypted connections also depend on the SSL/TLS options used to
+ *  establish the connection.
+ */
+std::string request_t::origin() const
+{
+    url_t target = proxy ? url_t(proxy) : url;
+    std::string key = target.service() + "://" + target.host();
+    if (target.service() == "https") {
+        key += "|" + certificate + "|" + revoke;
+        key += "|" + std::to_string(int_t(ssl));
+        key += "|" + std::to_string(bool(verifypeer));
+    }
+
+    return key;
+}
+
+
+/**
+ *  \brief Update the URL from a redirect response.
+ *
+ *  Returns if the connection must be reset for the new location.
+ */
+bool request_t::follow(const response_t& response)
+{
+    // check if we need to reset connection
+    bool reconnect = header.close_connection();
+    reconnect |= response.headers().close_connection();
+
+    url_t newurl(response.headers().at("location"));
+    if (newurl.absolute()) {
+        // reconnect if the service or host changes
+        reconnect |= url.service() != newurl.service();
+        reconnect |= url.host() != newurl.host();
+        url = newurl;
+    } else {
+        url.set_path(newurl.path());
+    }
+
+    return reconnect;
+}
+
+
 std::stringstream request_t::method_header() const
 {
     std::stringstream data;
@@ -104,6 +169,72 @@ std::stringstream request_t::method_header(const response_t& response) const
 }
 
 
+/**
+ *  \brief Get the request body, referencing the request's buffers.
+ */
+buffer_list_t request_t::body_buffers() const
+{
+    buffer_list_t list;
+    if (method == POST && parameters) {
+        list.view(parameters.post());
+    } else if (multipart) {
+        multipart.buffers(list);
+    }
+
+    return list;
+}
+
+
+/**
+ *  \brief Convert formatted HTTP/1.1 headers to HTTP/2 header fields.
+ *
+ *  The host header becomes the authority, and the TE header may
+ *  only request trailers.
+ */
+hpack_fields_t request_t::header_fields(const std::string& headers, size_t length) const
+{
+    std::string authority = url.host();
+    hpack_fields_t fields;
+    size_t first = 0;
+    while (first < headers.size()) {
+        size_t last = headers.find('\n', first);
+        last = last == std::string::npos ? headers.size() : last;
+        std::string line = headers.substr(first, last - first);
+        first = last + 1;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = ascii_tolower(line.substr(0, colon));
+        std::string value = trim(line.substr(colon + 1));
+        if (name == "host") {
+            authority = value;
+        } else if (is_connection_header(name) || (name == "te" && value != "trailers")) {
+            continue;
+        } else {
+            fields.emplace_back(std::move(name), std::move(value));
+        }
+    }
+    if (length) {
+        fields.emplace_back("content-length", std::to_string(length));
+    }
+
+    std::string path = url.path();
+    if (method != POST) {
+        path += parameters.get();
+    }
+    fields.insert(fields.begin(), {
+        {":method", method_name()},
+        {":scheme", url.service()},
+        {":authority", authority},
+        {":path", path},
+    });
+
+    return fields;
+}
+
+
 void request_t::set_method(method_t method)
 {
     this->method = method;
@@ -156,6 +287,30 @@ void request_t::set_timeout(const timeout_t& timeout)
 }
 
 
+void request_t::set_connect_timeout(const connect_timeout_t& timeout)
+{
+    connect_timeout = timeout;
+}
+
+
+void request_t::set_handshake_timeout(const handshake_timeout_t& timeout)
+{
+    handshake_timeout = timeout;
+}
+
+
+void request_t::set_read_timeout(const read_timeout_t& timeout)
+{
+    read_timeout = timeout;
+}
+
+
+void request_t::set_total_timeout(const total_timeout_t& timeout)
+{
+    total_timeout = timeout;
+}
+
+
 void request_t::set_auth(const authentication_t& auth)
 {
     header["Authorization"] = "Basic " + base64_encode(auth.string());
@@ -270,13 +425,25 @@ void request_t::set_ssl_protocol(ssl_protocol_t ssl)
 
 void request_t::set_verify_peer(const verify_peer_t& peer)
 {
-    this->verifypeer = verifypeer;
+    this->verifypeer = peer;
 }
 
 
 void request_t::set_verify_peer(verify_peer_t&& peer)
 {
-    this->verifypeer = verifypeer;
+    this->verifypeer = peer;
+}
+
+
+void request_t::set_early_data(const early_data_t& early)
+{
+    this->earlydata = early;
+}
+
+
+void request_t::set_kernel_tls(const kernel_tls_t& kernel)
+{
+    this->kerneltls = kernel;
 }
 
 
@@ -286,6 +453,63 @@ void request_t::set_cache(const dns_cache_t& cache)
 }
 
 
+void request_t::set_overrides(const dns_overrides_t& overrides)
+{
+    this->overrides = overrides;
+}
+
+
+void request_t::set_overrides(dns_overrides_t&& overrides)
+{
+    this->overrides = std::move(overrides);
+}
+
+
+void request_t::set_connection_cache(const connection_cache_t& pool)
+{
+    this->pool = pool;
+}
+
+
+void request_t::set_header_callback(const header_callback_t& callback)
+{
+    this->header_callback = callback;
+}
+
+
+/**
+ *  \brief Stream the response body to a callback, without storing it.
+ */
+void request_t::set_body_callback(const body_callback_t& callback)
+{
+    this->body_callback = callback;
+}
+
+
+/**
+ *  \brief Write the response body to a file, without storing it.
+ */
+void request_t::set_download(const download_t& download)
+{
+    this->download = download;
+}
+
+
+void request_t::set_download(download_t&& download)
+{
+    this->download = std::forward<download_t>(download);
+}
+
+
+/**
+ *  \brief Set the HTTP protocol version.
+ */
+void request_t::set_http_version(http_version_t version)
+{
+    this->version = version;
+}
+
+
 void request_t::set_option(method_t method)
 {
     this->method = method;
@@ -328,6 +552,30 @@ void request_t::set_option(const timeout_t& timeout)
 }
 
 
+void request_t::set_option(const connect_timeout_t& timeout)
+{
+    connect_timeout = timeout;
+}
+
+
+void request_t::set_option(const handshake_timeout_t& timeout)
+{
+    handshake_timeout = timeout;
+}
+
+
+void request_t::set_option(const read_timeout_t& timeout)
+{
+    read_timeout = timeout;
+}
+
+
+void request_t::set_option(const total_timeout_t& timeout)
+{
+    total_timeout = timeout;
+}
+
+
 void request_t::set_option(const authentication_t& auth)
 {
     header["Authorization"] = "Basic " + base64_encode(auth.string());
@@ -432,13 +680,25 @@ void request_t::set_option(ssl_protocol_t ssl)
 
 void request_t::set_option(const verify_peer_t& peer)
 {
-    this->verifypeer = verifypeer;
+    this->verifypeer = peer;
 }
 
 
 void request_t::set_option(verify_peer_t&& peer)
 {
-    this->verifypeer = verifypeer;
+    this->verifypeer = peer;
+}
+
+
+void request_t::set_option(const early_data_t& early)
+{
+    this->earlydata = early;
+}
+
+
+void request_t::set_option(const kernel_tls_t& kernel)
+{
+    this->kerneltls = kernel;
 }
 
 
@@ -448,6 +708,54 @@ void request_t::set_option(const dns_cache_t& cache)
 }
 
 
+void request_t::set_option(const dns_overrides_t& overrides)
+{
+    this->overrides = overrides;
+}
+
+
+void request_t::set_option(dns_overrides_t&& overrides)
+{
+    this->overrides = std::move(overrides);
+}
+
+
+void request_t::set_option(const connection_cache_t& pool)
+{
+    this->pool = pool;
+}
+
+
+void request_t::set_option(const header_callback_t& callback)
+{
+    set_header_callback(callback);
+}
+
+
+void request_t::set_option(const body_callback_t& callback)
+{
+    set_body_callback(callback);
+}
+
+
+void request_t::set_option(const download_t& download)
+{
+    set_download(download);
+}
+
+
+void request_t::set_option(download_t&& download)
+{
+    set_download(std::forward<download_t>(download));
+}
+
+
+void request_t::set_option(http_version_t version)
+{
+    set_http_version(version);
+}
+
+
 method_t request_t::get_method() const
 {
     return method;
@@ -478,6 +786,36 @@ const timeout_t& request_t::get_timeout() const
 }
 
 
+const connect_timeout_t& request_t::get_connect_timeout() const
+{
+    return connect_timeout;
+}
+
+
+const handshake_timeout_t& request_t::get_handshake_timeout() const
+{
+    return handshake_timeout;
+}
+
+
+const read_timeout_t& request_t::get_read_timeout() const
+{
+    return read_timeout;
+}
+
+
+const total_timeout_t& request_t::get_total_timeout() const
+{
+    return total_timeout;
+}
+
+
+const proxy_t& request_t::get_proxy() const
+{
+    return proxy;
+}
+
+
 const digest_t& request_t::get_digest() const
 {
     return digest;
@@ -514,9 +852,63 @@ const verify_peer_t& request_t::get_verify_peer() const
 }
 
 
+const early_data_t& request_t::get_early_data() const
+{
+    return earlydata;
+}
+
+
+const kernel_tls_t& request_t::get_kernel_tls() const
+{
+    return kerneltls;
+}
+
+
 const dns_cache_t request_t::get_dns_cache() const
 {
     return cache;
 }
 
+
+const dns_overrides_t& request_t::get_overrides() const
+{
+    return overrides;
+}
+
+
+const connection_cache_t request_t::get_connection_cache() const
+{
+    return pool;
+}
+
+
+const header_callback_t& request_t::get_header_callback() const
+{
+    return header_callback;
+}
+
+
+const body_callback_t& request_t::get_body_callback() const
+{
+    return body_callback;
+}
+
+
+const download_t& request_t::get_download() const
+{
+    return download;
+}
+
+
+const multipart_t& request_t::get_multipart() const
+{
+    return multipart;
+}
+
+
+http_version_t request_t::get_http_version() const
+{
+    return version;
+}
+
 LATTICE_END_NAMESPACE
@@ -0,0 +1,697 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Asynchronous DNS resolver over UDP.
+ */
+
+#ifndef _WIN32
+
+#include <lattice/resolver.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static const char RESOLV_CONF[] = "/etc/resolv.conf";
+static constexpr size_t DNS_PACKET_SIZE = 1232;
+static constexpr uint16_t DNS_TYPE_A = 1;
+static constexpr uint16_t DNS_TYPE_CNAME = 5;
+static constexpr uint16_t DNS_TYPE_AAAA = 28;
+static constexpr uint16_t DNS_TYPE_OPT = 41;
+static constexpr uint16_t DNS_CLASS_IN = 1;
+static constexpr int DNS_RCODE_NXDOMAIN = 3;
+static constexpr uint16_t DNS_FLAG_TRUNCATED = 0x0200;
+static constexpr size_t DNS_MAX_CNAMES = 8;
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Resource record in an answer, referencing its data.
+ */
+struct dns_record_t
+{
+    std::string owner;
+    uint16_t type;
+    uint16_t klass;
+    uint32_t ttl;
+    size_t offset;
+    uint16_t length;
+};
+
+
+static void put16(std::string& packet, uint16_t value)
+{
+    packet.push_back(static_cast<char>(value >> 8));
+    packet.push_back(static_cast<char>(value & 0xff));
+}
+
+
+static bool get16(const std::string& packet, size_t offset, uint16_t& value)
+{
+    if (offset + 2 > packet.size()) {
+        return false;
+    }
+    auto *data = reinterpret_cast<const unsigned char*>(packet.data() + offset);
+    value = static_cast<uint16_t>((data[0] << 8) | data[1]);
+    return true;
+}
+
+
+static bool get32(const std::string& packet, size_t offset, uint32_t& value)
+{
+    uint16_t high, low;
+    if (!get16(packet, offset, high) || !get16(packet, offset + 2, low)) {
+        return false;
+    }
+    value = (static_cast<uint32_t>(high) << 16) | low;
+    return true;
+}
+
+
+/**
+ *  \brief Generate an unpredictable query ID.
+ */
+static uint16_t random_id()
+{
+    thread_local std::mt19937 generator(std::random_device {}());
+    return static_cast<uint16_t>(generator());
+}
+
+
+/**
+ *  \brief Encode the question for a name, with recursion desired.
+ *
+ *  An EDNS0 OPT record advertises DNS_PACKET_SIZE, since servers
+ *  otherwise truncate UDP answers at 512 bytes.
+ */
+static std::string encode_question(uint16_t id, const std::string& name, uint16_t type)
+{
+    std::string packet;
+    put16(packet, id);
+    put16(packet, 0x0100);
+    put16(packet, 1);
+    put16(packet, 0);
+    put16(packet, 0);
+    put16(packet, 1);
+
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        size_t length = end - start;
+        if (length == 0 || length > 63) {
+            throw std::runtime_error("Invalid host name: " + name);
+        }
+        packet.push_back(static_cast<char>(length));
+        packet.append(name, start, length);
+        start = end + 1;
+    }
+    packet.push_back('\0');
+    put16(packet, type);
+    put16(packet, DNS_CLASS_IN);
+
+    // OPT record for the root, with no flags or options
+    packet.push_back('\0');
+    put16(packet, DNS_TYPE_OPT);
+    put16(packet, static_cast<uint16_t>(DNS_PACKET_SIZE));
+    put16(packet, 0);
+    put16(packet, 0);
+    put16(packet, 0);
+
+    return packet;
+}
+
+
+/**
+ *  \brief Read a possibly compressed name, advancing past it.
+ */
+static bool read_name(const std::string& packet, size_t& offset, std::string& name)
+{
+    name.clear();
+    size_t position = offset;
+    bool jumped = false;
+    for (int jumps = 0; jumps < 64; ) {
+        if (position >= packet.size()) {
+            return false;
+        }
+        auto length = static_cast<unsigned char>(packet[position]);
+        if ((length & 0xc0) == 0xc0) {
+            uint16_t pointer;
+            if (!get16(packet, position, pointer)) {
+                return false;
+            }
+            if (!jumped) {
+                offset = position + 2;
+            }
+            jumped = true;
+            position = pointer & 0x3fff;
+            ++jumps;
+        } else if (length == 0) {
+            if (!jumped) {
+                offset = position + 1;
+            }
+            return true;
+        } else {
+            if (position + 1 + length > packet.size()) {
+                return false;
+            }
+            if (!name.empty()) {
+                name.push_back('.');
+            }
+            name.append(packet, position + 1, length);
+            position += 1 + length;
+        }
+    }
+
+    return false;
+}
+
+
+static bool same_name(const std::string& left, const std::string& right)
+{
+    return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin(), [](char l, char r) {
+        return std::tolower(static_cast<unsigned char>(l)) == std::tolower(static_cast<unsigned char>(r));
+    });
+}
+
+
+static address_t make_address(const sockaddr* address, socklen_t length)
+{
+    addrinfo info;
+    memset(&info, 0, sizeof(info));
+    info.ai_family = address->sa_family;
+    info.ai_socktype = SOCK_STREAM;
+    info.ai_protocol = IPPROTO_TCP;
+    info.ai_addr = const_cast<sockaddr*>(address);
+    info.ai_addrlen = length;
+
+    return address_t(info);
+}
+
+
+/**
+ *  \brief Parse a numeric address, returning false for names.
+ */
+static bool numeric_address(const std::string& host, uint16_t port, address_t& address)
+{
+    sockaddr_in ipv4;
+    sockaddr_in6 ipv6;
+    memset(&ipv4, 0, sizeof(ipv4));
+    memset(&ipv6, 0, sizeof(ipv6));
+    if (::inet_pton(AF_INET, host.data(), &ipv4.sin_addr) == 1) {
+        ipv4.sin_family = AF_INET;
+        ipv4.sin_port = htons(port);
+        address = make_address(reinterpret_cast<sockaddr*>(&ipv4), sizeof(ipv4));
+        return true;
+    } else if (::inet_pton(AF_INET6, host.data(), &ipv6.sin6_addr) == 1) {
+        ipv6.sin6_family = AF_INET6;
+        ipv6.sin6_port = htons(port);
+        address = make_address(reinterpret_cast<sockaddr*>(&ipv6), sizeof(ipv6));
+        return true;
+    }
+
+    return false;
+}
+
+// OBJECTS
+// -------
+
+
+dns_query_t::dns_query_t(const std::string& host, const std::string& service, const address_list_t& servers, std::chrono::milliseconds timeout, int attempts):
+    hostname(host),
+    servicename(service),
+    servers(servers),
+    timeout(timeout),
+    attempts(std::max(attempts, 1))
+{
+    std::string port;
+    split_host(host, name, port);
+    this->port = service_port(port.empty() ? service : port);
+    if (!name.empty() && name.back() == '.') {
+        name.pop_back();
+    }
+    questions[0].type = DNS_TYPE_A;
+    questions[1].type = DNS_TYPE_AAAA;
+
+    address_t address;
+    if (numeric_address(name, this->port, address)) {
+        results.emplace_back(address);
+        minimum = static_cast<uint32_t>(DNS_TTL.count());
+        finished = true;
+        return;
+    } else if (servers.empty()) {
+        throw std::runtime_error("No nameservers to resolve host: " + host);
+    }
+    send();
+}
+
+
+dns_query_t::~dns_query_t()
+{
+    if (sock >= 0) {
+        ::close(sock);
+    }
+}
+
+
+/**
+ *  \brief Read all pending responses.
+ */
+void dns_query_t::on_readable()
+{
+    char buffer[DNS_PACKET_SIZE * 4];
+    while (!finished && sock >= 0) {
+        ssize_t length = ::recv(sock, buffer, sizeof(buffer), 0);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (length < 0) {
+            // ICMP errors, like an unreachable nameserver
+            on_timeout();
+            break;
+        }
+        if (!receive(std::string(buffer, length))) {
+            // the nameserver failed, so move on early
+            on_timeout();
+        }
+    }
+}
+
+
+/**
+ *  \brief Retry unanswered questions on the next nameserver, or fail
+ *  once all attempts are used.
+ */
+void dns_query_t::on_timeout()
+{
+    if (finished) {
+        return;
+    }
+    if (tries >= attempts * static_cast<int>(servers.size())) {
+        finished = true;
+        return;
+    }
+    send();
+}
+
+
+int dns_query_t::fd() const
+{
+    return sock;
+}
+
+
+/**
+ *  \brief Get the time to retry on the next nameserver.
+ */
+auto dns_query_t::expires() const -> clock::time_point
+{
+    return deadline;
+}
+
+
+bool dns_query_t::done() const
+{
+    return finished;
+}
+
+
+/**
+ *  \brief Check if the query finished with a truncated answer, which
+ *  must be resolved another way.
+ */
+bool dns_query_t::truncated() const
+{
+    return overflowed;
+}
+
+
+/**
+ *  \brief Get the addresses by order of preference, or throw if the
+ *  lookup failed.
+ */
+address_list_t dns_query_t::addresses() const
+{
+    if (!finished) {
+        throw std::runtime_error("DNS query is still running.");
+    } else if (results.empty()) {
+        throw std::runtime_error("Unable to resolve host: " + hostname);
+    }
+
+    return results;
+}
+
+
+/**
+ *  \brief Get the lowest TTL of the answers.
+ */
+std::chrono::seconds dns_query_t::ttl() const
+{
+    return std::chrono::seconds(minimum == UINT32_MAX ? 0 : minimum);
+}
+
+
+const std::string& dns_query_t::host() const
+{
+    return hostname;
+}
+
+
+const std::string& dns_query_t::service() const
+{
+    return servicename;
+}
+
+
+/**
+ *  \brief Send unanswered questions to the next nameserver.
+ */
+void dns_query_t::send()
+{
+    const address_t& server = servers[tries++ % servers.size()];
+    if (sock < 0 || family != server.family) {
+        if (sock >= 0) {
+            ::close(sock);
+        }
+        sock = ::socket(server.family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+        family = server.family;
+        if (sock < 0) {
+            throw std::runtime_error("Unable to create socket for DNS query.");
+        }
+    }
+
+    // only accept responses from the current nameserver
+    auto address = reinterpret_cast<const sockaddr*>(&server.address);
+    if (::connect(sock, address, static_cast<socklen_t>(server.length)) < 0) {
+        deadline = clock::now();
+        return;
+    }
+    for (auto &question: questions) {
+        if (question.answered) {
+            continue;
+        }
+        question.id = random_id();
+        auto packet = encode_question(question.id, name, question.type);
+        ::send(sock, packet.data(), packet.size(), MSG_NOSIGNAL);
+    }
+    deadline = clock::now() + timeout;
+}
+
+
+/**
+ *  \brief Process a response, returning false if the nameserver
+ *  failed to answer.
+ */
+bool dns_query_t::receive(const std::string& packet)
+{
+    uint16_t id, flags, qdcount, ancount;
+    if (!get16(packet, 0, id) || !get16(packet, 2, flags) || !get16(packet, 4, qdcount) || !get16(packet, 6, ancount)) {
+        return true;
+    }
+
+    // match an outstanding question, ignoring stray or spoofed packets
+    question_t *question = nullptr;
+    for (auto &item: questions) {
+        if (!item.answered && item.id == id) {
+            question = &item;
+        }
+    }
+    if (!question || !(flags & 0x8000) || qdcount != 1) {
+        return true;
+    }
+    size_t offset = 12;
+    std::string owner;
+    uint16_t type, klass;
+    if (!read_name(packet, offset, owner) || !same_name(owner, name)) {
+        return true;
+    }
+    if (!get16(packet, offset, type) || !get16(packet, offset + 2, klass) || type != question->type) {
+        return true;
+    }
+    offset += 4;
+
+    int rcode = flags & 0x000f;
+    if (rcode == DNS_RCODE_NXDOMAIN) {
+        nxdomain = true;
+        for (auto &item: questions) {
+            item.answered = true;
+        }
+        check();
+        return true;
+    } else if (flags & DNS_FLAG_TRUNCATED) {
+        // answers too large even with EDNS0 need TCP, which is not used
+        overflowed = true;
+        finished = true;
+        results.clear();
+        return true;
+    } else if (rcode != 0) {
+        return false;
+    }
+
+    std::vector<dns_record_t> answers;
+    for (uint16_t i = 0; i < ancount; ++i) {
+        dns_record_t record;
+        if (!read_name(packet, offset, record.owner)) {
+            break;
+        }
+        if (!get16(packet, offset, record.type) || !get16(packet, offset + 2, record.klass) ||
+            !get32(packet, offset + 4, record.ttl) || !get16(packet, offset + 8, record.length)) {
+            break;
+        }
+        record.offset = offset + 10;
+        offset = record.offset + record.length;
+        if (offset > packet.size()) {
+            break;
+        }
+        answers.emplace_back(std::move(record));
+    }
+
+    // follow the CNAME chain from the name, in any order
+    std::vector<std::string> chain = {name};
+    uint32_t ttl = UINT32_MAX;
+    for (bool extended = true; extended && chain.size() <= DNS_MAX_CNAMES; ) {
+        extended = false;
+        for (const auto &record: answers) {
+            size_t position = record.offset;
+            std::string target;
+            if (record.klass == DNS_CLASS_IN && record.type == DNS_TYPE_CNAME && same_name(record.owner, chain.back())) {
+                if (read_name(packet, position, target)) {
+                    ttl = std::min(ttl, record.ttl);
+                    chain.emplace_back(std::move(target));
+                    extended = true;
+                }
+                break;
+            }
+        }
+    }
+
+    // only accept addresses for names on the chain
+    for (const auto &record: answers) {
+        bool owned = std::any_of(chain.begin(), chain.end(), [&](const std::string& item) {
+            return same_name(record.owner, item);
+        });
+        if (!owned || record.klass != DNS_CLASS_IN) {
+            continue;
+        }
+        if (record.type == DNS_TYPE_A && record.length == 4) {
+            sockaddr_in ipv4;
+            memset(&ipv4, 0, sizeof(ipv4));
+            ipv4.sin_family = AF_INET;
+            ipv4.sin_port = htons(port);
+            memcpy(&ipv4.sin_addr, packet.data() + record.offset, 4);
+            results.emplace_back(make_address(reinterpret_cast<sockaddr*>(&ipv4), sizeof(ipv4)));
+        } else if (record.type == DNS_TYPE_AAAA && record.length == 16) {
+            sockaddr_in6 ipv6;
+            memset(&ipv6, 0, sizeof(ipv6));
+            ipv6.sin6_family = AF_INET6;
+            ipv6.sin6_port = htons(port);
+            memcpy(&ipv6.sin6_addr, packet.data() + record.offset, 16);
+            results.emplace_back(make_address(reinterpret_cast<sockaddr*>(&ipv6), sizeof(ipv6)));
+        } else {
+            continue;
+        }
+        minimum = std::min(minimum, std::min(ttl, record.ttl));
+    }
+    question->answered = true;
+    check();
+
+    return true;
+}
+
+
+/**
+ *  \brief Finish once both questions are answered.
+ */
+void dns_query_t::check()
+{
+    for (auto &question: questions) {
+        if (!question.answered) {
+            return;
+        }
+    }
+    if (nxdomain) {
+        results.clear();
+    }
+    sort_addresses(results);
+    finished = true;
+}
+
+
+/**
+ *  \brief Use the nameservers and options from resolv.conf.
+ *
+ *  Without nameservers, queries go to the local host, as with the
+ *  system resolver.
+ */
+dns_resolver_t::dns_resolver_t()
+{
+    std::ifstream stream(RESOLV_CONF);
+    std::string line, keyword, value;
+    while (std::getline(stream, line)) {
+        std::istringstream words(line);
+        if (!(words >> keyword)) {
+            continue;
+        } else if (keyword == "nameserver" && words >> value) {
+            try {
+                add_nameserver(value);
+            } catch (std::exception&) {
+                // skip invalid entries, like the system resolver
+            }
+        } else if (keyword == "options") {
+            while (words >> value) {
+                if (value.compare(0, 8, "timeout:") == 0) {
+                    timeout = std::chrono::seconds(std::max(1, atoi(value.data() + 8)));
+                } else if (value.compare(0, 9, "attempts:") == 0) {
+                    attempts = std::max(1, atoi(value.data() + 9));
+                }
+            }
+        }
+    }
+
+    if (servers.empty()) {
+        add_nameserver("127.0.0.1");
+    }
+}
+
+
+/**
+ *  \brief Use the nameservers, as "address", "address:port", or
+ *  "[address]:port".
+ */
+dns_resolver_t::dns_resolver_t(const std::vector<std::string>& nameservers)
+{
+    for (const auto &nameserver: nameservers) {
+        add_nameserver(nameserver);
+    }
+}
+
+
+/**
+ *  \brief Start a non-blocking lookup for the host.
+ */
+std::unique_ptr<dns_query_t> dns_resolver_t::query(const std::string& host, const std::string& service) const
+{
+    return std::unique_ptr<dns_query_t>(new dns_query_t(host, service, servers, timeout, attempts));
+}
+
+
+/**
+ *  \brief Look up a host, waiting for the query to complete.
+ *
+ *  If `ttl` is set, it receives the lowest TTL of the answers. Hosts
+ *  with truncated answers are resolved with getaddrinfo, cached for
+ *  DNS_TTL.
+ */
+address_list_t dns_resolver_t::resolve(const std::string& host, const std::string& service, std::chrono::seconds* ttl) const
+{
+    auto lookup = query(host, service);
+    while (!lookup->done()) {
+        auto remaining = lookup->expires() - dns_query_t::clock::now();
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+        pollfd descriptor;
+        descriptor.fd = lookup->fd();
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        int ready = ::poll(&descriptor, 1, static_cast<int>(std::max<long long>(wait, 0)));
+        if (ready > 0) {
+            lookup->on_readable();
+        } else if (ready == 0) {
+            lookup->on_timeout();
+        } else if (errno != EINTR) {
+            throw std::runtime_error("Unable to wait for DNS response via poll().");
+        }
+    }
+    if (lookup->truncated()) {
+        if (ttl) {
+            *ttl = DNS_TTL;
+        }
+        return lookup_addresses(host, service);
+    }
+    if (ttl) {
+        *ttl = lookup->ttl();
+    }
+
+    return lookup->addresses();
+}
+
+
+void dns_resolver_t::set_timeout(std::chrono::milliseconds timeout)
+{
+    this->timeout = timeout;
+}
+
+
+void dns_resolver_t::set_attempts(int attempts)
+{
+    this->attempts = attempts;
+}
+
+
+const address_list_t& dns_resolver_t::nameservers() const
+{
+    return servers;
+}
+
+
+void dns_resolver_t::add_nameserver(const std::string& nameserver)
+{
+    std::string host, port;
+    split_host(nameserver, host, port);
+
+    addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_DGRAM;
+    const char *service = port.empty() ? "53" : port.data();
+    if (::getaddrinfo(host.data(), service, &hints, &result)) {
+        throw std::runtime_error("Invalid nameserver address: " + nameserver);
+    }
+    servers.emplace_back(*result);
+    freeaddrinfo(result);
+}
+
+LATTICE_END_NAMESPACE
+
+#endif
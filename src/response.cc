@@ -10,6 +10,7 @@
 #include <pycpp/string/getline.h>
 #include <pycpp/string/string.h>
 #include <cctype>
+#include <cstdlib>
 #include <cstring>
 #include <sstream>
 #include <string>
@@ -133,8 +134,9 @@ void response_t::parse_type(const std::string &string)
 void response_t::parse_header_line(const std::string &line)
 {
     if (startswith(line, "HTTP/")) {
-        // this is valid
+        // this is valid, HTTP/1.1 connections are persistent by default
         parse_code(line);
+        persistent = !startswith(line, "HTTP/1.0");
     } else {
         // common headers
         size_t colon = line.find_first_of(":");
@@ -168,6 +170,41 @@ void response_t::parse_header(const std::string &lines)
             parse_header_line(line.data());
         }
     }
+
+    // explicit connection options override the protocol default
+    auto it = headers_.find("connection");
+    if (it != headers_.end()) {
+        auto value = ascii_tolower(it->second);
+        if (value.find("close") != std::string::npos) {
+            persistent = false;
+        } else if (value.find("keep-alive") != std::string::npos) {
+            persistent = true;
+        }
+    }
+}
+
+
+/**
+ *  \brief Add trailers from a chunked body to the headers.
+ *
+ *  Trailers never replace headers sent before the body.
+ */
+void response_t::parse_trailers(const header_t &trailers)
+{
+    for (const auto &trailer: trailers) {
+        headers_.insert(trailer);
+    }
+}
+
+
+bool response_t::has_body(method_t method) const
+{
+    return !(
+        method == HEAD ||
+        status_ < 200 ||
+        status_ == status_code_t::NO_CONTENT ||
+        status_ == status_code_t::NOT_MODIFIED
+    );
 }
 
 
@@ -494,6 +531,37 @@ bool response_t::permanent_redirect() const
 }
 
 
+/**
+ *  Whether the connection may be reused for another request, which
+ *  requires a persistent connection and a delimited message body.
+ */
+bool response_t::keep_alive() const
+{
+    return persistent;
+}
+
+
+/**
+ *  \brief Get the idle timeout advertised in the "Keep-Alive" header.
+ *
+ *  Returns an empty timeout if the server did not advertise one.
+ */
+timeout_t response_t::keep_alive_timeout() const
+{
+    auto it = headers().find("keep-alive");
+    if (it != headers().end()) {
+        for (auto &parameter: split(ascii_tolower(it->second), ",")) {
+            parameter = trim(parameter);
+            if (startswith(parameter, "timeout=")) {
+                return timeout_t(std::atol(parameter.data() + 8) * 1000);
+            }
+        }
+    }
+
+    return timeout_t();
+}
+
+
 response_t::operator bool() const
 {
     return (
@@ -0,0 +1,85 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief Portable helpers for raw socket handles.
+ */
+
+#include <lattice/socket.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <cerrno>
+#endif
+
+LATTICE_BEGIN_NAMESPACE
+
+// FUNCTIONS
+// ---------
+
+#ifdef _WIN32
+
+
+bool set_blocking(socket_handle_t sock, bool blocking)
+{
+    u_long mode = blocking ? 0 : 1;
+    return ::ioctlsocket(sock, FIONBIO, &mode) == 0;
+}
+
+
+bool wait_socket(socket_handle_t sock, bool write, std::chrono::milliseconds timeout)
+{
+    WSAPOLLFD descriptor;
+    descriptor.fd = sock;
+    descriptor.events = write ? POLLOUT : POLLIN;
+    descriptor.revents = 0;
+    int ms = timeout.count() > 0 ? static_cast<int>(timeout.count()) : -1;
+
+    return ::WSAPoll(&descriptor, 1, ms) > 0;
+}
+
+#else
+
+
+bool set_blocking(socket_handle_t sock, bool blocking)
+{
+    int flags = ::fcntl(sock, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
+    }
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return ::fcntl(sock, F_SETFL, flags) == 0;
+}
+
+
+/**
+ *  Interrupted waits resume with the remaining time.
+ */
+bool wait_socket(socket_handle_t sock, bool write, std::chrono::milliseconds timeout)
+{
+    typedef std::chrono::steady_clock steady_clock;
+    auto deadline = steady_clock::now() + timeout;
+    pollfd descriptor;
+    descriptor.fd = sock;
+    descriptor.events = write ? POLLOUT : POLLIN;
+
+    while (true) {
+        int ms = -1;
+        if (timeout.count() > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - steady_clock::now());
+            ms = static_cast<int>(std::max<long long>(remaining.count(), 0));
+        }
+        descriptor.revents = 0;
+        int count = ::poll(&descriptor, 1, ms);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        return count > 0;
+    }
+}
+
+#endif
+
+LATTICE_END_NAMESPACE
@@ -68,6 +68,28 @@ verify_peer_t::operator bool() const
     return verify;
 }
 
+
+early_data_t::early_data_t(const bool enabled):
+    enabled(enabled)
+{}
+
+
+early_data_t::operator bool() const
+{
+    return enabled;
+}
+
+
+kernel_tls_t::kernel_tls_t(const bool enabled):
+    enabled(enabled)
+{}
+
+
+kernel_tls_t::operator bool() const
+{
+    return enabled;
+}
+
 LATTICE_END_NAMESPACE
 
 #ifdef _MSC_VER
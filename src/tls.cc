@@ -0,0 +1,306 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see LICENSE.md for more details.
+/**
+ *  \addtogroup Lattice
+ *  \brief TLS over memory buffers, for non-blocking transports.
+ */
+
+#ifdef LATTICE_HAVE_OPENSSL
+
+#include <lattice/tls.h>
+#include <lattice/adaptor/openssl.h>
+#include <openssl/bio.h>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+LATTICE_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static constexpr size_t TLS_BLOCK_SIZE = 16384;
+
+// OBJECTS
+// -------
+
+
+/**
+ *  If not initialized, initialize SSL.
+ */
+tls_engine_t::tls_engine_t()
+{
+    std::lock_guard<std::mutex> lock(MUTEX);
+    if (!SSL_INITIALIZED) {
+        SSL_load_error_strings();
+        SSL_library_init();
+        OpenSSL_add_ssl_algorithms();
+        SSL_INITIALIZED = true;
+    }
+}
+
+
+tls_engine_t::~tls_engine_t()
+{
+    close();
+}
+
+
+/**
+ *  \brief Create a client connection to `host`, over memory buffers.
+ *
+ *  The ClientHello is produced by the first call to `handshake()`.
+ */
+void tls_engine_t::open(const std::string& host)
+{
+    // drop the previous connection's unsent data, and ramp up again
+    close();
+    outgoing.clear();
+    sent = 0;
+    ramp = ssl_ramp_t();
+    ssl_context_key_t key = {protocol, certificate, revoke, bool(verifypeer)};
+    ssl = ssl_new_connection(key, host, session);
+    if (!alpn.empty()) {
+        auto data = reinterpret_cast<const unsigned char*>(alpn.data());
+        SSL_set_alpn_protos(ssl, data, static_cast<unsigned>(alpn.size()));
+    }
+
+    // empty input buffers ask for more data, rather than signal EOF
+    input = BIO_new(BIO_s_mem());
+    network = BIO_new(BIO_s_mem());
+    if (!input || !network) {
+        BIO_free(input);
+        BIO_free(network);
+        input = network = nullptr;
+        throw std::runtime_error("Unable to create SSL buffers.");
+    }
+    BIO_set_mem_eof_return(input, -1);
+    SSL_set_bio(ssl, input, network);
+}
+
+
+/**
+ *  \brief Queue a close_notify, and release the connection.
+ */
+void tls_engine_t::close()
+{
+    if (ssl) {
+        if (established()) {
+            SSL_shutdown(ssl);
+            flush();
+        }
+        SSL_free(ssl);
+        ssl = nullptr;
+        input = network = nullptr;
+    }
+}
+
+
+/**
+ *  \brief Advance the handshake with the data received so far.
+ *
+ *  Returns true once the handshake completes, and false if it needs
+ *  more data from the peer. Either way, `output()` may hold data to
+ *  send.
+ */
+bool tls_engine_t::handshake()
+{
+    int status = SSL_do_handshake(ssl);
+    flush();
+    if (status == 1) {
+        return true;
+    }
+
+    switch (SSL_get_error(ssl, status)) {
+        case SSL_ERROR_WANT_READ:
+            /* fallthrough */
+        case SSL_ERROR_WANT_WRITE:
+            return false;
+        default:
+            throw std::runtime_error("Unable to complete SSL handshake.");
+    }
+}
+
+
+/**
+ *  \brief Encrypt data for the peer, returning the bytes accepted.
+ *
+ *  Memory buffers grow as needed, so all data is accepted once the
+ *  handshake completes. Records are sized as by the socket adaptor.
+ */
+size_t tls_engine_t::write(const char *buf, size_t len)
+{
+    size_t written = ssl_write(ssl, ramp, buf, len);
+    flush();
+
+    return written;
+}
+
+
+/**
+ *  \brief Decrypt data from the peer.
+ *
+ *  Returns the number of bytes read, 0 once the peer closed the
+ *  connection, or -1 if more data is needed from the peer.
+ */
+long tls_engine_t::read(char *buf, size_t count)
+{
+    int size = static_cast<int>(std::min(count, TLS_BLOCK_SIZE * 4));
+    int status = SSL_read(ssl, buf, size);
+    flush();
+    if (status > 0) {
+        return status;
+    }
+
+    switch (SSL_get_error(ssl, status)) {
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_WANT_READ:
+            /* fallthrough */
+        case SSL_ERROR_WANT_WRITE:
+            return -1;
+        default:
+            throw std::runtime_error("Unable to read from SSL connection.");
+    }
+}
+
+
+/**
+ *  \brief Pass ciphertext received from the peer.
+ */
+void tls_engine_t::receive(const char *data, size_t size)
+{
+    while (size) {
+        int written = BIO_write(input, data, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+        if (written <= 0) {
+            throw std::runtime_error("Unable to buffer SSL data.");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+
+/**
+ *  \brief Get the ciphertext waiting to be sent to the peer.
+ *
+ *  The view is invalidated by any other call on the engine.
+ */
+buffer_view_t tls_engine_t::output() const
+{
+    return buffer_view_t(outgoing.data() + sent, outgoing.size() - sent);
+}
+
+
+/**
+ *  \brief Discard ciphertext sent to the peer.
+ *
+ *  Sent data is skipped rather than erased, and the buffer is only
+ *  compacted once drained, or once most of it was sent, so partial
+ *  writes of large outputs stay linear.
+ */
+void tls_engine_t::consume(size_t bytes)
+{
+    sent += std::min(bytes, outgoing.size() - sent);
+    if (sent == outgoing.size()) {
+        outgoing.clear();
+        sent = 0;
+    } else if (sent > outgoing.size() / 2) {
+        outgoing.erase(0, sent);
+        sent = 0;
+    }
+}
+
+
+void tls_engine_t::set_certificate_file(const certificate_file_t& certificate)
+{
+    this->certificate = certificate;
+}
+
+
+void tls_engine_t::set_revocation_lists(const revocation_lists_t& revoke)
+{
+    this->revoke = revoke;
+}
+
+
+void tls_engine_t::set_ssl_protocol(ssl_protocol_t protocol)
+{
+    this->protocol = protocol;
+}
+
+
+void tls_engine_t::set_verify_peer(const verify_peer_t& peer)
+{
+    this->verifypeer = peer;
+}
+
+
+/**
+ *  \brief Set the protocols offered with ALPN, in order of preference.
+ */
+void tls_engine_t::set_alpn(const std::vector<std::string>& protocols)
+{
+    alpn = ssl_alpn_protocols(protocols);
+}
+
+
+/**
+ *  \brief Check if the handshake has completed.
+ */
+bool tls_engine_t::established() const
+{
+    return ssl && SSL_is_init_finished(ssl);
+}
+
+
+/**
+ *  \brief Check if received data is buffered, decrypted or not.
+ */
+bool tls_engine_t::pending() const
+{
+    return ssl && (SSL_pending(ssl) > 0 || BIO_ctrl_pending(input) > 0);
+}
+
+
+/**
+ *  \brief Check if the handshake resumed a cached session.
+ */
+bool tls_engine_t::resumed() const
+{
+    return ssl && SSL_session_reused(ssl);
+}
+
+
+/**
+ *  \brief Get the protocol selected by the server with ALPN.
+ */
+std::string tls_engine_t::alpn_protocol() const
+{
+    const unsigned char *data = nullptr;
+    unsigned length = 0;
+    if (ssl) {
+        SSL_get0_alpn_selected(ssl, &data, &length);
+    }
+    if (!data) {
+        return std::string();
+    }
+    return std::string(reinterpret_cast<const char*>(data), length);
+}
+
+
+/**
+ *  \brief Move ciphertext produced by OpenSSL to the output.
+ */
+void tls_engine_t::flush()
+{
+    char block[TLS_BLOCK_SIZE];
+    int read;
+    while ((read = BIO_read(network, block, sizeof(block))) > 0) {
+        outgoing.append(block, read);
+    }
+}
+
+LATTICE_END_NAMESPACE
+
+#endif
@@ -0,0 +1,81 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Scatter-gather buffer unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+
+LATTICE_USING_NAMESPACE
+
+
+// TESTS
+// -----
+
+
+TEST(buffer_list_t, buffer_list_t)
+{
+    std::string body = "body";
+    buffer_list_t list;
+    list.view(body);
+    list.view("", 0);
+    list.store("\r\n");
+    list.store_front("head\r\n");
+    EXPECT_EQ(list.size(), 3);
+    EXPECT_EQ(list[1].data, body.data());
+    EXPECT_EQ(list.length(), 12);
+    EXPECT_EQ(list.string(), "head\r\nbody\r\n");
+
+    // moved lists keep referencing their stored buffers
+    buffer_list_t moved(std::move(list));
+    moved.store(std::string(64, 'x'));
+    EXPECT_EQ(moved.string(), "head\r\nbody\r\n" + std::string(64, 'x'));
+
+    // appended lists keep referencing short, stored strings
+    buffer_list_t other;
+    other.store("tail");
+    moved.append(std::move(other));
+    EXPECT_TRUE(other.empty());
+    EXPECT_EQ(moved.size(), 5);
+    EXPECT_EQ(moved.string(), "head\r\nbody\r\n" + std::string(64, 'x') + "tail");
+}
+
+
+TEST(buffer_list_t, multipart)
+{
+    multipart_t multipart;
+    multipart.add(create_buffer("a.txt", "content", "text/plain"));
+    multipart.add(create_buffer("b.bin", std::string(100, 'z')));
+
+    buffer_list_t list;
+    multipart.buffers(list);
+    EXPECT_EQ(list.string(), multipart.string());
+
+    // file parts are streamed, so need a writev transport
+    EXPECT_FALSE(multipart.has_files());
+    multipart.add(create_file("c.txt"));
+    EXPECT_TRUE(multipart.has_files());
+}
+
+
+TEST(buffer_list_t, file)
+{
+    std::string path = "lattice_buffer_test.txt";
+    std::string content(100000, 'y');
+    std::ofstream(path, std::ios_base::binary) << content;
+
+    buffer_list_t list;
+    list.store("head\r\n");
+    list.file(path);
+    EXPECT_EQ(list.size(), 2);
+    EXPECT_TRUE(list.back().file());
+    EXPECT_EQ(list.length(), 6 + content.size());
+    EXPECT_EQ(list.string(), "head\r\n" + content);
+    std::remove(path.data());
+
+    EXPECT_THROW(list.file(path), std::runtime_error);
+}
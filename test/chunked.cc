@@ -0,0 +1,97 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Chunked transfer encoding decoder unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+
+LATTICE_USING_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+static const std::string BODY = (
+    "5;name=value\r\nhello\r\n"
+    "6\r\n world\r\n"
+    "A \r\n0123456789\r\n"
+    "0\r\nX-Trailer: yes\r\nExpires:  never \r\n\r\n"
+);
+
+// TESTS
+// -----
+
+
+TEST(chunked_decoder_t, decode)
+{
+    chunked_decoder_t decoder;
+    std::string output;
+    std::string data = BODY + "HTTP/1.1";
+    EXPECT_EQ(decoder.decode(data.data(), data.size(), output), BODY.size());
+    EXPECT_TRUE(decoder.done());
+    EXPECT_EQ(output, "hello world0123456789");
+    EXPECT_EQ(decoder.trailers().at("x-trailer"), "yes");
+    EXPECT_EQ(decoder.trailers().at("expires"), "never");
+}
+
+
+TEST(chunked_decoder_t, bytes)
+{
+    chunked_decoder_t decoder;
+    std::string output;
+    size_t consumed = 0;
+    while (consumed < BODY.size() && !decoder.done()) {
+        consumed += decoder.decode(BODY.data() + consumed, 1, output);
+        if (output == "h") {
+            EXPECT_EQ(decoder.extensions(), "name=value");
+        } else if (output == "hello ") {
+            // chunks without extensions do not keep the previous one
+            EXPECT_EQ(decoder.extensions(), "");
+        }
+    }
+    EXPECT_EQ(consumed, BODY.size());
+    EXPECT_TRUE(decoder.done());
+    EXPECT_EQ(output, "hello world0123456789");
+    EXPECT_EQ(decoder.trailers().size(), 2);
+}
+
+
+TEST(chunked_decoder_t, spans)
+{
+    // spans point into the input, and respect the size limit
+    chunked_decoder_t decoder;
+    std::string data = "b\nhello world\n0\n\n";
+    const char *chunk;
+    size_t size = 4;
+    EXPECT_EQ(decoder.decode(data.data(), data.size(), chunk, size), 6);
+    EXPECT_EQ(chunk, data.data() + 2);
+    EXPECT_EQ(size, 4);
+    EXPECT_EQ(decoder.remaining(), 7);
+
+    // data read directly by the caller
+    decoder.consume(7);
+    EXPECT_EQ(decoder.remaining(), 0);
+    size = 4;
+    EXPECT_EQ(decoder.decode(data.data() + 13, data.size() - 13, chunk, size), 4);
+    EXPECT_EQ(size, 0);
+    EXPECT_TRUE(decoder.done());
+}
+
+
+TEST(chunked_decoder_t, invalid)
+{
+    chunked_decoder_t decoder;
+    std::string output;
+    std::string data = "x\r\n";
+    EXPECT_THROW(decoder.decode(data.data(), data.size(), output), std::runtime_error);
+
+    decoder.reset();
+    data = "1234567890abcdef0\r\n";
+    EXPECT_THROW(decoder.decode(data.data(), data.size(), output), std::runtime_error);
+
+    decoder.reset();
+    data = "1\r\nab\r\n";
+    EXPECT_THROW(decoder.decode(data.data(), data.size(), output), std::runtime_error);
+}
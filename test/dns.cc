@@ -0,0 +1,257 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief DNS cache unittests.
+ */
+
+#include "loopback.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+
+// TESTS
+// -----
+
+
+TEST(address_cache_t, entries)
+{
+    auto cache = create_dns_cache();
+    address_list_t addresses = {
+        make_address("2001:db8::1", "443"),
+        make_address("192.0.2.1", "443"),
+    };
+    address_list_t found;
+    EXPECT_EQ(cache->find("example.com", "https", found), DNS_MISSING);
+
+    // every address is stored, and IPv6 addresses are intact
+    cache->insert("example.com", "https", addresses);
+    EXPECT_EQ(cache->find("example.com", "https", found), DNS_FRESH);
+    ASSERT_EQ(found.size(), 2);
+    EXPECT_EQ(found[0].family, AF_INET6);
+    EXPECT_EQ(memcmp(&found[0].address, &addresses[0].address, sizeof(sockaddr_in6)), 0);
+    EXPECT_EQ(cache->find("example.com", "http", found), DNS_MISSING);
+
+    // expired entries are stale, and still served
+    cache->insert("example.com", "http", addresses, std::chrono::seconds(0));
+    EXPECT_EQ(cache->find("example.com", "http", found), DNS_STALE);
+    EXPECT_EQ(found.size(), 2);
+
+    // failed lookups are cached until they expire
+    cache->insert_failure("invalid.test", "http");
+    EXPECT_EQ(cache->find("invalid.test", "http", found), DNS_NEGATIVE);
+    EXPECT_THROW(cache->resolve("invalid.test", "http"), std::runtime_error);
+    cache->insert_failure("invalid.test", "http", std::chrono::seconds(0));
+    EXPECT_EQ(cache->find("invalid.test", "http", found), DNS_MISSING);
+
+    EXPECT_EQ(cache->size(), 3);
+    cache->erase("example.com", "http");
+    EXPECT_EQ(cache->size(), 2);
+    cache->clear();
+    EXPECT_EQ(cache->size(), 0);
+}
+
+
+TEST(address_cache_t, resolve)
+{
+    auto cache = create_dns_cache();
+    bool cached = true;
+    auto addresses = cache->resolve("127.0.0.1:8080", "http", &cached);
+    EXPECT_FALSE(cached);
+    ASSERT_EQ(addresses.size(), 1);
+    auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&addresses[0].address);
+    EXPECT_EQ(ntohs(ipv4->sin_port), 8080);
+
+    cache->resolve("127.0.0.1:8080", "http", &cached);
+    EXPECT_TRUE(cached);
+
+    // stale entries are served, then refreshed in the background
+    cache->insert("127.0.0.1:8080", "http", addresses, std::chrono::seconds(0));
+    EXPECT_EQ(cache->resolve("127.0.0.1:8080", "http", &cached).size(), 1);
+    EXPECT_TRUE(cached);
+    address_list_t found;
+    for (int i = 0; i < 100 && cache->find("127.0.0.1:8080", "http", found) != DNS_FRESH; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(cache->find("127.0.0.1:8080", "http", found), DNS_FRESH);
+
+    // many stale entries share a few background workers
+    for (int port = 1; port <= 32; ++port) {
+        cache->insert("127.0.0.1:" + std::to_string(port), "http", addresses, std::chrono::seconds(0));
+        cache->resolve("127.0.0.1:" + std::to_string(port), "http");
+    }
+    for (int port = 1; port <= 32; ++port) {
+        std::string host = "127.0.0.1:" + std::to_string(port);
+        for (int i = 0; i < 100 && cache->find(host, "http", found) != DNS_FRESH; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(cache->find(host, "http", found), DNS_FRESH);
+    }
+}
+
+
+TEST(address_cache_t, capacity)
+{
+    auto cache = create_dns_cache(DNS_CACHE_SHARDS * 2);
+    address_list_t addresses = {make_address("192.0.2.1", "80")};
+    for (int i = 0; i < 1000; ++i) {
+        cache->insert("host" + std::to_string(i), "http", addresses);
+    }
+    EXPECT_LE(cache->size(), cache->capacity());
+
+    // concurrent readers and writers
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([cache, addresses, i]() {
+            address_list_t found;
+            for (int j = 0; j < 1000; ++j) {
+                auto host = "host" + std::to_string((i * 1000 + j) % 64);
+                cache->insert(host, "http", addresses);
+                cache->find(host, "http", found);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    EXPECT_LE(cache->size(), cache->capacity());
+}
+
+
+TEST(address_cache_t, prefetch)
+{
+    dns_host_list_t hosts = {
+        {"127.0.0.1:8080", "http"},
+        {"127.0.0.2:8080", "http"},
+        {"[::1]:443", "https"},
+    };
+    auto cache = create_dns_cache(hosts);
+    address_list_t found;
+    EXPECT_EQ(cache->find("127.0.0.1:8080", "http", found), DNS_FRESH);
+    EXPECT_EQ(cache->find("127.0.0.2:8080", "http", found), DNS_FRESH);
+    EXPECT_EQ(cache->size(), 3);
+
+    // entries about to expire are refreshed in the background
+    cache = create_dns_cache(hosts, true);
+    cache->insert("127.0.0.1:8080", "http", found, std::chrono::seconds(0));
+    cache->erase("127.0.0.2:8080", "http");
+    for (int i = 0; i < 300 && cache->size() < 3; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(cache->find("127.0.0.2:8080", "http", found), DNS_FRESH);
+    for (int i = 0; i < 300 && cache->find("127.0.0.1:8080", "http", found) != DNS_FRESH; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(cache->find("127.0.0.1:8080", "http", found), DNS_FRESH);
+    cache->stop_refresh();
+}
+
+
+TEST(dns_overrides_t, find)
+{
+    dns_overrides_t overrides = {
+        {"Example.com:443", "192.0.2.1,[2001:db8::1]"},
+        {"example.com", "192.0.2.2"},
+    };
+    address_list_t found;
+    ASSERT_TRUE(overrides.find("example.com", "https", found));
+    ASSERT_EQ(found.size(), 2);
+    EXPECT_EQ(found[1].family, AF_INET6);
+    auto *ipv6 = reinterpret_cast<const sockaddr_in6*>(&found[1].address);
+    EXPECT_EQ(ntohs(ipv6->sin6_port), 443);
+
+    // hosts without a port match every other port
+    ASSERT_TRUE(overrides.find("EXAMPLE.com.:8080", "http", found));
+    ASSERT_EQ(found.size(), 1);
+    auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&found[0].address);
+    EXPECT_EQ(ntohs(ipv4->sin_port), 8080);
+    EXPECT_FALSE(overrides.find("example.org", "http", found));
+    EXPECT_THROW(overrides.add("example.org:80", "example.com"), std::runtime_error);
+
+    // copies are independent
+    dns_overrides_t copy(overrides);
+    copy.add("example.org:80", "127.0.0.1");
+    EXPECT_TRUE(copy.find("example.org", "http", found));
+    EXPECT_FALSE(overrides.find("example.org", "http", found));
+
+    // hosts files add entries for every port
+    const char *path = "lattice_hosts.test";
+    {
+        std::ofstream file(path);
+        file << "# comment\n127.0.0.1 localhost loopback  # trailing\n::1 localhost\ninvalid line\n";
+    }
+    dns_overrides_t hosts;
+    hosts.load_hosts(path);
+    std::remove(path);
+    EXPECT_EQ(hosts.size(), 2);
+    ASSERT_TRUE(hosts.find("localhost", "https", found));
+    EXPECT_EQ(found.size(), 2);
+    EXPECT_TRUE(hosts.find("loopback:8080", "http", found));
+}
+
+
+TEST(address_cache_t, snapshot)
+{
+    const char *path = "lattice_dns.snapshot";
+    address_list_t addresses = {
+        make_address("2001:db8::1", "443"),
+        make_address("192.0.2.1", "443"),
+    };
+    auto cache = create_dns_cache();
+    cache->insert("example.com", "https", addresses);
+    cache->insert("expired.test", "https", addresses, std::chrono::seconds(0));
+    cache->insert_failure("invalid.test", "http");
+    cache->snapshot(path);
+
+    // live entries round-trip, and expired entries are dropped
+    auto copy = create_dns_cache();
+    EXPECT_EQ(copy->load(path), 2);
+    std::remove(path);
+    address_list_t found;
+    ASSERT_EQ(copy->find("example.com", "https", found), DNS_FRESH);
+    ASSERT_EQ(found.size(), 2);
+    for (size_t i = 0; i < found.size(); ++i) {
+        EXPECT_EQ(found[i].family, addresses[i].family);
+        EXPECT_EQ(found[i].length, addresses[i].length);
+        EXPECT_EQ(memcmp(&found[i].address, &addresses[i].address, addresses[i].length), 0);
+    }
+    EXPECT_EQ(copy->find("expired.test", "https", found), DNS_MISSING);
+    EXPECT_EQ(copy->find("invalid.test", "http", found), DNS_NEGATIVE);
+
+    // missing files add nothing, and invalid files throw
+    EXPECT_EQ(copy->load(path), 0);
+    {
+        std::ofstream file(path);
+        file << "invalid";
+    }
+    EXPECT_THROW(copy->load(path), std::runtime_error);
+    std::remove(path);
+}
+
+
+TEST(address_cache_t, snapshot_concurrent)
+{
+    // concurrent snapshots to one path leave a valid file
+    const char *path = "lattice_dns.snapshot";
+    address_list_t addresses = {make_address("192.0.2.1", "443")};
+    auto cache = create_dns_cache();
+    for (int i = 0; i < 2000; ++i) {
+        cache->insert("host" + std::to_string(i) + ".test", "https", addresses);
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&cache, path]() {
+            for (int j = 0; j < 10; ++j) {
+                cache->snapshot(path);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    auto copy = create_dns_cache();
+    EXPECT_EQ(copy->load(path), 2000);
+    std::remove(path);
+}
@@ -0,0 +1,73 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief File download unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    return buffer.str();
+}
+
+// TESTS
+// -----
+
+
+TEST(download_t, download_t)
+{
+    EXPECT_FALSE(download_t());
+    EXPECT_TRUE(download_t("file.bin"));
+    EXPECT_TRUE(download_t(1, DOWNLOAD_SYNC));
+    EXPECT_EQ(download_t(1, DOWNLOAD_SYNC).flags(), DOWNLOAD_SYNC);
+}
+
+
+TEST(file_writer_t, preallocate)
+{
+    // preallocated space past the written data is trimmed
+    std::string path = "lattice_download.bin";
+    {
+        file_writer_t file(download_t(path, DOWNLOAD_SYNC));
+        file.allocate(4096);
+        file.write("hello ", 6);
+        file.write("world", 5);
+        file.finish();
+        EXPECT_EQ(file.size(), 11);
+    }
+    EXPECT_EQ(read_file(path), "hello world");
+    std::remove(path.data());
+}
+
+
+TEST(file_writer_t, direct)
+{
+    // direct writes stage data in aligned blocks, with a buffered tail
+    std::string path = "lattice_direct.bin";
+    std::string data(3 << 20 | 17, 'x');
+    {
+        file_writer_t file(download_t(path, DOWNLOAD_DIRECT));
+        file.allocate(data.size());
+        for (size_t i = 0; i < data.size(); i += 65535) {
+            file.write(data.data() + i, std::min<size_t>(65535, data.size() - i));
+        }
+        file.finish();
+    }
+    EXPECT_EQ(read_file(path), data);
+    std::remove(path.data());
+}
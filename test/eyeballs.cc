@@ -0,0 +1,81 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Address sorting and parallel connection unittests.
+ */
+
+#include "loopback.h"
+#include <gtest/gtest.h>
+#include <cstring>
+
+// HELPERS
+// -------
+
+
+static std::string address_host(const address_t& address)
+{
+    char host[NI_MAXHOST];
+    auto *data = reinterpret_cast<const sockaddr*>(&address.address);
+    getnameinfo(data, address.length, host, sizeof(host), nullptr, 0, NI_NUMERICHOST);
+    return host;
+}
+
+// TESTS
+// -----
+
+
+TEST(eyeballs, sort_addresses)
+{
+    // loopback IPv6 has the highest precedence
+    address_list_t addresses = {
+        make_address("127.0.0.1", "80"),
+        make_address("::1", "80"),
+    };
+    sort_addresses(addresses);
+    ASSERT_EQ(addresses.size(), 2);
+    EXPECT_EQ(address_host(addresses[0]), "::1");
+    EXPECT_EQ(address_host(addresses[1]), "127.0.0.1");
+
+    // families are interleaved
+    addresses = {
+        make_address("::1", "80"),
+        make_address("::1", "81"),
+        make_address("127.0.0.1", "80"),
+        make_address("127.0.0.1", "81"),
+    };
+    sort_addresses(addresses);
+    ASSERT_EQ(addresses.size(), 4);
+    EXPECT_EQ(addresses[0].family, AF_INET6);
+    EXPECT_EQ(addresses[1].family, AF_INET);
+    EXPECT_EQ(addresses[2].family, AF_INET6);
+    EXPECT_EQ(addresses[3].family, AF_INET);
+}
+
+#ifndef _WIN32
+
+
+TEST(eyeballs, connect_any)
+{
+    std::string closed;
+    ::close(listen_loopback(closed));
+    std::string port;
+    int server = listen_loopback(port);
+
+    // refused addresses are skipped without waiting
+    address_list_t addresses = {
+        make_address("127.0.0.1", closed),
+        make_address("127.0.0.1", port),
+    };
+    socket_handle_t sock;
+    size_t index;
+    ASSERT_TRUE(connect_any(addresses, sock, index, std::chrono::seconds(10)));
+    EXPECT_EQ(index, 1);
+    ::close(sock);
+
+    addresses.pop_back();
+    EXPECT_FALSE(connect_any(addresses, sock, index));
+    ::close(server);
+}
+
+#endif
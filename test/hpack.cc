@@ -0,0 +1,109 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief HPACK header compression unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+
+LATTICE_USING_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Requests and header blocks from RFC 7541 Appendix C.4.
+ */
+static const std::vector<std::pair<hpack_fields_t, std::string>> REQUESTS = {
+    {
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}},
+        "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff",
+    },
+    {
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}, {"cache-control", "no-cache"}},
+        "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf",
+    },
+    {
+        {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"}, {"custom-key", "custom-value"}},
+        "\x82\x87\x85\xbf\x40\x88\x25\xa8\x49\xe9\x5b\xa9\x7d\x7f\x89\x25\xa8\x49\xe9\x5b\xb8\xe8\xb4\xbf",
+    },
+};
+
+// TESTS
+// -----
+
+
+TEST(hpack, encode)
+{
+    hpack_encoder_t encoder;
+    for (const auto &request: REQUESTS) {
+        std::string block;
+        encoder.encode(request.first, block);
+        EXPECT_EQ(block, request.second);
+    }
+    EXPECT_EQ(encoder.table().entries(), 3);
+    EXPECT_EQ(encoder.table().size(), 164);
+}
+
+
+TEST(hpack, decode)
+{
+    hpack_decoder_t decoder;
+    for (const auto &request: REQUESTS) {
+        hpack_fields_t fields;
+        decoder.decode(request.second.data(), request.second.size(), fields);
+        EXPECT_EQ(fields, request.first);
+    }
+    EXPECT_EQ(decoder.table().size(), 164);
+
+    // indices outside the tables are errors
+    hpack_fields_t fields;
+    EXPECT_THROW(decoder.decode("\xc2", 1, fields), std::runtime_error);
+    EXPECT_THROW(decoder.decode("\x80", 1, fields), std::runtime_error);
+
+    // runs of zero continuation bytes are rejected
+    std::string block("\xff");
+    block.append(16, '\x80');
+    block.push_back('\x01');
+    EXPECT_THROW(decoder.decode(block.data(), block.size(), fields), std::runtime_error);
+}
+
+
+TEST(hpack, sensitive)
+{
+    hpack_encoder_t encoder;
+    hpack_decoder_t decoder;
+    hpack_fields_t input = {{"authorization", "Basic dXNlcjpwYXNz"}, {"x-custom", "value"}};
+    std::string block;
+    encoder.set_table_size(256);
+    encoder.encode(input, block);
+    EXPECT_EQ(block[0], '\x3f');                // table size update
+    EXPECT_EQ(encoder.table().entries(), 1);
+
+    hpack_fields_t fields;
+    decoder.decode(block.data(), block.size(), fields);
+    EXPECT_EQ(fields, input);
+    EXPECT_EQ(decoder.table().entries(), 1);
+    EXPECT_EQ(decoder.table().limit(), 256);
+}
+
+
+TEST(hpack, huffman)
+{
+    std::string input;
+    for (int c = 0; c < 256; ++c) {
+        input.push_back(static_cast<char>(c));
+    }
+    std::string encoded;
+    huffman_encode(input, encoded);
+    EXPECT_EQ(encoded.size(), huffman_length(input));
+    EXPECT_EQ(huffman_decode(encoded.data(), encoded.size()), input);
+
+    // padding longer than 7 bits, or not all ones, is invalid
+    EXPECT_THROW(huffman_decode("\x1f\xff", 2), std::runtime_error);
+    EXPECT_THROW(huffman_decode("\x1e", 1), std::runtime_error);
+    // EOS symbol is invalid
+    EXPECT_THROW(huffman_decode("\xff\xff\xff\xff", 4), std::runtime_error);
+}
@@ -0,0 +1,364 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief HTTP/2 framing unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+typedef std::tuple<uint8_t, uint8_t, uint32_t, std::string> frame_t;
+
+
+/**
+ *  \brief Handler recording stream events as strings.
+ */
+struct recorder_t: http2_handler_t
+{
+    std::vector<std::string> events;
+    std::vector<hpack_fields_t> headers;
+
+    void on_headers(uint32_t stream, hpack_fields_t&& fields, bool end) override
+    {
+        events.push_back("headers " + std::to_string(stream) + (end ? " end" : ""));
+        headers.emplace_back(std::move(fields));
+    }
+
+    void on_data(uint32_t stream, const char *data, size_t length, bool end) override
+    {
+        events.push_back("data " + std::to_string(stream) + " " + std::string(data, length) + (end ? " end" : ""));
+    }
+
+    void on_reset(uint32_t stream, http2_error_t error) override
+    {
+        events.push_back("reset " + std::to_string(stream) + " " + std::to_string(error));
+    }
+
+    void on_goaway(uint32_t last, http2_error_t error) override
+    {
+        events.push_back("goaway " + std::to_string(last) + " " + std::to_string(error));
+    }
+};
+
+
+/**
+ *  \brief Channel for streams read without a session.
+ */
+struct null_channel_t: detail::http2_channel_t
+{
+    size_t consumed = 0;
+
+    void consume(uint32_t, size_t bytes) override
+    {
+        consumed += bytes;
+    }
+
+    void cancel(uint32_t) override
+    {}
+
+    bool available() const override
+    {
+        return true;
+    }
+};
+
+
+static std::string uint32_bytes(uint32_t value)
+{
+    std::string data(4, '\0');
+    data[0] = static_cast<char>(value >> 24);
+    data[1] = static_cast<char>(value >> 16);
+    data[2] = static_cast<char>(value >> 8);
+    data[3] = static_cast<char>(value);
+    return data;
+}
+
+
+static std::string setting(http2_setting_t id, uint32_t value)
+{
+    return std::string(1, static_cast<char>(id >> 8)) + static_cast<char>(id) + uint32_bytes(value);
+}
+
+
+/**
+ *  \brief Encode a frame as sent by the server.
+ */
+static std::string frame(uint8_t type, uint8_t flags, uint32_t stream, const std::string& payload = "")
+{
+    std::string data;
+    data.push_back(static_cast<char>(payload.size() >> 16));
+    data.push_back(static_cast<char>(payload.size() >> 8));
+    data.push_back(static_cast<char>(payload.size()));
+    data.push_back(static_cast<char>(type));
+    data.push_back(static_cast<char>(flags));
+    return data + uint32_bytes(stream) + payload;
+}
+
+
+/**
+ *  \brief Split frames sent by the client, skipping the preface.
+ */
+static std::vector<frame_t> frames(std::string data)
+{
+    if (data.compare(0, HTTP2_PREFACE.size(), HTTP2_PREFACE) == 0) {
+        data.erase(0, HTTP2_PREFACE.size());
+    }
+
+    std::vector<frame_t> list;
+    size_t offset = 0;
+    while (offset + HTTP2_FRAME_HEADER <= data.size()) {
+        auto p = reinterpret_cast<const uint8_t*>(data.data() + offset);
+        size_t size = (size_t(p[0]) << 16) | (size_t(p[1]) << 8) | p[2];
+        uint32_t stream = ((uint32_t(p[5]) << 24) | (uint32_t(p[6]) << 16) | (uint32_t(p[7]) << 8) | p[8]) & 0x7fffffff;
+        list.emplace_back(p[3], p[4], stream, data.substr(offset + HTTP2_FRAME_HEADER, size));
+        offset += HTTP2_FRAME_HEADER + size;
+    }
+
+    return list;
+}
+
+
+static void receive(http2_engine_t& engine, const std::string& data)
+{
+    engine.receive(data.data(), data.size());
+}
+
+
+static const hpack_fields_t REQUEST = {
+    {":method", "POST"}, {":scheme", "https"}, {":path", "/"}, {":authority", "example.com"},
+};
+
+// TESTS
+// -----
+
+
+TEST(http2_engine_t, settings)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    engine.preface();
+    std::string output = engine.take();
+    EXPECT_EQ(output.compare(0, HTTP2_PREFACE.size(), HTTP2_PREFACE), 0);
+    auto sent = frames(output);
+    ASSERT_EQ(sent.size(), 2);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_SETTINGS);
+    EXPECT_EQ(std::get<0>(sent[1]), HTTP2_WINDOW_UPDATE);
+    EXPECT_EQ(std::get<3>(sent[1]), uint32_bytes(HTTP2_CONNECTION_WINDOW - HTTP2_DEFAULT_WINDOW));
+
+    // server settings are acknowledged, and limit new streams
+    receive(engine, frame(HTTP2_SETTINGS, 0, 0, setting(HTTP2_MAX_CONCURRENT_STREAMS, 1)));
+    sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_SETTINGS);
+    EXPECT_EQ(std::get<1>(sent[0]), HTTP2_ACK);
+    EXPECT_TRUE(engine.available());
+    engine.submit(REQUEST, "");
+    EXPECT_FALSE(engine.available());
+    EXPECT_TRUE(engine.open());
+
+    // acknowledgements are not acknowledged, and must be empty
+    engine.take();
+    receive(engine, frame(HTTP2_SETTINGS, HTTP2_ACK, 0));
+    EXPECT_TRUE(engine.take().empty());
+    EXPECT_THROW(receive(engine, frame(HTTP2_SETTINGS, HTTP2_ACK, 0, setting(HTTP2_ENABLE_PUSH, 0))), std::runtime_error);
+    sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_GOAWAY);
+    EXPECT_FALSE(engine.open());
+}
+
+
+TEST(http2_engine_t, flow_control)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    receive(engine, frame(HTTP2_SETTINGS, 0, 0, setting(HTTP2_INITIAL_WINDOW_SIZE, 10)));
+    engine.take();
+
+    // the body is held back once the stream window is exhausted
+    std::string body(25, 'x');
+    uint32_t id = engine.submit(REQUEST, std::string(body));
+    auto sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 2);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_HEADERS);
+    EXPECT_EQ(std::get<1>(sent[0]), HTTP2_END_HEADERS);
+    EXPECT_EQ(std::get<0>(sent[1]), HTTP2_DATA);
+    EXPECT_EQ(std::get<1>(sent[1]), 0);
+    EXPECT_EQ(std::get<3>(sent[1]).size(), 10);
+
+    // and released by window updates
+    receive(engine, frame(HTTP2_WINDOW_UPDATE, 0, id, uint32_bytes(5)));
+    sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<3>(sent[0]).size(), 5);
+    receive(engine, frame(HTTP2_WINDOW_UPDATE, 0, id, uint32_bytes(100)));
+    sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<1>(sent[0]), HTTP2_END_STREAM);
+    EXPECT_EQ(std::get<3>(sent[0]).size(), 10);
+
+    // empty stream updates reset the stream
+    uint32_t other = engine.submit(REQUEST, "body");
+    engine.take();
+    receive(engine, frame(HTTP2_WINDOW_UPDATE, 0, other, uint32_bytes(0)));
+    sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_RST_STREAM);
+    EXPECT_EQ(std::get<3>(sent[0]), uint32_bytes(HTTP2_PROTOCOL_ERROR));
+    ASSERT_EQ(recorder.events.size(), 1);
+    EXPECT_EQ(recorder.events[0], "reset 3 1");
+
+    // data beyond the connection window is a connection error
+    std::string data(HTTP2_FRAME_SIZE, 'y');
+    EXPECT_THROW({
+        for (int i = 0; i < 5; ++i) {
+            receive(engine, frame(HTTP2_DATA, 0, id, data));
+        }
+    }, std::runtime_error);
+    sent = frames(engine.take());
+    ASSERT_FALSE(sent.empty());
+    EXPECT_EQ(std::get<0>(sent.back()), HTTP2_GOAWAY);
+    EXPECT_EQ(std::get<3>(sent.back()).substr(4), uint32_bytes(HTTP2_FLOW_CONTROL_ERROR));
+}
+
+
+TEST(http2_engine_t, continuation)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    uint32_t id = engine.submit(REQUEST, "");
+
+    hpack_encoder_t encoder;
+    std::string block;
+    encoder.encode({{":status", "200"}, {"content-type", "text/plain"}, {"x-long", std::string(100, 'z')}}, block);
+
+    // header blocks span HEADERS and CONTINUATION frames
+    receive(engine, frame(HTTP2_HEADERS, 0, id, block.substr(0, 10)));
+    EXPECT_TRUE(recorder.events.empty());
+    receive(engine, frame(HTTP2_CONTINUATION, 0, id, block.substr(10, 20)));
+    receive(engine, frame(HTTP2_CONTINUATION, HTTP2_END_HEADERS, id, block.substr(30)));
+    ASSERT_EQ(recorder.events.size(), 1);
+    EXPECT_EQ(recorder.events[0], "headers 1");
+    ASSERT_EQ(recorder.headers[0].size(), 3);
+    EXPECT_EQ(recorder.headers[0][1].second, "text/plain");
+
+    receive(engine, frame(HTTP2_DATA, HTTP2_END_STREAM, id, "body"));
+    EXPECT_EQ(recorder.events.back(), "data 1 body end");
+    EXPECT_EQ(engine.streams(), 0);
+
+    // other frames may not interrupt a header block
+    id = engine.submit(REQUEST, "");
+    block.clear();
+    encoder.encode({{":status", "204"}}, block);
+    receive(engine, frame(HTTP2_HEADERS, HTTP2_END_STREAM, id, block));
+    EXPECT_THROW(receive(engine, frame(HTTP2_PING, 0, 0, std::string(8, '\0'))), std::runtime_error);
+}
+
+
+TEST(http2_engine_t, reset)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    uint32_t first = engine.submit(REQUEST, "");
+    uint32_t second = engine.submit(REQUEST, "");
+    engine.take();
+
+    // the server refuses a stream
+    receive(engine, frame(HTTP2_RST_STREAM, 0, first, uint32_bytes(HTTP2_REFUSED_STREAM)));
+    ASSERT_EQ(recorder.events.size(), 1);
+    EXPECT_EQ(recorder.events[0], "reset 1 7");
+    EXPECT_EQ(engine.streams(), 1);
+
+    // data for the closed stream is released, but not delivered
+    receive(engine, frame(HTTP2_DATA, 0, first, "late"));
+    EXPECT_EQ(recorder.events.size(), 1);
+
+    // the client cancels a stream
+    engine.reset(second);
+    auto sent = frames(engine.take());
+    ASSERT_EQ(sent.size(), 1);
+    EXPECT_EQ(std::get<0>(sent[0]), HTTP2_RST_STREAM);
+    EXPECT_EQ(std::get<2>(sent[0]), second);
+    EXPECT_EQ(std::get<3>(sent[0]), uint32_bytes(HTTP2_CANCEL));
+    EXPECT_EQ(engine.streams(), 0);
+
+    // streams which were never opened cannot be reset
+    EXPECT_THROW(receive(engine, frame(HTTP2_RST_STREAM, 0, 7, uint32_bytes(HTTP2_CANCEL))), std::runtime_error);
+}
+
+
+TEST(http2_engine_t, goaway)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    engine.submit(REQUEST, "");
+    engine.submit(REQUEST, "");
+    engine.submit(REQUEST, "");
+    engine.take();
+
+    // streams after the last processed stream are dropped, to retry
+    receive(engine, frame(HTTP2_GOAWAY, 0, 0, uint32_bytes(1) + uint32_bytes(HTTP2_NO_ERROR)));
+    ASSERT_EQ(recorder.events.size(), 1);
+    EXPECT_EQ(recorder.events[0], "goaway 1 0");
+    EXPECT_EQ(engine.streams(), 1);
+    EXPECT_FALSE(engine.open());
+    EXPECT_FALSE(engine.available());
+
+    // the processed stream still completes
+    hpack_encoder_t encoder;
+    std::string block;
+    encoder.encode({{":status", "200"}}, block);
+    receive(engine, frame(HTTP2_HEADERS, HTTP2_END_HEADERS | HTTP2_END_STREAM, 1, block));
+    EXPECT_EQ(recorder.events.back(), "headers 1 end");
+    EXPECT_EQ(engine.streams(), 0);
+
+    // refused streams report the error used to retry them
+    null_channel_t channel;
+    http2_stream_t stream(&channel, 3, GET, timeout_t(1000));
+    stream.reset(HTTP2_REFUSED_STREAM);
+    EXPECT_FALSE(stream.response());
+    EXPECT_EQ(stream.error(), HTTP2_REFUSED_STREAM);
+    EXPECT_TRUE(stream.done());
+}
+
+
+TEST(http2_engine_t, informational)
+{
+    recorder_t recorder;
+    http2_engine_t engine(recorder);
+    uint32_t id = engine.submit(REQUEST, "");
+
+    // informational responses are separate header blocks
+    hpack_encoder_t encoder;
+    std::string early, response;
+    encoder.encode({{":status", "103"}, {"link", "</style.css>; rel=preload"}}, early);
+    encoder.encode({{":status", "200"}, {"content-length", "2"}}, response);
+    receive(engine, frame(HTTP2_HEADERS, HTTP2_END_HEADERS, id, early));
+    receive(engine, frame(HTTP2_HEADERS, HTTP2_END_HEADERS, id, response));
+    receive(engine, frame(HTTP2_DATA, HTTP2_END_STREAM, id, "ok"));
+    ASSERT_EQ(recorder.events.size(), 3);
+    EXPECT_EQ(recorder.events[0], "headers 1");
+    EXPECT_EQ(recorder.events[1], "headers 1");
+    EXPECT_EQ(recorder.events[2], "data 1 ok end");
+
+    // and streams skip them for the final response
+    null_channel_t channel;
+    http2_stream_t stream(&channel, id, GET, timeout_t(1000));
+    stream.headers(std::move(recorder.headers[0]), false);
+    stream.headers(std::move(recorder.headers[1]), false);
+    stream.data("ok", 2, true);
+    EXPECT_EQ(stream.response().status(), 200);
+    EXPECT_EQ(stream.response().headers().count("link"), 0);
+    std::string body;
+    while (stream.read(body)) {}
+    EXPECT_EQ(channel.consumed, 2);
+}
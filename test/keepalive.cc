@@ -0,0 +1,126 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Keep-alive connection pool unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+LATTICE_USING_NAMESPACE
+
+// OBJECTS
+// -------
+
+
+struct dummy_connection_t
+{
+    int id = 0;
+    bool open = true;
+
+    dummy_connection_t(int id): id(id) {}
+    bool alive() const { return open; }
+};
+
+typedef std::unique_ptr<dummy_connection_t> dummy_ptr_t;
+
+// TESTS
+// -----
+
+
+TEST(connection_pool_t, checkout)
+{
+    connection_pool_t pool;
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example.com"));
+
+    pool.checkin("http://example.com", dummy_ptr_t(new dummy_connection_t(1)));
+    pool.checkin("http://example.com", dummy_ptr_t(new dummy_connection_t(2)));
+    EXPECT_EQ(pool.size(), 2);
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example.net"));
+
+    // most recently used first
+    auto connection = pool.checkout<dummy_connection_t>("http://example.com");
+    ASSERT_TRUE(bool(connection));
+    EXPECT_EQ(connection->id, 2);
+    EXPECT_EQ(pool.size(), 1);
+
+    pool.clear();
+    EXPECT_EQ(pool.size(), 0);
+}
+
+
+TEST(connection_pool_t, dead)
+{
+    connection_pool_t pool;
+    dummy_ptr_t closed(new dummy_connection_t(1));
+    closed->open = false;
+    pool.checkin("http://example.com", std::move(closed));
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example.com"));
+    EXPECT_EQ(pool.size(), 0);
+}
+
+
+TEST(connection_pool_t, limits)
+{
+    connection_pool_t pool(timeout_t(60000), 2);
+    for (int i = 0; i < 4; ++i) {
+        pool.checkin("http://example.com", dummy_ptr_t(new dummy_connection_t(i)));
+    }
+    EXPECT_EQ(pool.size(), 2);
+    EXPECT_EQ(pool.checkout<dummy_connection_t>("http://example.com")->id, 3);
+    EXPECT_EQ(pool.checkout<dummy_connection_t>("http://example.com")->id, 2);
+
+    // expired connections are discarded
+    pool.set_idle_timeout(timeout_t(-1));
+    pool.checkin("http://example.com", dummy_ptr_t(new dummy_connection_t(4)));
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example.com"));
+
+    // server timeout is shorter than the idle timeout
+    pool.set_idle_timeout(timeout_t(60000));
+    pool.checkin("http://example.com", dummy_ptr_t(new dummy_connection_t(5)), timeout_t(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example.com"));
+}
+
+
+TEST(connection_pool_t, expire)
+{
+    connection_pool_t pool;
+    for (int i = 0; i < 3; ++i) {
+        std::string origin = "http://example" + std::to_string(i) + ".com";
+        pool.checkin(origin, dummy_ptr_t(new dummy_connection_t(2*i)), timeout_t(1));
+        pool.checkin(origin, dummy_ptr_t(new dummy_connection_t(2*i+1)), timeout_t(1));
+    }
+    EXPECT_EQ(pool.size(), 6);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // checkins close expired connections to every origin
+    pool.checkin("http://example.net", dummy_ptr_t(new dummy_connection_t(6)));
+    EXPECT_EQ(pool.size(), 1);
+
+    // checkouts close every expired connection to the origin
+    pool.clear();
+    pool.checkin("http://example.net", dummy_ptr_t(new dummy_connection_t(7)), timeout_t(1));
+    pool.checkin("http://example.net", dummy_ptr_t(new dummy_connection_t(8)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(pool.checkout<dummy_connection_t>("http://example.net")->id, 8);
+    EXPECT_EQ(pool.size(), 0);
+}
+
+
+TEST(connection_pool_t, total)
+{
+    connection_pool_t pool;
+    pool.set_max_idle_total(3);
+    for (int i = 0; i < 5; ++i) {
+        pool.checkin("http://example" + std::to_string(i) + ".com", dummy_ptr_t(new dummy_connection_t(i)));
+    }
+
+    // the connections closest to expiry are evicted
+    EXPECT_EQ(pool.size(), 3);
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example0.com"));
+    EXPECT_FALSE(pool.checkout<dummy_connection_t>("http://example1.com"));
+    EXPECT_EQ(pool.checkout<dummy_connection_t>("http://example4.com")->id, 4);
+}
@@ -0,0 +1,231 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Addresses, loopback servers and TLS helpers shared by unittests.
+ */
+
+#pragma once
+
+#include <lattice.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#   include <arpa/inet.h>
+#   include <netinet/in.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#endif
+
+#ifdef LATTICE_HAVE_OPENSSL
+#   include <openssl/ec.h>
+#   include <openssl/evp.h>
+#   include <openssl/ssl.h>
+#   include <openssl/x509.h>
+#endif
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Parse a numeric host and port into an address.
+ */
+inline address_t make_address(const std::string& host, const std::string& port)
+{
+    addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.data(), port.data(), &hints, &result)) {
+        throw std::runtime_error("Unable to parse address.");
+    }
+    address_t address(*result);
+    freeaddrinfo(result);
+
+    return address;
+}
+
+#ifndef _WIN32
+
+
+/**
+ *  \brief Listen on a loopback port, returning the socket and port.
+ */
+inline int listen_loopback(std::string& port, int backlog = 4)
+{
+    int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    ::bind(sock, reinterpret_cast<sockaddr*>(&address), length);
+    ::listen(sock, backlog);
+    ::getsockname(sock, reinterpret_cast<sockaddr*>(&address), &length);
+    port = std::to_string(ntohs(address.sin_port));
+
+    return sock;
+}
+
+
+/**
+ *  \brief Connect a socket to the loopback port.
+ */
+inline int connect_loopback(const std::string& port)
+{
+    int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(std::stoi(port)));
+    ::connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+    return sock;
+}
+
+#endif
+
+#ifdef LATTICE_HAVE_OPENSSL
+
+typedef open_ssl_adaptor_t<posix_socket_adaptor_t> tls_adaptor_t;
+
+
+/**
+ *  \brief Create a server context with a self-signed EC certificate.
+ */
+inline SSL_CTX* server_context()
+{
+    EVP_PKEY *key = nullptr;
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(kctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(kctx, &key);
+    EVP_PKEY_CTX_free(kctx);
+
+    X509 *cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    auto name = X509_get_subject_name(cert);
+    auto cn = reinterpret_cast<const unsigned char*>("localhost");
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, cn, -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+
+    return ctx;
+}
+
+#ifndef _WIN32
+
+
+/**
+ *  \brief Loopback TLS server answering each request with "ok".
+ *
+ *  Each connection is held until the client closes it, so the client
+ *  never writes to a closed socket. Stores all data received over
+ *  each connection, and whether its early data was accepted. Early
+ *  data is only read if `read_early` is set, and rejected otherwise.
+ */
+struct tls_server_t
+{
+    SSL_CTX *ctx = server_context();
+    std::string port;
+    int sock = listen_loopback(port);
+    std::vector<std::string> requests;
+    std::vector<int> early;
+    bool read_early = false;
+    std::thread thread;
+
+    tls_server_t() = default;
+    tls_server_t(const tls_server_t&) = delete;
+    tls_server_t & operator=(const tls_server_t&) = delete;
+
+    ~tls_server_t()
+    {
+        join();
+        ::close(sock);
+        SSL_CTX_free(ctx);
+    }
+
+    /**
+     *  \brief Accept `count` connections in a new thread.
+     */
+    void start(size_t count)
+    {
+        thread = std::thread(&tls_server_t::serve, this, count);
+    }
+
+    void join()
+    {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    /**
+     *  \brief Send a request over the adaptor, and read the response.
+     */
+    std::string exchange(tls_adaptor_t& adaptor, const std::string& request)
+    {
+        adaptor.set_verify_peer(verify_peer_t(false));
+        adaptor.attach(connect_loopback(port), "localhost:" + port);
+        adaptor.write(request.data(), request.size());
+
+        char buffer[64];
+        int read = static_cast<int>(adaptor.read(buffer, sizeof(buffer)));
+        return std::string(buffer, read > 0 ? read : 0);
+    }
+
+protected:
+    void serve(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            int fd = ::accept(sock, nullptr, nullptr);
+            SSL *ssl = SSL_new(ctx);
+            SSL_set_fd(ssl, fd);
+
+            char buffer[4096];
+            std::string request;
+            size_t size;
+            while (read_early && SSL_read_early_data(ssl, buffer, sizeof(buffer), &size) == SSL_READ_EARLY_DATA_SUCCESS) {
+                request.append(buffer, size);
+            }
+            int read;
+            if (SSL_accept(ssl) == 1) {
+                if (request.empty() && (read = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+                    request.append(buffer, read);
+                }
+                SSL_write(ssl, "ok", 2);
+            }
+            early.push_back(SSL_get_early_data_status(ssl));
+
+            // anything sent after the response, like a replayed request
+            SSL_shutdown(ssl);
+            while ((read = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+                request.append(buffer, read);
+            }
+            requests.push_back(request);
+            SSL_free(ssl);
+            ::close(fd);
+        }
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,467 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief OpenSSL adaptor unittests.
+ */
+
+#ifdef LATTICE_HAVE_OPENSSL
+
+#include "loopback.h"
+#include <openssl/pem.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+#   include <sys/stat.h>
+#   include <utime.h>
+#endif
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Move all ciphertext written by one connection to the other.
+ */
+static void transfer(SSL* from, SSL* to)
+{
+    char buffer[4096];
+    int read;
+    while ((read = BIO_read(SSL_get_wbio(from), buffer, sizeof(buffer))) > 0) {
+        BIO_write(SSL_get_rbio(to), buffer, read);
+    }
+}
+
+
+/**
+ *  \brief Drain the ciphertext written by the connection, returning
+ *  the size of each record.
+ */
+static std::vector<size_t> record_sizes(SSL* ssl)
+{
+    std::string data;
+    char buffer[4096];
+    int read;
+    while ((read = BIO_read(SSL_get_wbio(ssl), buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, read);
+    }
+
+    // each record has a 5-byte header, ending with the length
+    std::vector<size_t> sizes;
+    for (size_t offset = 0; offset + 5 <= data.size(); ) {
+        auto *header = reinterpret_cast<const unsigned char*>(data.data() + offset);
+        size_t size = (header[3] << 8) | header[4];
+        sizes.push_back(size);
+        offset += 5 + size;
+    }
+
+    return sizes;
+}
+
+#ifndef _WIN32
+
+
+/**
+ *  \brief Write the certificate for the server context to a PEM file.
+ */
+static void write_certificate(SSL_CTX* ctx, const char* path)
+{
+    FILE *file = std::fopen(path, "w");
+    PEM_write_X509(file, SSL_CTX_get0_certificate(ctx));
+    std::fclose(file);
+}
+
+
+/**
+ *  \brief Move the modification time of the file forward.
+ */
+static void touch(const char* path, time_t seconds)
+{
+    struct stat info;
+    ::stat(path, &info);
+    utimbuf times = {info.st_atime, info.st_mtime + seconds};
+    ::utime(path, &times);
+}
+
+
+/**
+ *  \brief Check if both OpenSSL and the kernel support kernel TLS.
+ */
+static bool kernel_tls_available()
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    std::ifstream stream("/proc/sys/net/ipv4/tcp_available_ulp");
+    std::string name;
+    while (stream >> name) {
+        if (name == "tls") {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+
+/**
+ *  \brief Session cache writing its file directly, like another process.
+ */
+struct session_writer_t: ssl_session_cache_t
+{
+    using ssl_session_cache_t::save;
+};
+
+#endif
+
+// TESTS
+// -----
+
+
+TEST(open_ssl_adaptor_t, shared_context)
+{
+    ssl_context_key_t key = {TLS, certificate_file_t(), revocation_lists_t(), false};
+    ssl_context_key_t other = {TLS_V12, certificate_file_t(), revocation_lists_t(), false};
+
+    // equal settings share the configured context
+    SSL_CTX *ctx = ssl_context(key);
+    SSL_CTX *same = ssl_context(key);
+    EXPECT_EQ(same, ctx);
+    SSL_CTX_free(same);
+
+    // connections only create an SSL object over the shared context
+    std::string first_session, second_session, third_session;
+    SSL *first = ssl_new_connection(key, "localhost", first_session);
+    SSL *second = ssl_new_connection(key, "127.0.0.1", second_session);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(SSL_get_SSL_CTX(first), ctx);
+    EXPECT_EQ(SSL_get_SSL_CTX(second), ctx);
+
+    // other settings are configured separately
+    SSL *third = ssl_new_connection(other, "localhost", third_session);
+    EXPECT_NE(SSL_get_SSL_CTX(third), ctx);
+    SSL_CTX *verified = ssl_context({TLS, certificate_file_t(), revocation_lists_t(), true});
+    EXPECT_NE(verified, ctx);
+    EXPECT_EQ(SSL_CTX_get_verify_mode(verified), SSL_VERIFY_PEER);
+    EXPECT_EQ(SSL_CTX_get_verify_mode(ctx), SSL_VERIFY_NONE);
+
+    SSL_CTX_free(verified);
+    SSL_free(third);
+    SSL_free(second);
+    SSL_free(first);
+    SSL_CTX_free(ctx);
+}
+
+
+TEST(open_ssl_adaptor_t, record_ramp)
+{
+    // handshake over memory BIOs
+    SSL_CTX *ctx = server_context();
+    SSL *server = SSL_new(ctx);
+    SSL_set_bio(server, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+    SSL_set_accept_state(server);
+    SSL_CTX *client_ctx = ssl_context({TLS, certificate_file_t(), revocation_lists_t(), false});
+    SSL *client = SSL_new(client_ctx);
+    SSL_set_bio(client, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+    SSL_set_connect_state(client);
+    for (int i = 0; i < 8 && !(SSL_is_init_finished(client) && SSL_is_init_finished(server)); ++i) {
+        SSL_do_handshake(client);
+        transfer(client, server);
+        SSL_do_handshake(server);
+        transfer(server, client);
+    }
+    ASSERT_TRUE(SSL_is_init_finished(client));
+
+    // records carry at most 17 bytes of overhead with TLS 1.3
+    const size_t small = SSL_SMALL_RECORD_SIZE + 17;
+    auto all_small = [&](const std::vector<size_t>& sizes) {
+        return std::all_of(sizes.begin(), sizes.end(), [&](size_t size) {
+            return size <= small;
+        });
+    };
+
+    // new connections send records fitting a single segment
+    ssl_ramp_t ramp;
+    std::string data(SSL_RAMP_SIZE, 'x');
+    EXPECT_EQ(ssl_write(client, ramp, data.data(), 4096), 4096);
+    auto sizes = record_sizes(client);
+    EXPECT_EQ(sizes.size(), 3);
+    EXPECT_TRUE(all_small(sizes));
+
+    // until SSL_RAMP_SIZE bytes are sent
+    size_t rest = SSL_RAMP_SIZE - 4096;
+    EXPECT_EQ(ssl_write(client, ramp, data.data(), rest), rest);
+    EXPECT_TRUE(all_small(record_sizes(client)));
+
+    // then full records
+    EXPECT_EQ(ssl_write(client, ramp, data.data(), SSL_RECORD_SIZE), SSL_RECORD_SIZE);
+    sizes = record_sizes(client);
+    EXPECT_EQ(sizes.size(), 1);
+    EXPECT_GT(sizes.front(), small);
+
+    // idle connections ramp up again
+    ramp.last -= 2 * SSL_RAMP_IDLE;
+    EXPECT_EQ(ssl_write(client, ramp, data.data(), 4096), 4096);
+    sizes = record_sizes(client);
+    EXPECT_EQ(sizes.size(), 3);
+    EXPECT_TRUE(all_small(sizes));
+
+    SSL_free(client);
+    SSL_CTX_free(client_ctx);
+    SSL_free(server);
+    SSL_CTX_free(ctx);
+}
+
+#ifndef _WIN32
+
+
+TEST(open_ssl_adaptor_t, store_reload)
+{
+    const char *path = "lattice_ca.pem";
+    SSL_CTX *ctx = server_context();
+    write_certificate(ctx, path);
+
+    // rewind the last check, as if SSL_STORE_CHECK had passed
+    auto &cache = ssl_stores();
+    auto expire = [&]() {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.stores[std::make_pair(std::string(path), std::string())].checked -= SSL_STORE_CHECK;
+    };
+
+    // the bundle is parsed once, and shared
+    X509_STORE *store = ssl_store(path, "");
+    X509_STORE *same = ssl_store(path, "");
+    EXPECT_EQ(same, store);
+    X509_STORE_free(same);
+    ssl_context_key_t key = {TLS, certificate_file_t(path), revocation_lists_t(), true};
+    SSL_CTX *client = ssl_context(key);
+    EXPECT_EQ(SSL_CTX_get_cert_store(client), store);
+
+    // unchanged files keep the store after the check
+    expire();
+    same = ssl_store(path, "");
+    EXPECT_EQ(same, store);
+    X509_STORE_free(same);
+
+    // changes are only noticed once per check interval
+    touch(path, 10);
+    same = ssl_store(path, "");
+    EXPECT_EQ(same, store);
+    X509_STORE_free(same);
+
+    // the changed bundle is parsed into a new store
+    expire();
+    X509_STORE *reloaded = ssl_store(path, "");
+    EXPECT_NE(reloaded, store);
+    same = ssl_store(path, "");
+    EXPECT_EQ(same, reloaded);
+    X509_STORE_free(same);
+
+    // contexts verifying against the old store are replaced
+    SSL_CTX *replaced = ssl_context(key);
+    EXPECT_NE(replaced, client);
+    EXPECT_EQ(SSL_CTX_get_cert_store(replaced), reloaded);
+    EXPECT_EQ(SSL_CTX_get_cert_store(client), store);
+
+    SSL_CTX_free(replaced);
+    SSL_CTX_free(client);
+    X509_STORE_free(reloaded);
+    X509_STORE_free(store);
+    SSL_CTX_free(ctx);
+    std::remove(path);
+}
+
+
+TEST(open_ssl_adaptor_t, session_file)
+{
+    std::string path = "lattice_sessions.test";
+    std::remove(path.data());
+    set_ssl_session_file(path);
+
+    tls_server_t server;
+    server.start(2);
+
+    // the first connection performs a full handshake
+    {
+        tls_adaptor_t adaptor;
+        EXPECT_EQ(server.exchange(adaptor, "first"), "ok");
+        EXPECT_FALSE(adaptor.resumed());
+    }
+    flush_ssl_sessions();
+
+    // drop the cached sessions, and reload them from the file
+    auto &cache = ssl_sessions();
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        for (auto &item: cache.sessions) {
+            SSL_SESSION_free(item.second);
+        }
+        cache.sessions.clear();
+    }
+    set_ssl_session_file(path);
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        EXPECT_FALSE(cache.sessions.empty());
+    }
+
+    // the reloaded session is offered, and resumed
+    {
+        tls_adaptor_t adaptor;
+        EXPECT_EQ(server.exchange(adaptor, "second"), "ok");
+        EXPECT_TRUE(adaptor.resumed());
+    }
+
+    server.join();
+    EXPECT_EQ(server.requests, std::vector<std::string>({"first", "second"}));
+
+    // stop writing to the file
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.path.clear();
+        cache.dirty = false;
+    }
+    std::remove(path.data());
+}
+
+
+TEST(open_ssl_adaptor_t, session_file_concurrent)
+{
+    // writers with separate caches, like restarted workers, leave a whole file
+    std::string path = "lattice_sessions.test";
+    std::remove(path.data());
+    std::vector<std::string> contents;
+    for (int i = 0; i < 8; ++i) {
+        contents.emplace_back(200000, static_cast<char>('a' + i));
+    }
+
+    // a link at a predictable temporary name is never followed
+    std::string target = "lattice_sessions.target";
+    {
+        std::ofstream stream(target);
+        stream << "target";
+    }
+    ::symlink(target.data(), (path + ".tmp").data());
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&path, &contents, i]() {
+            session_writer_t writer;
+            for (uint64_t j = 1; j <= 10; ++j) {
+                writer.save(path, contents[i], j);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    std::ifstream stream(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    EXPECT_NE(std::find(contents.begin(), contents.end(), data), contents.end());
+
+    struct stat info;
+    ASSERT_EQ(::stat(path.data(), &info), 0);
+    EXPECT_EQ(info.st_mode & 0777, 0600);
+    ASSERT_EQ(::stat(target.data(), &info), 0);
+    EXPECT_EQ(info.st_size, 6);
+
+    std::remove((path + ".tmp").data());
+    std::remove(target.data());
+    std::remove(path.data());
+}
+
+
+TEST(open_ssl_adaptor_t, early_data_rejected)
+{
+    // tickets allow early data, but the server never reads it
+    tls_server_t server;
+    SSL_CTX_set_max_early_data(server.ctx, 16384);
+    server.start(2);
+
+    {
+        tls_adaptor_t adaptor;
+        EXPECT_EQ(server.exchange(adaptor, "first"), "ok");
+    }
+
+    // the rejected request is replayed after the handshake
+    {
+        tls_adaptor_t adaptor;
+        adaptor.set_early_data(early_data_t(true));
+        EXPECT_EQ(server.exchange(adaptor, "second"), "ok");
+        EXPECT_TRUE(adaptor.resumed());
+    }
+
+    server.join();
+    EXPECT_EQ(server.requests, std::vector<std::string>({"first", "second"}));
+    EXPECT_EQ(server.early[0], SSL_EARLY_DATA_NOT_SENT);
+    EXPECT_EQ(server.early[1], SSL_EARLY_DATA_REJECTED);
+}
+
+
+TEST(open_ssl_adaptor_t, early_data_accepted)
+{
+    tls_server_t server;
+    SSL_CTX_set_max_early_data(server.ctx, 16384);
+    server.read_early = true;
+    server.start(2);
+
+    {
+        tls_adaptor_t adaptor;
+        EXPECT_EQ(server.exchange(adaptor, "first"), "ok");
+    }
+
+    // the accepted request is sent once, before the handshake completes
+    {
+        tls_adaptor_t adaptor;
+        adaptor.set_early_data(early_data_t(true));
+        EXPECT_EQ(server.exchange(adaptor, "second"), "ok");
+        EXPECT_TRUE(adaptor.resumed());
+    }
+
+    server.join();
+    EXPECT_EQ(server.requests, std::vector<std::string>({"first", "second"}));
+    EXPECT_EQ(server.early[0], SSL_EARLY_DATA_NOT_SENT);
+    EXPECT_EQ(server.early[1], SSL_EARLY_DATA_ACCEPTED);
+}
+
+
+TEST(open_ssl_adaptor_t, kernel_tls)
+{
+    // every kernel with TLS offload supports AES-128-GCM
+    tls_server_t server;
+    SSL_CTX_set_ciphersuites(server.ctx, "TLS_AES_128_GCM_SHA256");
+    SSL_CTX_set_cipher_list(server.ctx, "ECDHE-ECDSA-AES128-GCM-SHA256");
+    server.start(2);
+
+    // not requested, user space encrypts records
+    {
+        tls_adaptor_t adaptor;
+        EXPECT_FALSE(adaptor.kernel_tls());
+        EXPECT_EQ(server.exchange(adaptor, "first"), "ok");
+        EXPECT_FALSE(adaptor.kernel_tls());
+    }
+
+    // requested, the kernel encrypts records, or if unsupported,
+    // writes fall back to user space
+    {
+        tls_adaptor_t adaptor;
+        adaptor.set_kernel_tls(kernel_tls_t(true));
+        EXPECT_EQ(server.exchange(adaptor, "second"), "ok");
+        // checked once connected, which may load the kernel module
+        if (kernel_tls_available()) {
+            EXPECT_TRUE(adaptor.kernel_tls());
+        } else {
+            EXPECT_FALSE(adaptor.kernel_tls());
+        }
+        adaptor.close();
+        EXPECT_FALSE(adaptor.kernel_tls());
+    }
+
+    server.join();
+    EXPECT_EQ(server.requests, std::vector<std::string>({"first", "second"}));
+}
+
+#endif
+
+#endif
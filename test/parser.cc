@@ -0,0 +1,102 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Incremental response parser unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Feed data to the parser one byte at a time.
+ */
+static size_t feed_bytes(response_parser_t& parser, const std::string& data)
+{
+    size_t consumed = 0;
+    while (consumed < data.size() && !parser.done()) {
+        consumed += parser.feed(data.data() + consumed, 1);
+    }
+    return consumed;
+}
+
+// TESTS
+// -----
+
+
+TEST(response_parser_t, length)
+{
+    std::string data = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+    response_parser_t parser(GET);
+    EXPECT_EQ(feed_bytes(parser, data), data.size());
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ(parser.response().status(), 200);
+    EXPECT_EQ(parser.response().body(), "hello");
+    EXPECT_TRUE(parser.response().keep_alive());
+
+    // HEAD responses have no body
+    data = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n";
+    parser.reset(HEAD);
+    EXPECT_EQ(parser.feed(data.data(), data.size()), data.size());
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ(parser.response().body(), "");
+}
+
+
+TEST(response_parser_t, chunked)
+{
+    std::string data = (
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;ext=1\r\nhello\r\n"
+        "6\r\n world\r\n"
+        "0\r\nX-Trailer: 1\r\n\r\n"
+    );
+    response_parser_t parser(GET);
+    EXPECT_EQ(feed_bytes(parser, data), data.size());
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ(parser.response().body(), "hello world");
+}
+
+
+TEST(response_parser_t, close)
+{
+    std::string data = "HTTP/1.1 200 OK\r\n\r\nhello";
+    response_parser_t parser(GET);
+    EXPECT_EQ(parser.feed(data.data(), data.size()), data.size());
+    EXPECT_TRUE(parser.headers_done());
+    EXPECT_FALSE(parser.done());
+    parser.finish();
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ(parser.response().body(), "hello");
+    EXPECT_FALSE(parser.response().keep_alive());
+
+    // truncated responses are errors
+    data = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nhello";
+    parser.reset(GET);
+    parser.feed(data.data(), data.size());
+    EXPECT_THROW(parser.finish(), std::runtime_error);
+}
+
+
+TEST(response_parser_t, pipelined)
+{
+    std::string first = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nab";
+    std::string second = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    std::string data = first + second;
+
+    response_parser_t parser(GET);
+    size_t consumed = parser.feed(data.data(), data.size());
+    EXPECT_EQ(consumed, first.size());
+    EXPECT_EQ(parser.response().body(), "ab");
+
+    parser.reset(GET);
+    EXPECT_EQ(parser.feed(data.data() + consumed, data.size() - consumed), second.size());
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ(parser.response().status(), 404);
+}
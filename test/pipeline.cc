@@ -0,0 +1,171 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Request pipelining unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <deque>
+#include <vector>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Adaptor answering each request written with a canned response.
+ *
+ *  Each connection serves the next list of responses, and closes once
+ *  the list is exhausted. Writes and reads are logged as "w" and "r".
+ */
+struct session_adaptor_t
+{
+    static std::deque<std::deque<std::string>> sessions;
+    static std::string events;
+
+    std::deque<std::string> responses;
+    std::string data;
+    size_t offset = 0;
+
+    bool open(const addrinfo&, const std::string&)
+    {
+        responses = sessions.front();
+        sessions.pop_front();
+        events += "|";
+        return true;
+    }
+
+    void close()
+    {}
+
+    size_t write(const char *buf, size_t len)
+    {
+        std::string request(buf, len);
+        for (size_t i = request.find(" HTTP/1.1\r\n"); i != std::string::npos; i = request.find(" HTTP/1.1\r\n", i + 1)) {
+            if (!responses.empty()) {
+                data += responses.front();
+                responses.pop_front();
+            }
+        }
+        log('w');
+        return len;
+    }
+
+    size_t read(char *buf, size_t count)
+    {
+        size_t read = std::min(count, data.size() - offset);
+        data.copy(buf, read, offset);
+        offset += read;
+        log('r');
+        return read;
+    }
+
+    bool alive() const
+    {
+        return offset == data.size();
+    }
+
+    void log(char event)
+    {
+        if (events.empty() || events.back() != event) {
+            events += event;
+        }
+    }
+};
+
+std::deque<std::deque<std::string>> session_adaptor_t::sessions;
+std::string session_adaptor_t::events;
+
+typedef connection_t<session_adaptor_t> session_connection_t;
+
+
+static std::string response(const std::string& body, bool close = false)
+{
+    std::string headers = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    if (close) {
+        headers += "Connection: close\r\n";
+    }
+    return headers + "\r\n" + body;
+}
+
+
+static response_list_t perform(pipeline_t& pipeline)
+{
+    session_connection_t connection;
+    connection.open(url_t("http://localhost/"));
+    return pipeline.perform(connection);
+}
+
+// TESTS
+// -----
+
+
+TEST(pipeline_t, pipeline)
+{
+    session_adaptor_t::events.clear();
+    session_adaptor_t::sessions = {{response("a"), response("b"), response("c")}};
+
+    pipeline_t pipeline;
+    for (auto path: {"/a", "/b", "/c"}) {
+        pipeline.get(url_t(std::string("http://localhost") + path));
+    }
+    auto responses = perform(pipeline);
+    ASSERT_EQ(responses.size(), 3);
+    EXPECT_EQ(responses[0].body(), "a");
+    EXPECT_EQ(responses[1].body(), "b");
+    EXPECT_EQ(responses[2].body(), "c");
+    EXPECT_EQ(session_adaptor_t::events, "|wr");
+    EXPECT_FALSE(pipeline);
+}
+
+
+TEST(pipeline_t, idempotent)
+{
+    // non-idempotent requests are sent alone
+    session_adaptor_t::events.clear();
+    session_adaptor_t::sessions = {{response("a"), response("b"), response("c")}};
+
+    pipeline_t pipeline;
+    pipeline.get(url_t("http://localhost/a"));
+    pipeline.post(url_t("http://localhost/b"), body_t("data"));
+    pipeline.get(url_t("http://localhost/c"));
+    auto responses = perform(pipeline);
+    ASSERT_EQ(responses.size(), 3);
+    EXPECT_EQ(responses[1].body(), "b");
+    EXPECT_EQ(session_adaptor_t::events, "|wrwrwr");
+}
+
+
+TEST(pipeline_t, reconnect)
+{
+    // unanswered requests are sent on a new connection
+    session_adaptor_t::events.clear();
+    session_adaptor_t::sessions = {
+        {response("a", true)},
+        {response("b"), response("c")},
+    };
+
+    pipeline_t pipeline;
+    for (auto path: {"/a", "/b", "/c"}) {
+        pipeline.get(url_t(std::string("http://localhost") + path));
+    }
+    auto responses = perform(pipeline);
+    ASSERT_EQ(responses.size(), 3);
+    EXPECT_EQ(responses[0].body(), "a");
+    EXPECT_EQ(responses[1].body(), "b");
+    EXPECT_EQ(responses[2].body(), "c");
+    EXPECT_EQ(session_adaptor_t::events, "|wr|wr");
+}
+
+
+TEST(pipeline_t, origin)
+{
+    pipeline_t pipeline;
+    pipeline.get(url_t("http://localhost/a"));
+    pipeline.get(url_t("http://example.com/b"));
+    EXPECT_THROW(pipeline.perform(), std::runtime_error);
+}
@@ -0,0 +1,167 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Event-driven reactor unittests.
+ */
+
+#include "loopback.h"
+#include <gtest/gtest.h>
+
+#if defined(LATTICE_HAVE_EPOLL)
+#   include <poll.h>
+#endif
+
+#if defined(LATTICE_HAVE_EPOLL)
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Answer `count` requests with `response`, over any number
+ *  of keep-alive connections.
+ *
+ *  Stores the number of connections accepted.
+ */
+static void serve(int server, size_t count, std::string response, size_t& accepted)
+{
+    std::vector<pollfd> descriptors = {{server, POLLIN, 0}};
+    std::vector<std::string> buffers(1);
+    size_t answered = 0;
+    while (answered < count) {
+        if (::poll(descriptors.data(), descriptors.size(), 5000) <= 0) {
+            break;
+        }
+        if (descriptors[0].revents & POLLIN) {
+            descriptors.push_back({::accept(server, nullptr, nullptr), POLLIN, 0});
+            buffers.emplace_back();
+            ++accepted;
+        }
+
+        for (size_t i = 1; i < descriptors.size(); ++i) {
+            auto &descriptor = descriptors[i];
+            if (descriptor.fd < 0 || !(descriptor.revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            char buffer[1024];
+            auto read = ::recv(descriptor.fd, buffer, sizeof(buffer), 0);
+            if (read <= 0) {
+                ::close(descriptor.fd);
+                descriptor.fd = -1;
+                continue;
+            }
+
+            // each request is headers only
+            auto &data = buffers[i];
+            data.append(buffer, read);
+            size_t end;
+            while ((end = data.find("\r\n\r\n")) != std::string::npos) {
+                data.erase(0, end + 4);
+                ::send(descriptor.fd, response.data(), response.size(), MSG_NOSIGNAL);
+                ++answered;
+            }
+        }
+    }
+
+    for (size_t i = 1; i < descriptors.size(); ++i) {
+        if (descriptors[i].fd >= 0) {
+            ::close(descriptors[i].fd);
+        }
+    }
+}
+
+// TESTS
+// -----
+
+
+TEST(reactor_t, submit)
+{
+    std::string port;
+    int server = listen_loopback(port, 16);
+    size_t accepted = 0;
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    std::thread thread(serve, server, 8, response, std::ref(accepted));
+
+    // concurrent requests share the loops
+    auto reactor = std::make_shared<reactor_t>(2);
+    EXPECT_EQ(reactor->threads(), 2);
+    pool_t pool(reactor);
+    url_t url = "http://127.0.0.1:" + port + "/";
+    for (int i = 0; i < 8; ++i) {
+        pool.get(url, read_timeout_t(5000));
+    }
+    auto responses = pool.perform();
+    ASSERT_EQ(responses.size(), 8);
+    for (const auto &item: responses) {
+        EXPECT_EQ(item.status(), 200);
+        EXPECT_EQ(item.body(), "ok");
+    }
+
+    thread.join();
+    EXPECT_GE(accepted, 1);
+    EXPECT_LE(accepted, 8);
+    ::close(server);
+}
+
+
+TEST(reactor_t, reuse)
+{
+    std::string port;
+    int server = listen_loopback(port);
+    size_t accepted = 0;
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    std::thread thread(serve, server, 3, response, std::ref(accepted));
+
+    // sequential requests to an origin reuse the idle socket
+    auto reactor = std::make_shared<reactor_t>(1);
+    url_t url = "http://127.0.0.1:" + port + "/";
+    for (int i = 0; i < 3; ++i) {
+        pool_t pool(reactor);
+        pool.get(url, read_timeout_t(5000));
+        auto responses = pool.perform();
+        ASSERT_EQ(responses.size(), 1);
+        EXPECT_EQ(responses.front().body(), "ok");
+    }
+
+    thread.join();
+    EXPECT_EQ(accepted, 1);
+    ::close(server);
+}
+
+
+TEST(reactor_t, redirect)
+{
+    std::string target_port;
+    int target = listen_loopback(target_port, 16);
+    size_t target_accepted = 0;
+    std::string ok = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    std::thread target_thread(serve, target, 8, ok, std::ref(target_accepted));
+
+    std::string port;
+    int server = listen_loopback(port, 16);
+    size_t accepted = 0;
+    std::string location = "http://127.0.0.1:" + target_port + "/next";
+    std::string redirect = "HTTP/1.1 302 Found\r\nLocation: " + location + "\r\nContent-Length: 0\r\n\r\n";
+    std::thread thread(serve, server, 8, redirect, std::ref(accepted));
+
+    // redirects to another origin are resolved off the loop
+    pool_t pool(std::make_shared<reactor_t>(1));
+    url_t url = "http://127.0.0.1:" + port + "/";
+    for (int i = 0; i < 8; ++i) {
+        pool.get(url, redirects_t(1), read_timeout_t(5000));
+    }
+    auto responses = pool.perform();
+    ASSERT_EQ(responses.size(), 8);
+    for (const auto &item: responses) {
+        EXPECT_EQ(item.status(), 200);
+        EXPECT_EQ(item.body(), "ok");
+    }
+
+    thread.join();
+    target_thread.join();
+    ::close(server);
+    ::close(target);
+}
+
+#endif
@@ -0,0 +1,292 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Asynchronous DNS resolver unittests.
+ */
+
+#ifndef _WIN32
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Nameserver for "example.test", on a random local port.
+ *
+ *  The first `drop` queries are ignored, to exercise retries.
+ */
+class stub_nameserver_t
+{
+public:
+    stub_nameserver_t(int drop = 0):
+        drop(drop)
+    {
+        sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        socklen_t length = sizeof(address);
+        ::getsockname(sock, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+        thread = std::thread([this]() { serve(); });
+    }
+
+    ~stub_nameserver_t()
+    {
+        running = false;
+        thread.join();
+        ::close(sock);
+    }
+
+    std::string address() const
+    {
+        return "127.0.0.1:" + std::to_string(port);
+    }
+
+    std::atomic<int> queries {0};
+    std::atomic<int> payload {0};
+
+private:
+    int sock;
+    int drop;
+    uint16_t port;
+    std::atomic<bool> running {true};
+    std::thread thread;
+
+    void serve()
+    {
+        char buffer[512];
+        while (running) {
+            pollfd descriptor = {sock, POLLIN, 0};
+            if (::poll(&descriptor, 1, 10) <= 0) {
+                continue;
+            }
+            sockaddr_storage peer;
+            socklen_t length = sizeof(peer);
+            auto size = ::recvfrom(sock, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&peer), &length);
+            if (size < 17 || queries++ < drop) {
+                continue;
+            }
+            payload = edns_payload(std::string(buffer, size));
+            auto answer = respond(std::string(buffer, size));
+            ::sendto(sock, answer.data(), answer.size(), 0, reinterpret_cast<sockaddr*>(&peer), length);
+        }
+    }
+
+    /**
+     *  \brief Get the UDP payload size from the query's OPT record.
+     */
+    static int edns_payload(const std::string& query)
+    {
+        size_t end = query.find('\0', 12) + 5;
+        if (query[11] != 1 || end + 11 > query.size() || query[end] != '\0' || query[end+2] != 41) {
+            return 0;
+        }
+        return (static_cast<unsigned char>(query[end+3]) << 8) | static_cast<unsigned char>(query[end+4]);
+    }
+
+    static std::string encode_name(const std::string& name)
+    {
+        std::string data;
+        size_t start = 0;
+        while (start < name.size()) {
+            size_t end = std::min(name.find('.', start), name.size());
+            data.push_back(static_cast<char>(end - start));
+            data.append(name, start, end - start);
+            start = end + 1;
+        }
+        return data + std::string(1, '\0');
+    }
+
+    static std::string record(const std::string& owner, uint16_t type, uint8_t ttl, const std::string& data)
+    {
+        std::string packet = encode_name(owner);
+        packet += std::string(1, '\0') + static_cast<char>(type) + std::string("\0\x01\0\0\0", 5);
+        packet += std::string(1, static_cast<char>(ttl)) + '\0' + static_cast<char>(data.size()) + data;
+        return packet;
+    }
+
+    /**
+     *  \brief Answer A records with a TTL of 60s, and AAAA records
+     *  with a TTL of 30s, for "example.test".
+     *
+     *  "alias.test" is a CNAME for it, with a TTL of 20s, and its A
+     *  answer has an unrelated record. "zero.test" answers have a TTL
+     *  of 0s, "truncated.test" and "localhost" answers are truncated, and
+     *  other names do not exist.
+     */
+    static std::string respond(const std::string& query)
+    {
+        size_t end = query.find('\0', 12) + 5;
+        std::string question = query.substr(12, end - 12);
+        uint16_t type = static_cast<uint16_t>((static_cast<unsigned char>(query[end-4]) << 8) | static_cast<unsigned char>(query[end-3]));
+        std::string address = type == 1 ? std::string("\xc0\0\x02\x01", 4) : std::string("\x20\x01\x0d\xb8", 4) + std::string(11, '\0') + "\x01";
+        uint8_t ttl = type == 1 ? 60 : 30;
+
+        std::string answers, flags = "\x81\x80";
+        if (question.compare(0, 14, encode_name("example.test")) == 0) {
+            answers = record("example.test", type, ttl, address);
+        } else if (question.compare(0, 12, encode_name("alias.test")) == 0) {
+            answers = record("alias.test", 5, 20, encode_name("example.test"));
+            if (type == 1) {
+                answers += record("other.test", type, ttl, std::string("\x0a\0\0\x01", 4));
+                answers += record("example.test", type, ttl, address);
+            }
+        } else if (question.compare(0, 11, encode_name("zero.test")) == 0) {
+            answers = record("zero.test", type, 0, address);
+        } else if (question.compare(0, 16, encode_name("truncated.test")) == 0 || question.compare(0, 11, encode_name("localhost")) == 0) {
+            flags = "\x83\x80";
+        } else {
+            flags = "\x81\x83";
+        }
+
+        size_t count = 0;
+        for (size_t offset = 0; offset < answers.size(); ++count) {
+            size_t name = answers.find('\0', offset) + 1;
+            offset = name + 10 + static_cast<unsigned char>(answers[name + 9]);
+        }
+        std::string packet = query.substr(0, 2) + flags;
+        packet += std::string("\0\x01\0", 3) + static_cast<char>(count);
+        packet += std::string(4, '\0');
+        return packet + question + answers;
+    }
+};
+
+// TESTS
+// -----
+
+
+TEST(dns_resolver_t, resolve)
+{
+    stub_nameserver_t server;
+    auto resolver = std::make_shared<dns_resolver_t>(std::vector<std::string> {server.address()});
+
+    // both families are resolved, with the lowest TTL
+    std::chrono::seconds ttl;
+    auto addresses = resolver->resolve("example.test", "https", &ttl);
+    ASSERT_EQ(addresses.size(), 2);
+    EXPECT_EQ(ttl.count(), 30);
+    EXPECT_NE(addresses[0].family, addresses[1].family);
+    for (const auto &address: addresses) {
+        if (address.family == AF_INET) {
+            auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&address.address);
+            EXPECT_EQ(ntohs(ipv4->sin_port), 443);
+            EXPECT_EQ(ntohl(ipv4->sin_addr.s_addr), 0xc0000201);
+        }
+    }
+    EXPECT_THROW(resolver->resolve("missing.test", "http"), std::runtime_error);
+
+    // numeric hosts do not send queries
+    int queries = server.queries;
+    EXPECT_EQ(resolver->resolve("127.0.0.1:8080", "http").size(), 1);
+    EXPECT_EQ(server.queries, queries);
+
+    // caches use the resolver and the record TTLs
+    auto cache = create_dns_cache();
+    cache->set_resolver(resolver);
+    EXPECT_EQ(cache->resolve("example.test", "http").size(), 2);
+    address_list_t found;
+    EXPECT_EQ(cache->find("example.test", "http", found), DNS_FRESH);
+
+    // short TTLs are cached for a minimum time
+    EXPECT_EQ(cache->resolve("zero.test", "http").size(), 2);
+    EXPECT_EQ(cache->find("zero.test", "http", found), DNS_FRESH);
+}
+
+
+TEST(dns_resolver_t, system_host)
+{
+    EXPECT_TRUE(system_host("localhost"));
+    EXPECT_TRUE(system_host("intranet:8080"));
+    EXPECT_FALSE(system_host("example.test"));
+
+    // short names bypass the nameservers, for search domains and the hosts file
+    stub_nameserver_t server;
+    auto cache = create_dns_cache();
+    cache->set_resolver(std::make_shared<dns_resolver_t>(std::vector<std::string> {server.address()}));
+    EXPECT_FALSE(cache->resolve("localhost", "http").empty());
+    EXPECT_EQ(server.queries, 0);
+}
+
+
+TEST(dns_resolver_t, cname)
+{
+    stub_nameserver_t server;
+    dns_resolver_t resolver(std::vector<std::string> {server.address()});
+
+    // records off the CNAME chain are ignored
+    std::chrono::seconds ttl;
+    auto addresses = resolver.resolve("alias.test", "http", &ttl);
+    ASSERT_EQ(addresses.size(), 1);
+    EXPECT_EQ(ttl.count(), 20);
+    auto *ipv4 = reinterpret_cast<const sockaddr_in*>(&addresses[0].address);
+    EXPECT_EQ(ntohl(ipv4->sin_addr.s_addr), 0xc0000201);
+
+}
+
+
+TEST(dns_resolver_t, truncated)
+{
+    stub_nameserver_t server;
+    dns_resolver_t resolver(std::vector<std::string> {server.address()});
+
+    // queries advertise a larger UDP payload with EDNS0
+    EXPECT_EQ(resolver.resolve("example.test", "http").size(), 2);
+    EXPECT_EQ(server.payload, 1232);
+
+    // truncated answers finish the query, which is not retried
+    int queries = server.queries;
+    auto query = resolver.query("truncated.test", "http");
+    while (!query->done()) {
+        pollfd descriptor = {query->fd(), POLLIN, 0};
+        ::poll(&descriptor, 1, 1000);
+        query->on_readable();
+    }
+    EXPECT_TRUE(query->truncated());
+    EXPECT_THROW(query->addresses(), std::runtime_error);
+    EXPECT_LE(server.queries - queries, 2);
+
+    // and lookups fall back to getaddrinfo
+    std::chrono::seconds ttl;
+    EXPECT_FALSE(resolver.resolve("localhost", "http", &ttl).empty());
+    EXPECT_EQ(ttl, DNS_TTL);
+}
+
+
+TEST(dns_resolver_t, retry)
+{
+    // the first A and AAAA questions are lost
+    stub_nameserver_t server(2);
+    dns_resolver_t resolver(std::vector<std::string> {server.address()});
+    resolver.set_timeout(std::chrono::milliseconds(50));
+    resolver.set_attempts(2);
+
+    EXPECT_EQ(resolver.resolve("example.test", "http").size(), 2);
+    EXPECT_EQ(server.queries, 4);
+
+    // lookups fail once every attempt is lost
+    stub_nameserver_t lossy(4);
+    dns_resolver_t fallback(std::vector<std::string> {lossy.address()});
+    fallback.set_timeout(std::chrono::milliseconds(50));
+    fallback.set_attempts(2);
+    EXPECT_THROW(fallback.resolve("example.test", "http"), std::runtime_error);
+}
+
+#endif
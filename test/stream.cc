@@ -0,0 +1,199 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Streaming response body unittests.
+ */
+
+#include <lattice.h>
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+LATTICE_USING_NAMESPACE
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Adaptor serving a fixed response, a few bytes per read.
+ */
+struct string_adaptor_t
+{
+    std::string data;
+    size_t offset = 0;
+
+    bool open(const addrinfo&, const std::string&)
+    {
+        return true;
+    }
+
+    void close()
+    {}
+
+    size_t write(const char*, size_t len)
+    {
+        return len;
+    }
+
+    size_t read(char *buf, size_t count)
+    {
+        size_t read = std::min<size_t>({count, 7, data.size() - offset});
+        data.copy(buf, read, offset);
+        offset += read;
+        return read;
+    }
+
+    bool alive() const
+    {
+        return offset == data.size();
+    }
+};
+
+
+struct string_connection_t: connection_t<string_adaptor_t>
+{
+    string_connection_t(const std::string& data)
+    {
+        adaptor.data = data;
+    }
+};
+
+
+/**
+ *  \brief Read the full body, one small block at a time.
+ */
+static std::string read_body(body_reader_t<string_connection_t>& reader)
+{
+    std::string body;
+    char buffer[5];
+    while (size_t read = reader.read(buffer, sizeof(buffer))) {
+        body.append(buffer, read);
+    }
+    return body;
+}
+
+// TESTS
+// -----
+
+
+TEST(body_reader_t, length)
+{
+    string_connection_t connection("HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world");
+    body_reader_t<string_connection_t> reader(connection);
+    EXPECT_EQ(reader.response().status(), 200);
+    EXPECT_FALSE(reader.done());
+    EXPECT_EQ(read_body(reader), "hello world");
+    EXPECT_TRUE(reader.done());
+    EXPECT_EQ(reader.response().body(), "");
+    EXPECT_TRUE(reader.response().keep_alive());
+    EXPECT_TRUE(connection.alive());
+}
+
+
+TEST(body_reader_t, chunked)
+{
+    string_connection_t connection(
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;ext=1\r\nhello\r\n"
+        "6\r\n world\r\n"
+        "0\r\nX-Trailer: 1\r\n\r\n"
+    );
+    body_reader_t<string_connection_t> reader(connection);
+    EXPECT_EQ(read_body(reader), "hello world");
+    EXPECT_TRUE(reader.response().keep_alive());
+    EXPECT_TRUE(connection.alive());
+}
+
+
+TEST(body_reader_t, close)
+{
+    string_connection_t connection("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nhello world");
+    body_reader_t<string_connection_t> reader(connection);
+    EXPECT_EQ(read_body(reader), "hello world");
+    EXPECT_FALSE(reader.response().keep_alive());
+}
+
+
+TEST(body_reader_t, buffer)
+{
+    string_connection_t connection("HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world");
+    body_reader_t<string_connection_t> reader(connection);
+    char buffer[6];
+    size_t read = 0;
+    while (read < sizeof(buffer)) {
+        read += reader.read(buffer + read, sizeof(buffer) - read);
+    }
+    reader.buffer();
+    EXPECT_EQ(reader.response().body(), "world");
+}
+
+
+TEST(body_reader_t, truncated)
+{
+    string_connection_t connection("HTTP/1.1 200 OK\r\nContent-Length: 20\r\n\r\nhello world");
+    body_reader_t<string_connection_t> reader(connection);
+    EXPECT_EQ(read_body(reader), "hello world");
+    EXPECT_TRUE(reader.done());
+    EXPECT_FALSE(reader.response().keep_alive());
+}
+
+
+TEST(body_reader_t, download_truncated)
+{
+    // bodies ending early throw, keeping the bytes received
+    std::vector<std::string> responses = {
+        "HTTP/1.1 200 OK\r\nContent-Length: 20\r\n\r\nhello world",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n14\r\n world",
+    };
+    std::string path = "lattice_stream.bin";
+    for (const auto& response: responses) {
+        string_connection_t connection(response);
+        body_reader_t<string_connection_t> reader(connection);
+        {
+            download_t download(path);
+            file_writer_t file(download);
+            EXPECT_THROW(reader.download(file), std::runtime_error);
+            file.finish();
+        }
+        EXPECT_TRUE(reader.done());
+        EXPECT_FALSE(reader.response().keep_alive());
+
+        std::ifstream stream(path, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(contents, "hello world");
+    }
+    std::remove(path.data());
+}
+
+
+TEST(body_reader_t, download)
+{
+    std::string body(100000, 'a');
+    string_connection_t connection(
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n"
+        "186a0\r\n" + body + "\r\n"
+        "0\r\n\r\n"
+    );
+    body_reader_t<string_connection_t> reader(connection);
+    std::string path = "lattice_stream.bin";
+    {
+        download_t download(path);
+        file_writer_t file(download);
+        reader.download(file);
+        file.finish();
+        EXPECT_EQ(file.size(), 100005);
+    }
+    EXPECT_TRUE(reader.done());
+    EXPECT_TRUE(reader.response().keep_alive());
+    EXPECT_TRUE(connection.alive());
+
+    std::ifstream stream(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(contents, "hello" + body);
+    std::remove(path.data());
+}
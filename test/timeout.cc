@@ -5,11 +5,91 @@
  *  \brief Timeout unittests.
  */
 
-#include <lattice.h>
+#include "loopback.h"
 #include <gtest/gtest.h>
+#include <cstdio>
 
-LATTICE_USING_NAMESPACE
+#ifndef _WIN32
+#   include <poll.h>
+#endif
 
+#ifndef _WIN32
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Fill the accept queue of a listener that never accepts.
+ *
+ *  Once the queue is full, the kernel drops further SYNs, so new
+ *  connections hang until the client gives up.
+ */
+static std::vector<int> fill_backlog(const std::string& port)
+{
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(std::stoi(port)));
+
+    std::vector<int> clients;
+    while (clients.size() < 16) {
+        int sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        clients.push_back(sock);
+        ::connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        pollfd fd = {sock, POLLOUT, 0};
+        if (::poll(&fd, 1, 100) == 0) {
+            break;
+        }
+    }
+
+    return clients;
+}
+
+
+/**
+ *  \brief Answer each of `responses` on a new connection, after `delay`.
+ */
+static void serve_delayed(int server, std::vector<std::string> responses, std::chrono::milliseconds delay)
+{
+    for (const auto& response: responses) {
+        int client = ::accept(server, nullptr, nullptr);
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            auto read = ::recv(client, buffer, sizeof(buffer), 0);
+            if (read <= 0) {
+                break;
+            }
+            request.append(buffer, read);
+        }
+        std::this_thread::sleep_for(delay);
+        ::send(client, response.data(), response.size(), MSG_NOSIGNAL);
+        ::close(client);
+    }
+}
+
+
+/**
+ *  \brief Answer with `headers`, then send the body a byte at a time.
+ */
+static void serve_slowly(int server, std::string headers, std::chrono::milliseconds interval)
+{
+    int client = ::accept(server, nullptr, nullptr);
+    char buffer[1024];
+    ::recv(client, buffer, sizeof(buffer), 0);
+    ::send(client, headers.data(), headers.size(), MSG_NOSIGNAL);
+    for (int i = 0; i < 100; ++i) {
+        std::this_thread::sleep_for(interval);
+        if (::send(client, "x", 1, MSG_NOSIGNAL) != 1) {
+            break;
+        }
+    }
+    ::close(client);
+}
+
+#endif
 
 // TESTS
 // -----
@@ -26,3 +106,170 @@ TEST(timeout_t, timeout_t)
     timeout_t empty;
     EXPECT_FALSE(bool(empty));
 }
+
+#ifndef _WIN32
+
+
+TEST(timeout_t, connect_timeout)
+{
+    std::string port;
+    int server = listen_loopback(port, 0);
+    auto clients = fill_backlog(port);
+
+    auto start = std::chrono::steady_clock::now();
+    url_t url = "http://127.0.0.1:" + port + "/";
+    try {
+        Get(url, connect_timeout_t(200));
+        ADD_FAILURE() << "Expected the connection to time out.";
+    } catch (std::runtime_error& error) {
+        EXPECT_STREQ(error.what(), "Request timed out.");
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+    for (int client: clients) {
+        ::close(client);
+    }
+    ::close(server);
+}
+
+#if defined(HAVE_SSL) && defined(LATTICE_HAVE_OPENSSL)
+
+
+TEST(timeout_t, handshake_timeout)
+{
+    // the kernel completes the TCP handshake, but the peer never answers
+    std::string port;
+    int server = listen_loopback(port);
+
+    auto start = std::chrono::steady_clock::now();
+    url_t url = "https://127.0.0.1:" + port + "/";
+    try {
+        Get(url, handshake_timeout_t(200));
+        ADD_FAILURE() << "Expected the handshake to time out.";
+    } catch (std::runtime_error& error) {
+        EXPECT_STREQ(error.what(), "Request timed out during SSL handshake.");
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+    ::close(server);
+}
+
+#endif
+
+
+TEST(timeout_t, total_timeout)
+{
+    std::vector<std::string> responses = {
+        "HTTP/1.1 302 Found\r\nLocation: /next\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok",
+    };
+    auto delay = std::chrono::milliseconds(300);
+
+    // each response arrives well within the read timeout
+    std::string port;
+    int server = listen_loopback(port);
+    std::thread thread(serve_delayed, server, responses, delay);
+    url_t url = "http://127.0.0.1:" + port + "/";
+    auto response = Get(url, redirects_t(1), read_timeout_t(1000), total_timeout_t(2000));
+    EXPECT_EQ(response.status(), 200);
+    EXPECT_EQ(response.body(), "ok");
+    thread.join();
+    ::close(server);
+
+    // but the deadline covers the redirect as well
+    server = listen_loopback(port);
+    thread = std::thread(serve_delayed, server, responses, delay);
+    url = "http://127.0.0.1:" + port + "/";
+    try {
+        Get(url, redirects_t(1), read_timeout_t(1000), total_timeout_t(450));
+        ADD_FAILURE() << "Expected the request to time out.";
+    } catch (std::runtime_error& error) {
+        EXPECT_STREQ(error.what(), "Request timed out.");
+    }
+    thread.join();
+    ::close(server);
+}
+
+
+TEST(timeout_t, redirect_timeout)
+{
+    // the redirect reconnects to a peer that never answers
+    std::string silent;
+    int peer = listen_loopback(silent);
+    std::vector<std::string> responses = {
+        "HTTP/1.1 302 Found\r\nLocation: http://127.0.0.1:" + silent + "/\r\nContent-Length: 0\r\n\r\n",
+    };
+
+    std::string port;
+    int server = listen_loopback(port);
+    std::thread thread(serve_delayed, server, responses, std::chrono::milliseconds(0));
+    auto start = std::chrono::steady_clock::now();
+    url_t url = "http://127.0.0.1:" + port + "/";
+    try {
+        Get(url, redirects_t(1), read_timeout_t(300));
+        ADD_FAILURE() << "Expected the request to time out.";
+    } catch (std::runtime_error& error) {
+        EXPECT_STREQ(error.what(), "Request timed out.");
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(elapsed, std::chrono::seconds(2));
+
+    thread.join();
+    ::close(server);
+    ::close(peer);
+}
+
+
+TEST(timeout_t, download_timeout)
+{
+    // the body arrives steadily, but too slowly to meet the deadline
+    std::string path = "lattice_timeout.bin";
+    std::vector<std::string> headers = {
+        "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n",
+    };
+    for (const auto& header: headers) {
+        std::string port;
+        int server = listen_loopback(port);
+        std::thread thread(serve_slowly, server, header, std::chrono::milliseconds(20));
+        auto start = std::chrono::steady_clock::now();
+        url_t url = "http://127.0.0.1:" + port + "/";
+        try {
+            Get(url, download_t(path), read_timeout_t(1000), total_timeout_t(300));
+            ADD_FAILURE() << "Expected the download to time out.";
+        } catch (std::runtime_error& error) {
+            EXPECT_STREQ(error.what(), "Request timed out.");
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+        thread.join();
+        ::close(server);
+    }
+    std::remove(path.data());
+}
+
+
+TEST(timeout_t, upload_timeout)
+{
+    // the peer never reads, so the upload stalls once its buffers fill
+    std::string port;
+    int server = listen_loopback(port);
+
+    auto start = std::chrono::steady_clock::now();
+    url_t url = "http://127.0.0.1:" + port + "/";
+    try {
+        Post(url, body_t(64 << 20, 'x'), total_timeout_t(300));
+        ADD_FAILURE() << "Expected the upload to time out.";
+    } catch (std::runtime_error& error) {
+        EXPECT_STREQ(error.what(), "Request timed out.");
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+    ::close(server);
+}
+
+#endif
@@ -0,0 +1,144 @@
+//  :copyright: (c) 2015-2017 The Regents of the University of California.
+//  :license: MIT, see licenses/mit.md for more details.
+/*
+ *  \addtogroup LatticeTests
+ *  \brief Memory-BIO TLS engine unittests.
+ */
+
+#ifdef LATTICE_HAVE_OPENSSL
+
+#include "loopback.h"
+#include <gtest/gtest.h>
+
+// HELPERS
+// -------
+
+
+/**
+ *  \brief Move all ciphertext from the engine to the server, and back.
+ *
+ *  Ciphertext is moved in small blocks, like partial socket writes.
+ */
+static void pump(tls_engine_t& client, SSL* server)
+{
+    for (auto output = client.output(); output.size; output = client.output()) {
+        int size = static_cast<int>(std::min<size_t>(output.size, 100));
+        BIO_write(SSL_get_rbio(server), output.data, size);
+        client.consume(size);
+    }
+
+    char buffer[4096];
+    int read;
+    while ((read = BIO_read(SSL_get_wbio(server), buffer, sizeof(buffer))) > 0) {
+        client.receive(buffer, read);
+    }
+}
+
+
+/**
+ *  \brief Complete the handshake between the engine and a new server.
+ */
+static bool connect(tls_engine_t& client, SSL* server)
+{
+    SSL_set_bio(server, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+    SSL_set_accept_state(server);
+
+    bool done = false;
+    for (int i = 0; i < 8 && !done; ++i) {
+        done = client.handshake();
+        pump(client, server);
+        SSL_do_handshake(server);
+        pump(client, server);
+    }
+    return done;
+}
+
+// TESTS
+// -----
+
+
+TEST(tls_engine_t, exchange)
+{
+    tls_engine_t client;
+    client.set_verify_peer(verify_peer_t(false));
+    client.set_alpn({"http/1.1"});
+    client.open("localhost");
+
+    SSL_CTX *ctx = server_context();
+    SSL *server = SSL_new(ctx);
+
+    // the handshake completes without any socket
+    EXPECT_TRUE(connect(client, server));
+    EXPECT_TRUE(client.established());
+    EXPECT_FALSE(client.resumed());
+
+    // no plaintext is available until the peer sends data
+    char buffer[64];
+    EXPECT_EQ(client.read(buffer, sizeof(buffer)), -1);
+
+    EXPECT_EQ(client.write("ping", 4), 4);
+    pump(client, server);
+    EXPECT_EQ(SSL_read(server, buffer, sizeof(buffer)), 4);
+    EXPECT_EQ(std::string(buffer, 4), "ping");
+
+    SSL_write(server, "pong", 4);
+    pump(client, server);
+    EXPECT_TRUE(client.pending());
+    EXPECT_EQ(client.read(buffer, sizeof(buffer)), 4);
+    EXPECT_EQ(std::string(buffer, 4), "pong");
+    EXPECT_FALSE(client.pending());
+
+    // a close_notify from the peer reads as EOF
+    SSL_shutdown(server);
+    pump(client, server);
+    EXPECT_EQ(client.read(buffer, sizeof(buffer)), 0);
+
+    client.close();
+    EXPECT_FALSE(client.established());
+    SSL_free(server);
+    SSL_CTX_free(ctx);
+}
+
+
+
+TEST(tls_engine_t, reopen)
+{
+    tls_engine_t client;
+    client.set_verify_peer(verify_peer_t(false));
+    client.open("localhost");
+
+    SSL_CTX *ctx = server_context();
+    SSL *server = SSL_new(ctx);
+    ASSERT_TRUE(connect(client, server));
+
+    // finish ramping up, discarding the ciphertext
+    std::string data(1 << 20, 'a');
+    EXPECT_EQ(client.write(data.data(), data.size()), data.size());
+    client.consume(client.output().size);
+    SSL_free(server);
+
+    // the close_notify is dropped, and the ClientHello comes first
+    client.open("localhost");
+    EXPECT_EQ(client.output().size, 0);
+    EXPECT_FALSE(client.handshake());
+    auto output = client.output();
+    ASSERT_GT(output.size, 0);
+    EXPECT_EQ(output.data[0], '\x16');
+
+    server = SSL_new(ctx);
+    ASSERT_TRUE(connect(client, server));
+
+    // writes start with small records again
+    EXPECT_EQ(client.write(data.data(), 4096), 4096);
+    output = client.output();
+    ASSERT_GE(output.size, 5);
+    EXPECT_EQ(output.data[0], '\x17');
+    size_t length = (static_cast<uint8_t>(output.data[3]) << 8) | static_cast<uint8_t>(output.data[4]);
+    EXPECT_LT(length, 2048);
+
+    client.close();
+    SSL_free(server);
+    SSL_CTX_free(ctx);
+}
+
+#endif